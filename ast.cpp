@@ -1,11 +1,141 @@
+#include <vector>
 #include "ast.hpp"
 
-drewno_mars::ProgramNode::ProgramNode(std::list<DeclNode *> * globalsIn)
-: ASTNode(new Position(0,0,0,0)), myGlobals(globalsIn){
-	if (!globalsIn->empty()){
-		myPos = new Position(
-			myGlobals->front()->pos(),
-			myGlobals->back()->pos()
+namespace drewno_mars{
+
+static const Position noPosition(0,0,0,0);
+
+ProgramNode::ProgramNode(std::list<DeclNode *> globalsIn)
+: ASTNode(&noPosition, NodeKind::Program), myGlobals(std::move(globalsIn)){
+	if (!myGlobals.empty()){
+		myPos = Position(
+			myGlobals.front()->pos(),
+			myGlobals.back()->pos()
 		);
 	}
 }
+
+//Each node owns its children (including those in its lists),
+// so deleting a subtree's root releases the whole subtree.
+// Children aren't deleted by their parent's destructor, though,
+// which would recurse as deep as the tree: they are queued, and
+// whichever release is outermost deletes them one at a time.
+static thread_local std::vector<ASTNode *> * releasing = nullptr;
+
+static void release(ASTNode * node){
+	if (node == nullptr){ return; }
+	if (releasing != nullptr){
+		releasing->push_back(node);
+		return;
+	}
+	std::vector<ASTNode *> queue;
+	queue.push_back(node);
+	releasing = &queue;
+	while (!queue.empty()){
+		ASTNode * next = queue.back();
+		queue.pop_back();
+		delete next;
+	}
+	releasing = nullptr;
+}
+
+template <typename T>
+static void deleteAll(std::list<T *>& nodes){
+	for (auto node : nodes){ release(node); }
+}
+
+ProgramNode::~ProgramNode(){
+	deleteAll(myGlobals);
+}
+
+ClassDefnNode::~ClassDefnNode(){
+	release(myID);
+	deleteAll(myMembers);
+}
+
+VarDeclNode::~VarDeclNode(){
+	release(myID);
+	release(myType);
+	release(myInit);
+}
+
+FnDeclNode::~FnDeclNode(){
+	release(myID);
+	deleteAll(myFormals);
+	release(myRetType);
+	deleteAll(myBody);
+}
+
+AssignStmtNode::~AssignStmtNode(){
+	release(myDst);
+	release(mySrc);
+}
+
+TakeStmtNode::~TakeStmtNode(){
+	release(myDst);
+}
+
+GiveStmtNode::~GiveStmtNode(){
+	release(mySrc);
+}
+
+PostDecStmtNode::~PostDecStmtNode(){
+	release(myLoc);
+}
+
+PostIncStmtNode::~PostIncStmtNode(){
+	release(myLoc);
+}
+
+IfStmtNode::~IfStmtNode(){
+	release(myCond);
+	deleteAll(myBody);
+}
+
+IfElseStmtNode::~IfElseStmtNode(){
+	release(myCond);
+	deleteAll(myBodyTrue);
+	deleteAll(myBodyFalse);
+}
+
+WhileStmtNode::~WhileStmtNode(){
+	release(myCond);
+	deleteAll(myBody);
+}
+
+ReturnStmtNode::~ReturnStmtNode(){
+	release(myExp);
+}
+
+CallExpNode::~CallExpNode(){
+	release(myCallee);
+	deleteAll(myArgs);
+}
+
+MemberFieldExpNode::~MemberFieldExpNode(){
+	release(myBase);
+	release(myField);
+}
+
+BinaryExpNode::~BinaryExpNode(){
+	release(myExp1);
+	release(myExp2);
+}
+
+UnaryExpNode::~UnaryExpNode(){
+	release(myExp);
+}
+
+ClassTypeNode::~ClassTypeNode(){
+	release(myID);
+}
+
+PerfectTypeNode::~PerfectTypeNode(){
+	release(mySub);
+}
+
+CallStmtNode::~CallStmtNode(){
+	release(myCallExp);
+}
+
+} //End namespace drewno_mars
@@ -1,10 +1,13 @@
 #ifndef DREWNO_MARS_AST_HPP
 #define DREWNO_MARS_AST_HPP
 
+#include <cstdint>
 #include <ostream>
 #include <sstream>
 #include <string.h>
 #include <list>
+#include <utility>
+#include <vector>
 #include "tokens.hpp"
 
 namespace drewno_mars {
@@ -22,52 +25,87 @@ class TypeNode;
 class ExpNode;
 class IDNode;
 
+
+//What each node is, so passes can switch on it (see
+// visitor.hpp) rather than each needing a virtual method on
+// every class. List is not a node, but stands for a list of
+// them in the binary AST, whose records store these values (so
+// add new kinds at the end).
+enum class NodeKind : unsigned char{
+	List, Program,
+	ClassDefn, VarDecl, FormalDecl, FnDecl,
+	AssignStmt, TakeStmt, GiveStmt, ExitStmt, PostDecStmt, PostIncStmt,
+	IfStmt, IfElseStmt, WhileStmt, ReturnStmt, CallStmt,
+	CallExp, MemberFieldExp, ID,
+	Plus, Minus, Times, Divide, And, Or,
+	Equals, NotEquals, Less, LessEq, Greater, GreaterEq,
+	Neg, Not,
+	VoidType, ClassType, PerfectType, IntType, BoolType,
+	IntLit, StrLit, True, False, Magic,
+	KindCount
+};
+
+//Told about every symbol name analysis attaches to an
+// IDNode, while set as IDNode::observer
+class BindingObserver{
+public:
+	virtual ~BindingObserver(){ }
+	virtual void bound(IDNode * id, SemSymbol * symbol) = 0;
+};
+
 class ASTNode{
 public:
-	ASTNode(const Position * pos) : myPos(pos){ }
-	virtual void unparse(std::ostream&, int) = 0;
-	const Position * pos() { return myPos; };
+	//Nodes keep their own copy of the position they are
+	// given, so the parser (and tokens) can drop theirs
+	ASTNode(const Position * pos, NodeKind kind)
+	: myPos(*pos), myKind(kind){ }
+	virtual ~ASTNode(){ }
+	NodeKind kind() const{ return myKind; }
+	const Position * pos() { return &myPos; };
 	std::string posStr(){ return pos()->span(); }
-	virtual bool nameAnalysis(SymbolTable *);
+	//Write this subtree back out as source (see unparse.cpp)
+	void unparse(std::ostream& out, int indent);
+	//Bind this subtree's IDs to symbols (see name_analysis.cpp)
+	bool nameAnalysis(SymbolTable * symTab);
 protected:
-	const Position * myPos = nullptr;
+	Position myPos;
+private:
+	const NodeKind myKind;
 };
 
 class ProgramNode : public ASTNode{
 public:
-	ProgramNode(std::list<DeclNode *> * globalsIn);
-	void unparse(std::ostream&, int) override;
-	virtual bool nameAnalysis(SymbolTable *) override;
+	ProgramNode(std::list<DeclNode *> globalsIn);
+	~ProgramNode();
+	//Render each global declaration into its own buffer,
+	// spreading the work over (up to) numThreads threads
+	std::vector<std::string> unparseGlobals(int indent,
+	  unsigned int numThreads);
+	std::list<DeclNode *> * getGlobals(){ return &myGlobals; }
 private:
-	std::list<DeclNode *> * myGlobals;
+	std::list<DeclNode *> myGlobals;
 };
 
 class ExpNode : public ASTNode{
 protected:
-	ExpNode(const Position * p) : ASTNode(p){ }
-public:
-	virtual void unparseNested(std::ostream& out);
-    virtual bool nameAnalysis(SymbolTable * symTab) override = 0;
+	ExpNode(const Position * p, NodeKind kind) : ASTNode(p, kind){ }
 };
 
 class LocNode : public ExpNode{
 public:
-	LocNode(const Position * p)
-	: ExpNode(p){}
-    bool nameAnalysis(SymbolTable * symTab) override { return false; }
+	LocNode(const Position * p, NodeKind kind)
+	: ExpNode(p, kind){}
     virtual SemSymbol * getSymbol() = 0;
 };
 
 class IDNode : public LocNode{
 public:
 	IDNode(const Position * p, std::string nameIn)
-	: LocNode(p), name(nameIn), mySymbol(nullptr){}
-	std::string getName(){ return name; }
-	void unparse(std::ostream& out, int indent) override;
-	void unparseNested(std::ostream& out) override;
+	: LocNode(p, NodeKind::ID), name(std::move(nameIn)), mySymbol(nullptr){}
+	const std::string& getName(){ return name; }
 	void attachSymbol(SemSymbol * symbolIn);
 	SemSymbol * getSymbol() override { return mySymbol; }
-    bool nameAnalysis(SymbolTable * symTab) override;
+	static BindingObserver * observer;
 private:
 	std::string name;
 	SemSymbol * mySymbol;
@@ -75,9 +113,7 @@ private:
 
 class TypeNode : public ASTNode{
 public:
-	TypeNode(const Position * p) : ASTNode(p){ }
-	void unparse(std::ostream&, int) override = 0;
-    bool nameAnalysis(SymbolTable *) override = 0;
+	TypeNode(const Position * p, NodeKind kind) : ASTNode(p, kind){ }
     virtual std::string getType() = 0;
     virtual SemSymbol * getSymbol() {
         return nullptr;
@@ -86,14 +122,12 @@ public:
 
 class StmtNode : public ASTNode{
 public:
-	StmtNode(const Position * p) : ASTNode(p){ }
-	virtual void unparse(std::ostream& out, int indent) override = 0;
+	StmtNode(const Position * p, NodeKind kind) : ASTNode(p, kind){ }
 };
 
 class DeclNode : public StmtNode{
 public:
-	DeclNode(const Position * p) : StmtNode(p){ }
-	void unparse(std::ostream& out, int indent) override =0;
+	DeclNode(const Position * p, NodeKind kind) : StmtNode(p, kind){ }
     virtual TypeNode* getTypeNode() = 0;
     virtual std::list<FormalDeclNode *> * getFormals() = 0;
     virtual IDNode * ID() = 0;
@@ -101,81 +135,95 @@ public:
 
 class ClassDefnNode : public DeclNode{
 public:
-	ClassDefnNode(const Position * p, IDNode * inID, std::list<DeclNode *> * inMembers)
-	: DeclNode(p), myID(inID), myMembers(inMembers){ }
-	void unparse(std::ostream& out, int indent) override;
+	ClassDefnNode(const Position * p, IDNode * inID,
+	  std::list<DeclNode *> inMembers)
+	: DeclNode(p, NodeKind::ClassDefn), myID(inID),
+	  myMembers(std::move(inMembers)){
+		myShapeHash = hashShape();
+	}
+	~ClassDefnNode();
 	IDNode * ID() override { return myID; }
-    bool nameAnalysis(SymbolTable * symTab) override;
     TypeNode * getTypeNode() override {return nullptr;}
     std::list<FormalDeclNode *> * getFormals() override {
-        return formals;
+        return nullptr;
     }
     std::list<DeclNode *> * getMembers() {
-        return myMembers;
+        return &myMembers;
     }
+	uint64_t shapeHash(){ return myShapeHash; }
 private:
+	uint64_t hashShape();
 	IDNode * myID;
-	std::list<DeclNode *> * myMembers;
-    std::list<FormalDeclNode *> * formals;
+	std::list<DeclNode *> myMembers;
+	uint64_t myShapeHash;
 };
 
 class VarDeclNode : public DeclNode{
 public:
 	VarDeclNode(const Position * p, IDNode * inID,
 	TypeNode * inType, ExpNode * inInit)
-	: DeclNode(p), myID(inID), myType(inType), myInit(inInit){ }
-	void unparse(std::ostream& out, int indent) override;
+	: VarDeclNode(p, NodeKind::VarDecl, inID, inType, inInit){ }
+	~VarDeclNode();
 	IDNode * ID() override { return myID; }
 	TypeNode * getTypeNode() override { return myType; }
     std::list<FormalDeclNode *> * getFormals() override {
-        return formals;
+        return nullptr;
     }
-	bool nameAnalysis(SymbolTable * symTab) override;
+	ExpNode * getInit(){ return myInit; }
+	void setInit(ExpNode * init){ myInit = init; }
+protected:
+	VarDeclNode(const Position * p, NodeKind kind, IDNode * inID,
+	TypeNode * inType, ExpNode * inInit)
+	: DeclNode(p, kind), myID(inID), myType(inType), myInit(inInit){ }
 private:
 	IDNode * myID;
 	TypeNode * myType;
 	ExpNode * myInit;
-    std::list<FormalDeclNode *> * formals;
 };
 
 class FormalDeclNode : public VarDeclNode{
 public:
 	FormalDeclNode(const Position * p, IDNode * id, TypeNode * type)
-	: VarDeclNode(p, id, type, nullptr){ }
-	void unparse(std::ostream& out, int indent) override;
+	: VarDeclNode(p, NodeKind::FormalDecl, id, type, nullptr){ }
 };
 
 class FnDeclNode : public DeclNode{
 public:
 	FnDeclNode(const Position * p,
 	  IDNode * inID,
-	  std::list<FormalDeclNode *> * inFormals,
+	  std::list<FormalDeclNode *> inFormals,
 	  TypeNode * retTypeIn,
-	  std::list<StmtNode *> * inBody)
-	: DeclNode(p), myID(inID),
-	  myFormals(inFormals), myRetType(retTypeIn),
-	  myBody(inBody){
+	  std::list<StmtNode *> inBody)
+	: DeclNode(p, NodeKind::FnDecl), myID(inID),
+	  myFormals(std::move(inFormals)), myRetType(retTypeIn),
+	  myBody(std::move(inBody)){
+		myShapeHash = hashShape();
 	}
+	~FnDeclNode();
 	IDNode * ID() override { return myID; }
     TypeNode * getTypeNode() override { return myRetType; }
 	std::list<FormalDeclNode *> * getFormals() override{
-		return myFormals;
+		return &myFormals;
 	}
-	void unparse(std::ostream& out, int indent) override;
-	virtual bool nameAnalysis(SymbolTable * symTab) override;
+	uint64_t shapeHash(){ return myShapeHash; }
+	std::list<StmtNode *> * getBody(){ return &myBody; }
 private:
+	uint64_t hashShape();
 	IDNode * myID;
-	std::list<FormalDeclNode *> * myFormals;
+	std::list<FormalDeclNode *> myFormals;
 	TypeNode * myRetType;
-	std::list<StmtNode *> * myBody;
+	std::list<StmtNode *> myBody;
+	uint64_t myShapeHash;
 };
 
 class AssignStmtNode : public StmtNode{
 public:
 	AssignStmtNode(const Position * p, LocNode * inDst, ExpNode * inSrc)
-	: StmtNode(p), myDst(inDst), mySrc(inSrc){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: StmtNode(p, NodeKind::AssignStmt), myDst(inDst), mySrc(inSrc){ }
+	~AssignStmtNode();
+	LocNode * getDst(){ return myDst; }
+	ExpNode * getSrc(){ return mySrc; }
+	void setSrc(ExpNode * src){ mySrc = src; }
 private:
 	LocNode * myDst;
 	ExpNode * mySrc;
@@ -184,9 +232,9 @@ private:
 class TakeStmtNode : public StmtNode{
 public:
 	TakeStmtNode(const Position * p, LocNode * inDst)
-	: StmtNode(p), myDst(inDst){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: StmtNode(p, NodeKind::TakeStmt), myDst(inDst){ }
+	~TakeStmtNode();
+	LocNode * getDst(){ return myDst; }
 private:
 	LocNode * myDst;
 };
@@ -194,26 +242,25 @@ private:
 class GiveStmtNode : public StmtNode{
 public:
 	GiveStmtNode(const Position * p, ExpNode * inSrc)
-	: StmtNode(p), mySrc(inSrc){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: StmtNode(p, NodeKind::GiveStmt), mySrc(inSrc){ }
+	~GiveStmtNode();
+	ExpNode * getSrc(){ return mySrc; }
+	void setSrc(ExpNode * src){ mySrc = src; }
 private:
 	ExpNode * mySrc;
 };
 
 class ExitStmtNode : public StmtNode{
 public:
-	ExitStmtNode(const Position * p) : StmtNode(p) { }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	ExitStmtNode(const Position * p) : StmtNode(p, NodeKind::ExitStmt) { }
 };
 
 class PostDecStmtNode : public StmtNode{
 public:
 	PostDecStmtNode(const Position * p, LocNode * inLoc)
-	: StmtNode(p), myLoc(inLoc){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: StmtNode(p, NodeKind::PostDecStmt), myLoc(inLoc){ }
+	~PostDecStmtNode();
+	LocNode * getLoc(){ return myLoc; }
 private:
 	LocNode * myLoc;
 };
@@ -221,9 +268,9 @@ private:
 class PostIncStmtNode : public StmtNode{
 public:
 	PostIncStmtNode(const Position * p, LocNode * inLoc)
-	: StmtNode(p), myLoc(inLoc){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: StmtNode(p, NodeKind::PostIncStmt), myLoc(inLoc){ }
+	~PostIncStmtNode();
+	LocNode * getLoc(){ return myLoc; }
 private:
 	LocNode * myLoc;
 };
@@ -231,48 +278,59 @@ private:
 class IfStmtNode : public StmtNode{
 public:
 	IfStmtNode(const Position * p, ExpNode * condIn,
-	  std::list<StmtNode *> * bodyIn)
-	: StmtNode(p), myCond(condIn), myBody(bodyIn){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	  std::list<StmtNode *> bodyIn)
+	: StmtNode(p, NodeKind::IfStmt), myCond(condIn),
+	  myBody(std::move(bodyIn)){ }
+	~IfStmtNode();
+	ExpNode * getCond(){ return myCond; }
+	void setCond(ExpNode * cond){ myCond = cond; }
+	std::list<StmtNode *> * getBody(){ return &myBody; }
 private:
 	ExpNode * myCond;
-	std::list<StmtNode *> * myBody;
+	std::list<StmtNode *> myBody;
 };
 
 class IfElseStmtNode : public StmtNode{
 public:
 	IfElseStmtNode(const Position * p, ExpNode * condIn,
-	  std::list<StmtNode *> * bodyTrueIn,
-	  std::list<StmtNode *> * bodyFalseIn)
-	: StmtNode(p), myCond(condIn),
-	  myBodyTrue(bodyTrueIn), myBodyFalse(bodyFalseIn) { }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	  std::list<StmtNode *> bodyTrueIn,
+	  std::list<StmtNode *> bodyFalseIn)
+	: StmtNode(p, NodeKind::IfElseStmt), myCond(condIn),
+	  myBodyTrue(std::move(bodyTrueIn)),
+	  myBodyFalse(std::move(bodyFalseIn)) { }
+	~IfElseStmtNode();
+	ExpNode * getCond(){ return myCond; }
+	void setCond(ExpNode * cond){ myCond = cond; }
+	std::list<StmtNode *> * getBodyTrue(){ return &myBodyTrue; }
+	std::list<StmtNode *> * getBodyFalse(){ return &myBodyFalse; }
 private:
 	ExpNode * myCond;
-	std::list<StmtNode *> * myBodyTrue;
-	std::list<StmtNode *> * myBodyFalse;
+	std::list<StmtNode *> myBodyTrue;
+	std::list<StmtNode *> myBodyFalse;
 };
 
 class WhileStmtNode : public StmtNode{
 public:
 	WhileStmtNode(const Position * p, ExpNode * condIn,
-	  std::list<StmtNode *> * bodyIn)
-	: StmtNode(p), myCond(condIn), myBody(bodyIn){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	  std::list<StmtNode *> bodyIn)
+	: StmtNode(p, NodeKind::WhileStmt), myCond(condIn),
+	  myBody(std::move(bodyIn)){ }
+	~WhileStmtNode();
+	ExpNode * getCond(){ return myCond; }
+	void setCond(ExpNode * cond){ myCond = cond; }
+	std::list<StmtNode *> * getBody(){ return &myBody; }
 private:
 	ExpNode * myCond;
-	std::list<StmtNode *> * myBody;
+	std::list<StmtNode *> myBody;
 };
 
 class ReturnStmtNode : public StmtNode{
 public:
 	ReturnStmtNode(const Position * p, ExpNode * exp)
-	: StmtNode(p), myExp(exp){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: StmtNode(p, NodeKind::ReturnStmt), myExp(exp){ }
+	~ReturnStmtNode();
+	ExpNode * getExp(){ return myExp; }
+	void setExp(ExpNode * exp){ myExp = exp; }
 private:
 	ExpNode * myExp;
 };
@@ -280,24 +338,34 @@ private:
 class CallExpNode : public ExpNode{
 public:
 	CallExpNode(const Position * p, LocNode * inCallee,
-	  std::list<ExpNode *> * inArgs)
-	: ExpNode(p), myCallee(inCallee), myArgs(inArgs){ }
-	void unparse(std::ostream& out, int indent) override;
-	void unparseNested(std::ostream& out) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	  std::list<ExpNode *> inArgs)
+	: ExpNode(p, NodeKind::CallExp), myCallee(inCallee),
+	  myArgs(std::move(inArgs)){ }
+	~CallExpNode();
+	LocNode * getCallee(){ return myCallee; }
+	std::list<ExpNode *> * getArgs(){ return &myArgs; }
 private:
 	LocNode * myCallee;
-	std::list<ExpNode *> * myArgs;
+	std::list<ExpNode *> myArgs;
 };
 
 class MemberFieldExpNode : public LocNode {
 public:
 	MemberFieldExpNode(const Position * p, LocNode * inBase,
 	IDNode * inField)
-	: LocNode(p), myBase(inBase), myField(inField) { }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
-    SemSymbol * getSymbol() override { return myBase->getSymbol();}
+	: LocNode(p, NodeKind::MemberFieldExp), myBase(inBase), myField(inField) { }
+	~MemberFieldExpNode();
+	//That of the innermost base (found without recursing, as
+	// a chain of fields can be any length)
+	SemSymbol * getSymbol() override {
+		LocNode * base = myBase;
+		while (base->kind() == NodeKind::MemberFieldExp){
+			base = static_cast<MemberFieldExpNode *>(base)->myBase;
+		}
+		return base->getSymbol();
+	}
+	LocNode * getBase(){ return myBase; }
+	IDNode * getField(){ return myField; }
 private:
 	LocNode * myBase;
 	IDNode * myField;
@@ -305,9 +373,14 @@ private:
 
 class BinaryExpNode : public ExpNode{
 public:
-	BinaryExpNode(const Position * p, ExpNode * lhs, ExpNode * rhs)
-	: ExpNode(p), myExp1(lhs), myExp2(rhs) { }
-    bool nameAnalysis(SymbolTable * symTab) override;
+	BinaryExpNode(const Position * p, NodeKind kind, ExpNode * lhs,
+	  ExpNode * rhs)
+	: ExpNode(p, kind), myExp1(lhs), myExp2(rhs) { }
+	~BinaryExpNode();
+	ExpNode * getExp1(){ return myExp1; }
+	ExpNode * getExp2(){ return myExp2; }
+	void setExp1(ExpNode * exp){ myExp1 = exp; }
+	void setExp2(ExpNode * exp){ myExp2 = exp; }
 protected:
 	ExpNode * myExp1;
 	ExpNode * myExp2;
@@ -316,95 +389,84 @@ protected:
 class PlusNode : public BinaryExpNode{
 public:
 	PlusNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::Plus, e1, e2){ }
 };
 
 class MinusNode : public BinaryExpNode{
 public:
 	MinusNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::Minus, e1, e2){ }
 };
 
 class TimesNode : public BinaryExpNode{
 public:
 	TimesNode(const Position * p, ExpNode * e1In, ExpNode * e2In)
-	: BinaryExpNode(p, e1In, e2In){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::Times, e1In, e2In){ }
 };
 
 class DivideNode : public BinaryExpNode{
 public:
 	DivideNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::Divide, e1, e2){ }
 };
 
 class AndNode : public BinaryExpNode{
 public:
 	AndNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::And, e1, e2){ }
 };
 
 class OrNode : public BinaryExpNode{
 public:
 	OrNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::Or, e1, e2){ }
 };
 
 class EqualsNode : public BinaryExpNode{
 public:
 	EqualsNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::Equals, e1, e2){ }
 };
 
 class NotEqualsNode : public BinaryExpNode{
 public:
 	NotEqualsNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::NotEquals, e1, e2){ }
 };
 
 class LessNode : public BinaryExpNode{
 public:
 	LessNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::Less, e1, e2){ }
 };
 
 class LessEqNode : public BinaryExpNode{
 public:
 	LessEqNode(const Position * pos, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(pos, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(pos, NodeKind::LessEq, e1, e2){ }
 };
 
 class GreaterNode : public BinaryExpNode{
 public:
 	GreaterNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::Greater, e1, e2){ }
 };
 
 class GreaterEqNode : public BinaryExpNode{
 public:
 	GreaterEqNode(const Position * p, ExpNode * e1, ExpNode * e2)
-	: BinaryExpNode(p, e1, e2){ }
-	void unparse(std::ostream& out, int indent) override;
+	: BinaryExpNode(p, NodeKind::GreaterEq, e1, e2){ }
 };
 
 class UnaryExpNode : public ExpNode {
 public:
-	UnaryExpNode(const Position * p, ExpNode * expIn)
-	: ExpNode(p){
+	UnaryExpNode(const Position * p, NodeKind kind, ExpNode * expIn)
+	: ExpNode(p, kind){
 		this->myExp = expIn;
 	}
-	virtual void unparse(std::ostream& out, int indent) override = 0;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	~UnaryExpNode();
+	ExpNode * getExp(){ return myExp; }
+	void setExp(ExpNode * exp){ myExp = exp; }
 protected:
 	ExpNode * myExp;
 };
@@ -412,22 +474,18 @@ protected:
 class NegNode : public UnaryExpNode{
 public:
 	NegNode(const Position * p, ExpNode * exp)
-	: UnaryExpNode(p, exp){ }
-	void unparse(std::ostream& out, int indent) override;
+	: UnaryExpNode(p, NodeKind::Neg, exp){ }
 };
 
 class NotNode : public UnaryExpNode{
 public:
 	NotNode(const Position * p, ExpNode * exp)
-	: UnaryExpNode(p, exp){ }
-	void unparse(std::ostream& out, int indent) override;
+	: UnaryExpNode(p, NodeKind::Not, exp){ }
 };
 
 class VoidTypeNode : public TypeNode{
 public:
-	VoidTypeNode(const Position * p) : TypeNode(p){}
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	VoidTypeNode(const Position * p) : TypeNode(p, NodeKind::VoidType){}
     std::string getType() override {
         return "void";
     }
@@ -436,9 +494,8 @@ public:
 class ClassTypeNode : public TypeNode{
 public:
 	ClassTypeNode(const Position * p, IDNode * inID)
-	: TypeNode(p), myID(inID){}
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: TypeNode(p, NodeKind::ClassType), myID(inID){}
+	~ClassTypeNode();
     std::string getType() override {
         return myID->getName();
     }
@@ -446,6 +503,7 @@ public:
         return myID->getSymbol();
     }
 
+	IDNode * ID(){ return myID; }
 private:
 	IDNode * myID;
 };
@@ -453,23 +511,21 @@ private:
 class PerfectTypeNode : public TypeNode{
 public:
 	PerfectTypeNode(const Position * p, TypeNode * inSub)
-	: TypeNode(p), mySub(inSub){}
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: TypeNode(p, NodeKind::PerfectType), mySub(inSub){}
+	~PerfectTypeNode();
     std::string getType() override {
         std::string result = "perfect ";
         result += mySub->getType();
         return result;
     }
+	TypeNode * getSub(){ return mySub; }
 private:
 	TypeNode * mySub;
 };
 
 class IntTypeNode : public TypeNode{
 public:
-	IntTypeNode(const Position * p): TypeNode(p){}
-	void unparse(std::ostream& out, int indent) override;
-	bool nameAnalysis(SymbolTable *) override;
+	IntTypeNode(const Position * p): TypeNode(p, NodeKind::IntType){}
     std::string getType() override {
         return "int";
     }
@@ -477,9 +533,7 @@ public:
 
 class BoolTypeNode : public TypeNode{
 public:
-	BoolTypeNode(const Position * p): TypeNode(p) { }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	BoolTypeNode(const Position * p): TypeNode(p, NodeKind::BoolType) { }
     std::string getType() override {
         return "bool";
     }
@@ -488,65 +542,42 @@ public:
 class IntLitNode : public ExpNode{
 public:
 	IntLitNode(const Position * p, const int numIn)
-	: ExpNode(p), myNum(numIn){ }
-	virtual void unparseNested(std::ostream& out) override{
-		unparse(out, 0);
-	}
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: ExpNode(p, NodeKind::IntLit), myNum(numIn){ }
+	int getNum(){ return myNum; }
 private:
 	const int myNum;
 };
 
 class StrLitNode : public ExpNode{
 public:
-	StrLitNode(const Position * p, const std::string strIn)
-	: ExpNode(p), myStr(strIn){ }
-	virtual void unparseNested(std::ostream& out) override{
-		unparse(out, 0);
-	}
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	StrLitNode(const Position * p, std::string strIn)
+	: ExpNode(p, NodeKind::StrLit), myStr(std::move(strIn)){ }
+	const std::string& getStr(){ return myStr; }
 private:
 	 const std::string myStr;
 };
 
 class TrueNode : public ExpNode{
 public:
-	TrueNode(const Position * p): ExpNode(p){ }
-	virtual void unparseNested(std::ostream& out) override{
-		unparse(out, 0);
-	}
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	TrueNode(const Position * p): ExpNode(p, NodeKind::True){ }
 };
 
 class FalseNode : public ExpNode{
 public:
-	FalseNode(const Position * p): ExpNode(p){ }
-	virtual void unparseNested(std::ostream& out) override{
-		unparse(out, 0);
-	}
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	FalseNode(const Position * p): ExpNode(p, NodeKind::False){ }
 };
 
 class MagicNode : public ExpNode{
 public:
-	MagicNode(const Position * p): ExpNode(p){ }
-	virtual void unparseNested(std::ostream& out) override{
-		unparse(out, 0);
-	}
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	MagicNode(const Position * p): ExpNode(p, NodeKind::Magic){ }
 };
 
 class CallStmtNode : public StmtNode{
 public:
 	CallStmtNode(const Position * p, CallExpNode * expIn)
-	: StmtNode(p), myCallExp(expIn){ }
-	void unparse(std::ostream& out, int indent) override;
-    bool nameAnalysis(SymbolTable * symTab) override;
+	: StmtNode(p, NodeKind::CallStmt), myCallExp(expIn){ }
+	~CallStmtNode();
+	CallExpNode * getCallExp(){ return myCallExp; }
 private:
 	CallExpNode * myCallExp;
 };
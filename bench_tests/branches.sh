@@ -0,0 +1,29 @@
+#!/bin/sh
+# Write a program whose one function is <count> if/else statements
+# each followed by a while, for timing the passes over the IR
+#  branches.sh <count>
+count=$1
+if [ -z "$count" ]; then
+	echo "Usage: $0 <count>" >&2
+	exit 1
+fi
+awk -v count="$count" '
+BEGIN {
+	print "main : () void {"
+	print "\ta : int = 1;"
+	print "\tb : int = 2;"
+	print "\tc : int = 0;"
+	for (i = 0; i < count; i++){
+		print "\tif (a < " (i % 7) ") {"
+		print "\t\tb = b + a;"
+		print "\t} else {"
+		print "\t\tc = c + 1;"
+		print "\t}"
+		print "\twhile (c > " (i % 5) ") {"
+		print "\t\tc = c - 1;"
+		print "\t\ta++;"
+		print "\t}"
+	}
+	print "\tgive a + b + c;"
+	print "}"
+}'
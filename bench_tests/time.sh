@@ -0,0 +1,41 @@
+#!/bin/sh
+# Time <file> on the VM unoptimised (-N -r) and optimised (-r) and
+# natively (-o, assembled and linked with <cc>), with <file>'s .in
+# as its input if there is one, and print the best of <runs> wall
+# times for each
+#  time.sh <dmc> <cc> <file> <runs>
+dmc=$1
+cc=$2
+file=$3
+runs=$4
+base=${file%.dm}
+work=$base.work
+input=/dev/null
+if [ -f $base.in ]; then
+	input=$base.in
+fi
+rm -rf $work
+mkdir -p $work
+if ! $dmc $file -o $work/native.s ||
+    ! $cc $work/native.s -o $work/native; then
+	echo "FAIL $file: -o"
+	rm -rf $work
+	exit 1
+fi
+# The best of <runs> times of a command, in ms
+best() {
+	min=""
+	for i in $(seq $runs); do
+		start=$(date +%s%N)
+		"$@" < $input > /dev/null 2>&1
+		end=$(date +%s%N)
+		ms=$(( (end - start) / 1000000 ))
+		if [ -z "$min" ] || [ $ms -lt $min ]; then
+			min=$ms
+		fi
+	done
+	echo $min
+}
+echo "$file: -N -r $(best $dmc $file -N -r) ms," \
+    "-r $(best $dmc $file -r) ms, -o $(best $work/native) ms"
+rm -rf $work
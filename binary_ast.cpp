@@ -0,0 +1,324 @@
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "binary_ast.hpp"
+#include "errors.hpp"
+#include "rebuild.hpp"
+#include "symbol_table.hpp"
+
+namespace drewno_mars{
+
+static const char MAGIC[4] = {'D', 'M', 'C', 'A'};
+static const uint32_t VERSION = 1;
+static const size_t HEADER_WORDS = 9;
+static const size_t MIN_RECORD_WORDS = 4;
+static const unsigned char WIDE_LOCATION = 1;
+static const unsigned char LONG_COUNT = 2;
+static const unsigned char HAS_DATA = 4;
+static const unsigned char HAS_SYMBOL = 8;
+
+static void put32(std::vector<unsigned char>& bytes, uint32_t val){
+	for (int i = 0; i < 4; i++){
+		bytes.push_back(static_cast<unsigned char>(val >> (8 * i)));
+	}
+}
+
+static uint32_t get32(const unsigned char * bytes){
+	return static_cast<uint32_t>(bytes[0])
+	  | static_cast<uint32_t>(bytes[1]) << 8
+	  | static_cast<uint32_t>(bytes[2]) << 16
+	  | static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+static void corrupt(){
+	throw new UserError("Corrupt binary AST");
+}
+
+uint32_t AstWriter::node(NodeKind kind, const Position * pos,
+  const std::vector<uint32_t>& children, uint32_t data, SemSymbol * symbol){
+	uint32_t offset = static_cast<uint32_t>(4 * myNodes.size());
+	static const Position none(0, 0, 0, 0);
+	if (pos == nullptr){ pos = &none; }
+
+	unsigned char flags = 0;
+	if (pos->colBegin() > 0xffff || pos->colEnd() > 0xffff
+	  || pos->lineBegin() > 0xffffffff
+	  || pos->lineEnd() - pos->lineBegin() > 0xffff){
+		flags |= WIDE_LOCATION;
+	}
+	if (children.size() > 0xffff){ flags |= LONG_COUNT; }
+	if (kind == NodeKind::ID || kind == NodeKind::IntLit
+	  || kind == NodeKind::StrLit){
+		flags |= HAS_DATA;
+	}
+	if (symbol != nullptr){ flags |= HAS_SYMBOL; }
+
+	uint32_t count = static_cast<uint32_t>(children.size());
+	myNodes.push_back(static_cast<uint32_t>(kind)
+	  | static_cast<uint32_t>(flags) << 8
+	  | (flags & LONG_COUNT ? 0xffff : count) << 16);
+	if (flags & LONG_COUNT){ myNodes.push_back(count); }
+	if (flags & HAS_DATA){ myNodes.push_back(data); }
+	if (flags & HAS_SYMBOL){
+		auto found = mySymbolIds.find(symbol);
+		if (found == mySymbolIds.end()){
+			uint32_t id = static_cast<uint32_t>(mySymbols.size());
+			found = mySymbolIds.insert(std::make_pair(symbol, id)).first;
+			mySymbols.push_back(symbol);
+			name(symbol->getName());
+			name(symbol->getKind());
+			name(symbol->getType());
+		}
+		myNodes.push_back(found->second);
+	}
+	if (flags & WIDE_LOCATION){
+		myNodes.push_back(static_cast<uint32_t>(pos->lineBegin()));
+		myNodes.push_back(static_cast<uint32_t>(pos->colBegin()));
+		myNodes.push_back(static_cast<uint32_t>(pos->lineEnd()));
+		myNodes.push_back(static_cast<uint32_t>(pos->colEnd()));
+	} else {
+		myNodes.push_back(static_cast<uint32_t>(pos->lineBegin()));
+		myNodes.push_back(static_cast<uint32_t>(pos->colBegin()
+		  | pos->colEnd() << 16));
+		myNodes.push_back(static_cast<uint32_t>(pos->lineEnd()
+		  - pos->lineBegin()));
+	}
+	myNodes.insert(myNodes.end(), children.begin(), children.end());
+	return offset;
+}
+
+uint32_t AstWriter::name(const std::string& str){
+	auto found = myStringIds.find(str);
+	if (found != myStringIds.end()){ return found->second; }
+	uint32_t id = static_cast<uint32_t>(myStrings.size());
+	myStringIds[str] = id;
+	myStrings.push_back(str);
+	return id;
+}
+
+void AstWriter::write(std::ostream& out, uint32_t root){
+	std::vector<unsigned char> nodes;
+	nodes.reserve(4 * myNodes.size());
+	for (uint32_t word : myNodes){ put32(nodes, word); }
+	std::vector<unsigned char> symbols;
+	for (SemSymbol * symbol : mySymbols){
+		put32(symbols, name(symbol->getName()));
+		put32(symbols, name(symbol->getKind()));
+		put32(symbols, name(symbol->getType()));
+	}
+	std::vector<unsigned char> strings;
+	uint32_t textAt = static_cast<uint32_t>(4 * myStrings.size());
+	for (const std::string& str : myStrings){
+		put32(strings, textAt);
+		textAt += static_cast<uint32_t>(str.size() + 1);
+	}
+	for (const std::string& str : myStrings){
+		strings.insert(strings.end(), str.begin(), str.end());
+		strings.push_back(0);
+	}
+
+	std::vector<unsigned char> header(MAGIC, MAGIC + 4);
+	uint32_t nodesAt = static_cast<uint32_t>(4 * HEADER_WORDS);
+	uint32_t symbolsAt = nodesAt + static_cast<uint32_t>(nodes.size());
+	uint32_t stringsAt = symbolsAt + static_cast<uint32_t>(symbols.size());
+	put32(header, VERSION);
+	put32(header, static_cast<uint32_t>(nodes.size()));
+	put32(header, root);
+	put32(header, static_cast<uint32_t>(myStrings.size()));
+	put32(header, static_cast<uint32_t>(mySymbols.size()));
+	put32(header, nodesAt);
+	put32(header, stringsAt);
+	put32(header, symbolsAt);
+
+	for (auto * section : {&header, &nodes, &symbols, &strings}){
+		out.write(reinterpret_cast<const char *>(section->data()),
+		  static_cast<std::streamsize>(section->size()));
+	}
+}
+
+AstNodeView::AstNodeView(const AstImage * image, uint32_t offset)
+: myImage(image), myRecord(image->record(offset)){
+	if (myRecord[0] >= static_cast<unsigned char>(NodeKind::KindCount)){
+		corrupt();
+	}
+	unsigned char flags = myRecord[1];
+	unsigned char at = 1;
+	myChildCount = word(0) >> 16;
+	if (flags & LONG_COUNT){ myChildCount = word(at++); }
+	myData = flags & HAS_DATA ? at++ : 0;
+	mySymbol = flags & HAS_SYMBOL ? at++ : 0;
+	myLocation = at;
+	myChildren = static_cast<unsigned char>(
+	  at + (flags & WIDE_LOCATION ? 4 : 3));
+	if (offset + 4 * (myChildren + myChildCount) > image->header(2)){
+		corrupt();
+	}
+}
+
+uint32_t AstNodeView::word(size_t i) const{
+	return get32(myRecord + 4 * i);
+}
+
+NodeKind AstNodeView::kind() const{
+	return static_cast<NodeKind>(myRecord[0]);
+}
+
+size_t AstNodeView::childCount() const{
+	return myChildCount;
+}
+
+bool AstNodeView::hasChild(size_t i) const{
+	return i < myChildCount && word(myChildren + i) != AstWriter::NO_NODE;
+}
+
+AstNodeView AstNodeView::child(size_t i) const{
+	if (!hasChild(i)){ corrupt(); }
+	//Children are written before their parents, so this can't
+	// lead round in a cycle
+	uint32_t at = word(myChildren + i);
+	if (myImage->record(at) >= myRecord){ corrupt(); }
+	return AstNodeView(myImage, at);
+}
+
+const char * AstNodeView::name() const{
+	if (myData == 0){ corrupt(); }
+	return myImage->string(word(myData));
+}
+
+int AstNodeView::intValue() const{
+	if (myData == 0){ corrupt(); }
+	return static_cast<int>(word(myData));
+}
+
+long AstNodeView::symbol() const{
+	if (mySymbol == 0){ return -1; }
+	uint32_t index = word(mySymbol);
+	if (index >= myImage->symbolCount()){ corrupt(); }
+	return static_cast<long>(index);
+}
+
+Position AstNodeView::position() const{
+	if (myRecord[1] & WIDE_LOCATION){
+		return Position(word(myLocation), word(myLocation + 1),
+		  word(myLocation + 2), word(myLocation + 3));
+	}
+	uint32_t line = word(myLocation);
+	uint32_t cols = word(myLocation + 1);
+	return Position(line, cols & 0xffff, line + word(myLocation + 2),
+	  cols >> 16);
+}
+
+AstImage::AstImage(const unsigned char * bytes, size_t size, bool mapped)
+: myBytes(bytes), mySize(size), myMapped(mapped){
+}
+
+AstImage::~AstImage(){
+	if (myMapped){
+		munmap(const_cast<unsigned char *>(myBytes), mySize);
+	}
+}
+
+bool AstImage::isImage(const char * bytes, size_t size){
+	return size >= 4 && memcmp(bytes, MAGIC, 4) == 0;
+}
+
+//Check that the sections all lie within the image, so that
+// views only need to check offsets within a section
+static void checkLayout(const unsigned char * bytes, size_t size){
+	if (size < 4 * HEADER_WORDS){ corrupt(); }
+	if (get32(bytes + 4) != VERSION){
+		throw new UserError("Unsupported binary AST version");
+	}
+	uint64_t nodeBytes = get32(bytes + 8);
+	uint64_t root = get32(bytes + 12);
+	uint64_t strings = get32(bytes + 16);
+	uint64_t symbols = get32(bytes + 20);
+	uint64_t nodesAt = get32(bytes + 24);
+	uint64_t stringsAt = get32(bytes + 28);
+	uint64_t symbolsAt = get32(bytes + 32);
+	bool good = nodesAt == 4 * HEADER_WORDS
+	  && nodesAt + nodeBytes <= symbolsAt
+	  && symbolsAt + 12 * symbols <= stringsAt
+	  && stringsAt + 4 * strings <= size
+	  && (strings == 0 || bytes[size - 1] == 0)
+	  && root + 4 * MIN_RECORD_WORDS <= nodeBytes
+	  && nodeBytes % 4 == 0 && root % 4 == 0;
+	if (!good){ corrupt(); }
+}
+
+AstImage * AstImage::map(const char * path){
+	int fd = open(path, O_RDONLY);
+	if (fd < 0){ return nullptr; }
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)
+	  || info.st_size < 4){
+		close(fd);
+		return nullptr;
+	}
+	size_t size = static_cast<size_t>(info.st_size);
+	void * bytes = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (bytes == MAP_FAILED){ return nullptr; }
+	if (!isImage(static_cast<const char *>(bytes), size)){
+		munmap(bytes, size);
+		return nullptr;
+	}
+	AstImage * image = new AstImage(
+	  static_cast<const unsigned char *>(bytes), size, true);
+	checkLayout(image->myBytes, size);
+	return image;
+}
+
+AstImage * AstImage::copy(const std::string& bytes){
+	AstImage * image = new AstImage(nullptr, bytes.size(), false);
+	image->myCopy = bytes;
+	image->myBytes = reinterpret_cast<const unsigned char *>(
+	  image->myCopy.data());
+	checkLayout(image->myBytes, image->mySize);
+	return image;
+}
+
+uint32_t AstImage::header(size_t i) const{
+	return get32(myBytes + 4 * i);
+}
+
+const unsigned char * AstImage::record(uint32_t offset) const{
+	if (offset % 4 != 0 || offset + 4 * MIN_RECORD_WORDS > header(2)){
+		corrupt();
+	}
+	return myBytes + header(6) + offset;
+}
+
+AstNodeView AstImage::root() const{
+	return AstNodeView(this, header(3));
+}
+
+size_t AstImage::symbolCount() const{
+	return header(5);
+}
+
+const char * AstImage::symbolPart(size_t i, size_t part) const{
+	if (i >= symbolCount() || part > 2){ corrupt(); }
+	return string(get32(myBytes + header(8) + 12 * i + 4 * part));
+}
+
+const char * AstImage::string(uint32_t id) const{
+	if (id >= header(4)){ corrupt(); }
+	size_t at = header(7) + get32(myBytes + header(7) + 4 * id);
+	if (at >= mySize){ corrupt(); }
+	return reinterpret_cast<const char *>(myBytes + at);
+}
+
+void AstNodeView::corrupt(){
+	drewno_mars::corrupt();
+}
+
+ProgramNode * AstImage::rebuild() const{
+	AstNodeView top = root();
+	if (top.kind() != NodeKind::Program){ corrupt(); }
+	return static_cast<ProgramNode *>(TreeBuilder<AstNodeView>::build(top));
+}
+
+}
@@ -0,0 +1,121 @@
+#ifndef DREWNO_MARS_BINARY_AST_HPP
+#define DREWNO_MARS_BINARY_AST_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.hpp"
+
+//The binary AST format (written by -b, and read back in place
+// of source wherever dmc takes a program). All numbers are
+// 32-bit little-endian, and every reference is an offset, so a
+// file can be mapped into memory and read where it lies.
+//
+// header:  "DMCA" version nodeBytes root
+//          stringCount symbolCount nodesAt stringsAt symbolsAt
+// nodes:   records, children before parents; root is the
+//          offset (within nodes) of the ProgramNode's record
+// record:  kind(8) flags(8) childCount(16)
+//          childCount again, if it needs all 32 bits (LONG_COUNT)
+//          data (HAS_DATA), symbol (HAS_SYMBOL)
+//          location: line, column and end column (16 bits each)
+//          and end line - line, or if any of those don't fit
+//          (WIDE_LOCATION), line, column, end line and end column
+//          childCount child offsets (NO_NODE for an absent one)
+// symbols: symbolCount (name, kind, type) string ids
+// strings: stringCount offsets, then the NUL-terminated bytes
+//
+//A record's data is the interned name of an IDNode or
+// StrLitNode, or the value of an IntLitNode. Its symbol is the
+// index of the symbol the IDNode is bound to, if any.
+// Lists of nodes are List records with the items as children.
+namespace drewno_mars{
+
+//Builds up a binary AST, one record at a time
+class AstWriter{
+public:
+	static const uint32_t NO_NODE = 0xffffffff;
+
+	//Add a record, returning its offset
+	uint32_t node(NodeKind kind, const Position * pos,
+	  const std::vector<uint32_t>& children,
+	  uint32_t data = 0, SemSymbol * symbol = nullptr);
+	//Add a whole subtree (see serialize.cpp), returning the
+	// offset of its root's record
+	uint32_t tree(ASTNode * root);
+	uint32_t name(const std::string& str);
+
+	void write(std::ostream& out, uint32_t root);
+private:
+	std::vector<uint32_t> myNodes;
+	std::vector<std::string> myStrings;
+	std::unordered_map<std::string, uint32_t> myStringIds;
+	std::vector<SemSymbol *> mySymbols;
+	std::unordered_map<SemSymbol *, uint32_t> mySymbolIds;
+};
+
+class AstImage;
+
+//A record, read where it lies in the image
+class AstNodeView{
+public:
+	AstNodeView(const AstImage * image, uint32_t offset);
+	NodeKind kind() const;
+	size_t childCount() const;
+	bool hasChild(size_t i) const;
+	AstNodeView child(size_t i) const;
+	const char * name() const;
+	int intValue() const;
+	//The index of the symbol this ID was bound to, or -1
+	long symbol() const;
+	Position position() const;
+	//Throw, for a record that can't be what was written
+	static void corrupt();
+private:
+	uint32_t word(size_t i) const;
+	const AstImage * myImage;
+	const unsigned char * myRecord;
+	//Where the optional fields, the location and the children
+	// start, in words from the start of the record
+	unsigned char myData;
+	unsigned char mySymbol;
+	unsigned char myLocation;
+	unsigned char myChildren;
+	size_t myChildCount;
+};
+
+//A binary AST, mapped from a file or copied from memory
+class AstImage{
+public:
+	//Null if path isn't a binary AST
+	static AstImage * map(const char * path);
+	static AstImage * copy(const std::string& bytes);
+	static bool isImage(const char * bytes, size_t size);
+	~AstImage();
+
+	AstNodeView root() const;
+	size_t symbolCount() const;
+	//The name, kind and type of symbol i
+	const char * symbolPart(size_t i, size_t part) const;
+	const char * string(uint32_t id) const;
+
+	//A fresh tree, as the parser would have built it
+	ProgramNode * rebuild() const;
+
+private:
+	friend class AstNodeView;
+	AstImage(const unsigned char * bytes, size_t size, bool mapped);
+	uint32_t header(size_t i) const;
+	const unsigned char * record(uint32_t offset) const;
+
+	const unsigned char * myBytes;
+	size_t mySize;
+	bool myMapped;
+	std::string myCopy;
+};
+
+}
+
+#endif
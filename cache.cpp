@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "cache.hpp"
+#include "errors.hpp"
+
+namespace drewno_mars{
+
+//Entry format: the magic, the key (so a damaged or misnamed
+// file is never mistaken for another entry), the exit status,
+// stdout, stderr, a file count and each file's name and
+// contents. Every integer is 64-bit little-endian, and every
+// string is a length followed by its bytes.
+static const char entryMagic[4] = {'D', 'M', 'C', 'K'};
+//Bump whenever what dmc outputs changes without the binary's
+// size or timestamp changing, or when the entry format does
+static const uint64_t CACHE_VERSION = 1;
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+
+static uint64_t rotl(uint64_t val, int bits){
+	return (val << bits) | (val >> (64 - bits));
+}
+
+static uint64_t finish(uint64_t val){
+	val ^= val >> 33;
+	val *= 0xff51afd7ed558ccdULL;
+	val ^= val >> 33;
+	val *= 0xc4ceb9fe1a85ec53ULL;
+	val ^= val >> 33;
+	return val;
+}
+
+CacheHasher::CacheHasher() : myLength(0){
+	myLanes[0] = PRIME1;
+	myLanes[1] = PRIME2;
+}
+
+void CacheHasher::add(const char * bytes, size_t len){
+	//Fold in the length too, so that adding "ab" then "c"
+	// differs from adding "a" then "bc"
+	myLength += len;
+	myLanes[0] = rotl(myLanes[0] ^ len, 27) * PRIME1;
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8){
+		uint64_t word;
+		memcpy(&word, bytes + i, 8);
+		myLanes[0] = rotl(myLanes[0] ^ (word * PRIME2), 31) * PRIME1;
+		myLanes[1] = rotl(myLanes[1] + word, 29) * PRIME2 + myLanes[0];
+	}
+	uint64_t tail = 0;
+	for (size_t shift = 0; i < len; i++, shift += 8){
+		tail |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[i]))
+		  << shift;
+	}
+	myLanes[0] = rotl(myLanes[0] ^ (tail * PRIME2), 31) * PRIME1;
+	myLanes[1] = rotl(myLanes[1] + tail, 29) * PRIME2 + myLanes[0];
+}
+
+void CacheHasher::add(const std::string& str){
+	add(str.data(), str.size());
+}
+
+void CacheHasher::add(uint64_t val){
+	char bytes[8];
+	for (int i = 0; i < 8; i++){
+		bytes[i] = static_cast<char>((val >> (8 * i)) & 0xff);
+	}
+	add(bytes, 8);
+}
+
+CacheKey CacheHasher::key() const{
+	CacheKey key;
+	key.hi = finish(myLanes[0] ^ myLength);
+	key.lo = finish(myLanes[1] + key.hi);
+	return key;
+}
+
+std::string CacheKey::hex() const{
+	char buf[33];
+	snprintf(buf, sizeof(buf), "%016llx%016llx",
+	  static_cast<unsigned long long>(hi),
+	  static_cast<unsigned long long>(lo));
+	return buf;
+}
+
+void hashCompiler(CacheHasher& hasher){
+	hasher.add(CACHE_VERSION);
+	struct stat info;
+	if (stat("/proc/self/exe", &info) == 0){
+		hasher.add(static_cast<uint64_t>(info.st_size));
+		hasher.add(static_cast<uint64_t>(info.st_mtim.tv_sec));
+		hasher.add(static_cast<uint64_t>(info.st_mtim.tv_nsec));
+	}
+}
+
+static void putNum(std::string& out, uint64_t val){
+	for (int i = 0; i < 8; i++){
+		out.push_back(static_cast<char>((val >> (8 * i)) & 0xff));
+	}
+}
+
+static void putStr(std::string& out, const std::string& str){
+	putNum(out, str.size());
+	out += str;
+}
+
+//Reads an entry back, failing on anything out of place
+class EntryReader{
+public:
+	EntryReader(const std::string& bytes, size_t at)
+	: myBytes(bytes), myAt(at){ }
+	bool num(uint64_t& val){
+		if (myBytes.size() - myAt < 8){ return false; }
+		val = 0;
+		for (size_t i = 0; i < 8; i++){
+			unsigned char byte = static_cast<unsigned char>(myBytes[myAt + i]);
+			val |= static_cast<uint64_t>(byte) << (8 * i);
+		}
+		myAt += 8;
+		return true;
+	}
+	bool str(std::string& val){
+		uint64_t len;
+		if (!num(len) || myBytes.size() - myAt < len){ return false; }
+		val.assign(myBytes, myAt, len);
+		myAt += len;
+		return true;
+	}
+	bool done(){ return myAt == myBytes.size(); }
+private:
+	const std::string& myBytes;
+	size_t myAt;
+};
+
+static bool readFile(const std::string& path, std::string& bytes){
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0){ return false; }
+	struct stat info;
+	bool ok = fstat(fd, &info) == 0;
+	if (ok){
+		bytes.resize(static_cast<size_t>(info.st_size));
+		size_t got = 0;
+		while (ok && got < bytes.size()){
+			ssize_t n = read(fd, &bytes[got], bytes.size() - got);
+			if (n < 0 && errno == EINTR){ continue; }
+			ok = n > 0;
+			if (ok){ got += static_cast<size_t>(n); }
+		}
+	}
+	close(fd);
+	return ok;
+}
+
+ResultCache::ResultCache(const std::string& dir, uint64_t limit)
+: myDir(dir), myLimit(limit){
+	if (mkdir(myDir.c_str(), 0755) != 0 && errno != EEXIST){
+		std::string msg = "Bad cache directory " + myDir;
+		throw new UserError(msg.c_str());
+	}
+	struct stat info;
+	if (stat(myDir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)){
+		std::string msg = "Bad cache directory " + myDir;
+		throw new UserError(msg.c_str());
+	}
+}
+
+std::string ResultCache::path(const CacheKey& key){
+	return myDir + "/" + key.hex();
+}
+
+bool ResultCache::lookup(const CacheKey& key, CompileResult& result){
+	std::string bytes;
+	if (!readFile(path(key), bytes)){ return false; }
+	if (bytes.size() < 4 || memcmp(bytes.data(), entryMagic, 4) != 0){
+		return false;
+	}
+	EntryReader in(bytes, 4);
+	uint64_t hi, lo, status, fileCount;
+	if (!in.num(hi) || !in.num(lo) || hi != key.hi || lo != key.lo
+	  || !in.num(status) || !in.str(result.out) || !in.str(result.err)
+	  || !in.num(fileCount)){
+		return false;
+	}
+	result.status = static_cast<int>(status);
+	result.files.clear();
+	for (uint64_t i = 0; i < fileCount; i++){
+		std::pair<std::string, std::string> file;
+		if (!in.str(file.first) || !in.str(file.second)){ return false; }
+		result.files.push_back(file);
+	}
+	if (!in.done()){ return false; }
+
+	//Mark the entry as recently used
+	utimensat(AT_FDCWD, path(key).c_str(), nullptr, 0);
+	return true;
+}
+
+//A cache that can't be written to just doesn't remember
+// anything, so failures here are not errors
+void ResultCache::store(const CacheKey& key, const CompileResult& result){
+	std::string bytes(entryMagic, 4);
+	putNum(bytes, key.hi);
+	putNum(bytes, key.lo);
+	putNum(bytes, static_cast<uint64_t>(result.status));
+	putStr(bytes, result.out);
+	putStr(bytes, result.err);
+	putNum(bytes, result.files.size());
+	for (const auto& file : result.files){
+		putStr(bytes, file.first);
+		putStr(bytes, file.second);
+	}
+	if (bytes.size() > myLimit){ return; }
+
+	std::string temp = myDir + "/tmp." + std::to_string(getpid())
+	  + "." + key.hex();
+	int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0){ return; }
+	size_t done = 0;
+	bool ok = true;
+	while (ok && done < bytes.size()){
+		ssize_t n = write(fd, bytes.data() + done, bytes.size() - done);
+		if (n < 0 && errno == EINTR){ continue; }
+		ok = n > 0;
+		if (ok){ done += static_cast<size_t>(n); }
+	}
+	ok = close(fd) == 0 && ok;
+	if (!ok || rename(temp.c_str(), path(key).c_str()) != 0){
+		unlink(temp.c_str());
+		return;
+	}
+	evict();
+}
+
+void ResultCache::evict(){
+	DIR * dir = opendir(myDir.c_str());
+	if (dir == nullptr){ return; }
+	struct Entry{
+		std::string path;
+		uint64_t size;
+		struct timespec used;
+	};
+	std::vector<Entry> entries;
+	uint64_t total = 0;
+	while (struct dirent * ent = readdir(dir)){
+		//Entries are named by their key's 32 hex digits; leave
+		// anything else (including other dmcs' temporaries) be
+		std::string name = ent->d_name;
+		if (name.size() != 32
+		  || name.find_first_not_of("0123456789abcdef") != std::string::npos){
+			continue;
+		}
+		Entry entry;
+		entry.path = myDir + "/" + name;
+		struct stat info;
+		if (stat(entry.path.c_str(), &info) != 0){ continue; }
+		entry.size = static_cast<uint64_t>(info.st_size);
+		entry.used = info.st_mtim;
+		total += entry.size;
+		entries.push_back(entry);
+	}
+	closedir(dir);
+	if (total <= myLimit){ return; }
+
+	std::sort(entries.begin(), entries.end(),
+	  [](const Entry& a, const Entry& b){
+		if (a.used.tv_sec != b.used.tv_sec){
+			return a.used.tv_sec < b.used.tv_sec;
+		}
+		return a.used.tv_nsec < b.used.tv_nsec;
+	});
+	for (const Entry& entry : entries){
+		if (total <= myLimit){ break; }
+		//Another dmc may have got there first
+		unlink(entry.path.c_str());
+		total -= entry.size;
+	}
+}
+
+}
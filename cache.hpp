@@ -0,0 +1,58 @@
+#ifndef DREWNO_MARS_CACHE_HPP
+#define DREWNO_MARS_CACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include "server.hpp"
+
+namespace drewno_mars{
+
+//Identifies one compilation: a hash of the program text, the
+// compiler that compiled it and the options that say what it
+// was asked for. Not cryptographic; 128 bits just makes an
+// accidental collision vanishingly unlikely.
+struct CacheKey{
+	uint64_t hi;
+	uint64_t lo;
+	std::string hex() const;
+};
+
+//Hashes bytes in 8-byte words, in two independent lanes
+class CacheHasher{
+public:
+	CacheHasher();
+	void add(const char * bytes, size_t len);
+	void add(const std::string& str);
+	void add(uint64_t val);
+	CacheKey key() const;
+private:
+	uint64_t myLanes[2];
+	uint64_t myLength;
+};
+
+//A directory of compile results (see -k), one file per key:
+// those of whole requests, and what the front end made of each
+// program (see FrontEnd in main.cpp). Entries are written to a
+// temporary file and renamed into place, so concurrent dmcs
+// never see half an entry. Once the directory holds more than
+// its limit, the least recently used entries (by modification
+// time, which a hit refreshes) are removed.
+class ResultCache{
+public:
+	ResultCache(const std::string& dir, uint64_t limit);
+	bool lookup(const CacheKey& key, CompileResult& result);
+	void store(const CacheKey& key, const CompileResult& result);
+private:
+	std::string path(const CacheKey& key);
+	void evict();
+	std::string myDir;
+	uint64_t myLimit;
+};
+
+//The key of the compiler itself: this file format's version,
+// plus the size and modification time of the dmc binary
+void hashCompiler(CacheHasher& hasher);
+
+}
+
+#endif
@@ -0,0 +1,532 @@
+#include <cstdint>
+#include <iterator>
+#include <unordered_map>
+#include <unordered_set>
+#include "dce.hpp"
+#include "symbol_table.hpp"
+#include "visitor.hpp"
+
+namespace drewno_mars{
+
+//A set of a function's locals, by index
+typedef std::vector<uint64_t> Bits;
+
+static void add(Bits& bits, uint32_t i){
+	if (i / 64 >= bits.size()){ bits.resize(i / 64 + 1, 0); }
+	bits[i / 64] |= uint64_t(1) << (i % 64);
+}
+
+static void remove(Bits& bits, uint32_t i){
+	if (i / 64 < bits.size()){ bits[i / 64] &= ~(uint64_t(1) << (i % 64)); }
+}
+
+static bool has(const Bits& bits, uint32_t i){
+	return i / 64 < bits.size() && (bits[i / 64] >> (i % 64) & 1) != 0;
+}
+
+static void merge(Bits& into, const Bits& from){
+	if (from.size() > into.size()){ into.resize(from.size(), 0); }
+	for (size_t w = 0; w < from.size(); w++){ into[w] |= from[w]; }
+}
+
+static const uint32_t NO_LOCAL = 0xffffffff;
+
+//A function's locals and formals, numbered as they are declared
+class Locals{
+public:
+	void declare(VarDeclNode * decl){
+		SemSymbol * symbol = decl->ID()->getSymbol();
+		if (symbol == nullptr){ return; }
+		std::string type = symbol->getType();
+		if (type.compare(0, 8, "perfect ") == 0){ type = type.substr(8); }
+		myIndex.emplace(symbol, static_cast<uint32_t>(myScalar.size()));
+		myScalar.push_back(type == "int" || type == "bool");
+	}
+	//The local that node names (or NO_LOCAL)
+	uint32_t of(ASTNode * node) const{
+		if (node->kind() != NodeKind::ID){ return NO_LOCAL; }
+		auto found = myIndex.find(static_cast<IDNode *>(node)->getSymbol());
+		return found == myIndex.end() ? NO_LOCAL : found->second;
+	}
+	bool scalar(uint32_t local) const{ return myScalar[local]; }
+	uint32_t count() const{ return static_cast<uint32_t>(myScalar.size()); }
+private:
+	std::unordered_map<SemSymbol *, uint32_t> myIndex;
+	std::vector<bool> myScalar;
+};
+
+//Cuts each statement list after its first statement that never
+// finishes (a return, an exit, or an if-else both of whose
+// branches end in one)
+class Unreachable : public AstWalker<Unreachable>{
+public:
+	explicit Unreachable(size_t& removed) : myRemoved(removed){ }
+	void post(ASTNode * node){
+		switch (node->kind()){
+		case NodeKind::FnDecl:
+			cut(*static_cast<FnDeclNode *>(node)->getBody());
+			break;
+		case NodeKind::IfStmt:
+			cut(*static_cast<IfStmtNode *>(node)->getBody());
+			break;
+		case NodeKind::WhileStmt:
+			cut(*static_cast<WhileStmtNode *>(node)->getBody());
+			break;
+		case NodeKind::IfElseStmt: {
+			IfElseStmtNode * stmt = static_cast<IfElseStmtNode *>(node);
+			bool endsTrue = cut(*stmt->getBodyTrue());
+			bool endsFalse = cut(*stmt->getBodyFalse());
+			if (endsTrue && endsFalse){ myEnds.insert(stmt); }
+			break;
+		}
+		default:
+			break;
+		}
+	}
+private:
+	bool ends(StmtNode * stmt){
+		return stmt->kind() == NodeKind::ReturnStmt
+		  || stmt->kind() == NodeKind::ExitStmt
+		  || myEnds.count(stmt) != 0;
+	}
+	//Whether the list (once cut) never finishes
+	bool cut(std::list<StmtNode *>& body){
+		for (auto it = body.begin(); it != body.end(); ++it){
+			if (!ends(*it)){ continue; }
+			for (++it; it != body.end(); it = body.erase(it)){
+				delete *it;
+				myRemoved++;
+			}
+			return true;
+		}
+		return false;
+	}
+	size_t& myRemoved;
+	std::unordered_set<StmtNode *> myEnds;
+};
+
+//Numbers a function's locals, and finds the ones each while
+// mentions (inner whiles' included)
+class LocalFinder : public AstWalker<LocalFinder>{
+public:
+	LocalFinder(Locals& locals,
+	  std::unordered_map<ASTNode *, Bits>& loops)
+	: myLocals(locals), myLoops(loops){ }
+	bool pre(ASTNode * node){
+		switch (node->kind()){
+		case NodeKind::VarDecl: case NodeKind::FormalDecl:
+			myLocals.declare(static_cast<VarDeclNode *>(node));
+			break;
+		case NodeKind::WhileStmt:
+			myOpen.emplace_back();
+			break;
+		case NodeKind::ID: {
+			uint32_t local = myLocals.of(node);
+			if (local != NO_LOCAL && !myOpen.empty()){
+				add(myOpen.back(), local);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return true;
+	}
+	void post(ASTNode * node){
+		if (node->kind() != NodeKind::WhileStmt){ return; }
+		Bits& mentioned = myLoops[node];
+		mentioned.swap(myOpen.back());
+		myOpen.pop_back();
+		if (!myOpen.empty()){ merge(myOpen.back(), mentioned); }
+	}
+private:
+	Locals& myLocals;
+	std::unordered_map<ASTNode *, Bits>& myLoops;
+	//The whiles the walk is inside, and the locals seen in each
+	std::vector<Bits> myOpen;
+};
+
+//Adds the locals an expression reads to a set, and notes if it
+// does anything but work out a value
+class ExpScan : public AstWalker<ExpScan>{
+public:
+	ExpScan(const Locals& locals, Bits& reads)
+	: myLocals(locals), myReads(reads), myPure(true){ }
+	bool pre(ASTNode * node){
+		switch (node->kind()){
+		case NodeKind::ID: {
+			uint32_t local = myLocals.of(node);
+			if (local != NO_LOCAL){ add(myReads, local); }
+			break;
+		}
+		case NodeKind::CallExp: case NodeKind::Magic:
+			myPure = false;
+			break;
+		case NodeKind::Divide: {
+			ExpNode * divisor = static_cast<DivideNode *>(node)->getExp2();
+			if (divisor->kind() != NodeKind::IntLit
+			  || static_cast<IntLitNode *>(divisor)->getNum() == 0){
+				myPure = false;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return true;
+	}
+	bool pure() const{ return myPure; }
+private:
+	const Locals& myLocals;
+	Bits& myReads;
+	bool myPure;
+};
+
+//Removes stores to locals that are dead: working backwards
+// through each statement list, with the set of locals that are
+// live (may yet be read) after the statement at hand. A
+// compound statement's lists are worked through on a stack of
+// frames, not by recursing.
+class DeadStores{
+public:
+	DeadStores(const Locals& locals,
+	  const std::unordered_map<ASTNode *, Bits>& loops, size_t& removed)
+	: myLocals(locals), myLoops(loops), myRemoved(removed){ }
+
+	void run(std::list<StmtNode *> * body){
+		myStack.push_back(Frame(body, Bits()));
+		while (true){
+			Frame& f = myStack.back();
+			if (f.at == f.list->begin()){
+				if (myStack.size() == 1){ break; }
+				Bits result;
+				result.swap(f.live);
+				myStack.pop_back();
+				resume(result);
+				continue;
+			}
+			--f.at;
+			statement();
+		}
+		myStack.clear();
+	}
+
+private:
+	struct Frame{
+		Frame(std::list<StmtNode *> * listIn, Bits liveIn)
+		: list(listIn), at(listIn->end()), live(std::move(liveIn)),
+		  step(0){ }
+		std::list<StmtNode *> * list;
+		//The statement being worked on
+		std::list<StmtNode *>::iterator at;
+		Bits live;
+		//How far into the statement's lists the work is, and the
+		// locals live into an if-else's true branch
+		int step;
+		Bits taken;
+	};
+
+	//Work on the statement at the top frame
+	void statement(){
+		Frame& f = myStack.back();
+		StmtNode * stmt = *f.at;
+		switch (stmt->kind()){
+		case NodeKind::VarDecl: {
+			//A local declared without a value starts at 0
+			VarDeclNode * decl = static_cast<VarDeclNode *>(stmt);
+			uint32_t local = myLocals.of(decl->ID());
+			ExpNode * init = decl->getInit();
+			if (init == nullptr){
+				remove(f.live, local);
+				break;
+			}
+			Bits reads;
+			bool pure = scan(init, reads);
+			if (local != NO_LOCAL && !has(f.live, local)
+			  && myLocals.scalar(local)){
+				if (init->kind() == NodeKind::CallExp){
+					decl->setInit(nullptr);
+					f.list->insert(std::next(f.at),
+					  new CallStmtNode(init->pos(),
+					  static_cast<CallExpNode *>(init)));
+					myRemoved++;
+				} else if (pure){
+					decl->setInit(nullptr);
+					delete init;
+					myRemoved++;
+					reads.clear();
+				}
+			}
+			remove(f.live, local);
+			merge(f.live, reads);
+			break;
+		}
+		case NodeKind::AssignStmt: {
+			AssignStmtNode * assign = static_cast<AssignStmtNode *>(stmt);
+			uint32_t local = myLocals.of(assign->getDst());
+			if (local == NO_LOCAL){
+				scan(assign->getDst(), f.live);
+				scan(assign->getSrc(), f.live);
+				break;
+			}
+			Bits reads;
+			bool pure = scan(assign->getSrc(), reads);
+			if (has(f.live, local) || !myLocals.scalar(local)){
+				remove(f.live, local);
+				merge(f.live, reads);
+				break;
+			}
+			ExpNode * src = assign->getSrc();
+			if (src->kind() == NodeKind::CallExp){
+				assign->setSrc(nullptr);
+				*f.at = new CallStmtNode(src->pos(),
+				  static_cast<CallExpNode *>(src));
+				delete assign;
+				merge(f.live, reads);
+				myRemoved++;
+			} else if (pure){
+				drop();
+			} else {
+				merge(f.live, reads);
+			}
+			break;
+		}
+		case NodeKind::PostIncStmt: case NodeKind::PostDecStmt: {
+			LocNode * loc = stmt->kind() == NodeKind::PostIncStmt
+			  ? static_cast<PostIncStmtNode *>(stmt)->getLoc()
+			  : static_cast<PostDecStmtNode *>(stmt)->getLoc();
+			uint32_t local = myLocals.of(loc);
+			if (local != NO_LOCAL && !has(f.live, local)
+			  && myLocals.scalar(local)){
+				drop();
+			} else {
+				scan(loc, f.live);
+			}
+			break;
+		}
+		case NodeKind::TakeStmt: {
+			LocNode * dst = static_cast<TakeStmtNode *>(stmt)->getDst();
+			uint32_t local = myLocals.of(dst);
+			if (local == NO_LOCAL){
+				scan(dst, f.live);
+			} else {
+				remove(f.live, local);
+			}
+			break;
+		}
+		case NodeKind::GiveStmt:
+			scan(static_cast<GiveStmtNode *>(stmt)->getSrc(), f.live);
+			break;
+		case NodeKind::CallStmt:
+			scan(static_cast<CallStmtNode *>(stmt)->getCallExp(), f.live);
+			break;
+		case NodeKind::ReturnStmt: {
+			ExpNode * exp = static_cast<ReturnStmtNode *>(stmt)->getExp();
+			f.live.clear();
+			if (exp != nullptr){ scan(exp, f.live); }
+			break;
+		}
+		case NodeKind::ExitStmt:
+			f.live.clear();
+			break;
+		case NodeKind::IfStmt:
+			f.step = 1;
+			enter(static_cast<IfStmtNode *>(stmt)->getBody(), f.live);
+			break;
+		case NodeKind::IfElseStmt:
+			f.step = 1;
+			enter(static_cast<IfElseStmtNode *>(stmt)->getBodyTrue(), f.live);
+			break;
+		case NodeKind::WhileStmt:
+			//Whatever the loop mentions may be read on the way round
+			merge(f.live, myLoops.at(stmt));
+			f.step = 1;
+			enter(static_cast<WhileStmtNode *>(stmt)->getBody(), f.live);
+			break;
+		default:
+			break;
+		}
+	}
+
+	//Carry on with the compound statement at the top frame, now
+	// that the list last entered is done, with result live into it
+	void resume(Bits& result){
+		Frame& f = myStack.back();
+		StmtNode * stmt = *f.at;
+		switch (stmt->kind()){
+		case NodeKind::IfStmt:
+			merge(f.live, result);
+			scan(static_cast<IfStmtNode *>(stmt)->getCond(), f.live);
+			break;
+		case NodeKind::IfElseStmt: {
+			IfElseStmtNode * ifElse = static_cast<IfElseStmtNode *>(stmt);
+			if (f.step == 1){
+				f.taken.swap(result);
+				f.step = 2;
+				enter(ifElse->getBodyFalse(), f.live);
+				return;
+			}
+			f.live.swap(result);
+			merge(f.live, f.taken);
+			f.taken.clear();
+			scan(ifElse->getCond(), f.live);
+			break;
+		}
+		default:
+			//A while's body reads nothing that its frame didn't
+			// already have as live
+			break;
+		}
+		f.step = 0;
+	}
+
+	void enter(std::list<StmtNode *> * list, const Bits& live){
+		myStack.push_back(Frame(list, live));
+	}
+
+	//Remove the statement at the top frame
+	void drop(){
+		Frame& f = myStack.back();
+		delete *f.at;
+		f.at = f.list->erase(f.at);
+		myRemoved++;
+	}
+
+	//Add the locals exp reads to reads; false if it has effects
+	bool scan(ExpNode * exp, Bits& reads){
+		ExpScan scanner(myLocals, reads);
+		scanner.walk(exp);
+		return scanner.pure();
+	}
+
+	const Locals& myLocals;
+	const std::unordered_map<ASTNode *, Bits>& myLoops;
+	size_t& myRemoved;
+	std::vector<Frame> myStack;
+};
+
+//Counts how often each local is mentioned
+class Mentions : public AstWalker<Mentions>{
+public:
+	Mentions(const Locals& locals, std::vector<uint32_t>& counts)
+	: myLocals(locals), myCounts(counts){ }
+	bool pre(ASTNode * node){
+		uint32_t local = myLocals.of(node);
+		if (local != NO_LOCAL){ myCounts[local]++; }
+		return true;
+	}
+private:
+	const Locals& myLocals;
+	std::vector<uint32_t>& myCounts;
+};
+
+//Removes the declarations of locals mentioned nowhere else, as
+// long as any initialiser has no effects (or is a call, which
+// is kept)
+class UnusedLocals : public AstWalker<UnusedLocals>{
+public:
+	UnusedLocals(const Locals& locals, const std::vector<uint32_t>& counts,
+	  size_t& removed)
+	: myLocals(locals), myCounts(counts), myRemoved(removed){ }
+	void post(ASTNode * node){
+		switch (node->kind()){
+		case NodeKind::FnDecl:
+			prune(*static_cast<FnDeclNode *>(node)->getBody());
+			break;
+		case NodeKind::IfStmt:
+			prune(*static_cast<IfStmtNode *>(node)->getBody());
+			break;
+		case NodeKind::IfElseStmt:
+			prune(*static_cast<IfElseStmtNode *>(node)->getBodyTrue());
+			prune(*static_cast<IfElseStmtNode *>(node)->getBodyFalse());
+			break;
+		case NodeKind::WhileStmt:
+			prune(*static_cast<WhileStmtNode *>(node)->getBody());
+			break;
+		default:
+			break;
+		}
+	}
+private:
+	bool pure(ExpNode * exp){
+		Bits reads;
+		ExpScan scanner(myLocals, reads);
+		scanner.walk(exp);
+		return scanner.pure();
+	}
+	void prune(std::list<StmtNode *>& body){
+		for (auto it = body.begin(); it != body.end();){
+			if ((*it)->kind() != NodeKind::VarDecl){
+				++it;
+				continue;
+			}
+			VarDeclNode * decl = static_cast<VarDeclNode *>(*it);
+			uint32_t local = myLocals.of(decl->ID());
+			//Its own ID is the one mention
+			if (local == NO_LOCAL || myCounts[local] != 1){
+				++it;
+				continue;
+			}
+			ExpNode * init = decl->getInit();
+			if (init != nullptr && init->kind() == NodeKind::CallExp){
+				decl->setInit(nullptr);
+				*it = new CallStmtNode(init->pos(),
+				  static_cast<CallExpNode *>(init));
+				++it;
+			} else if (init == nullptr || pure(init)){
+				it = body.erase(it);
+			} else {
+				++it;
+				continue;
+			}
+			delete decl;
+			myRemoved++;
+		}
+	}
+	const Locals& myLocals;
+	const std::vector<uint32_t>& myCounts;
+	size_t& myRemoved;
+};
+
+void DeadCodeEliminator::eliminate(DeclNode * decl){
+	if (decl->kind() == NodeKind::FnDecl){
+		function(static_cast<FnDeclNode *>(decl), decl->ID()->getName());
+		return;
+	}
+	if (decl->kind() != NodeKind::ClassDefn){ return; }
+	ClassDefnNode * cls = static_cast<ClassDefnNode *>(decl);
+	for (DeclNode * member : *cls->getMembers()){
+		if (member->kind() != NodeKind::FnDecl){ continue; }
+		function(static_cast<FnDeclNode *>(member),
+		  cls->ID()->getName() + "." + member->ID()->getName());
+	}
+}
+
+void DeadCodeEliminator::function(FnDeclNode * fn, const std::string& name){
+	size_t removed = 0;
+	Unreachable unreachable(removed);
+	unreachable.walk(fn);
+
+	Locals locals;
+	std::unordered_map<ASTNode *, Bits> loops;
+	LocalFinder finder(locals, loops);
+	finder.walk(fn);
+	DeadStores stores(locals, loops, removed);
+	stores.run(fn->getBody());
+
+	std::vector<uint32_t> counts(locals.count(), 0);
+	Mentions mentions(locals, counts);
+	mentions.walk(fn);
+	UnusedLocals unused(locals, counts, removed);
+	unused.walk(fn);
+
+	if (removed > 0){ myRemoved.push_back(std::make_pair(name, removed)); }
+}
+
+size_t DeadCodeEliminator::total() const{
+	size_t total = 0;
+	for (auto& fn : myRemoved){ total += fn.second; }
+	return total;
+}
+
+}
@@ -0,0 +1,45 @@
+#ifndef DREWNO_MARS_DCE_HPP
+#define DREWNO_MARS_DCE_HPP
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ast.hpp"
+
+//Dead code elimination on name-analysed functions, done in
+// place after constant folding (see fold.hpp) and before they
+// are lowered.
+//
+//Three things go, in this order: statements after a return, an
+// exit, or an if-else both of whose branches end in one; stores
+// to a function's int and bool locals (and formals), the values
+// they are declared with included, that nothing reads before
+// the next store, the function's end or a return, found by a
+// backwards liveness analysis; and locals that are then never
+// mentioned. A store goes along with its expression if that has
+// no effect (no call, no 24Kmagic, no division that could fail),
+// and is replaced by the call if its expression is one;
+// otherwise it stays. A while's body is analysed once, as if
+// every local mentioned anywhere in the loop were read on the
+// way round, so that nested loops cost no more than a pass.
+namespace drewno_mars{
+
+class DeadCodeEliminator{
+public:
+	//Remove the dead code from decl's function (or methods)
+	void eliminate(DeclNode * decl);
+	//How many statements were removed from each function that
+	// had any removed, in order
+	const std::vector<std::pair<std::string, size_t>>& removed() const{
+		return myRemoved;
+	}
+	size_t total() const;
+private:
+	void function(FnDeclNode * fn, const std::string& name);
+	std::vector<std::pair<std::string, size_t>> myRemoved;
+};
+
+}
+
+#endif
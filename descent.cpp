@@ -0,0 +1,538 @@
+#include <memory>
+#include <utility>
+#include "descent.hpp"
+#include "stats.hpp"
+
+namespace drewno_mars{
+
+using TokenKind = drewno_mars::Parser::token;
+
+//How deeply expressions and blocks may nest before the rest
+// is left to the bison parser, whose stack is on the heap
+static const size_t MAX_DEPTH = 1000;
+
+//Binding powers, lowest first, as in drewno_mars.yy's
+// precedence declarations (ASSIGN only appears in statements)
+static const int NO_PREC = 0;
+static const int OR_PREC = 1;
+static const int AND_PREC = 2;
+static const int COMPARE_PREC = 3;
+static const int SUM_PREC = 4;
+static const int PRODUCT_PREC = 5;
+static const int NOT_PREC = 6;
+
+static int binaryPrec(int kind){
+	switch (kind){
+	case TokenKind::OR:
+		return OR_PREC;
+	case TokenKind::AND:
+		return AND_PREC;
+	case TokenKind::EQUALS:
+	case TokenKind::NOTEQUALS:
+	case TokenKind::LESS:
+	case TokenKind::LESSEQ:
+	case TokenKind::GREATER:
+	case TokenKind::GREATEREQ:
+		return COMPARE_PREC;
+	case TokenKind::DASH:
+	case TokenKind::CROSS:
+		return SUM_PREC;
+	case TokenKind::STAR:
+	case TokenKind::SLASH:
+		return PRODUCT_PREC;
+	default:
+		return NO_PREC;
+	}
+}
+
+static ExpNode * binary(int kind, const Position * pos,
+  ExpNode * lhs, ExpNode * rhs){
+	switch (kind){
+	case TokenKind::OR: return new OrNode(pos, lhs, rhs);
+	case TokenKind::AND: return new AndNode(pos, lhs, rhs);
+	case TokenKind::EQUALS: return new EqualsNode(pos, lhs, rhs);
+	case TokenKind::NOTEQUALS: return new NotEqualsNode(pos, lhs, rhs);
+	case TokenKind::LESS: return new LessNode(pos, lhs, rhs);
+	case TokenKind::LESSEQ: return new LessEqNode(pos, lhs, rhs);
+	case TokenKind::GREATER: return new GreaterNode(pos, lhs, rhs);
+	case TokenKind::GREATEREQ: return new GreaterEqNode(pos, lhs, rhs);
+	case TokenKind::DASH: return new MinusNode(pos, lhs, rhs);
+	case TokenKind::CROSS: return new PlusNode(pos, lhs, rhs);
+	case TokenKind::STAR: return new TimesNode(pos, lhs, rhs);
+	case TokenKind::SLASH: return new DivideNode(pos, lhs, rhs);
+	default:
+		throw new InternalError("Not a binary operator");
+	}
+}
+
+//Nodes parsed into a list, freed if the parse gives up
+// before the list is taken
+template <typename T>
+class DescentParser::Owned{
+public:
+	~Owned(){ for (T * node : myNodes){ delete node; } }
+	void add(T * node){ myNodes.push_back(node); }
+	std::list<T *> take(){
+		std::list<T *> taken;
+		taken.swap(myNodes);
+		return taken;
+	}
+private:
+	std::list<T *> myNodes;
+};
+
+//Counts the parser's recursion, giving up when it's too deep
+class DescentParser::Nest{
+public:
+	Nest(DescentParser * parser) : myParser(parser){
+		if (++myParser->myDepth > MAX_DEPTH){ myParser->fail(); }
+	}
+	~Nest(){ myParser->myDepth--; }
+private:
+	DescentParser * myParser;
+};
+
+//Feeds the bison parser the tokens the descent parser had
+// read of the declaration it gave up on, then the rest of the
+// input as the scanner lexes it
+class Replay : public Scanner{
+public:
+	Replay(Scanner& rest, const std::vector<DescentParser::Lexeme>& read)
+	: Scanner(nullptr), myRest(rest), myRead(read), myNext(0){
+		//Tokens lexed from here on are ours to release
+		myRest.handOffTokens();
+	}
+
+	using Scanner::yylex;
+	int yylex(drewno_mars::Parser::semantic_type * const lval) override{
+		if (myNext < myRead.size()){
+			const DescentParser::Lexeme& lexeme = myRead[myNext++];
+			if (lexeme.kind != TokenKind::END){
+				lval->emplace<Token *>(lexeme.token);
+			}
+			return lexeme.kind;
+		}
+		int kind = myRest.yylex(lval);
+		if (kind != TokenKind::END){ keep(lval->as<Token *>()); }
+		return kind;
+	}
+
+private:
+	Scanner& myRest;
+	const std::vector<DescentParser::Lexeme>& myRead;
+	size_t myNext;
+};
+
+DescentParser::DescentParser(Scanner& scanner, ProgramNode ** root,
+  DeclSink * sink)
+: myScanner(scanner), myRoot(root), mySink(sink), myHaveNext(false),
+  myDepth(0){ }
+
+int DescentParser::parse(){
+	Owned<DeclNode> globals;
+	try {
+		while (peek() != TokenKind::END){
+			DeclNode * declNode = decl();
+			if (mySink == nullptr){
+				globals.add(declNode);
+			} else {
+				//As in the bison parser's globals rule
+				mySink->accept(declNode);
+				myScanner.releaseTokens();
+			}
+			myDeclTokens.clear();
+		}
+	} catch (GiveUp * giveUp){
+		delete giveUp;
+		return handOver(globals);
+	}
+	*myRoot = new ProgramNode(globals.take());
+	return 0;
+}
+
+int DescentParser::handOver(Owned<DeclNode>& globals){
+	Stats::count("descent parser handovers", 1);
+	ProgramNode * rest = nullptr;
+	Replay replay(myScanner, myDeclTokens);
+	Parser parser(replay, &rest, mySink);
+	int errCode = parser.parse();
+	if (errCode != 0){
+		delete rest;
+		return errCode;
+	}
+	std::list<DeclNode *> all = globals.take();
+	all.splice(all.end(), *rest->getGlobals());
+	delete rest;
+	*myRoot = new ProgramNode(std::move(all));
+	return 0;
+}
+
+//The lookahead's kind, reading it if need be. Tokens are only
+// read once they're needed to decide what to do, as bison
+// does, so lexical errors and declarations given to the sink
+// come out in the same order either way.
+int DescentParser::peek(){
+	if (!myHaveNext){
+		Lexeme lexeme;
+		lexeme.kind = myScanner.yylex(&myValue);
+		lexeme.token = nullptr;
+		if (lexeme.kind != TokenKind::END){
+			lexeme.token = myValue.as<Token *>();
+			myValue.destroy<Token *>();
+		}
+		myDeclTokens.push_back(lexeme);
+		myHaveNext = true;
+	}
+	return myDeclTokens.back().kind;
+}
+
+Token * DescentParser::next(){
+	peek();
+	myHaveNext = false;
+	return myDeclTokens.back().token;
+}
+
+Token * DescentParser::expect(int kind){
+	if (peek() != kind){ fail(); }
+	return next();
+}
+
+void DescentParser::fail(){
+	throw new GiveUp();
+}
+
+DeclNode * DescentParser::decl(){
+	std::unique_ptr<IDNode> name(id());
+	expect(TokenKind::COLON);
+	switch (peek()){
+	case TokenKind::CLASS:
+		return classDecl(name.release());
+	case TokenKind::LPAREN:
+		return fnDecl(name.release());
+	default: {
+		std::unique_ptr<VarDeclNode> var(varDecl(name.release()));
+		expect(TokenKind::SEMICOL);
+		return var.release();
+	}
+	}
+}
+
+ClassDefnNode * DescentParser::classDecl(IDNode * nameIn){
+	std::unique_ptr<IDNode> name(nameIn);
+	expect(TokenKind::CLASS);
+	expect(TokenKind::LCURLY);
+	Owned<DeclNode> members;
+	while (peek() != TokenKind::RCURLY){
+		std::unique_ptr<IDNode> member(id());
+		expect(TokenKind::COLON);
+		if (peek() == TokenKind::LPAREN){
+			members.add(fnDecl(member.release()));
+		} else {
+			members.add(varDecl(member.release()));
+			expect(TokenKind::SEMICOL);
+		}
+	}
+	next();
+	Token * end = expect(TokenKind::SEMICOL);
+	Position p(name->pos(), end->pos());
+	return new ClassDefnNode(&p, name.release(), members.take());
+}
+
+FnDeclNode * DescentParser::fnDecl(IDNode * nameIn){
+	std::unique_ptr<IDNode> name(nameIn);
+	expect(TokenKind::LPAREN);
+	Owned<FormalDeclNode> formals;
+	if (peek() != TokenKind::RPAREN){
+		formals.add(formalDecl());
+		while (peek() == TokenKind::COMMA){
+			next();
+			formals.add(formalDecl());
+		}
+	}
+	expect(TokenKind::RPAREN);
+	std::unique_ptr<TypeNode> retType(type());
+	expect(TokenKind::LCURLY);
+	Owned<StmtNode> body;
+	stmtList(body);
+	Token * end = expect(TokenKind::RCURLY);
+	Position pos(name->pos(), end->pos());
+	return new FnDeclNode(&pos, name.release(), formals.take(),
+	  retType.release(), body.take());
+}
+
+//The rest of a variable declaration, after its colon
+VarDeclNode * DescentParser::varDecl(IDNode * nameIn){
+	std::unique_ptr<IDNode> name(nameIn);
+	std::unique_ptr<TypeNode> varType(type());
+	if (peek() != TokenKind::ASSIGN){
+		Position p(name->pos(), varType->pos());
+		return new VarDeclNode(&p, name.release(), varType.release(),
+		  nullptr);
+	}
+	next();
+	std::unique_ptr<ExpNode> init(exp(OR_PREC));
+	Position p(name->pos(), init->pos());
+	return new VarDeclNode(&p, name.release(), varType.release(),
+	  init.release());
+}
+
+FormalDeclNode * DescentParser::formalDecl(){
+	std::unique_ptr<IDNode> name(id());
+	Token * colon = expect(TokenKind::COLON);
+	//The bison parser ends a formal's position at its colon
+	Position pos(name->pos(), colon->pos());
+	TypeNode * formalType = type();
+	return new FormalDeclNode(&pos, name.release(), formalType);
+}
+
+TypeNode * DescentParser::type(){
+	if (peek() == TokenKind::ID){
+		IDNode * name = id();
+		return new ClassTypeNode(name->pos(), name);
+	}
+	if (peek() != TokenKind::PERFECT){ return primType(); }
+	Token * perfect = next();
+	std::unique_ptr<TypeNode> sub;
+	if (peek() == TokenKind::ID){
+		IDNode * name = id();
+		Position p(perfect->pos(), name->pos());
+		sub.reset(new ClassTypeNode(name->pos(), name));
+		return new PerfectTypeNode(&p, sub.release());
+	}
+	sub.reset(primType());
+	Position p(perfect->pos(), sub->pos());
+	return new PerfectTypeNode(&p, sub.release());
+}
+
+TypeNode * DescentParser::primType(){
+	switch (peek()){
+	case TokenKind::INT:
+		return new IntTypeNode(next()->pos());
+	case TokenKind::BOOL:
+		return new BoolTypeNode(next()->pos());
+	case TokenKind::VOID:
+		return new VoidTypeNode(next()->pos());
+	default:
+		fail();
+		return nullptr;
+	}
+}
+
+//Statements up to (not including) the closing brace
+void DescentParser::stmtList(Owned<StmtNode>& stmts){
+	Nest nest(this);
+	while (peek() != TokenKind::RCURLY){
+		if (peek() == TokenKind::WHILE || peek() == TokenKind::IF){
+			stmts.add(blockStmt());
+		} else {
+			stmts.add(stmt());
+			expect(TokenKind::SEMICOL);
+		}
+	}
+}
+
+StmtNode * DescentParser::blockStmt(){
+	Token * keyword = next();
+	expect(TokenKind::LPAREN);
+	std::unique_ptr<ExpNode> cond(exp(OR_PREC));
+	expect(TokenKind::RPAREN);
+	expect(TokenKind::LCURLY);
+	Owned<StmtNode> body;
+	stmtList(body);
+	Token * end = expect(TokenKind::RCURLY);
+	if (keyword->kind() == TokenKind::WHILE){
+		Position p(keyword->pos(), end->pos());
+		return new WhileStmtNode(&p, cond.release(), body.take());
+	}
+	if (peek() != TokenKind::ELSE){
+		Position p(keyword->pos(), end->pos());
+		return new IfStmtNode(&p, cond.release(), body.take());
+	}
+	next();
+	expect(TokenKind::LCURLY);
+	Owned<StmtNode> elseBody;
+	stmtList(elseBody);
+	end = expect(TokenKind::RCURLY);
+	Position p(keyword->pos(), end->pos());
+	return new IfElseStmtNode(&p, cond.release(), body.take(),
+	  elseBody.take());
+}
+
+StmtNode * DescentParser::stmt(){
+	Token * keyword;
+	switch (peek()){
+	case TokenKind::GIVE: {
+		keyword = next();
+		ExpNode * src = exp(OR_PREC);
+		Position p(keyword->pos(), src->pos());
+		return new GiveStmtNode(&p, src);
+	}
+	case TokenKind::TAKE: {
+		keyword = next();
+		LocNode * dst = loc(id(), nullptr);
+		Position p(keyword->pos(), dst->pos());
+		return new TakeStmtNode(&p, dst);
+	}
+	case TokenKind::RETURN: {
+		keyword = next();
+		if (peek() == TokenKind::SEMICOL){
+			return new ReturnStmtNode(keyword->pos(), nullptr);
+		}
+		ExpNode * result = exp(OR_PREC);
+		Position p(keyword->pos(), result->pos());
+		return new ReturnStmtNode(&p, result);
+	}
+	case TokenKind::EXIT:
+		return new ExitStmtNode(next()->pos());
+	case TokenKind::ID:
+		break;
+	default:
+		fail();
+	}
+
+	IDNode * name = id();
+	if (peek() == TokenKind::COLON){
+		next();
+		return varDecl(name);
+	}
+	Token * postDec = nullptr;
+	std::unique_ptr<LocNode> target(loc(name, &postDec));
+	if (postDec != nullptr){
+		Position p(target->pos(), postDec->pos());
+		return new PostDecStmtNode(&p, target.release());
+	}
+	switch (peek()){
+	case TokenKind::ASSIGN: {
+		next();
+		ExpNode * src = exp(OR_PREC);
+		Position p(target->pos(), src->pos());
+		return new AssignStmtNode(&p, target.release(), src);
+	}
+	case TokenKind::POSTINC: {
+		Position p(target->pos(), next()->pos());
+		return new PostIncStmtNode(&p, target.release());
+	}
+	case TokenKind::LPAREN: {
+		CallExpNode * callExp = call(target.release());
+		return new CallStmtNode(callExp->pos(), callExp);
+	}
+	default:
+		fail();
+		return nullptr;
+	}
+}
+
+//An expression of operators that bind at least as tightly as
+// minPrec. Binary operators associate left, but comparisons
+// don't associate at all.
+ExpNode * DescentParser::exp(int minPrec){
+	Nest nest(this);
+	std::unique_ptr<ExpNode> lhs(unary());
+	while (true){
+		int op = peek();
+		int prec = binaryPrec(op);
+		if (prec == NO_PREC || prec < minPrec){ return lhs.release(); }
+		next();
+		ExpNode * rhs = exp(prec + 1);
+		Position p(lhs->pos(), rhs->pos());
+		lhs.reset(binary(op, &p, lhs.release(), rhs));
+		if (prec == COMPARE_PREC && binaryPrec(peek()) == COMPARE_PREC){
+			fail();
+		}
+	}
+}
+
+ExpNode * DescentParser::unary(){
+	if (peek() == TokenKind::NOT){
+		Token * op = next();
+		ExpNode * operand = exp(NOT_PREC);
+		Position p(op->pos(), operand->pos());
+		return new NotNode(&p, operand);
+	}
+	if (peek() == TokenKind::DASH){
+		//Negation applies to a term, not an expression
+		Token * op = next();
+		ExpNode * operand = term();
+		Position p(op->pos(), operand->pos());
+		return new NegNode(&p, operand);
+	}
+	return term();
+}
+
+ExpNode * DescentParser::term(){
+	Token * token;
+	switch (peek()){
+	case TokenKind::INTLITERAL:
+		token = next();
+		return new IntLitNode(token->pos(),
+		  static_cast<IntLitToken *>(token)->num());
+	case TokenKind::STRINGLITERAL:
+		token = next();
+		return new StrLitNode(token->pos(),
+		  static_cast<StrToken *>(token)->str());
+	case TokenKind::TRUE:
+		return new TrueNode(next()->pos());
+	case TokenKind::FALSE:
+		return new FalseNode(next()->pos());
+	case TokenKind::MAGIC:
+		return new MagicNode(next()->pos());
+	case TokenKind::LPAREN: {
+		next();
+		std::unique_ptr<ExpNode> inner(exp(OR_PREC));
+		expect(TokenKind::RPAREN);
+		return inner.release();
+	}
+	case TokenKind::ID: {
+		LocNode * place = loc(id(), nullptr);
+		if (peek() == TokenKind::LPAREN){ return call(place); }
+		return place;
+	}
+	default:
+		fail();
+		return nullptr;
+	}
+}
+
+CallExpNode * DescentParser::call(LocNode * calleeIn){
+	std::unique_ptr<LocNode> callee(calleeIn);
+	expect(TokenKind::LPAREN);
+	Owned<ExpNode> args;
+	if (peek() != TokenKind::RPAREN){
+		args.add(exp(OR_PREC));
+		while (peek() == TokenKind::COMMA){
+			next();
+			args.add(exp(OR_PREC));
+		}
+	}
+	Token * end = expect(TokenKind::RPAREN);
+	Position p(callee->pos(), end->pos());
+	return new CallExpNode(&p, callee.release(), args.take());
+}
+
+//A location starting from its base name. Since -- both
+// separates a field from its base and (after a whole location)
+// makes a statement, a -- not followed by a field name is left
+// in *postDec for a statement to take; anywhere else (postDec
+// is null) it's an error.
+LocNode * DescentParser::loc(IDNode * base, Token ** postDec){
+	std::unique_ptr<LocNode> place(base);
+	while (peek() == TokenKind::POSTDEC){
+		Token * op = next();
+		if (peek() != TokenKind::ID){
+			if (postDec == nullptr){ fail(); }
+			*postDec = op;
+			break;
+		}
+		IDNode * field = id();
+		Position p(place->pos(), field->pos());
+		place.reset(new MemberFieldExpNode(&p, place.release(), field));
+	}
+	return place.release();
+}
+
+IDNode * DescentParser::id(){
+	IDToken * token = static_cast<IDToken *>(expect(TokenKind::ID));
+	return new IDNode(token->pos(), token->value());
+}
+
+}
@@ -0,0 +1,80 @@
+#ifndef DREWNO_MARS_DESCENT_HPP
+#define DREWNO_MARS_DESCENT_HPP
+
+#include <list>
+#include <vector>
+#include "scanner.hpp"
+#include "stream.hpp"
+
+namespace drewno_mars{
+
+//A hand-written alternative to the bison parser (see -d):
+// recursive descent for declarations and statements, and
+// precedence climbing (Pratt parsing) for expressions, using
+// the precedence table in drewno_mars.yy. It takes tokens from
+// the same Scanner, builds the same AST and hands finished
+// declarations to the same DeclSink, but has no tables to
+// consult and no semantic values to move up a stack.
+//
+//It doesn't report syntax errors itself. When it meets one,
+// or nesting deep enough to threaten the native stack, it
+// hands the tokens it has read of the current declaration,
+// and the rest of the input, to the bison parser, which
+// carries on from there. So the diagnostics are bison's, word
+// for word, and arbitrarily deep programs still parse.
+class DescentParser{
+public:
+	DescentParser(Scanner& scanner, ProgramNode ** root,
+	  DeclSink * sink);
+	//As Parser::parse: 0 if the input parsed
+	int parse();
+
+	//A token read, and its lexeme (none for END)
+	struct Lexeme{
+		int kind;
+		Token * token;
+	};
+
+private:
+	class Nest;
+	template <typename T> class Owned;
+	//Thrown to give up on the current declaration
+	class GiveUp{ };
+
+	int peek();
+	Token * next();
+	Token * expect(int kind);
+	void fail();
+	int handOver(Owned<DeclNode>& globals);
+
+	DeclNode * decl();
+	ClassDefnNode * classDecl(IDNode * name);
+	FnDeclNode * fnDecl(IDNode * name);
+	VarDeclNode * varDecl(IDNode * name);
+	FormalDeclNode * formalDecl();
+	TypeNode * type();
+	TypeNode * primType();
+	void stmtList(Owned<StmtNode>& stmts);
+	StmtNode * blockStmt();
+	StmtNode * stmt();
+	ExpNode * exp(int minPrec);
+	ExpNode * unary();
+	ExpNode * term();
+	CallExpNode * call(LocNode * callee);
+	LocNode * loc(IDNode * base, Token ** postDec);
+	IDNode * id();
+
+	Scanner& myScanner;
+	ProgramNode ** myRoot;
+	DeclSink * mySink;
+	Parser::semantic_type myValue;
+	//Every token read since the current declaration began,
+	// ending with the lookahead (if it has been read)
+	std::vector<Lexeme> myDeclTokens;
+	bool myHaveNext;
+	size_t myDepth;
+};
+
+}
+
+#endif
@@ -0,0 +1,34 @@
+#!/bin/sh
+# Compile <file> with bison's parser and with -d's recursive
+# descent under each mode that reads the parse, and print a DIFF
+# line for each where the output file, stdout, stderr or exit
+# status is not the same
+#  parsediff.sh <dmc> <file>
+dmc=$1
+file=$2
+work=$file.work
+mkdir -p $work
+status=0
+for mode in "-p" "-u @" "-n @" "-b @" "-s -n @" "-f -n @" "-l -u @"; do
+	for parser in bison descent; do
+		flag=""
+		if [ $parser = descent ]; then
+			flag="-d"
+		fi
+		out=$work/$parser
+		rm -f $out.file
+		: > $out.file
+		args=$(echo "$mode" | sed "s|@|$out.file|")
+		$dmc $file $flag $args > $out.stdout 2> $out.stderr
+		echo $? > $out.status
+	done
+	for part in file stdout stderr status; do
+		if ! cmp -s $work/bison.$part $work/descent.$part; then
+			echo "DIFF $file $mode: $part"
+			status=1
+			break
+		fi
+	done
+done
+rm -rf $work
+exit $status
@@ -14,6 +14,7 @@
 	#include "ast.hpp"
 	namespace drewno_mars {
 		class Scanner;
+		class DeclSink;
 	}
 
 //The following definition is required when 
@@ -31,6 +32,7 @@
 
 %parse-param { drewno_mars::Scanner &scanner }
 %parse-param { drewno_mars::ProgramNode** root }
+%parse-param { drewno_mars::DeclSink * sink }
 %code{
    // C std code for utility functions
    #include <iostream>
@@ -41,109 +43,120 @@
    #include "scanner.hpp"
    #include "ast.hpp"
    #include "tokens.hpp"
+   #include "stream.hpp"
 
   //Request tokens from our scanner member, not 
   // from a global function
   #undef yylex
   #define yylex scanner.yylex
-}
 
-%union {
-   bool                                        transBool;
-   drewno_mars::Token*                         transToken;
-   drewno_mars::Token*                         lexeme;
-   drewno_mars::IDToken*                       transIDToken;
-   drewno_mars::IntLitToken*                   transIntToken;
-   drewno_mars::IntLitToken*                   transShortToken;
-   drewno_mars::StrToken*                      transStrToken;
-   drewno_mars::ProgramNode*                   transProgram;
-   drewno_mars::DeclNode *                     transDecl;
-   drewno_mars::ClassDefnNode *                transClassDefn;
-   std::list<drewno_mars::DeclNode *> *        transClassBody;
-   std::list<drewno_mars::DeclNode *> *        transDeclList;
-   drewno_mars::VarDeclNode *                  transVarDecl;
-   std::list<drewno_mars::TypeNode *> *        transTypeList;
-   std::list<drewno_mars::VarDeclNode *> *     transVarDeclList;
-   drewno_mars::FormalDeclNode *               transFormal;
-   std::list<drewno_mars::FormalDeclNode *> *  transFormalList;
-   drewno_mars::TypeNode *                     transType;
-   drewno_mars::LocNode *                      transLoc;
-   drewno_mars::IDNode *                       transID;
-   drewno_mars::FnDeclNode *                   transFn;
-   std::list<drewno_mars::VarDeclNode *> *     transVarDecls;
-   std::list<drewno_mars::StmtNode *> *        transStmts;
-   drewno_mars::StmtNode *                     transStmt;
-   drewno_mars::ExpNode *                      transExp;
-   drewno_mars::CallExpNode *                  transCallExp;
-   std::list<drewno_mars::ExpNode *> *         transActuals;
+  //Take a value off the parse stack, leaving it empty there, so
+  // the stack's %destructors (below) don't free what now belongs
+  // to the tree
+  template <typename T>
+  static T * take(T *& value){
+	T * taken = value;
+	value = nullptr;
+	return taken;
+  }
+  template <typename T>
+  static std::list<T> take(std::list<T>& values){
+	std::list<T> taken;
+	taken.swap(values);
+	return taken;
+  }
 }
 
-%define parse.assert
+//Semantic values are typed variants rather than a union of raw
+// pointers. Lists live in the value itself and are moved up the
+// stack as they grow. Bison runs the %destructors below on every
+// value it pops, so actions take() what they use, and whatever
+// is still on the stack when a parse fails is freed: a syntax
+// error doesn't leak the partial tree. (A finished program is
+// left to the caller, so ProgramNode * has no %destructor.)
+%define api.value.type variant
+
+%destructor { delete $$; } <drewno_mars::DeclNode *>
+%destructor { delete $$; } <drewno_mars::VarDeclNode *>
+%destructor { delete $$; } <drewno_mars::ClassDefnNode *>
+%destructor { delete $$; } <drewno_mars::FnDeclNode *>
+%destructor { delete $$; } <drewno_mars::FormalDeclNode *>
+%destructor { delete $$; } <drewno_mars::TypeNode *>
+%destructor { delete $$; } <drewno_mars::StmtNode *>
+%destructor { delete $$; } <drewno_mars::ExpNode *>
+%destructor { delete $$; } <drewno_mars::CallExpNode *>
+%destructor { delete $$; } <drewno_mars::LocNode *>
+%destructor { delete $$; } <drewno_mars::IDNode *>
+%destructor { for (auto node : $$){ delete node; } }
+  <std::list<drewno_mars::DeclNode *>>
+  <std::list<drewno_mars::FormalDeclNode *>>
+  <std::list<drewno_mars::StmtNode *>>
+  <std::list<drewno_mars::ExpNode *>>
 
 %token                   END	   0 "end file"
-%token	<transToken>     AND
-%token	<transToken>     ASSIGN
-%token	<transToken>     BOOL
-%token	<transToken>     COLON
-%token	<transToken>     COMMA
-%token	<transToken>     CLASS
-%token	<transToken>     DASH
-%token	<transToken>     ELSE
-%token	<transToken>     EXIT
-%token	<transToken>     EQUALS
-%token	<transToken>     FALSE
-%token	<transToken>     GIVE
-%token	<transToken>     GREATER
-%token	<transToken>     GREATEREQ
-%token	<transIDToken>   ID
-%token	<transToken>     IF
-%token	<transToken>     INT
-%token	<transIntToken>  INTLITERAL
-%token	<transToken>     LCURLY
-%token	<transToken>     LESS
-%token	<transToken>     LESSEQ
-%token	<transToken>     LPAREN
-%token	<transToken>     MAGIC
-%token	<transToken>     NOT
-%token	<transToken>     NOTEQUALS
-%token	<transToken>     OR
-%token	<transToken>     PERFECT
-%token	<transToken>     CROSS
-%token	<transToken>     POSTDEC
-%token	<transToken>     POSTINC
-%token	<transToken>     RETURN
-%token	<transToken>     RCURLY
-%token	<transToken>     RPAREN
-%token	<transToken>     SEMICOL
-%token	<transToken>     SLASH
-%token	<transToken>     STAR
-%token	<transStrToken>  STRINGLITERAL
-%token	<transToken>     TAKE
-%token	<transToken>     TRUE
-%token	<transToken>     VOID
-%token	<transToken>     WHILE
-
-%type <transProgram> program
-%type <transDeclList> globals
-%type <transDecl> decl
-%type <transVarDecl> varDecl
-%type <transClassDefn> classDecl
-%type <transClassBody> classBody
-%type <transFn> fnDecl
-%type <transExp> term
-%type <transExp> exp
-%type <transActuals> actualsList
-%type <transCallExp> callExp
-%type <transID> id
-%type <transLoc> loc
-%type <transStmt> stmt
-%type <transStmt> blockStmt
-%type <transStmts> stmtList
-%type <transType> type
-%type <transFormal> formalDecl
-%type <transFormalList> formals
-%type <transFormalList> formalsList
-%type <transType> primType
+%token	<drewno_mars::Token *> AND
+%token	<drewno_mars::Token *> ASSIGN
+%token	<drewno_mars::Token *> BOOL
+%token	<drewno_mars::Token *> COLON
+%token	<drewno_mars::Token *> COMMA
+%token	<drewno_mars::Token *> CLASS
+%token	<drewno_mars::Token *> DASH
+%token	<drewno_mars::Token *> ELSE
+%token	<drewno_mars::Token *> EXIT
+%token	<drewno_mars::Token *> EQUALS
+%token	<drewno_mars::Token *> FALSE
+%token	<drewno_mars::Token *> GIVE
+%token	<drewno_mars::Token *> GREATER
+%token	<drewno_mars::Token *> GREATEREQ
+%token	<drewno_mars::Token *> ID
+%token	<drewno_mars::Token *> IF
+%token	<drewno_mars::Token *> INT
+%token	<drewno_mars::Token *> INTLITERAL
+%token	<drewno_mars::Token *> LCURLY
+%token	<drewno_mars::Token *> LESS
+%token	<drewno_mars::Token *> LESSEQ
+%token	<drewno_mars::Token *> LPAREN
+%token	<drewno_mars::Token *> MAGIC
+%token	<drewno_mars::Token *> NOT
+%token	<drewno_mars::Token *> NOTEQUALS
+%token	<drewno_mars::Token *> OR
+%token	<drewno_mars::Token *> PERFECT
+%token	<drewno_mars::Token *> CROSS
+%token	<drewno_mars::Token *> POSTDEC
+%token	<drewno_mars::Token *> POSTINC
+%token	<drewno_mars::Token *> RETURN
+%token	<drewno_mars::Token *> RCURLY
+%token	<drewno_mars::Token *> RPAREN
+%token	<drewno_mars::Token *> SEMICOL
+%token	<drewno_mars::Token *> SLASH
+%token	<drewno_mars::Token *> STAR
+%token	<drewno_mars::Token *> STRINGLITERAL
+%token	<drewno_mars::Token *> TAKE
+%token	<drewno_mars::Token *> TRUE
+%token	<drewno_mars::Token *> VOID
+%token	<drewno_mars::Token *> WHILE
+
+%type <drewno_mars::ProgramNode *> program
+%type <std::list<drewno_mars::DeclNode *>> globals
+%type <drewno_mars::DeclNode *> decl
+%type <drewno_mars::VarDeclNode *> varDecl
+%type <drewno_mars::ClassDefnNode *> classDecl
+%type <std::list<drewno_mars::DeclNode *>> classBody
+%type <drewno_mars::FnDeclNode *> fnDecl
+%type <drewno_mars::ExpNode *> term
+%type <drewno_mars::ExpNode *> exp
+%type <std::list<drewno_mars::ExpNode *>> actualsList
+%type <drewno_mars::CallExpNode *> callExp
+%type <drewno_mars::IDNode *> id
+%type <drewno_mars::LocNode *> loc
+%type <drewno_mars::StmtNode *> stmt
+%type <drewno_mars::StmtNode *> blockStmt
+%type <std::list<drewno_mars::StmtNode *>> stmtList
+%type <drewno_mars::TypeNode *> type
+%type <drewno_mars::FormalDeclNode *> formalDecl
+%type <std::list<drewno_mars::FormalDeclNode *>> formals
+%type <std::list<drewno_mars::FormalDeclNode *>> formalsList
+%type <drewno_mars::TypeNode *> primType
 
 /* NOTE: Make sure to add precedence and associativity 
  * declarations
@@ -160,63 +173,72 @@
 
 program 	: globals
 		  {
-		  $$ = new ProgramNode($1);
+		  $$ = new ProgramNode(take($1));
 		  *root = $$;
 		  }
 
 globals 	: globals decl
 	  	  { 
-		  $$ = $1;
-		  DeclNode * declNode = $2;
-		  $$->push_back(declNode);
+		  $$ = take($1);
+		  DeclNode * declNode = take($2);
+		  if (sink == nullptr){
+		    $$.push_back(declNode);
+		  } else {
+		    //Nothing refers to the tokens of a finished
+		    // declaration any more
+		    sink->accept(declNode);
+		    scanner.releaseTokens();
+		  }
 	  	  }
 		| /* epsilon */
 		  {
-		  $$ = new std::list<DeclNode *>();
+		  $$ = std::list<DeclNode *>();
 		  }
 
 decl 		: varDecl SEMICOL 
 		  { 
-		  $$ = $1;
+		  $$ = take($1);
 		  }
  		| classDecl
 		  { 
-		  $$ = $1;
+		  $$ = take($1);
 		  }
  		| fnDecl 
 		  {
-		  $$ = $1;
+		  $$ = take($1);
 		  }
 
 varDecl 	: id COLON type
 		  {
-		  Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new VarDeclNode(p,$1, $3, nullptr);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new VarDeclNode(&p,take($1), take($3), nullptr);
 		  }
 		| id COLON type ASSIGN exp
 		  {
-		  Position * p = new Position($1->pos(), $5->pos());
-		  $$ = new VarDeclNode(p,$1, $3, $5);
+		  Position p($1->pos(), $5->pos());
+		  $$ = new VarDeclNode(&p,take($1), take($3), take($5));
 		  }
 
 type		: primType
 		  {
-		  $$ = $1;
+		  $$ = take($1);
 		  }
 		| id
 		  {
-		  $$ = new ClassTypeNode($1->pos(), $1);
+		  IDNode * name = take($1);
+		  $$ = new ClassTypeNode(name->pos(), name);
 		  }
 		| PERFECT primType
 		  {
-		  Position * p = new Position($1->pos(), $2->pos());
-		  $$ = new PerfectTypeNode(p, $2);
+		  Position p($1->pos(), $2->pos());
+		  $$ = new PerfectTypeNode(&p, take($2));
 		  }
 		| PERFECT id
 		  {
-		  Position * p = new Position($1->pos(), $2->pos());
-		  ClassTypeNode * c = new ClassTypeNode($2->pos(), $2);
-		  $$ = new PerfectTypeNode(p, c);
+		  Position p($1->pos(), $2->pos());
+		  IDNode * name = take($2);
+		  ClassTypeNode * c = new ClassTypeNode(name->pos(), name);
+		  $$ = new PerfectTypeNode(&p, c);
 		  }
 
 primType 	: INT
@@ -234,121 +256,120 @@ primType 	: INT
 
 classDecl	: id COLON CLASS LCURLY classBody RCURLY SEMICOL
 		  {
-		  Position * p = new Position($1->pos(), $7->pos());
-		  $$ = new ClassDefnNode(p, $1, $5);
+		  Position p($1->pos(), $7->pos());
+		  $$ = new ClassDefnNode(&p, take($1), take($5));
 		  }
 
 classBody	: classBody varDecl SEMICOL
 		  {
-		  $$ = $1;
-		  $$->push_back($2);
+		  $$ = take($1);
+		  $$.push_back(take($2));
 		  }
 		| classBody fnDecl
 		  {
-		  $$ = $1;
-		  $$->push_back($2);
+		  $$ = take($1);
+		  $$.push_back(take($2));
 		  }
 		| /* epsilon */
 		  {
-		  $$ = new std::list<DeclNode *>();
+		  $$ = std::list<DeclNode *>();
 		  }
 
 fnDecl  : id COLON LPAREN formals RPAREN type LCURLY stmtList RCURLY
 		  {
-		  auto pos = new Position($1->pos(), $9->pos());
-		  $$ = new FnDeclNode(pos, $1, $4, $6, $8);
+		  Position pos($1->pos(), $9->pos());
+		  $$ = new FnDeclNode(&pos, take($1), take($4), take($6), take($8));
 		  }
 
 formals 	: /* epsilon */
 		  {
-		  $$ = new std::list<drewno_mars::FormalDeclNode *>();
+		  $$ = std::list<FormalDeclNode *>();
 		  }
 		| formalsList
 		  {
-		  $$ = $1;
+		  $$ = take($1);
 		  }
 
 formalsList 	: formalDecl
 		  {
-		  $$ = new std::list<FormalDeclNode *>();
-		  $$->push_back($1);
+		  $$.push_back(take($1));
 		  }
 		| formalsList COMMA formalDecl
 		  {
-		  $$ = $1;
-		  $$->push_back($3);
+		  $$ = take($1);
+		  $$.push_back(take($3));
 		  }
 
 formalDecl 	: id COLON type
 		  {
-		  const Position * pos = new Position($1->pos(), $2->pos());
-		  $$ = new FormalDeclNode(pos, $1, $3);
+		  Position pos($1->pos(), $2->pos());
+		  $$ = new FormalDeclNode(&pos, take($1), take($3));
 		  }
 
 stmtList 	: /* epsilon */
 	   	  {
-		  $$ = new std::list<StmtNode *>();
+		  $$ = std::list<StmtNode *>();
 	   	  }
 		| stmtList stmt SEMICOL
 	  	  {
-		  $$ = $1;
-		  $$->push_back($2);
+		  $$ = take($1);
+		  $$.push_back(take($2));
 	  	  }
 		| stmtList blockStmt
 	  	  {
-		  $$ = $1;
-		  $$->push_back($2);
+		  $$ = take($1);
+		  $$.push_back(take($2));
 	  	  }
 
 blockStmt	: WHILE LPAREN exp RPAREN LCURLY stmtList RCURLY
 		  {
-		  const Position * p = new Position($1->pos(), $7->pos());
-		  $$ = new WhileStmtNode(p, $3, $6);
+		  Position p($1->pos(), $7->pos());
+		  $$ = new WhileStmtNode(&p, take($3), take($6));
 		  }
 		| IF LPAREN exp RPAREN LCURLY stmtList RCURLY
 		  {
-		  const Position * p = new Position($1->pos(), $7->pos());
-		  $$ = new IfStmtNode(p, $3, $6);
+		  Position p($1->pos(), $7->pos());
+		  $$ = new IfStmtNode(&p, take($3), take($6));
 		  }
 		| IF LPAREN exp RPAREN LCURLY stmtList RCURLY ELSE LCURLY stmtList RCURLY
 		  {
-		  const Position * p = new Position($1->pos(), $11->pos());
-		  $$ = new IfElseStmtNode(p, $3, $6, $10);
+		  Position p($1->pos(), $11->pos());
+		  $$ = new IfElseStmtNode(&p, take($3), take($6), take($10));
 		  }
 
 stmt		: varDecl
 		  {
-		  $$ = $1;
+		  $$ = take($1);
 		  }
 		| loc ASSIGN exp
 		  {
-		  const auto p = new Position($1->pos(), $3->pos());
-		  $$ = new AssignStmtNode(p, $1, $3); 
+		  Position p($1->pos(), $3->pos());
+		  $$ = new AssignStmtNode(&p, take($1), take($3)); 
 		  }
 		| loc POSTDEC
 		  {
-		  const Position * p = new Position($1->pos(), $2->pos());
-		  $$ = new PostDecStmtNode(p, $1);
+		  Position p($1->pos(), $2->pos());
+		  $$ = new PostDecStmtNode(&p, take($1));
 		  }
 		| loc POSTINC
 		  {
-		  const Position * p = new Position($1->pos(), $2->pos());
-		  $$ = new PostIncStmtNode(p, $1);
+		  Position p($1->pos(), $2->pos());
+		  $$ = new PostIncStmtNode(&p, take($1));
 		  }
 		| GIVE exp
 		  {
-		  const Position * p = new Position($1->pos(), $2->pos());
-		  $$ = new GiveStmtNode(p, $2);
+		  Position p($1->pos(), $2->pos());
+		  $$ = new GiveStmtNode(&p, take($2));
 		  }
 		| TAKE loc
 		  {
-		  const Position * p = new Position($1->pos(), $2->pos());
-		  $$ = new TakeStmtNode(p, $2);
+		  Position p($1->pos(), $2->pos());
+		  $$ = new TakeStmtNode(&p, take($2));
 		  }
 		| RETURN exp
 		  {
-		  const Position * p = new Position($1->pos(), $2->pos());
-		  $$ = new ReturnStmtNode(p, $2);
+		  Position p($1->pos(), $2->pos());
+		  $$ = new ReturnStmtNode(&p, take($2));
 		  }
 		| RETURN
 		  {
@@ -360,114 +381,116 @@ stmt		: varDecl
 		  }
 		| callExp
 		  { 
-		  $$ = new CallStmtNode($1->pos(), $1); 
+		  CallExpNode * call = take($1);
+		  $$ = new CallStmtNode(call->pos(), call);
 		  }
 
 exp		: exp DASH exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new MinusNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new MinusNode(&p, take($1), take($3));
 		  }
 		| exp CROSS exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new PlusNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new PlusNode(&p, take($1), take($3));
 		  }
 		| exp STAR exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new TimesNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new TimesNode(&p, take($1), take($3));
 		  }
 		| exp SLASH exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new DivideNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new DivideNode(&p, take($1), take($3));
 		  }
 		| exp AND exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new AndNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new AndNode(&p, take($1), take($3));
 		  }
 		| exp OR exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new OrNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new OrNode(&p, take($1), take($3));
 		  }
 		| exp EQUALS exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new EqualsNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new EqualsNode(&p, take($1), take($3));
 		  }
 		| exp NOTEQUALS exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new NotEqualsNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new NotEqualsNode(&p, take($1), take($3));
 		  }
 		| exp GREATER exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new GreaterNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new GreaterNode(&p, take($1), take($3));
 		  }
 		| exp GREATEREQ exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new GreaterEqNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new GreaterEqNode(&p, take($1), take($3));
 		  }
 		| exp LESS exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new LessNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new LessNode(&p, take($1), take($3));
 		  }
 		| exp LESSEQ exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new LessEqNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new LessEqNode(&p, take($1), take($3));
 		  }
 		| NOT exp
 	  	  {
-		  const Position * p = new Position($1->pos(), $2->pos());
-		  $$ = new NotNode(p, $2);
+		  Position p($1->pos(), $2->pos());
+		  $$ = new NotNode(&p, take($2));
 		  }
 		| DASH term
 	  	  {
-		  const Position * p = new Position($1->pos(), $2->pos());
-		  $$ = new NegNode(p, $2);
+		  Position p($1->pos(), $2->pos());
+		  $$ = new NegNode(&p, take($2));
 		  }
 		| term
-	  	  { $$ = $1; }
+	  	  { $$ = take($1); }
 
 callExp		: loc LPAREN RPAREN
 		  {
-		  const Position * p = new Position($1->pos(), $3->pos());
-		  std::list<ExpNode *> * noargs =
-		    new std::list<ExpNode *>();
-		  $$ = new CallExpNode(p, $1, noargs);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new CallExpNode(&p, take($1), std::list<ExpNode *>());
 		  }
 		| loc LPAREN actualsList RPAREN
 		  {
-		  const Position * p = new Position($1->pos(), $4->pos());
-		  $$ = new CallExpNode(p, $1, $3);
+		  Position p($1->pos(), $4->pos());
+		  $$ = new CallExpNode(&p, take($1), take($3));
 		  }
 
 actualsList	: exp
 		  {
-		  std::list<ExpNode *> * list =
-		    new std::list<ExpNode *>();
-		  list->push_back($1);
-		  $$ = list;
+		  $$.push_back(take($1));
 		  }
 		| actualsList COMMA exp
 		  {
-		  $$ = $1;
-		  $$->push_back($3);
+		  $$ = take($1);
+		  $$.push_back(take($3));
 		  }
 
 term 		: loc
-		  { $$ = $1; }
+		  { $$ = take($1); }
 		| INTLITERAL 
-		  { $$ = new IntLitNode($1->pos(), $1->num()); }
+		  {
+		  IntLitToken * token = static_cast<IntLitToken *>($1);
+		  $$ = new IntLitNode(token->pos(), token->num());
+		  }
 		| STRINGLITERAL 
-		  { $$ = new StrLitNode($1->pos(), $1->str()); }
+		  {
+		  StrToken * token = static_cast<StrToken *>($1);
+		  $$ = new StrLitNode(token->pos(), token->str());
+		  }
 		| TRUE
 		  { $$ = new TrueNode($1->pos()); }
 		| FALSE
@@ -475,24 +498,24 @@ term 		: loc
 		| MAGIC
 		  { $$ = new MagicNode($1->pos()); }
 		| LPAREN exp RPAREN
-		  { $$ = $2; }
+		  { $$ = take($2); }
 		| callExp
-		  { $$ = $1; } 
+		  { $$ = take($1); } 
 
 loc		: id
 		  {
-		  $$ = $1;
+		  $$ = take($1);
 		  }
 		| loc POSTDEC id
 		  {
-		  Position * p = new Position($1->pos(), $3->pos());
-		  $$ = new MemberFieldExpNode(p, $1, $3);
+		  Position p($1->pos(), $3->pos());
+		  $$ = new MemberFieldExpNode(&p, take($1), take($3));
 		  }
 
 id		: ID
 		  {
-		  const Position * pos = $1->pos();
-		  $$ = new IDNode(pos, $1->value()); 
+		  IDToken * token = static_cast<IDToken *>($1);
+		  $$ = new IDNode(token->pos(), token->value());
 		  }
 	
 %%
@@ -45,15 +45,32 @@ private:
 	const char * myMsg;
 };
 
+/* Receives reports in place of std::cerr, for callers (such
+   as the incremental compiler) that keep them for later */
+class ReportSink{
+public:
+	virtual ~ReportSink(){ }
+	virtual void report(const Position * pos, const std::string& msg) = 0;
+};
+
 /* This class is used to encapsulate error messages that the 
    user of the compiler will see in cases where the spec wants 
    a specific output format. */
 class Report{
 public:
+	static ReportSink *& sink(){
+		static ReportSink * current = nullptr;
+		return current;
+	}
+
 	static void fatal(
 		const Position * pos,
 		const char * msg
 	){
+		if (sink() != nullptr){
+			sink()->report(pos, msg);
+			return;
+		}
 		std::cerr << "FATAL " 
 		<< pos->span()
 		<< ": " 
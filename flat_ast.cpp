@@ -0,0 +1,140 @@
+#include <functional>
+#include "errors.hpp"
+#include "flat_ast.hpp"
+#include "rebuild.hpp"
+
+namespace drewno_mars{
+
+static const Position noPosition(0, 0, 0, 0);
+
+//Which kinds keep data, rather than children, in first
+static bool hasData(NodeKind kind){
+	return kind == NodeKind::ID || kind == NodeKind::IntLit
+	  || kind == NodeKind::StrLit;
+}
+
+FlatAst::FlatAst(){ }
+
+void FlatAst::accept(DeclNode * decl){
+	myGlobals.push_back(tree(decl));
+	delete decl;
+}
+
+DeclNode * FlatAst::global(size_t i) const{
+	ASTNode * decl = TreeBuilder<View>::build(View(this, myGlobals[i]));
+	return static_cast<DeclNode *>(decl);
+}
+
+Position FlatAst::position() const{
+	if (myGlobals.empty()){ return noPosition; }
+	Position first = View(this, myGlobals.front()).position();
+	Position last = View(this, myGlobals.back()).position();
+	return Position(&first, &last);
+}
+
+void FlatAst::shrink(){
+	myNodes.shrink_to_fit();
+	myEdges.shrink_to_fit();
+	myWide.shrink_to_fit();
+	myText.shrink_to_fit();
+	myGlobals.shrink_to_fit();
+	//Nothing more will be interned
+	std::unordered_multimap<size_t, uint32_t>().swap(myNames);
+}
+
+size_t FlatAst::bytes() const{
+	return myNodes.capacity() * sizeof(Node)
+	  + (myEdges.capacity() + myWide.capacity()
+	  + myGlobals.capacity()) * sizeof(uint32_t)
+	  + myText.capacity();
+}
+
+uint32_t FlatAst::node(NodeKind kind, const Position * pos,
+  const std::vector<uint32_t>& children, uint32_t data, SemSymbol * symbol){
+	if (myNodes.size() >= NO_NODE || myEdges.size() > NO_NODE - children.size()){
+		throw new InternalError("Program too big for a flat AST");
+	}
+	if (pos == nullptr){ pos = &noPosition; }
+	Node node;
+	node.kind = kind;
+	node.flags = 0;
+	if (pos->colBegin() > 0xffff || pos->colEnd() > 0xffff
+	  || pos->lineBegin() > 0xffffffff
+	  || pos->lineEnd() - pos->lineBegin() > 0xffff){
+		node.flags |= WIDE;
+		node.lines = 0;
+		node.line = static_cast<uint32_t>(myWide.size());
+		node.columns = 0;
+		myWide.push_back(static_cast<uint32_t>(pos->lineBegin()));
+		myWide.push_back(static_cast<uint32_t>(pos->colBegin()));
+		myWide.push_back(static_cast<uint32_t>(pos->lineEnd()));
+		myWide.push_back(static_cast<uint32_t>(pos->colEnd()));
+	} else {
+		node.lines = static_cast<uint16_t>(pos->lineEnd() - pos->lineBegin());
+		node.line = static_cast<uint32_t>(pos->lineBegin());
+		node.columns = static_cast<uint32_t>(pos->colBegin()
+		  | pos->colEnd() << 16);
+	}
+	if (hasData(kind)){
+		node.first = data;
+		node.count = 0;
+	} else {
+		node.first = static_cast<uint32_t>(myEdges.size());
+		node.count = static_cast<uint32_t>(children.size());
+		myEdges.insert(myEdges.end(), children.begin(), children.end());
+	}
+	myNodes.push_back(node);
+	return static_cast<uint32_t>(myNodes.size() - 1);
+}
+
+uint32_t FlatAst::name(const std::string& str){
+	size_t hash = std::hash<std::string>()(str);
+	auto range = myNames.equal_range(hash);
+	for (auto found = range.first; found != range.second; ++found){
+		if (str.compare(&myText[found->second]) == 0){
+			return found->second;
+		}
+	}
+	uint32_t at = static_cast<uint32_t>(myText.size());
+	myText.insert(myText.end(), str.begin(), str.end());
+	myText.push_back('\0');
+	myNames.insert(std::make_pair(hash, at));
+	return at;
+}
+
+size_t FlatAst::View::childCount() const{
+	return node().count;
+}
+
+bool FlatAst::View::hasChild(size_t i) const{
+	return i < node().count && myAst->myEdges[node().first + i] != NO_NODE;
+}
+
+FlatAst::View FlatAst::View::child(size_t i) const{
+	if (!hasChild(i)){ corrupt(); }
+	return View(myAst, myAst->myEdges[node().first + i]);
+}
+
+const char * FlatAst::View::name() const{
+	return &myAst->myText[node().first];
+}
+
+int FlatAst::View::intValue() const{
+	return static_cast<int>(node().first);
+}
+
+Position FlatAst::View::position() const{
+	const Node& n = node();
+	if (n.flags & WIDE){
+		const uint32_t * wide = &myAst->myWide[n.line];
+		return Position(wide[0], wide[1], wide[2], wide[3]);
+	}
+	return Position(n.line, n.columns & 0xffff, n.line + n.lines,
+	  n.columns >> 16);
+}
+
+void FlatAst::View::corrupt(){
+	throw new InternalError("Malformed flat AST");
+}
+
+}
@@ -0,0 +1,109 @@
+#ifndef DREWNO_MARS_FLAT_AST_HPP
+#define DREWNO_MARS_FLAT_AST_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.hpp"
+#include "stream.hpp"
+
+namespace drewno_mars{
+
+//A whole program held flat (see -f), in a few contiguous
+// arrays rather than an allocation per node, list and name:
+//
+// nodes:  kind(8) flags(8) end line - line(16), line, column
+//         and end column (16 bits each), then either the index
+//         in edges of the node's first child and how many it
+//         has, or its data (as in a binary AST record: an
+//         interned name or string, or an int). 20 bytes a node.
+//         If the location doesn't fit (WIDE), line is instead
+//         the index in wide of line, column, end line and end
+//         column.
+// edges:  child node indices, children before parents (NO_NODE
+//         for an absent child). Lists are List nodes with their
+//         items as children, as in a binary AST.
+// text:   interned names and strings, NUL-terminated
+//
+//Nodes are added a global declaration at a time, as the
+// parser finishes each one (FlatAst is a DeclSink), so the
+// pointer tree for more than one never exists at once. Passes
+// run over the program by rebuilding one declaration at a time
+// (global), which is cheap next to what they do with it.
+class FlatAst : public DeclSink{
+	struct Node;
+public:
+	static const uint32_t NO_NODE = 0xffffffff;
+
+	//A node, as TreeBuilder (see rebuild.hpp) reads it
+	class View{
+	public:
+		View(const FlatAst * ast, uint32_t index)
+		: myAst(ast), myIndex(index){ }
+		NodeKind kind() const{ return node().kind; }
+		size_t childCount() const;
+		bool hasChild(size_t i) const;
+		View child(size_t i) const;
+		const char * name() const;
+		int intValue() const;
+		Position position() const;
+		static void corrupt();
+	private:
+		const Node& node() const{ return myAst->myNodes[myIndex]; }
+		const FlatAst * myAst;
+		uint32_t myIndex;
+	};
+
+	FlatAst();
+	//Take a global declaration, and free it
+	void accept(DeclNode * decl) override;
+
+	size_t globalCount() const{ return myGlobals.size(); }
+	//A fresh copy of the i'th global declaration, for the
+	// caller to free
+	DeclNode * global(size_t i) const;
+	//Where the program spans, as ProgramNode has it
+	Position position() const;
+
+	//Give back the arrays' spare room, once the program is in
+	void shrink();
+
+	size_t nodeCount() const{ return myNodes.size(); }
+	//The bytes the arrays hold
+	size_t bytes() const;
+
+	//Add a subtree, returning its root's index (see
+	// serialize.cpp, which adds it with these)
+	uint32_t tree(ASTNode * root);
+	uint32_t node(NodeKind kind, const Position * pos,
+	  const std::vector<uint32_t>& children,
+	  uint32_t data = 0, SemSymbol * symbol = nullptr);
+	uint32_t name(const std::string& str);
+
+private:
+	//Node::flags
+	static const unsigned char WIDE = 1;
+
+	struct Node{
+		NodeKind kind;
+		unsigned char flags;
+		uint16_t lines;
+		uint32_t line;
+		uint32_t columns;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	std::vector<Node> myNodes;
+	std::vector<uint32_t> myEdges;
+	std::vector<uint32_t> myWide;
+	std::vector<char> myText;
+	//Each interned string's offset in myText, by its hash
+	std::unordered_multimap<size_t, uint32_t> myNames;
+	std::vector<uint32_t> myGlobals;
+};
+
+}
+
+#endif
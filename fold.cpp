@@ -0,0 +1,362 @@
+#include <cstdint>
+#include "fold.hpp"
+#include "symbol_table.hpp"
+#include "visitor.hpp"
+
+namespace drewno_mars{
+
+//What an expression is known to be before lowering looks at
+// it: an int, a bool, or (an object, a string, what a method
+// returns) neither
+enum class Sort{ Int, Bool, Unknown };
+
+static Sort sortOf(std::string type){
+	if (type.compare(0, 8, "perfect ") == 0){ type = type.substr(8); }
+	if (type == "int"){ return Sort::Int; }
+	if (type == "bool"){ return Sort::Bool; }
+	return Sort::Unknown;
+}
+
+static Sort sortOf(ExpNode * exp){
+	switch (exp->kind()){
+	case NodeKind::IntLit: case NodeKind::Plus: case NodeKind::Minus:
+	case NodeKind::Times: case NodeKind::Divide: case NodeKind::Neg:
+		return Sort::Int;
+	case NodeKind::True: case NodeKind::False: case NodeKind::Magic:
+	case NodeKind::And: case NodeKind::Or: case NodeKind::Not:
+	case NodeKind::Equals: case NodeKind::NotEquals: case NodeKind::Less:
+	case NodeKind::LessEq: case NodeKind::Greater: case NodeKind::GreaterEq:
+		return Sort::Bool;
+	case NodeKind::ID: {
+		SemSymbol * symbol = static_cast<IDNode *>(exp)->getSymbol();
+		if (symbol == nullptr || symbol->getKind() != "var"){
+			return Sort::Unknown;
+		}
+		return sortOf(symbol->getType());
+	}
+	case NodeKind::CallExp: {
+		//A function's type is (formals)->return type (a method's
+		// symbol isn't to hand)
+		LocNode * callee = static_cast<CallExpNode *>(exp)->getCallee();
+		if (callee->kind() != NodeKind::ID){ return Sort::Unknown; }
+		SemSymbol * symbol = callee->getSymbol();
+		if (symbol == nullptr || symbol->getKind() != "fn"){
+			return Sort::Unknown;
+		}
+		std::string type = symbol->getType();
+		return sortOf(type.substr(type.rfind("->") + 2));
+	}
+	default:
+		return Sort::Unknown;
+	}
+}
+
+static bool intLit(ExpNode * exp, int32_t& value){
+	if (exp->kind() != NodeKind::IntLit){ return false; }
+	value = static_cast<IntLitNode *>(exp)->getNum();
+	return true;
+}
+
+static bool isInt(ExpNode * exp, int32_t value){
+	int32_t num = 0;
+	return intLit(exp, num) && num == value;
+}
+
+static bool boolLit(ExpNode * exp, bool& value){
+	if (exp->kind() == NodeKind::True){
+		value = true;
+		return true;
+	}
+	if (exp->kind() == NodeKind::False){
+		value = false;
+		return true;
+	}
+	return false;
+}
+
+//The low 32 bits of value, as the runtime's ints keep
+static int32_t wrap(int64_t value){
+	return static_cast<int32_t>(static_cast<uint32_t>(
+	  static_cast<uint64_t>(value)));
+}
+
+//Simplifies each node's operands on the way back up, so that
+// they are simplified before what they are operands of, and
+// prunes each statement list once the conditions in it are
+class Folder : public AstWalker<Folder>{
+public:
+	Folder(size_t& folded, size_t& pruned)
+	: myFolded(folded), myPruned(pruned){ }
+
+	void post(ASTNode * node){
+		switch (node->kind()){
+		case NodeKind::VarDecl: {
+			VarDeclNode * decl = static_cast<VarDeclNode *>(node);
+			if (decl->getInit() != nullptr){
+				decl->setInit(simplify(decl->getInit()));
+			}
+			break;
+		}
+		case NodeKind::FnDecl:
+			prune(*static_cast<FnDeclNode *>(node)->getBody());
+			break;
+		case NodeKind::AssignStmt: {
+			AssignStmtNode * stmt = static_cast<AssignStmtNode *>(node);
+			stmt->setSrc(simplify(stmt->getSrc()));
+			break;
+		}
+		case NodeKind::GiveStmt: {
+			GiveStmtNode * stmt = static_cast<GiveStmtNode *>(node);
+			stmt->setSrc(simplify(stmt->getSrc()));
+			break;
+		}
+		case NodeKind::ReturnStmt: {
+			ReturnStmtNode * stmt = static_cast<ReturnStmtNode *>(node);
+			if (stmt->getExp() != nullptr){
+				stmt->setExp(simplify(stmt->getExp()));
+			}
+			break;
+		}
+		case NodeKind::IfStmt: {
+			IfStmtNode * stmt = static_cast<IfStmtNode *>(node);
+			stmt->setCond(simplify(stmt->getCond()));
+			prune(*stmt->getBody());
+			break;
+		}
+		case NodeKind::IfElseStmt: {
+			IfElseStmtNode * stmt = static_cast<IfElseStmtNode *>(node);
+			stmt->setCond(simplify(stmt->getCond()));
+			prune(*stmt->getBodyTrue());
+			prune(*stmt->getBodyFalse());
+			break;
+		}
+		case NodeKind::WhileStmt: {
+			WhileStmtNode * stmt = static_cast<WhileStmtNode *>(node);
+			stmt->setCond(simplify(stmt->getCond()));
+			prune(*stmt->getBody());
+			break;
+		}
+		case NodeKind::CallExp:
+			for (ExpNode *& arg : *static_cast<CallExpNode *>(node)->getArgs()){
+				arg = simplify(arg);
+			}
+			break;
+		case NodeKind::Plus: case NodeKind::Minus: case NodeKind::Times:
+		case NodeKind::Divide: case NodeKind::And: case NodeKind::Or:
+		case NodeKind::Equals: case NodeKind::NotEquals: case NodeKind::Less:
+		case NodeKind::LessEq: case NodeKind::Greater: case NodeKind::GreaterEq: {
+			BinaryExpNode * exp = static_cast<BinaryExpNode *>(node);
+			exp->setExp1(simplify(exp->getExp1()));
+			exp->setExp2(simplify(exp->getExp2()));
+			break;
+		}
+		case NodeKind::Neg: case NodeKind::Not: {
+			UnaryExpNode * exp = static_cast<UnaryExpNode *>(node);
+			exp->setExp(simplify(exp->getExp()));
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+private:
+	//What exp (whose operands are simplified) simplifies to:
+	// exp itself, or what replaced it (exp then being deleted)
+	ExpNode * simplify(ExpNode * exp){
+		switch (exp->kind()){
+		case NodeKind::Plus: case NodeKind::Minus: case NodeKind::Times:
+		case NodeKind::Divide: case NodeKind::And: case NodeKind::Or:
+		case NodeKind::Equals: case NodeKind::NotEquals: case NodeKind::Less:
+		case NodeKind::LessEq: case NodeKind::Greater: case NodeKind::GreaterEq:
+			return binary(static_cast<BinaryExpNode *>(exp));
+		case NodeKind::Neg: case NodeKind::Not:
+			return unary(static_cast<UnaryExpNode *>(exp));
+		default:
+			return exp;
+		}
+	}
+
+	ExpNode * binary(BinaryExpNode * exp){
+		ExpNode * lhs = exp->getExp1();
+		ExpNode * rhs = exp->getExp2();
+		int64_t a;
+		int64_t b;
+		int32_t l;
+		int32_t r;
+		if (intLit(lhs, l) && intLit(rhs, r)){
+			a = l;
+			b = r;
+			switch (exp->kind()){
+			case NodeKind::Plus: return intResult(exp, wrap(a + b));
+			case NodeKind::Minus: return intResult(exp, wrap(a - b));
+			case NodeKind::Times: return intResult(exp, wrap(a * b));
+			case NodeKind::Divide:
+				if (b == 0){ return exp; }
+				return intResult(exp, wrap(a / b));
+			case NodeKind::Equals: return boolResult(exp, a == b);
+			case NodeKind::NotEquals: return boolResult(exp, a != b);
+			case NodeKind::Less: return boolResult(exp, a < b);
+			case NodeKind::LessEq: return boolResult(exp, a <= b);
+			case NodeKind::Greater: return boolResult(exp, a > b);
+			case NodeKind::GreaterEq: return boolResult(exp, a >= b);
+			default: return exp;
+			}
+		}
+		bool p;
+		bool q;
+		if (boolLit(lhs, p) && boolLit(rhs, q)){
+			switch (exp->kind()){
+			case NodeKind::And: return boolResult(exp, p && q);
+			case NodeKind::Or: return boolResult(exp, p || q);
+			case NodeKind::Equals: return boolResult(exp, p == q);
+			case NodeKind::NotEquals: return boolResult(exp, p != q);
+			default: return exp;
+			}
+		}
+
+		switch (exp->kind()){
+		case NodeKind::Plus:
+			if (isInt(rhs, 0) && sortOf(lhs) == Sort::Int){ return keepLeft(exp); }
+			if (isInt(lhs, 0) && sortOf(rhs) == Sort::Int){ return keepRight(exp); }
+			break;
+		case NodeKind::Minus:
+			if (isInt(rhs, 0) && sortOf(lhs) == Sort::Int){ return keepLeft(exp); }
+			break;
+		case NodeKind::Times:
+			if (isInt(rhs, 1) && sortOf(lhs) == Sort::Int){ return keepLeft(exp); }
+			if (isInt(lhs, 1) && sortOf(rhs) == Sort::Int){ return keepRight(exp); }
+			break;
+		case NodeKind::Divide:
+			if (isInt(rhs, 1) && sortOf(lhs) == Sort::Int){ return keepLeft(exp); }
+			break;
+		case NodeKind::And:
+			//The right of an and is only evaluated if the left is
+			// true, so false and anything is false
+			if (boolLit(lhs, p)){
+				if (!p){ return boolResult(exp, false); }
+				if (sortOf(rhs) == Sort::Bool){ return keepRight(exp); }
+			}
+			if (boolLit(rhs, q) && q && sortOf(lhs) == Sort::Bool){
+				return keepLeft(exp);
+			}
+			break;
+		case NodeKind::Or:
+			if (boolLit(lhs, p)){
+				if (p){ return boolResult(exp, true); }
+				if (sortOf(rhs) == Sort::Bool){ return keepRight(exp); }
+			}
+			if (boolLit(rhs, q) && !q && sortOf(lhs) == Sort::Bool){
+				return keepLeft(exp);
+			}
+			break;
+		default:
+			break;
+		}
+		return exp;
+	}
+
+	ExpNode * unary(UnaryExpNode * exp){
+		ExpNode * operand = exp->getExp();
+		int32_t num;
+		bool val;
+		if (exp->kind() == NodeKind::Neg){
+			if (intLit(operand, num)){
+				return intResult(exp, wrap(-static_cast<int64_t>(num)));
+			}
+		} else if (boolLit(operand, val)){
+			return boolResult(exp, !val);
+		}
+		//--x is x, and !!b is b
+		if (operand->kind() != exp->kind()){ return exp; }
+		UnaryExpNode * inner = static_cast<UnaryExpNode *>(operand);
+		Sort sort = exp->kind() == NodeKind::Neg ? Sort::Int : Sort::Bool;
+		if (sortOf(inner->getExp()) != sort){ return exp; }
+		ExpNode * kept = inner->getExp();
+		inner->setExp(nullptr);
+		return replace(exp, kept);
+	}
+
+	ExpNode * keepLeft(BinaryExpNode * exp){
+		ExpNode * kept = exp->getExp1();
+		exp->setExp1(nullptr);
+		return replace(exp, kept);
+	}
+
+	ExpNode * keepRight(BinaryExpNode * exp){
+		ExpNode * kept = exp->getExp2();
+		exp->setExp2(nullptr);
+		return replace(exp, kept);
+	}
+
+	ExpNode * intResult(ExpNode * exp, int32_t value){
+		return replace(exp, new IntLitNode(exp->pos(), value));
+	}
+
+	ExpNode * boolResult(ExpNode * exp, bool value){
+		if (value){ return replace(exp, new TrueNode(exp->pos())); }
+		return replace(exp, new FalseNode(exp->pos()));
+	}
+
+	ExpNode * replace(ExpNode * exp, ExpNode * with){
+		delete exp;
+		myFolded++;
+		return with;
+	}
+
+	//Replace each if in body whose condition is a literal by the
+	// statements of the branch it takes, and drop each while
+	// whose condition is false
+	void prune(std::list<StmtNode *>& body){
+		auto it = body.begin();
+		while (it != body.end()){
+			StmtNode * stmt = *it;
+			std::list<StmtNode *> * taken = nullptr;
+			bool cond;
+			switch (stmt->kind()){
+			case NodeKind::IfStmt: {
+				IfStmtNode * ifStmt = static_cast<IfStmtNode *>(stmt);
+				if (!boolLit(ifStmt->getCond(), cond)){
+					++it;
+					continue;
+				}
+				if (cond){ taken = ifStmt->getBody(); }
+				break;
+			}
+			case NodeKind::IfElseStmt: {
+				IfElseStmtNode * ifElse = static_cast<IfElseStmtNode *>(stmt);
+				if (!boolLit(ifElse->getCond(), cond)){
+					++it;
+					continue;
+				}
+				taken = cond ? ifElse->getBodyTrue() : ifElse->getBodyFalse();
+				break;
+			}
+			case NodeKind::WhileStmt:
+				if (!boolLit(static_cast<WhileStmtNode *>(stmt)->getCond(), cond)
+				  || cond){
+					++it;
+					continue;
+				}
+				break;
+			default:
+				++it;
+				continue;
+			}
+			if (taken != nullptr){ body.splice(it, *taken); }
+			it = body.erase(it);
+			delete stmt;
+			myPruned++;
+		}
+	}
+
+	size_t& myFolded;
+	size_t& myPruned;
+};
+
+void ConstantFolder::fold(DeclNode * decl){
+	Folder folder(myFolded, myPruned);
+	folder.walk(decl);
+}
+
+}
@@ -0,0 +1,40 @@
+#ifndef DREWNO_MARS_FOLD_HPP
+#define DREWNO_MARS_FOLD_HPP
+
+#include <cstddef>
+#include "ast.hpp"
+
+//Constant folding and algebraic simplification of name-analysed
+// declarations, done in place just before they are lowered (so
+// -a, -o and -r see it, but -u, -n and -b don't).
+//
+//Operators whose operands are all literals are evaluated, ints
+// wrapping at 32 bits as they do when the program runs, except
+// for a division by zero, which is left to fail at run time.
+// Identities drop an operand that can't change the result (x +
+// 0, x * 1, !!b, true and b, false or b, ...), but only where
+// what is kept is known to be an int (or a bool) already, and
+// what is dropped is a literal or would never be evaluated. An
+// if whose condition folds to a literal is replaced by the
+// branch it takes, and a while whose condition is false goes.
+// Code that is dropped isn't lowered, so a mistake in it (that
+// lowering would have reported) goes unreported.
+namespace drewno_mars{
+
+class ConstantFolder{
+public:
+	ConstantFolder() : myFolded(0), myPruned(0){ }
+	//Simplify decl, deleting the nodes that are folded away
+	void fold(DeclNode * decl);
+	//How many expressions were replaced, and how many ifs and
+	// whiles were replaced by a branch (or nothing)
+	size_t folded() const{ return myFolded; }
+	size_t pruned() const{ return myPruned; }
+private:
+	size_t myFolded;
+	size_t myPruned;
+};
+
+}
+
+#endif
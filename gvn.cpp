@@ -0,0 +1,318 @@
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include "gvn.hpp"
+
+namespace drewno_mars{
+
+GvnCounts& GvnCounts::operator+=(const GvnCounts& other){
+	redundant += other.redundant;
+	dead += other.dead;
+	return *this;
+}
+
+//What an instruction computes: its operation and its operands'
+// numbers, immediates or memory version
+struct GvnKey{
+	uint32_t op;
+	uint32_t x;
+	uint32_t y;
+	uint32_t z;
+	bool operator==(const GvnKey& other) const{
+		return op == other.op && x == other.x && y == other.y && z == other.z;
+	}
+};
+
+//A hash table from keys to values, open addressed and never
+// grown (it is made big enough for each instruction to put a
+// key in it), that forgets what was put in it since a mark,
+// newest first. Taking entries out newest first leaves each
+// older entry's run of probes as it was when it went in.
+class ScopedTable{
+public:
+	explicit ScopedTable(size_t keys){
+		size_t capacity = 16;
+		while (capacity < 2 * keys){ capacity *= 2; }
+		mySlots.resize(capacity);
+		myMask = capacity - 1;
+	}
+
+	//The value key maps to, or IR_NONE
+	uint32_t find(const GvnKey& key) const{
+		return mySlots[probe(key)].value;
+	}
+	//Map key to value, whether or not it mapped to another
+	void put(const GvnKey& key, uint32_t value){
+		size_t at = probe(key);
+		Slot& slot = mySlots[at];
+		myLog.push_back({at, slot.value});
+		slot.key = key;
+		slot.value = value;
+	}
+
+	size_t mark() const{ return myLog.size(); }
+	void restore(size_t mark){
+		while (myLog.size() > mark){
+			mySlots[myLog.back().slot].value = myLog.back().value;
+			myLog.pop_back();
+		}
+	}
+
+private:
+	struct Slot{
+		GvnKey key;
+		uint32_t value = IR_NONE;
+	};
+	struct Undo{
+		size_t slot;
+		uint32_t value;
+	};
+
+	size_t probe(const GvnKey& key) const{
+		size_t at = hash(key) & myMask;
+		while (mySlots[at].value != IR_NONE && !(mySlots[at].key == key)){
+			at = (at + 1) & myMask;
+		}
+		return at;
+	}
+	static size_t hash(const GvnKey& key){
+		uint64_t h = key.op;
+		for (uint32_t part : {key.x, key.y, key.z}){
+			h = (h ^ part) * 0x9e3779b97f4a7c15u;
+			h ^= h >> 32;
+		}
+		return static_cast<size_t>(h);
+	}
+
+	std::vector<Slot> mySlots;
+	std::vector<Undo> myLog;
+	size_t myMask;
+};
+
+//Whether an instruction that computes what an earlier one did
+// is better left to compute it again: loading a constant or an
+// address is no dearer than a move and needs no register kept
+// for it, and the backends fuse a compare into the branch after
+// it
+static bool cheap(IrOp op){
+	return op == IrOp::Const || op == IrOp::GlobalAddr
+	  || op == IrOp::FrameAddr || isCompare(op);
+}
+
+GvnCounts numberValues(IrFunction& fn, const SsaForm& ssa){
+	const uint32_t NONE = IR_NONE;
+	const IrCfg& cfg = ssa.cfg;
+	const DomTree& dom = ssa.dom;
+	const uint32_t regs = fn.regs;
+	const uint32_t blocks = static_cast<uint32_t>(fn.blocks.size());
+	const uint32_t instrs = static_cast<uint32_t>(fn.code.size());
+	GvnCounts counts;
+
+	//Each value's register, and the block that defines it
+	// (IR_NONE for what the registers hold on entry)
+	std::vector<uint32_t> regOf(ssa.values);
+	std::vector<uint32_t> definedIn(ssa.values, NONE);
+	for (uint32_t reg = 0; reg < regs; reg++){ regOf[reg] = reg; }
+	for (const SsaPhi& phi : ssa.phis){
+		regOf[phi.value] = phi.reg;
+		definedIn[phi.value] = phi.block;
+	}
+	for (uint32_t b = 0; b < blocks; b++){
+		for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+			uint32_t v = ssa.defs[i];
+			if (v == NONE){ continue; }
+			regOf[v] = fn.code[i].dst;
+			definedIn[v] = b;
+		}
+	}
+
+	//Where the walk knows what a register holds: everywhere, for
+	// one written once, or read in a block before being written
+	// there (the SSA form puts phis for those), and otherwise
+	// only in the block that wrote it
+	std::vector<bool> known(regs, false);
+	{
+		std::vector<uint32_t> writtenIn(regs, NONE);
+		std::vector<uint32_t> writes(regs, 0);
+		for (uint32_t b : dom.order){
+			for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+				const IrInstr& in = fn.code[i];
+				forEachUse(fn, in, [&](uint32_t reg){
+					if (writtenIn[reg] != b){ known[reg] = true; }
+				});
+				if (in.dst != NONE){
+					writtenIn[in.dst] = b;
+					writes[in.dst]++;
+				}
+			}
+		}
+		for (uint32_t reg = 0; reg < regs; reg++){
+			if (writes[reg] == 1){ known[reg] = true; }
+		}
+	}
+
+	std::vector<uint32_t> number(ssa.values);
+	for (uint32_t v = 0; v < ssa.values; v++){ number[v] = v; }
+	ScopedTable table(instrs);
+	//The value each register holds, put back from the log as the
+	// walk leaves the subtree below the write that replaced it
+	std::vector<uint32_t> current(regs);
+	for (uint32_t reg = 0; reg < regs; reg++){ current[reg] = reg; }
+	std::vector<std::pair<uint32_t, uint32_t>> log;
+	auto define = [&](uint32_t reg, uint32_t value){
+		log.push_back(std::make_pair(reg, current[reg]));
+		current[reg] = value;
+	};
+	//Blocks whose subtrees are still being walked: where each
+	// subtree ends in the preorder, and the table and log as they
+	// were
+	struct Scope{ uint32_t end; size_t table; size_t log; };
+	std::vector<Scope> open;
+	//The version of memory at the end of each block
+	std::vector<uint32_t> memoryOut(blocks, NONE);
+	uint32_t versions = 0;
+	std::vector<bool> removed(instrs, false);
+
+	for (uint32_t at = 0; at < dom.order.size(); at++){
+		uint32_t b = dom.order[at];
+		while (!open.empty() && open.back().end <= at){
+			table.restore(open.back().table);
+			for (size_t mark = open.back().log; log.size() > mark;){
+				current[log.back().first] = log.back().second;
+				log.pop_back();
+			}
+			open.pop_back();
+		}
+		open.push_back({at + dom.size[b], table.mark(), log.size()});
+
+		//Memory is as its immediate dominator left it only if that
+		// is the one way in
+		uint32_t memory = ++versions;
+		if (cfg.predFirst[b + 1] - cfg.predFirst[b] == 1
+		  && cfg.preds[cfg.predFirst[b]] == dom.idom[b]){
+			memory = memoryOut[dom.idom[b]];
+		}
+
+		for (uint32_t p = ssa.phiFirst[b]; p < ssa.phiFirst[b + 1]; p++){
+			const SsaPhi& phi = ssa.phis[p];
+			uint32_t same = NONE;
+			bool meaningless = true;
+			uint32_t first = ssa.argFirst[p];
+			uint32_t count = cfg.predFirst[b + 1] - cfg.predFirst[b];
+			for (uint32_t j = 0; j < count; j++){
+				uint32_t arg = ssa.args[first + j];
+				if (arg == NONE){ continue; }
+				if (same == NONE){ same = number[arg]; }
+				meaningless = meaningless && number[arg] == same;
+			}
+			if (meaningless && same != NONE){ number[phi.value] = same; }
+			define(phi.reg, phi.value);
+		}
+
+		for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+			IrInstr& in = fn.code[i];
+			const uint32_t * reads = ssa.uses.data() + ssa.useFirst[i];
+			const uint32_t v = ssa.defs[i];
+			const uint32_t op = static_cast<uint32_t>(in.op);
+			GvnKey key{op, 0, 0, 0};
+			switch (in.op){
+			case IrOp::Const: case IrOp::GlobalAddr: case IrOp::FrameAddr:
+				key.x = in.a;
+				break;
+			case IrOp::Neg: case IrOp::Not:
+				key.x = number[reads[0]];
+				break;
+			case IrOp::Add: case IrOp::Mul: case IrOp::Eq: case IrOp::Ne:
+				key.x = number[reads[0]];
+				key.y = number[reads[1]];
+				if (key.x > key.y){ std::swap(key.x, key.y); }
+				break;
+			case IrOp::Sub: case IrOp::Div: case IrOp::Lt: case IrOp::Le:
+				key.x = number[reads[0]];
+				key.y = number[reads[1]];
+				break;
+			case IrOp::Gt: case IrOp::Ge:
+				key.op = static_cast<uint32_t>(in.op == IrOp::Gt ? IrOp::Lt
+				  : IrOp::Le);
+				key.x = number[reads[1]];
+				key.y = number[reads[0]];
+				break;
+			case IrOp::Field:
+				key.x = number[reads[0]];
+				key.y = in.b;
+				break;
+			case IrOp::Load:
+				key.x = number[reads[0]];
+				key.y = in.b;
+				key.z = memory;
+				break;
+			case IrOp::LoadGlobal:
+				key.x = in.a;
+				key.z = memory;
+				break;
+			case IrOp::Move:
+				number[v] = number[reads[0]];
+				key.op = NONE;
+				break;
+			case IrOp::Store:
+				memory = ++versions;
+				table.put({static_cast<uint32_t>(IrOp::Load), number[reads[0]],
+				  in.b, memory}, reads[1]);
+				key.op = NONE;
+				break;
+			case IrOp::StoreGlobal:
+				memory = ++versions;
+				table.put({static_cast<uint32_t>(IrOp::LoadGlobal), in.a, 0,
+				  memory}, reads[0]);
+				key.op = NONE;
+				break;
+			case IrOp::Copy: case IrOp::Zero: case IrOp::Call:
+				memory = ++versions;
+				key.op = NONE;
+				break;
+			default:
+				key.op = NONE;
+				break;
+			}
+
+			if (key.op != NONE){
+				uint32_t w = table.find(key);
+				uint32_t reg = w == NONE ? NONE : regOf[w];
+				//Whether w's register still holds it here
+				bool holds = w != NONE && current[reg] == w
+				  && (known[reg] || definedIn[w] == b);
+				if (w != NONE){ number[v] = number[w]; }
+				if (!holds){
+					//This is the one to reuse from here on
+					table.put(key, v);
+				} else if (!cheap(in.op)){
+					if (reg == in.dst){
+						removed[i] = true;
+					} else {
+						in = {IrOp::Move, in.dst, reg, 0, 0};
+					}
+					counts.redundant++;
+				}
+			}
+			if (v != NONE){ define(in.dst, v); }
+		}
+		memoryOut[b] = memory;
+	}
+
+	counts.dead = removeUnread(fn, removed);
+	if (counts.redundant == 0 && counts.dead == 0){ return counts; }
+	std::vector<IrInstr> code;
+	code.reserve(instrs);
+	for (IrBlock& block : fn.blocks){
+		uint32_t first = static_cast<uint32_t>(code.size());
+		for (uint32_t i = block.first; i < block.end; i++){
+			if (!removed[i]){ code.push_back(fn.code[i]); }
+		}
+		block.first = first;
+		block.end = static_cast<uint32_t>(code.size());
+	}
+	fn.code.swap(code);
+	return counts;
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef DREWNO_MARS_GVN_HPP
+#define DREWNO_MARS_GVN_HPP
+
+#include <cstddef>
+#include "ssa.hpp"
+
+//Global value numbering on the IR, after constants are
+// propagated through it and before loops are optimised (unless
+// dmc -N).
+//
+//A walk of the dominator tree gives each SSA value a number,
+// the same for two values only if they are always equal: a move
+// takes what it reads, a phi whose arguments all have the one
+// number takes that, and an instruction that computes something
+// without an effect takes the number of the value that an
+// instruction above it (in the tree) computed from the same
+// operation on operands with the same numbers, if there is one.
+// Those are looked up in a hash table scoped like the walk, so
+// that what a block computes is forgotten when the walk leaves
+// the blocks it dominates. Loads are looked up with the version
+// of memory they read, a new one after each store, copy, zero
+// or call and at each join (and a store is remembered as a load
+// from where it stored of what it stored). An instruction that
+// is found to compute what an earlier one did is made a move
+// from the earlier one's register, if that still holds it, and
+// then what nothing reads any more is removed.
+namespace drewno_mars{
+
+struct GvnCounts{
+	//Instructions made moves (or removed, if they would move a
+	// register to itself), and instructions then left unread
+	size_t redundant = 0;
+	size_t dead = 0;
+	GvnCounts& operator+=(const GvnCounts& other);
+};
+
+//Number the values of fn (whose SSA form is ssa), replacing what
+// is computed twice. ssa is no good afterwards.
+GvnCounts numberValues(IrFunction& fn, const SsaForm& ssa);
+
+}
+
+#endif
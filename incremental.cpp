@@ -0,0 +1,562 @@
+#include <algorithm>
+#include <sstream>
+#include "incremental.hpp"
+#include "scanner.hpp"
+#include "stats.hpp"
+#include "stream.hpp"
+
+namespace drewno_mars{
+
+//A run of whole lines, along with the top-level declarations
+// that start on them. Segments tile the program, so the lines
+// an edit touches map onto the segments that need redoing.
+struct IncrementalCompilation::Segment{
+	Segment(size_t firstLineIn, size_t originIn)
+	: index(0), firstLine(firstLineIn), lineCount(0), origin(originIn),
+	  broken(false), analysisOK(true){ }
+	~Segment(){
+		for (DeclNode * decl : decls){ delete decl; }
+	}
+	size_t index;
+	size_t firstLine;
+	size_t lineCount;
+	//The line that positions in the trees (and in the reports
+	// about them) count as line 1. Segments below an edit are
+	// moved by moving this, rather than touching their trees.
+	size_t origin;
+	bool broken;
+	bool analysisOK;
+	std::list<DeclNode *> decls;
+	std::vector<Diagnostic> parseErrors;
+	std::vector<Diagnostic> nameErrors;
+	std::string syntaxError;
+
+	//Global symbols declared here, by name
+	HashMap<std::string, SemSymbol *> globals;
+	//Every binding made while analysing the segment
+	std::vector<std::pair<IDNode *, SemSymbol *>> bindings;
+	//Every symbol declared here, global or not
+	std::vector<SemSymbol *> owned;
+	//Scopes opened while analysing the segment
+	std::list<ScopeTable *> scopes;
+	//Global names looked up here, whether found or not
+	std::set<std::string> uses;
+};
+
+//The global scope, shared by every segment. A name keeps the
+// symbol each segment declared for it, and a segment only sees
+// those declared before it (or earlier within it), exactly as
+// if the whole program were analysed from the top.
+class IncrementalCompilation::GlobalScope : public ScopeTable{
+public:
+	GlobalScope(IncrementalCompilation * owner) : myOwner(owner){ }
+	~GlobalScope() override{
+		for (auto& entry : myEntries){
+			for (auto& def : entry.second){ delete def.second; }
+		}
+	}
+
+	SemSymbol * lookup(std::string name) override{
+		Segment * current = myOwner->myCurrent;
+		current->uses.insert(name);
+		myOwner->myUsers[name].insert(current);
+
+		auto found = myEntries.find(name);
+		if (found == myEntries.end()){ return nullptr; }
+		//The first declaration wins; any after it are
+		// reported as multiply declared instead
+		SemSymbol * result = nullptr;
+		size_t first = current->index + 1;
+		for (auto& def : found->second){
+			if (def.first->index < first){
+				first = def.first->index;
+				result = def.second;
+			}
+		}
+		return result;
+	}
+
+	bool insert(SemSymbol * symbol) override{
+		std::string name = symbol->getName();
+		if (lookup(name) != nullptr){ return false; }
+		Segment * current = myOwner->myCurrent;
+		myEntries[name].push_back(std::make_pair(current, symbol));
+		current->globals[name] = symbol;
+		return true;
+	}
+
+	//Take out (without deleting) the symbol seg declared
+	void remove(const std::string& name, Segment * seg){
+		auto found = myEntries.find(name);
+		if (found == myEntries.end()){ return; }
+		auto& defs = found->second;
+		for (auto def = defs.begin(); def != defs.end(); ++def){
+			if (def->first == seg){
+				defs.erase(def);
+				break;
+			}
+		}
+		if (defs.empty()){ myEntries.erase(found); }
+	}
+
+	//Have the symbol seg declared for name be symbol instead
+	void replace(const std::string& name, Segment * seg, SemSymbol * symbol){
+		for (auto& def : myEntries[name]){
+			if (def.first == seg){ def.second = symbol; }
+		}
+	}
+
+private:
+	IncrementalCompilation * myOwner;
+	HashMap<std::string, std::vector<std::pair<Segment *, SemSymbol *>>>
+	  myEntries;
+};
+
+//Keeps the declarations the parser reduces, in order
+class DeclCollector : public DeclSink{
+public:
+	DeclCollector(std::list<DeclNode *>& decls) : myDecls(decls){ }
+	void accept(DeclNode * decl) override{ myDecls.push_back(decl); }
+private:
+	std::list<DeclNode *>& myDecls;
+};
+
+static std::vector<std::string> splitLines(const std::string& text){
+	std::vector<std::string> lines;
+	size_t start = 0;
+	while (start < text.size()){
+		size_t end = text.find('\n', start);
+		if (end == std::string::npos){ end = text.size(); }
+		lines.push_back(text.substr(start, end - start));
+		start = end + 1;
+	}
+	return lines;
+}
+
+//Whether code bound to one symbol would be just as well off
+// bound to the other
+static bool sameSymbol(SemSymbol * a, SemSymbol * b){
+	return a->getName() == b->getName()
+	  && a->getKind() == b->getKind()
+	  && a->getType() == b->getType()
+	  && a->getScopeTable() == b->getScopeTable();
+}
+
+IncrementalCompilation::IncrementalCompilation(const std::string& text)
+: myBroken(0), myFailed(0), myGlobals(new GlobalScope(this)),
+  myCurrent(nullptr), myDiagnostics(nullptr){
+	myLines = splitLines(text);
+	mySymTab.enterScope(myGlobals);
+	reparse(0, 0, 1, myLines.size());
+}
+
+IncrementalCompilation::~IncrementalCompilation(){
+	for (Segment * seg : mySegments){
+		for (ScopeTable * scope : seg->scopes){ delete scope; }
+		delete seg;
+	}
+	mySymTab.leaveScope();
+	delete myGlobals;
+	for (SemSymbol * symbol : myRetiredSymbols){ delete symbol; }
+	for (ScopeTable * scope : myRetiredScopes){ delete scope; }
+}
+
+void IncrementalCompilation::edit(size_t firstLine, size_t lineCount,
+  const std::string& text){
+	if (firstLine < 1 || firstLine > myLines.size() + 1
+	  || firstLine - 1 + lineCount > myLines.size()){
+		throw new UserError("Edit is outside the program");
+	}
+	std::vector<std::string> newLines = splitLines(text);
+
+	//The segments holding the edited lines (for an insertion,
+	// those on either side of it)
+	size_t low = firstLine;
+	size_t high = firstLine + lineCount - 1;
+	if (lineCount == 0){
+		low = firstLine - 1;
+		high = firstLine;
+	}
+	low = std::max<size_t>(low, 1);
+	high = std::min(high, myLines.size());
+	size_t first = mySegments.size();
+	size_t last = mySegments.size();
+	if (low <= high){
+		first = segmentAt(low);
+		last = segmentAt(high) + 1;
+	}
+
+	//Text that didn't parse by itself might along with the
+	// text around it, so it is always redone
+	if (myBroken > 0){
+		for (size_t i = 0; i < mySegments.size(); i++){
+			if (mySegments[i]->broken){
+				first = std::min(first, i);
+				last = std::max(last, i + 1);
+			}
+		}
+	}
+
+	size_t regionLine = firstLine;
+	size_t regionCount = 0;
+	if (first < last){
+		regionLine = mySegments[first]->firstLine;
+		const Segment * end = mySegments[last - 1];
+		regionCount = end->firstLine + end->lineCount - regionLine;
+	}
+
+	auto at = myLines.begin() + static_cast<long>(firstLine - 1);
+	at = myLines.erase(at, at + static_cast<long>(lineCount));
+	myLines.insert(at, newLines.begin(), newLines.end());
+	size_t shift = newLines.size() - lineCount;
+	for (size_t i = last; i < mySegments.size(); i++){
+		mySegments[i]->firstLine += shift;
+		mySegments[i]->origin += shift;
+	}
+
+	reparse(first, last, regionLine, regionCount + shift);
+}
+
+void IncrementalCompilation::reparse(size_t first, size_t last,
+  size_t firstLine, size_t lineCount){
+	Stopwatch timer;
+
+	//An edit can leave a declaration running past the lines
+	// redone (a half-typed one, say, or one whose semicolon is
+	// on the line the next one starts on), so before giving up
+	// on the lines, retry with the segments either side
+	std::vector<Segment *> fresh;
+	bool parsed = parseLines(firstLine, lineCount, fresh);
+	for (int widen = 0; !parsed && widen < 2; widen++){
+		if (first == 0 && last == mySegments.size()){ break; }
+		if (first > 0){
+			first--;
+			firstLine = mySegments[first]->firstLine;
+			lineCount += mySegments[first]->lineCount;
+		}
+		if (last < mySegments.size()){
+			lineCount += mySegments[last]->lineCount;
+			last++;
+		}
+		for (Segment * seg : fresh){ delete seg; }
+		fresh.clear();
+		parsed = parseLines(firstLine, lineCount, fresh);
+	}
+	Stats::count("incremental lines parsed", lineCount);
+
+	//Swap the new segments in for the old ones, undoing
+	// everything the old ones did to the rest of the program
+	std::vector<Segment *> old(mySegments.begin() + static_cast<long>(first),
+	  mySegments.begin() + static_cast<long>(last));
+	for (Segment * seg : old){ forget(seg); }
+	auto at = mySegments.erase(mySegments.begin() + static_cast<long>(first),
+	  mySegments.begin() + static_cast<long>(last));
+	mySegments.insert(at, fresh.begin(), fresh.end());
+	for (size_t i = first; i < mySegments.size(); i++){
+		mySegments[i]->index = i;
+	}
+
+	Queue queue;
+	for (Segment * seg : old){
+		if (seg->broken){ myBroken--; }
+		if (!seg->analysisOK){ myFailed--; }
+		for (SemSymbol * symbol : seg->owned){ retire(symbol, queue); }
+		for (auto& def : seg->globals){
+			myRetiredSymbols.push_back(def.second);
+			dirtyName(def.first, first, queue);
+		}
+		myRetiredScopes.splice(myRetiredScopes.end(), seg->scopes);
+		delete seg;
+	}
+	for (Segment * seg : fresh){
+		if (seg->broken){ myBroken++; }
+		enqueue(seg, queue);
+	}
+
+	//Queued segments only ever queue ones after themselves, so
+	// going in program order handles each at most once
+	size_t analysed = 0;
+	while (!queue.empty()){
+		Segment * seg = queue.begin()->second;
+		queue.erase(queue.begin());
+		analyse(seg, queue);
+		analysed++;
+	}
+	Stats::count("incremental segments analysed", analysed);
+
+	for (SemSymbol * symbol : myRetiredSymbols){ delete symbol; }
+	myRetiredSymbols.clear();
+	for (ScopeTable * scope : myRetiredScopes){ delete scope; }
+	myRetiredScopes.clear();
+	Stats::time("incremental update", timer.seconds());
+}
+
+//Parse lineCount lines from firstLine into segments. If they
+// don't parse, they become a single broken segment instead.
+bool IncrementalCompilation::parseLines(size_t firstLine, size_t lineCount,
+  std::vector<Segment *>& segments){
+	if (lineCount == 0){ return true; }
+	std::string text;
+	for (size_t i = 0; i < lineCount; i++){
+		text += myLines[firstLine - 1 + i];
+		text += '\n';
+	}
+	std::istringstream in(text);
+
+	std::list<DeclNode *> decls;
+	std::vector<Diagnostic> diags;
+	DeclCollector collector(decls);
+	ProgramNode * root = nullptr;
+	//The parser writes syntax errors straight to the console
+	std::ostringstream out;
+	std::ostringstream err;
+	std::streambuf * oldOut = std::cout.rdbuf(out.rdbuf());
+	std::streambuf * oldErr = std::cerr.rdbuf(err.rdbuf());
+	ReportSink * oldSink = Report::sink();
+	Report::sink() = this;
+	myDiagnostics = &diags;
+	int errCode;
+	{
+		Scanner scanner(&in);
+		Parser parser(scanner, &root, &collector);
+		errCode = parser.parse();
+	}
+	myDiagnostics = nullptr;
+	Report::sink() = oldSink;
+	std::cout.rdbuf(oldOut);
+	std::cerr.rdbuf(oldErr);
+	delete root;
+
+	if (errCode != 0){
+		for (DeclNode * decl : decls){ delete decl; }
+		Segment * seg = new Segment(firstLine, firstLine);
+		seg->lineCount = lineCount;
+		seg->broken = true;
+		seg->parseErrors = diags;
+		seg->syntaxError = err.str();
+		segments.push_back(seg);
+		return false;
+	}
+
+	//Each segment starts on the line its first declaration
+	// does, once everything before that line has ended
+	// (declarations sharing a line share a segment). Positions
+	// all stay relative to firstLine.
+	Segment * seg = new Segment(firstLine, firstLine);
+	size_t lastEnd = 0;
+	for (DeclNode * decl : decls){
+		size_t start = decl->pos()->lineBegin();
+		if (!seg->decls.empty() && start > lastEnd){
+			size_t line = firstLine + start - 1;
+			seg->lineCount = line - seg->firstLine;
+			segments.push_back(seg);
+			seg = new Segment(line, firstLine);
+		}
+		seg->decls.push_back(decl);
+		lastEnd = std::max(lastEnd, decl->pos()->lineEnd());
+	}
+	seg->lineCount = firstLine + lineCount - seg->firstLine;
+	segments.push_back(seg);
+
+	for (const Diagnostic& diag : diags){
+		size_t line = firstLine + diag.pos.lineBegin() - 1;
+		for (Segment * owner : segments){
+			if (line < owner->firstLine + owner->lineCount){
+				owner->parseErrors.push_back(diag);
+				break;
+			}
+		}
+	}
+	return true;
+}
+
+void IncrementalCompilation::analyse(Segment * seg, Queue& queue){
+	forget(seg);
+	HashMap<std::string, SemSymbol *> before;
+	before.swap(seg->globals);
+	std::vector<SemSymbol *> ownedBefore;
+	ownedBefore.swap(seg->owned);
+	myRetiredScopes.splice(myRetiredScopes.end(), seg->scopes);
+	if (!seg->analysisOK){ myFailed--; }
+	seg->nameErrors.clear();
+
+	BindingObserver * oldObserver = IDNode::observer;
+	ReportSink * oldSink = Report::sink();
+	IDNode::observer = this;
+	Report::sink() = this;
+	myCurrent = seg;
+	myDiagnostics = &seg->nameErrors;
+	bool ok = true;
+	for (DeclNode * decl : seg->decls){
+		ok = decl->nameAnalysis(&mySymTab) && ok;
+	}
+	myCurrent = nullptr;
+	myDiagnostics = nullptr;
+	seg->analysisOK = ok;
+	if (!ok){ myFailed++; }
+	seg->scopes = mySymTab.takeScopes();
+
+	//A declaration that comes out the same as before keeps
+	// its old symbol, so whatever was bound to that stays put
+	for (auto& def : seg->globals){
+		auto old = before.find(def.first);
+		if (old == before.end() || !sameSymbol(old->second, def.second)){
+			continue;
+		}
+		SemSymbol * made = def.second;
+		SemSymbol * kept = old->second;
+		myGlobals->replace(def.first, seg, kept);
+		for (auto& binding : seg->bindings){
+			if (binding.second == made){
+				binding.first->attachSymbol(kept);
+				binding.second = kept;
+			}
+		}
+		std::replace(seg->owned.begin(), seg->owned.end(), made, kept);
+		myOwners.erase(made);
+		myOwners[kept] = seg;
+		def.second = kept;
+		delete made;
+	}
+	IDNode::observer = oldObserver;
+	Report::sink() = oldSink;
+
+	//Anything bound to a symbol that didn't survive needs
+	// another look, as does anything that looked up a global
+	// name whose meaning may have changed
+	for (SemSymbol * symbol : ownedBefore){
+		if (myOwners.find(symbol) == myOwners.end()){
+			retire(symbol, queue);
+		}
+	}
+	for (auto& old : before){
+		auto now = seg->globals.find(old.first);
+		if (now == seg->globals.end() || now->second != old.second){
+			myRetiredSymbols.push_back(old.second);
+			dirtyName(old.first, seg->index + 1, queue);
+		}
+	}
+	for (auto& def : seg->globals){
+		if (before.find(def.first) == before.end()){
+			dirtyName(def.first, seg->index + 1, queue);
+		}
+	}
+}
+
+//Undo the effects of the segment's last analysis on the rest
+// of the program (but keep its symbols and scopes around)
+void IncrementalCompilation::forget(Segment * seg){
+	for (const std::string& name : seg->uses){
+		auto users = myUsers.find(name);
+		if (users == myUsers.end()){ continue; }
+		users->second.erase(seg);
+		if (users->second.empty()){ myUsers.erase(users); }
+	}
+	seg->uses.clear();
+	for (auto& binding : seg->bindings){
+		auto bound = myBoundBy.find(binding.second);
+		if (bound != myBoundBy.end()){
+			bound->second.erase(seg);
+			if (bound->second.empty()){ myBoundBy.erase(bound); }
+		}
+		binding.first->attachSymbol(nullptr);
+	}
+	seg->bindings.clear();
+	for (auto& def : seg->globals){
+		myGlobals->remove(def.first, seg);
+	}
+	for (SemSymbol * symbol : seg->owned){
+		myOwners.erase(symbol);
+	}
+}
+
+void IncrementalCompilation::retire(SemSymbol * symbol, Queue& queue){
+	auto bound = myBoundBy.find(symbol);
+	if (bound == myBoundBy.end()){ return; }
+	for (Segment * seg : bound->second){ enqueue(seg, queue); }
+	myBoundBy.erase(bound);
+}
+
+void IncrementalCompilation::dirtyName(const std::string& name, size_t from,
+  Queue& queue){
+	auto users = myUsers.find(name);
+	if (users == myUsers.end()){ return; }
+	for (Segment * seg : users->second){
+		if (seg->index >= from){ enqueue(seg, queue); }
+	}
+}
+
+void IncrementalCompilation::enqueue(Segment * seg, Queue& queue){
+	queue[seg->index] = seg;
+}
+
+void IncrementalCompilation::bound(IDNode * id, SemSymbol * symbol){
+	Segment * seg = myCurrent;
+	if (seg == nullptr || symbol == nullptr){ return; }
+	seg->bindings.push_back(std::make_pair(id, symbol));
+	//Symbols are bound where they are declared before
+	// anywhere else, so a new one belongs to this segment
+	auto owner = myOwners.find(symbol);
+	if (owner == myOwners.end()){
+		myOwners[symbol] = seg;
+		seg->owned.push_back(symbol);
+	} else if (owner->second != seg){
+		myBoundBy[symbol].insert(seg);
+	}
+}
+
+void IncrementalCompilation::report(const Position * pos,
+  const std::string& msg){
+	myDiagnostics->push_back(Diagnostic{*pos, msg});
+}
+
+size_t IncrementalCompilation::segmentAt(size_t line){
+	auto after = std::upper_bound(mySegments.begin(), mySegments.end(), line,
+	  [](size_t l, const Segment * seg){ return l < seg->firstLine; });
+	return static_cast<size_t>(after - mySegments.begin()) - 1;
+}
+
+void IncrementalCompilation::unparse(std::ostream& out){
+	//Like dmc -n, print nothing of a program that doesn't parse
+	if (myBroken > 0){ return; }
+	for (Segment * seg : mySegments){
+		for (DeclNode * decl : seg->decls){
+			decl->unparse(out, 0);
+		}
+	}
+}
+
+void IncrementalCompilation::render(std::ostream& out, const Segment * seg,
+  const std::vector<Diagnostic>& diags){
+	size_t shift = seg->origin - 1;
+	for (const Diagnostic& diag : diags){
+		Position pos(diag.pos.lineBegin() + shift, diag.pos.colBegin(),
+		  diag.pos.lineEnd() + shift, diag.pos.colEnd());
+		out << "FATAL " << pos.span() << ": " << diag.msg << std::endl;
+	}
+}
+
+void IncrementalCompilation::reportErrors(std::ostream& out){
+	//Parsing stops at the first syntax error
+	for (Segment * seg : mySegments){
+		render(out, seg, seg->parseErrors);
+		if (seg->broken){
+			out << seg->syntaxError;
+			return;
+		}
+	}
+	for (Segment * seg : mySegments){
+		render(out, seg, seg->nameErrors);
+	}
+}
+
+std::string IncrementalCompilation::text(){
+	std::string result;
+	for (const std::string& line : myLines){
+		result += line;
+		result += '\n';
+	}
+	return result;
+}
+
+}
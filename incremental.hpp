@@ -0,0 +1,109 @@
+#ifndef DREWNO_MARS_INCREMENTAL_HPP
+#define DREWNO_MARS_INCREMENTAL_HPP
+
+#include <list>
+#include <map>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+#include "ast.hpp"
+#include "errors.hpp"
+#include "symbol_table.hpp"
+
+namespace drewno_mars{
+
+//A compiled program that can be edited in place. An edit
+// re-lexes and reparses only the top-level declarations on the
+// lines it touches, and re-runs name analysis only for those
+// declarations and the ones whose bindings they could change,
+// so small edits to large programs stay cheap.
+//
+//The program is kept as a run of segments: whole lines
+// holding the declarations that start on them. Each segment
+// records the global names it looked up and, via
+// IDNode::observer, the symbols it was bound to. A segment is
+// re-analysed when a symbol it was bound to goes away, or when
+// the meaning of a global name it looked up changes. A changed
+// declaration whose symbol ends up the same (same name, kind
+// and type, e.g. after an edit to a function body) keeps its
+// old symbol, so nothing else needs to be re-analysed.
+class IncrementalCompilation : private BindingObserver, private ReportSink{
+public:
+	IncrementalCompilation(const std::string& text);
+	~IncrementalCompilation();
+
+	//Replace lineCount lines, starting at (1-based) firstLine,
+	// with the lines of text. A lineCount of 0 inserts text
+	// before firstLine (or at the end, if firstLine is one
+	// past the last line).
+	void edit(size_t firstLine, size_t lineCount, const std::string& text);
+
+	//Whether the whole program parses, and if so, whether it
+	// passes name analysis
+	bool parseOK(){ return myBroken == 0; }
+	bool analysisOK(){ return myBroken == 0 && myFailed == 0; }
+
+	//The program with its bindings, as dmc -n would print it
+	// (nothing, if it doesn't parse)
+	void unparse(std::ostream& out);
+	//Errors, as dmc -n would report them: those from lexing
+	// and parsing, then (if it parsed) those from name analysis
+	void reportErrors(std::ostream& out);
+
+	std::string text();
+	size_t lineCount(){ return myLines.size(); }
+
+private:
+	struct Diagnostic{
+		Position pos;
+		std::string msg;
+	};
+	struct Segment;
+	class GlobalScope;
+	typedef std::map<size_t, Segment *> Queue;
+
+	void bound(IDNode * id, SemSymbol * symbol) override;
+	void report(const Position * pos, const std::string& msg) override;
+
+	void reparse(size_t first, size_t last, size_t firstLine,
+	  size_t lineCount);
+	bool parseLines(size_t firstLine, size_t lineCount,
+	  std::vector<Segment *>& segments);
+	void analyse(Segment * seg, Queue& queue);
+	void forget(Segment * seg);
+	void retire(SemSymbol * symbol, Queue& queue);
+	void dirtyName(const std::string& name, size_t from, Queue& queue);
+	void enqueue(Segment * seg, Queue& queue);
+	void render(std::ostream& out, const Segment * seg,
+	  const std::vector<Diagnostic>& diags);
+	size_t segmentAt(size_t line);
+
+	std::vector<std::string> myLines;
+	std::vector<Segment *> mySegments;
+	//How many segments didn't parse, or failed name analysis
+	size_t myBroken;
+	size_t myFailed;
+
+	SymbolTable mySymTab;
+	GlobalScope * myGlobals;
+	//The segment being analysed, and where its reports go
+	Segment * myCurrent;
+	std::vector<Diagnostic> * myDiagnostics;
+
+	//Dependency edges: which segment declared each symbol,
+	// which segments are bound to it, and which segments
+	// looked up each global name
+	HashMap<SemSymbol *, Segment *> myOwners;
+	HashMap<SemSymbol *, std::set<Segment *>> myBoundBy;
+	HashMap<std::string, std::set<Segment *>> myUsers;
+
+	//Freed once an edit is done, since trees still being
+	// re-analysed may point at them until then
+	std::vector<SemSymbol *> myRetiredSymbols;
+	std::list<ScopeTable *> myRetiredScopes;
+};
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include "../errors.hpp"
+#include "../incremental.hpp"
+
+using namespace drewno_mars;
+
+//Everything that can be asked of a compilation, as text
+static std::string describe(IncrementalCompilation& inc){
+	std::ostringstream out;
+	out << "parse " << inc.parseOK() << " analysis " << inc.analysisOK()
+	  << "\n";
+	inc.unparse(out);
+	out << "--- errors\n";
+	inc.reportErrors(out);
+	return out.str();
+}
+
+static std::vector<std::string> readLines(const char * path){
+	std::ifstream in(path);
+	if (!in.good()){
+		std::string msg = std::string("Could not open ") + path;
+		throw new UserError(msg.c_str());
+	}
+	std::vector<std::string> lines;
+	std::string line;
+	while (std::getline(in, line)){ lines.push_back(line); }
+	return lines;
+}
+
+//Make random line edits to <file>, each an insertion, deletion or
+// replacement using the file's own lines, and check after each
+// that the edited compilation says what one made from its text
+// does. A mismatch leaves the text before and after the edit in
+// edit.before and edit.after.
+static int run(const char * path, size_t edits, unsigned seed){
+	std::vector<std::string> pool = readLines(path);
+	std::string source;
+	for (const std::string& line : pool){ source += line + "\n"; }
+	if (pool.empty()){ pool.push_back(""); }
+
+	std::mt19937 random(seed);
+	auto below = [&](size_t n){
+		return std::uniform_int_distribution<size_t>(0, n - 1)(random);
+	};
+	IncrementalCompilation inc(source);
+	for (size_t i = 0; i < edits; i++){
+		std::string before = inc.text();
+		size_t lines = inc.lineCount();
+		size_t kind = below(4);
+		size_t first;
+		size_t count;
+		std::string text = pool[below(pool.size())];
+		if (kind == 0 || lines == 0){
+			first = below(lines + 1) + 1;
+			count = 0;
+		} else {
+			first = below(lines) + 1;
+			count = 1 + below(std::min<size_t>(3, lines - first + 1));
+			if (kind == 1){
+				//Delete
+				text = "";
+			} else if (kind == 2){
+				count = 1;
+			} else {
+				text += "\n" + pool[below(pool.size())];
+			}
+		}
+		inc.edit(first, count, text);
+
+		IncrementalCompilation fresh(inc.text());
+		if (describe(inc) != describe(fresh)){
+			std::cerr << path << ": seed " << seed << ", edit " << i
+			  << " (replacing " << count << " lines at " << first
+			  << ") differs from a fresh compilation\n";
+			std::ofstream("edit.before") << before;
+			std::ofstream("edit.after") << inc.text();
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char * argv[]){
+	if (argc != 4){
+		std::cerr << "Usage: driver <file> <edits> <seed>\n";
+		return 1;
+	}
+	try {
+		return run(argv[1], std::strtoul(argv[2], nullptr, 10),
+		  static_cast<unsigned>(std::strtoul(argv[3], nullptr, 10)));
+	} catch (InternalError * e){
+		std::cerr << "InternalError: " << e->msg() << "\n";
+	} catch (UserError * e){
+		std::cerr << e->msg() << "\n";
+	}
+	return 1;
+}
@@ -0,0 +1,323 @@
+#include <algorithm>
+#include <cstdint>
+#include "inline.hpp"
+
+namespace drewno_mars{
+
+//How big (see inline.hpp) a callee may be to be inlined, and
+// the most the module may grow by that isn't in proportion to it
+static const int64_t INLINE_LIMIT = 16;
+static const size_t INLINE_SLACK = 128;
+//What a read of a formal whose argument is a constant takes off
+// a callee's size, and what more if a compare or branch reads it
+static const int64_t CONSTANT_READ = 1;
+static const int64_t CONSTANT_TEST = 4;
+
+//The functions of module, callees first; recursive is set for
+// those that can call themselves
+static std::vector<uint32_t> calleesFirst(const IrModule& module,
+  std::vector<bool>& recursive){
+	const uint32_t NONE = IR_NONE;
+	const uint32_t count = static_cast<uint32_t>(module.functions.size());
+	std::vector<uint32_t> calleeFirst(count + 1, 0);
+	std::vector<uint32_t> callees;
+	recursive.assign(count, false);
+	for (uint32_t f = 0; f < count; f++){
+		for (const IrInstr& in : module.functions[f].code){
+			if (in.op != IrOp::Call){ continue; }
+			callees.push_back(in.a);
+			if (in.a == f){ recursive[f] = true; }
+		}
+		calleeFirst[f + 1] = static_cast<uint32_t>(callees.size());
+	}
+
+	//Tarjan's algorithm, with an explicit stack of the functions
+	// being visited and how far through their callees each is
+	struct Visit{ uint32_t fn; uint32_t next; };
+	std::vector<uint32_t> index(count, NONE);
+	std::vector<uint32_t> low(count, 0);
+	std::vector<bool> open(count, false);
+	std::vector<uint32_t> component;
+	std::vector<Visit> visits;
+	std::vector<uint32_t> order;
+	order.reserve(count);
+	uint32_t next = 0;
+	for (uint32_t root = 0; root < count; root++){
+		if (index[root] != NONE){ continue; }
+		index[root] = low[root] = next++;
+		open[root] = true;
+		component.push_back(root);
+		visits.push_back({root, calleeFirst[root]});
+		while (!visits.empty()){
+			Visit& top = visits.back();
+			uint32_t f = top.fn;
+			if (top.next < calleeFirst[f + 1]){
+				uint32_t callee = callees[top.next++];
+				if (index[callee] == NONE){
+					index[callee] = low[callee] = next++;
+					open[callee] = true;
+					component.push_back(callee);
+					visits.push_back({callee, calleeFirst[callee]});
+				} else if (open[callee]){
+					low[f] = std::min(low[f], index[callee]);
+				}
+				continue;
+			}
+			visits.pop_back();
+			if (!visits.empty()){
+				uint32_t caller = visits.back().fn;
+				low[caller] = std::min(low[caller], low[f]);
+			}
+			if (low[f] != index[f]){ continue; }
+			size_t first = component.size();
+			do {
+				first--;
+				open[component[first]] = false;
+			} while (component[first] != f);
+			bool cycle = component.size() - first > 1;
+			for (size_t i = first; i < component.size(); i++){
+				if (cycle){ recursive[component[i]] = true; }
+				order.push_back(component[i]);
+			}
+			component.resize(first);
+		}
+	}
+	return order;
+}
+
+//Calls each of in's register operands (not its call's arguments)
+template <typename Reg>
+static void forEachReg(IrInstr& in, Reg reg){
+	if (in.dst != IR_NONE){ reg(in.dst); }
+	switch (in.op){
+	case IrOp::Move: case IrOp::Neg: case IrOp::Not: case IrOp::Field:
+	case IrOp::Load: case IrOp::Zero: case IrOp::GiveInt:
+	case IrOp::GiveBool: case IrOp::Branch:
+		reg(in.a);
+		break;
+	case IrOp::Return:
+		if (in.a != IR_NONE){ reg(in.a); }
+		break;
+	case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::Div:
+	case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Le:
+	case IrOp::Gt: case IrOp::Ge: case IrOp::Copy:
+		reg(in.a);
+		reg(in.b);
+		break;
+	case IrOp::StoreGlobal:
+		reg(in.b);
+		break;
+	case IrOp::Store:
+		reg(in.a);
+		reg(in.c);
+		break;
+	default:
+		break;
+	}
+}
+
+//What is known of a function once its own calls are inlined
+struct Callee{
+	//For each formal, what reading it with a constant saves
+	std::vector<int64_t> constantBonus;
+	uint32_t returns = 0;
+};
+
+static Callee weigh(const IrFunction& fn){
+	Callee callee;
+	callee.constantBonus.assign(fn.params, 0);
+	for (const IrInstr& in : fn.code){
+		if (in.op == IrOp::Return && in.a != IR_NONE){ callee.returns++; }
+		bool test = in.op == IrOp::Branch || isCompare(in.op);
+		forEachUse(fn, in, [&](uint32_t reg){
+			if (reg >= fn.params){ return; }
+			callee.constantBonus[reg] += CONSTANT_READ
+			  + (test ? CONSTANT_TEST : 0);
+		});
+	}
+	return callee;
+}
+
+//Rebuilds a function with calls copied in
+class Inliner{
+public:
+	Inliner(const IrModule& module, IrFunction& fn)
+	: myModule(module), myFn(fn){ }
+
+	//Inline the call at fn.code[at]
+	void mark(uint32_t at){ myCalls.push_back(at); }
+	bool marked() const{ return !myCalls.empty(); }
+
+	void run(){
+		const std::vector<IrInstr>& old = myFn.code;
+		std::vector<uint32_t> blockAt(myFn.blocks.size());
+		//Where, in the new code, the caller's own jumps and branches
+		// are (to be pointed at the new numbers of their blocks)
+		std::vector<uint32_t> terminators;
+		size_t call = 0;
+		for (uint32_t b = 0; b < myFn.blocks.size(); b++){
+			const IrBlock block = myFn.blocks[b];
+			blockAt[b] = static_cast<uint32_t>(myBlocks.size());
+			open(block.depth);
+			for (uint32_t i = block.first; i < block.end; i++){
+				const IrInstr& in = old[i];
+				if (call < myCalls.size() && myCalls[call] == i){
+					call++;
+					copyCallee(in, block.depth);
+					continue;
+				}
+				IrInstr copy = in;
+				if (in.op == IrOp::Call){
+					copy.b = static_cast<uint32_t>(myArgs.size());
+					for (uint32_t a = 0; a < in.c; a++){
+						myArgs.push_back(myFn.args[in.b + a]);
+					}
+				} else if (in.op == IrOp::Jump || in.op == IrOp::Branch){
+					terminators.push_back(static_cast<uint32_t>(myCode.size()));
+				}
+				myCode.push_back(copy);
+			}
+			close();
+		}
+		for (uint32_t t : terminators){
+			IrInstr& in = myCode[t];
+			if (in.op == IrOp::Jump){
+				in.a = blockAt[in.a];
+			} else {
+				in.b = blockAt[in.b];
+				in.c = blockAt[in.c];
+			}
+		}
+		myFn.code.swap(myCode);
+		myFn.blocks.swap(myBlocks);
+		myFn.args.swap(myArgs);
+	}
+
+private:
+	void open(uint32_t depth){
+		myBlocks.push_back({static_cast<uint32_t>(myCode.size()), 0, depth});
+	}
+	void close(){
+		myBlocks.back().end = static_cast<uint32_t>(myCode.size());
+	}
+
+	//Copy in call's callee: its entry block onto the end of the
+	// block being built (as nothing jumps back to an entry), the
+	// rest after it, then start the block that carries on after
+	// the call (unless the callee is the one block)
+	void copyCallee(const IrInstr& call, uint32_t depth){
+		const IrFunction& callee = myModule.functions[call.a];
+		const uint32_t regs = myFn.regs;
+		const uint32_t slots = myFn.frameSlots;
+		myFn.regs += callee.regs;
+		myFn.frameSlots += callee.frameSlots;
+		for (uint32_t p = 0; p < call.c; p++){
+			uint32_t arg = myFn.args[call.b + p];
+			myCode.push_back({IrOp::Move, regs + p, arg, 0, 0});
+		}
+		const uint32_t blocks = static_cast<uint32_t>(callee.blocks.size());
+		const uint32_t entry = static_cast<uint32_t>(myBlocks.size()) - 1;
+		const uint32_t after = entry + blocks;
+		for (uint32_t b = 0; b < blocks; b++){
+			const IrBlock& block = callee.blocks[b];
+			if (b > 0){ open(depth + block.depth); }
+			for (uint32_t i = block.first; i < block.end; i++){
+				IrInstr in = callee.code[i];
+				forEachReg(in, [regs](uint32_t& reg){ reg += regs; });
+				switch (in.op){
+				case IrOp::FrameAddr:
+					in.a += slots;
+					break;
+				case IrOp::Call: {
+					uint32_t first = static_cast<uint32_t>(myArgs.size());
+					for (uint32_t a = 0; a < in.c; a++){
+						myArgs.push_back(callee.args[in.b + a] + regs);
+					}
+					in.b = first;
+					break;
+				}
+				case IrOp::Jump:
+					in.a += entry;
+					break;
+				case IrOp::Branch:
+					in.b += entry;
+					in.c += entry;
+					break;
+				case IrOp::Return:
+					if (call.dst != IR_NONE && in.a != IR_NONE){
+						myCode.push_back({IrOp::Move, call.dst, in.a, 0, 0});
+					}
+					if (blocks == 1){ return; }
+					in = {IrOp::Jump, IR_NONE, after, 0, 0};
+					break;
+				default:
+					break;
+				}
+				myCode.push_back(in);
+			}
+			close();
+		}
+		open(depth);
+	}
+
+	const IrModule& myModule;
+	IrFunction& myFn;
+	//The calls to inline, in code order
+	std::vector<uint32_t> myCalls;
+	std::vector<IrInstr> myCode;
+	std::vector<IrBlock> myBlocks;
+	std::vector<uint32_t> myArgs;
+};
+
+InlineCounts inlineCalls(IrModule& module){
+	InlineCounts counts;
+	std::vector<bool> recursive;
+	std::vector<uint32_t> order = calleesFirst(module, recursive);
+	for (bool r : recursive){ counts.recursive += r ? 1 : 0; }
+	const int64_t budget = static_cast<int64_t>(module.instrCount() / 4
+	  + INLINE_SLACK);
+	int64_t grown = 0;
+	std::vector<Callee> weighed(module.functions.size());
+	//Whether each of a caller's registers is set once, by a Const
+	std::vector<uint8_t> sets;
+	for (uint32_t f : order){
+		IrFunction& fn = module.functions[f];
+		sets.assign(fn.regs, 0);
+		for (const IrInstr& in : fn.code){
+			if (in.dst == IR_NONE){ continue; }
+			uint8_t& set = sets[in.dst];
+			set = set == 0 && in.op == IrOp::Const ? 1 : 2;
+		}
+		Inliner inliner(module, fn);
+		for (uint32_t i = 0; i < fn.code.size(); i++){
+			const IrInstr& in = fn.code[i];
+			if (in.op != IrOp::Call || recursive[in.a]){ continue; }
+			const IrFunction& callee = module.functions[in.a];
+			if (in.c != callee.params){ continue; }
+			const Callee& known = weighed[in.a];
+			int64_t size = static_cast<int64_t>(callee.code.size())
+			  - static_cast<int64_t>(callee.params) - 2;
+			for (uint32_t p = 0; p < in.c; p++){
+				if (sets[fn.args[in.b + p]] == 1){
+					size -= known.constantBonus[p];
+				}
+			}
+			//The callee's code and the moves to its formals and from
+			// its returns, less the call (and the return, if that was
+			// its only block)
+			int64_t growth = static_cast<int64_t>(callee.code.size())
+			  + callee.params + (in.dst != IR_NONE ? known.returns : 0)
+			  - (callee.blocks.size() == 1 ? 2 : 1);
+			if (size > INLINE_LIMIT || grown + growth > budget){ continue; }
+			inliner.mark(i);
+			counts.calls++;
+			grown += growth;
+		}
+		if (inliner.marked()){ inliner.run(); }
+		weighed[f] = weigh(fn);
+	}
+	counts.growth = grown > 0 ? static_cast<size_t>(grown) : 0;
+	return counts;
+}
+
+}
@@ -0,0 +1,45 @@
+#ifndef DREWNO_MARS_INLINE_HPP
+#define DREWNO_MARS_INLINE_HPP
+
+#include <cstddef>
+#include "ir.hpp"
+
+//Inlining of small functions into their callers, on the IR
+// before constants are propagated through it (see ssa.hpp), so
+// that a constant argument reaches the callee's body.
+//
+//Functions are visited callees first (in the order Tarjan's
+// algorithm finds the call graph's strongly connected
+// components), so a callee has had its own calls inlined by the
+// time its callers weigh it up. A function that can reach
+// itself through the graph is never inlined. A call is inlined
+// if the callee's instructions, less the call, return and
+// argument passing that go, less a bonus for each read of a
+// formal whose argument is a constant (more if a compare or a
+// branch reads it, as those tend to fold away), come to no more
+// than INLINE_LIMIT, and the module has not yet grown by its
+// budget: a quarter of its size, plus INLINE_SLACK instructions
+// so that small programs get somewhere.
+//
+//The callee's code is copied in where the call was, its entry
+// block joining the code before the call and its other blocks
+// following, its registers and frame slots renamed to fresh
+// ones after the caller's, its formals set from the arguments
+// by moves, and each of its returns made a move to the call's
+// result and a jump past it (or, if the callee is one block,
+// just the move).
+namespace drewno_mars{
+
+struct InlineCounts{
+	size_t calls = 0;
+	//Instructions the module grew by (0 if it shrank)
+	size_t growth = 0;
+	//Functions left alone as they can call themselves
+	size_t recursive = 0;
+};
+
+InlineCounts inlineCalls(IrModule& module);
+
+}
+
+#endif
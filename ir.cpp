@@ -0,0 +1,194 @@
+#include "ir.hpp"
+
+namespace drewno_mars{
+
+static const char * opName(IrOp op){
+	switch (op){
+	case IrOp::Const: return "const";
+	case IrOp::Move: return "move";
+	case IrOp::Neg: return "neg";
+	case IrOp::Not: return "not";
+	case IrOp::Add: return "add";
+	case IrOp::Sub: return "sub";
+	case IrOp::Mul: return "mul";
+	case IrOp::Div: return "div";
+	case IrOp::Eq: return "eq";
+	case IrOp::Ne: return "ne";
+	case IrOp::Lt: return "lt";
+	case IrOp::Le: return "le";
+	case IrOp::Gt: return "gt";
+	case IrOp::Ge: return "ge";
+	case IrOp::LoadGlobal: return "loadg";
+	case IrOp::StoreGlobal: return "storeg";
+	case IrOp::GlobalAddr: return "globaladdr";
+	case IrOp::FrameAddr: return "frameaddr";
+	case IrOp::Field: return "field";
+	case IrOp::Load: return "load";
+	case IrOp::Store: return "store";
+	case IrOp::Copy: return "copy";
+	case IrOp::Zero: return "zero";
+	case IrOp::Call: return "call";
+	case IrOp::TakeInt: return "take int";
+	case IrOp::TakeBool: return "take bool";
+	case IrOp::GiveInt: return "give int";
+	case IrOp::GiveBool: return "give bool";
+	case IrOp::GiveStr: return "give str";
+	case IrOp::Magic: return "magic";
+	case IrOp::Jump: return "jump";
+	case IrOp::Branch: return "branch";
+	case IrOp::Return: return "return";
+	case IrOp::Exit: return "exit";
+	case IrOp::OpCount: break;
+	}
+	return "?";
+}
+
+//The global whose slots include slot
+static const IrGlobal * globalAt(const IrModule& module, uint32_t slot){
+	size_t low = 0;
+	size_t high = module.globals.size();
+	while (low < high){
+		size_t mid = low + (high - low) / 2;
+		const IrGlobal& global = module.globals[mid];
+		if (slot < global.slot){
+			high = mid;
+		} else if (slot >= global.slot + global.size){
+			low = mid + 1;
+		} else {
+			return &global;
+		}
+	}
+	return nullptr;
+}
+
+static void writeGlobal(std::ostream& out, const IrModule& module,
+  uint32_t slot){
+	const IrGlobal * global = globalAt(module, slot);
+	if (global == nullptr){
+		out << "@" << slot;
+	} else {
+		out << global->name;
+	}
+}
+
+static void writeString(std::ostream& out, const std::string& str){
+	out << '"';
+	for (char c : str){
+		if (c == '"' || c == '\\'){
+			out << '\\' << c;
+		} else if (c == '\n'){
+			out << "\\n";
+		} else if (c == '\t'){
+			out << "\\t";
+		} else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+static void writeInstr(std::ostream& out, const IrModule& module,
+  const IrFunction& fn, const IrInstr& in){
+	out << "\t";
+	if (in.dst != IR_NONE){ out << "r" << in.dst << " = "; }
+	out << opName(in.op);
+	switch (in.op){
+	case IrOp::Const:
+		out << " " << static_cast<int32_t>(in.a);
+		break;
+	case IrOp::Move: case IrOp::Neg: case IrOp::Not:
+	case IrOp::GiveInt: case IrOp::GiveBool:
+		out << " r" << in.a;
+		break;
+	case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::Div:
+	case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Le:
+	case IrOp::Gt: case IrOp::Ge:
+		out << " r" << in.a << ", r" << in.b;
+		break;
+	case IrOp::LoadGlobal: case IrOp::GlobalAddr:
+		out << " ";
+		writeGlobal(out, module, in.a);
+		break;
+	case IrOp::StoreGlobal:
+		out << " ";
+		writeGlobal(out, module, in.a);
+		out << ", r" << in.b;
+		break;
+	case IrOp::FrameAddr:
+		out << " " << in.a;
+		break;
+	case IrOp::Field: case IrOp::Load:
+		out << " r" << in.a << "[" << in.b << "]";
+		break;
+	case IrOp::Store:
+		out << " r" << in.a << "[" << in.b << "], r" << in.c;
+		break;
+	case IrOp::Copy:
+		out << " r" << in.a << ", r" << in.b << ", " << in.c;
+		break;
+	case IrOp::Zero:
+		out << " r" << in.a << ", " << in.b;
+		break;
+	case IrOp::Call:
+		out << " " << module.functions[in.a].name << "(";
+		for (uint32_t i = 0; i < in.c; i++){
+			if (i > 0){ out << ", "; }
+			out << "r" << fn.args[in.b + i];
+		}
+		out << ")";
+		break;
+	case IrOp::GiveStr:
+		out << " ";
+		writeString(out, module.strings[in.a]);
+		break;
+	case IrOp::Jump:
+		out << " b" << in.a;
+		break;
+	case IrOp::Branch:
+		out << " r" << in.a << ", b" << in.b << ", b" << in.c;
+		break;
+	case IrOp::Return:
+		if (in.a != IR_NONE){ out << " r" << in.a; }
+		break;
+	default:
+		break;
+	}
+	out << "\n";
+}
+
+void IrModule::dump(std::ostream& out) const{
+	for (const IrGlobal& global : globals){
+		out << "global " << global.name << " : " << global.type
+		  << " @" << global.slot;
+		if (global.size != 1){ out << " (" << global.size << " slots)"; }
+		out << "\n";
+	}
+	for (const IrFunction& fn : functions){
+		out << "\nfn " << fn.name << ": " << fn.params << " params, "
+		  << fn.regs << " registers, " << fn.frameSlots << " frame slots";
+		if (fn.returnsValue){ out << ", returns a value"; }
+		out << "\n";
+		for (size_t b = 0; b < fn.blocks.size(); b++){
+			out << "b" << b << ":\n";
+			for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+				writeInstr(out, *this, fn, fn.code[i]);
+			}
+		}
+	}
+}
+
+std::vector<uint32_t> readCounts(const IrFunction& fn){
+	std::vector<uint32_t> reads(fn.regs, 0);
+	for (const IrInstr& in : fn.code){
+		forEachUse(fn, in, [&](uint32_t reg){ reads[reg]++; });
+	}
+	return reads;
+}
+
+size_t IrModule::instrCount() const{
+	size_t count = 0;
+	for (const IrFunction& fn : functions){ count += fn.code.size(); }
+	return count;
+}
+
+}
@@ -0,0 +1,171 @@
+#ifndef DREWNO_MARS_IR_HPP
+#define DREWNO_MARS_IR_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ast.hpp"
+
+//The linear IR (dumped by -a): each function is one array of
+// three-address instructions over virtual registers, split into
+// basic blocks that are runs of that array, each ending in a
+// single jump, branch, return or exit. Nothing points at
+// anything: registers, blocks, functions, globals and strings
+// are all indices, so a pass walks plain arrays however big a
+// function gets.
+//
+//Ints are 32-bit and wrap; bools are 0 or 1. Scalar locals and
+// formals live in registers (the formals in the first ones, a
+// method's receiver before them). Objects live in memory, a slot
+// per scalar field, with fields of class type laid out inline: a
+// local object in its function's frame, a global one among the
+// globals, and an object formal is passed by its address. A
+// function that returns an object is passed, after its formals,
+// the address to copy it to. The start function runs the global
+// initialisers, then main.
+namespace drewno_mars{
+
+enum class IrOp : unsigned char{
+	//dst = a (as a signed 32-bit constant)
+	Const,
+	//dst = a, or op a
+	Move, Neg, Not,
+	//dst = a op b
+	Add, Sub, Mul, Div, Eq, Ne, Lt, Le, Gt, Ge,
+	//dst = global a; global a = b
+	LoadGlobal, StoreGlobal,
+	//dst = the address of global slot a, or of frame slot a
+	GlobalAddr, FrameAddr,
+	//dst = address a + b slots
+	Field,
+	//dst = slot b of address a; slot b of address a = c
+	Load, Store,
+	//Copy c slots from address b to address a; zero b slots at a
+	Copy, Zero,
+	//dst (if any) = function a of the args[b] onwards, c of them
+	Call,
+	//dst = what the user types; output a, or string a
+	TakeInt, TakeBool, GiveInt, GiveBool, GiveStr,
+	//dst = an unpredictable bool
+	Magic,
+	//The terminators: to block a; to block b if a, else block
+	// c; return a (if any); end the program
+	Jump, Branch, Return, Exit,
+	OpCount
+};
+
+//Stands for no register (or function, or block)
+static const uint32_t IR_NONE = 0xffffffff;
+
+struct IrInstr{
+	IrOp op;
+	uint32_t dst;
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+};
+
+//Instructions [first, end) of a function's code
+struct IrBlock{
+	uint32_t first;
+	uint32_t end;
+	//How many whiles (in the source) the block is inside
+	uint32_t depth;
+};
+
+struct IrFunction{
+	std::string name;
+	//How many registers hold arguments on entry
+	uint32_t params = 0;
+	uint32_t regs = 0;
+	uint32_t frameSlots = 0;
+	bool returnsValue = false;
+	std::vector<IrInstr> code;
+	//In code order, so block 0 is the entry
+	std::vector<IrBlock> blocks;
+	//The argument registers of every call
+	std::vector<uint32_t> args;
+
+	const IrInstr& terminator(uint32_t block) const{
+		return code[blocks[block].end - 1];
+	}
+};
+
+//Calls use(reg) for each register in reads (once per operand)
+template <typename Use>
+void forEachUse(const IrFunction& fn, const IrInstr& in, Use use){
+	switch (in.op){
+	case IrOp::Const: case IrOp::LoadGlobal: case IrOp::GlobalAddr:
+	case IrOp::FrameAddr: case IrOp::TakeInt: case IrOp::TakeBool:
+	case IrOp::GiveStr: case IrOp::Magic: case IrOp::Jump:
+	case IrOp::Exit: case IrOp::OpCount:
+		break;
+	case IrOp::StoreGlobal:
+		use(in.b);
+		break;
+	case IrOp::Call:
+		for (uint32_t i = 0; i < in.c; i++){ use(fn.args[in.b + i]); }
+		break;
+	case IrOp::Store:
+		use(in.a);
+		use(in.c);
+		break;
+	case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::Div:
+	case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Le:
+	case IrOp::Gt: case IrOp::Ge: case IrOp::Copy:
+		use(in.a);
+		use(in.b);
+		break;
+	default:
+		if (in.a != IR_NONE){ use(in.a); }
+		break;
+	}
+}
+
+inline bool isCompare(IrOp op){
+	return op == IrOp::Eq || op == IrOp::Ne || op == IrOp::Lt
+	  || op == IrOp::Le || op == IrOp::Gt || op == IrOp::Ge;
+}
+
+//How often each of fn's registers is read
+std::vector<uint32_t> readCounts(const IrFunction& fn);
+
+struct IrGlobal{
+	std::string name;
+	std::string type;
+	uint32_t slot;
+	uint32_t size;
+};
+
+struct IrModule{
+	std::vector<IrFunction> functions;
+	std::vector<IrGlobal> globals;
+	uint32_t globalSlots = 0;
+	std::vector<std::string> strings;
+	uint32_t start = 0;
+
+	void dump(std::ostream& out) const;
+	size_t instrCount() const;
+};
+
+//Lowers name-analysed global declarations, in order, into a
+// module. Constructs the IR can't express (or that a type
+// checker would have turned away) are reported as errors.
+class IrBuilder{
+public:
+	IrBuilder();
+	~IrBuilder();
+	//Lower decl, whose IDs must still be bound (and its symbols
+	// alive). False if it had errors.
+	bool add(DeclNode * decl);
+	//Finish the start function and hand over the module
+	IrModule * finish();
+private:
+	class Lowerer;
+	Lowerer * myLowerer;
+};
+
+}
+
+#endif
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Run <file> on the VM unoptimised (-N -r) and optimised (-r) and
+# natively (-o, assembled and linked with <cc>), with <file>'s .in
+# as its input if there is one, and print a DIFF line for each run
+# whose output and exit status are not those in <file>'s .expected
+#  run.sh <dmc> <cc> <file>
+dmc=$1
+cc=$2
+file=$3
+base=${file%.dm}
+work=$base.work
+input=/dev/null
+if [ -f $base.in ]; then
+	input=$base.in
+fi
+rm -rf $work
+mkdir -p $work
+$dmc $file -N -r < $input > $work/unoptimised 2>&1
+echo "exit $?" >> $work/unoptimised
+$dmc $file -r < $input > $work/optimised 2>&1
+echo "exit $?" >> $work/optimised
+if $dmc $file -o $work/native.s > $work/native 2>&1 &&
+    $cc $work/native.s -o $work/native.out >> $work/native 2>&1; then
+	$work/native.out < $input > $work/native 2>&1
+	echo "exit $?" >> $work/native
+else
+	echo "exit -o" >> $work/native
+fi
+status=0
+for run in unoptimised optimised native; do
+	if ! cmp -s $base.expected $work/$run; then
+		echo "DIFF $file $run:"
+		diff $base.expected $work/$run | head -n 5
+		status=1
+	fi
+done
+rm -rf $work
+exit $status
@@ -0,0 +1,666 @@
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include "loop.hpp"
+
+namespace drewno_mars{
+
+LoopCounts& LoopCounts::operator+=(const LoopCounts& other){
+	loops += other.loops;
+	hoisted += other.hoisted;
+	reduced += other.reduced;
+	return *this;
+}
+
+//The outermost loop found so far that loop is nested in, or loop
+// itself, with the path to it halved
+static uint32_t outermost(std::vector<uint32_t>& up, uint32_t loop){
+	while (up[loop] != loop){
+		up[loop] = up[up[loop]];
+		loop = up[loop];
+	}
+	return loop;
+}
+
+std::vector<IrLoop> naturalLoops(const IrFunction& fn, const IrCfg& cfg,
+  const DomTree& dom){
+	const uint32_t NONE = IR_NONE;
+	const uint32_t blocks = static_cast<uint32_t>(fn.blocks.size());
+	//Back edges, as (header, source), innermost header first
+	std::vector<std::pair<uint32_t, uint32_t>> back;
+	for (uint32_t b : dom.order){
+		for (uint32_t k = 2 * b; k < 2 * b + 2; k++){
+			uint32_t to = cfg.succs[k];
+			if (to != NONE && dom.dominates(to, b)){ back.emplace_back(to, b); }
+		}
+	}
+	std::sort(back.begin(), back.end(),
+	  [&dom](const std::pair<uint32_t, uint32_t>& x,
+	    const std::pair<uint32_t, uint32_t>& y){
+		return dom.pre[x.first] > dom.pre[y.first];
+	});
+
+	//Find the loops innermost first, numbered as they're found.
+	// Each block goes to the first loop to reach it, the innermost
+	// it's in; a walk that reaches a loop found before goes on from
+	// its header (that of the outermost loop it's nested in so far)
+	std::vector<uint32_t> header;
+	std::vector<uint32_t> parent;
+	std::vector<uint32_t> up;
+	std::vector<uint32_t> loopOf(blocks, NONE);
+	std::vector<uint32_t> work;
+	for (size_t e = 0; e < back.size();){
+		const uint32_t h = back[e].first;
+		const uint32_t id = static_cast<uint32_t>(header.size());
+		header.push_back(h);
+		parent.push_back(NONE);
+		up.push_back(id);
+		loopOf[h] = id;
+		for (; e < back.size() && back[e].first == h; e++){
+			work.push_back(back[e].second);
+		}
+		while (!work.empty()){
+			uint32_t b = work.back();
+			work.pop_back();
+			if (loopOf[b] != NONE){
+				uint32_t inner = outermost(up, loopOf[b]);
+				if (inner == id){ continue; }
+				parent[inner] = id;
+				up[inner] = id;
+				b = header[inner];
+			} else {
+				loopOf[b] = id;
+			}
+			for (uint32_t p = cfg.predFirst[b]; p < cfg.predFirst[b + 1]; p++){
+				if (dom.reached(cfg.preds[p])){ work.push_back(cfg.preds[p]); }
+			}
+		}
+	}
+
+	//Renumber them in a preorder of the forest, each loop's
+	// children (and the outermost loops) by their headers' places
+	// in the dominator tree's
+	const uint32_t found = static_cast<uint32_t>(header.size());
+	std::vector<uint32_t> childFirst(found + 3, 0);
+	for (uint32_t l = 0; l < found; l++){
+		childFirst[(parent[l] == NONE ? found : parent[l]) + 2]++;
+	}
+	for (uint32_t l = 0; l <= found; l++){
+		childFirst[l + 2] += childFirst[l + 1];
+	}
+	std::vector<uint32_t> children(found);
+	for (uint32_t l = found; l-- > 0;){
+		children[childFirst[(parent[l] == NONE ? found : parent[l]) + 1]++] = l;
+	}
+	std::vector<uint32_t> number(found, NONE);
+	std::vector<IrLoop> loops(found);
+	std::vector<std::pair<uint32_t, uint32_t>> stack;
+	stack.emplace_back(found, childFirst[found]);
+	uint32_t next = 0;
+	while (!stack.empty()){
+		const uint32_t at = stack.back().first;
+		if (stack.back().second == childFirst[at + 1]){
+			if (at != found){ loops[number[at]].end = next; }
+			stack.pop_back();
+			continue;
+		}
+		const uint32_t l = children[stack.back().second++];
+		number[l] = next++;
+		IrLoop& loop = loops[number[l]];
+		loop.header = header[l];
+		loop.parent = at == found ? NONE : number[at];
+		stack.emplace_back(l, childFirst[l]);
+	}
+	for (uint32_t b : dom.order){
+		if (loopOf[b] == NONE){ continue; }
+		loopOf[b] = number[loopOf[b]];
+		loops[loopOf[b]].blocks.push_back(b);
+	}
+
+	for (IrLoop& loop : loops){
+		const uint32_t id = static_cast<uint32_t>(&loop - loops.data());
+		loop.preheader = NONE;
+		uint32_t outside = 0;
+		for (uint32_t p = cfg.predFirst[loop.header];
+		  p < cfg.predFirst[loop.header + 1]; p++){
+			uint32_t pred = cfg.preds[p];
+			if (loopOf[pred] >= id && loopOf[pred] < loop.end){ continue; }
+			outside++;
+			loop.preheader = pred;
+		}
+		if (outside != 1 || fn.terminator(loop.preheader).op != IrOp::Jump){
+			loop.preheader = NONE;
+		}
+	}
+	return loops;
+}
+
+//Whether an instruction only defines its result, and can't fail
+static bool speculable(IrOp op){
+	switch (op){
+	case IrOp::Const: case IrOp::Move: case IrOp::Neg: case IrOp::Not:
+	case IrOp::Add: case IrOp::Sub: case IrOp::Mul:
+	case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Le:
+	case IrOp::Gt: case IrOp::Ge:
+	case IrOp::GlobalAddr: case IrOp::FrameAddr: case IrOp::Field:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool writesMemory(IrOp op){
+	return op == IrOp::StoreGlobal || op == IrOp::Store || op == IrOp::Copy
+	  || op == IrOp::Zero || op == IrOp::Call;
+}
+
+//Make in read same[reg] instead of each register reg it reads
+// that has one, as forEachUse finds them (bar a call's arguments,
+// which are in the function's args)
+static void renameUses(IrInstr& in, const std::vector<uint32_t>& same){
+	auto rename = [&same](uint32_t& reg){
+		if (reg != IR_NONE && same[reg] != IR_NONE){ reg = same[reg]; }
+	};
+	switch (in.op){
+	case IrOp::Const: case IrOp::LoadGlobal: case IrOp::GlobalAddr:
+	case IrOp::FrameAddr: case IrOp::TakeInt: case IrOp::TakeBool:
+	case IrOp::GiveStr: case IrOp::Magic: case IrOp::Jump:
+	case IrOp::Exit: case IrOp::OpCount: case IrOp::Call:
+		break;
+	case IrOp::StoreGlobal:
+		rename(in.b);
+		break;
+	case IrOp::Store:
+		rename(in.a);
+		rename(in.c);
+		break;
+	case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::Div:
+	case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Le:
+	case IrOp::Gt: case IrOp::Ge: case IrOp::Copy:
+		rename(in.a);
+		rename(in.b);
+		break;
+	default:
+		rename(in.a);
+		break;
+	}
+}
+
+//Moves invariants out of a function's loops and reduces
+// multiplications in them, holding each block's code as a list
+// of indices into the function's code (to which new instructions
+// are added), with IR_NONE where an instruction has gone, until
+// finish() lays the code out afresh
+class LoopOptimiser{
+public:
+	LoopOptimiser(IrFunction& fn, const DomTree& dom,
+	  const std::vector<IrLoop>& loops)
+	: myFn(fn), myDom(dom), myLoops(loops), myStamp(0), myRenamed(false){
+		const uint32_t NONE = IR_NONE;
+		const uint32_t blocks = static_cast<uint32_t>(fn.blocks.size());
+		myBody.resize(blocks);
+		myDefs.assign(fn.regs, 0);
+		myDefAt.assign(fn.regs, NONE);
+		std::vector<uint32_t> blockOf(fn.code.size());
+		for (uint32_t b = 0; b < blocks; b++){
+			for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+				myBody[b].push_back(i);
+				blockOf[i] = b;
+				uint32_t dst = fn.code[i].dst;
+				if (dst == NONE){ continue; }
+				myDefs[dst]++;
+				myDefAt[dst] = i;
+			}
+		}
+		//Which registers are written once, where that dominates
+		// every read
+		myDominant.assign(fn.regs, false);
+		for (uint32_t r = 0; r < fn.regs; r++){
+			myDominant[r] = myDefs[r] == 1 && dom.reached(blockOf[myDefAt[r]]);
+		}
+		for (uint32_t b : dom.order){
+			for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+				forEachUse(fn, fn.code[i], [&](uint32_t reg){
+					if (!myDominant[reg]){ return; }
+					uint32_t def = myDefAt[reg];
+					uint32_t from = blockOf[def];
+					if (from == b ? def >= i : !dom.dominates(from, b)){
+						myDominant[reg] = false;
+					}
+				});
+			}
+		}
+		myStepped.assign(fn.regs, 0);
+		mySame.assign(fn.regs, NONE);
+
+		//Each block's innermost loop, each loop's depth (1 for the
+		// outermost), and the loops at each depth, in order
+		myLoopOf.assign(blocks, NONE);
+		myDepth.resize(loops.size());
+		for (uint32_t l = 0; l < loops.size(); l++){
+			for (uint32_t b : loops[l].blocks){ myLoopOf[b] = l; }
+			uint32_t parent = loops[l].parent;
+			myDepth[l] = parent == NONE ? 1 : myDepth[parent] + 1;
+			if (myByDepth.size() < myDepth[l]){ myByDepth.emplace_back(); }
+			myByDepth[myDepth[l] - 1].push_back(l);
+		}
+		//Whether each loop (or one nested in it) writes memory, and
+		// the innermost loop around each that does
+		std::vector<bool> memory(loops.size(), false);
+		for (uint32_t l = 0; l < loops.size(); l++){
+			for (uint32_t b : loops[l].blocks){
+				for (uint32_t i : myBody[b]){
+					memory[l] = memory[l] || writesMemory(fn.code[i].op);
+				}
+			}
+		}
+		for (uint32_t l = static_cast<uint32_t>(loops.size()); l-- > 0;){
+			if (memory[l] && loops[l].parent != NONE){
+				memory[loops[l].parent] = true;
+			}
+		}
+		myMemoryIn.resize(loops.size());
+		for (uint32_t l = 0; l < loops.size(); l++){
+			uint32_t parent = loops[l].parent;
+			myMemoryIn[l] = memory[l] ? l
+			  : parent == NONE ? NONE : myMemoryIn[parent];
+		}
+		//The loops each register is written in, sorted; NONE (which
+		// sorts last) for a write outside them all
+		myWriteFirst.assign(fn.regs + 1, 0);
+		for (uint32_t r = 0; r < fn.regs; r++){
+			myWriteFirst[r + 1] = myWriteFirst[r] + myDefs[r];
+		}
+		myWrites.resize(myWriteFirst[fn.regs]);
+		std::vector<uint32_t> fill(myWriteFirst.begin(),
+		  myWriteFirst.end() - 1);
+		for (uint32_t b = 0; b < blocks; b++){
+			for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+				uint32_t dst = fn.code[i].dst;
+				if (dst != NONE){ myWrites[fill[dst]++] = myLoopOf[b]; }
+			}
+		}
+		for (uint32_t r = 0; r < fn.regs; r++){
+			std::sort(myWrites.begin() + myWriteFirst[r],
+			  myWrites.begin() + myWriteFirst[r + 1]);
+		}
+	}
+
+	//Move each invariant to the preheader of the outermost loop it
+	// is invariant in, visiting the blocks in a preorder of the
+	// dominator tree so that what it reads has already moved
+	void hoist(LoopCounts& counts){
+		for (uint32_t b : myDom.order){
+			const uint32_t loop = myLoopOf[b];
+			if (loop == IR_NONE){ continue; }
+			std::vector<uint32_t>& body = myBody[b];
+			for (size_t k = 0; k + 1 < body.size(); k++){
+				uint32_t i = body[k];
+				if (i == IR_NONE){ continue; }
+				uint32_t to = target(myFn.code[i], loop);
+				if (to == IR_NONE){ continue; }
+				body[k] = IR_NONE;
+				const IrInstr& moved = myFn.code[i];
+				uint32_t preheader = myLoops[to].preheader;
+				myWrites[myWriteFirst[moved.dst]] = myLoopOf[preheader];
+				counts.hoisted++;
+				//Value numbering leaves each constant loaded where it's
+				// read, but hoisted together, one register does for all
+				// those of a value (and in a deep nest, there are as
+				// many as loops, all live all through it)
+				if (moved.op == IrOp::Const){
+					uint64_t key = uint64_t(preheader) << 32 | moved.a;
+					auto first = myConsts.emplace(key, moved.dst);
+					if (!first.second){
+						mySame[moved.dst] = first.first->second;
+						myRenamed = true;
+						continue;
+					}
+				}
+				std::vector<uint32_t>& pre = myBody[preheader];
+				pre.insert(pre.end() - 1, i);
+			}
+		}
+	}
+
+	void reduce(uint32_t loop, LoopCounts& counts){
+		++myStamp;
+		//The induction variables' steps; a register the loop sets
+		// any other way is marked in myStepped with ~myStamp
+		std::vector<std::pair<uint32_t, Step>> stepping;
+		for (uint32_t b : myLoops[loop].blocks){
+			const std::vector<uint32_t>& body = myBody[b];
+			uint32_t prev = IR_NONE;
+			for (size_t k = 0; k < body.size(); k++){
+				uint32_t i = body[k];
+				if (i == IR_NONE){ continue; }
+				const IrInstr& in = myFn.code[i];
+				Step step = {b, k, IR_NONE, false};
+				if (in.dst != IR_NONE){
+					if (steps(in, prev, loop, step)){
+						stepping.emplace_back(in.dst, step);
+					} else {
+						myStepped[in.dst] = ~myStamp;
+					}
+				}
+				prev = i;
+			}
+		}
+		if (stepping.empty()){ return; }
+		std::sort(stepping.begin(), stepping.end(),
+		  [](const std::pair<uint32_t, Step>& x,
+		    const std::pair<uint32_t, Step>& y){ return x.first < y.first; });
+		//Only the loop's own blocks are looked at, so a variable also
+		// written in a loop nested in it is left be
+		for (size_t s = 0; s < stepping.size();){
+			uint32_t var = stepping[s].first;
+			size_t e = s;
+			while (e < stepping.size() && stepping[e].first == var){ e++; }
+			if (myStepped[var] != ~myStamp){
+				bool all = writes(var, loop) == e - s;
+				myStepped[var] = all ? myStamp : ~myStamp;
+			}
+			s = e;
+		}
+
+		std::vector<Product> products;
+		std::vector<Insert> after;
+		for (uint32_t b : myLoops[loop].blocks){
+			for (uint32_t i : myBody[b]){
+				if (i == IR_NONE || myFn.code[i].op != IrOp::Mul){ continue; }
+				const IrInstr mul = myFn.code[i];
+				uint32_t var = mul.a;
+				uint32_t factor = mul.b;
+				if (myStepped[var] != myStamp || !invariant(factor, loop)){
+					std::swap(var, factor);
+					if (myStepped[var] != myStamp || !invariant(factor, loop)){
+						continue;
+					}
+				}
+				uint32_t product = IR_NONE;
+				for (const Product& p : products){
+					if (p.var == var && p.factor == factor){ product = p.reg; }
+				}
+				if (product == IR_NONE){
+					product = start(loop, var, factor, stepping, after);
+					products.push_back({var, factor, product});
+				}
+				myFn.code[i] = {IrOp::Move, mul.dst, product, 0, 0};
+				counts.reduced++;
+			}
+		}
+		//Last first, so the places still to come stay put
+		std::sort(after.begin(), after.end(),
+		  [](const Insert& x, const Insert& y){
+			return x.block != y.block ? x.block > y.block : x.at > y.at;
+		});
+		for (const Insert& insert : after){
+			std::vector<uint32_t>& body = myBody[insert.block];
+			body.insert(body.begin() + static_cast<long>(insert.at) + 1,
+			  insert.instr);
+		}
+	}
+
+	void finish(){
+		std::vector<IrInstr> code;
+		code.reserve(myFn.code.size());
+		for (uint32_t b = 0; b < myBody.size(); b++){
+			myFn.blocks[b].first = static_cast<uint32_t>(code.size());
+			for (uint32_t i : myBody[b]){
+				if (i == IR_NONE){ continue; }
+				code.push_back(myFn.code[i]);
+				if (myRenamed){ renameUses(code.back(), mySame); }
+			}
+			myFn.blocks[b].end = static_cast<uint32_t>(code.size());
+		}
+		myFn.code.swap(code);
+		if (!myRenamed){ return; }
+		for (uint32_t& reg : myFn.args){
+			if (mySame[reg] != IR_NONE){ reg = mySame[reg]; }
+		}
+	}
+
+private:
+	//Where an induction variable is stepped: in block, just after
+	// the instruction at body[at], by adding step (or taking it)
+	struct Step{
+		uint32_t block;
+		size_t at;
+		uint32_t step;
+		bool down;
+	};
+	//A register made to hold var times factor
+	struct Product{
+		uint32_t var;
+		uint32_t factor;
+		uint32_t reg;
+	};
+	//An instruction to add to block, after body[at]
+	struct Insert{
+		uint32_t block;
+		size_t at;
+		uint32_t instr;
+	};
+
+	//How many times reg is written in loop (or those nested in it)
+	size_t writes(uint32_t reg, uint32_t loop) const{
+		auto first = myWrites.begin() + myWriteFirst[reg];
+		auto last = myWrites.begin() + myWriteFirst[reg + 1];
+		return static_cast<size_t>(
+		  std::lower_bound(first, last, myLoops[loop].end)
+		  - std::lower_bound(first, last, loop));
+	}
+
+	//Whether reg holds the same value all through loop
+	bool invariant(uint32_t reg, uint32_t loop) const{
+		return writes(reg, loop) == 0
+		  && (myDefs[reg] != 1 || myDominant[reg]);
+	}
+
+	//The loop loop is nested in (or is) at depth
+	uint32_t enclosing(uint32_t loop, uint32_t depth) const{
+		const std::vector<uint32_t>& at = myByDepth[depth - 1];
+		return *(std::upper_bound(at.begin(), at.end(), loop) - 1);
+	}
+
+	//The depth of the innermost loop around both loop and other
+	// (0 if there isn't one)
+	uint32_t shared(uint32_t loop, uint32_t other) const{
+		uint32_t lo = 0;
+		uint32_t hi = myDepth[loop];
+		while (lo < hi){
+			uint32_t mid = (lo + hi + 1) / 2;
+			uint32_t around = enclosing(loop, mid);
+			if (other >= around && other < myLoops[around].end){
+				lo = mid;
+			} else {
+				hi = mid - 1;
+			}
+		}
+		return lo;
+	}
+
+	//The depth of the innermost loop around loop that writes reg
+	// (0 if there isn't one). Of the loops reg is written in, those
+	// either side of loop in preorder share the most with it
+	uint32_t writtenAt(uint32_t reg, uint32_t loop) const{
+		auto first = myWrites.begin() + myWriteFirst[reg];
+		auto last = myWrites.begin() + myWriteFirst[reg + 1];
+		auto at = std::upper_bound(first, last, loop);
+		uint32_t depth = 0;
+		if (at != first){ depth = shared(loop, *(at - 1)); }
+		if (at != last && *at != IR_NONE){
+			depth = std::max(depth, shared(loop, *at));
+		}
+		return depth;
+	}
+
+	//The constant reg holds, if it is only ever set to one
+	bool constant(uint32_t reg, int32_t& value) const{
+		if (myDefs[reg] != 1 || !myDominant[reg]){ return false; }
+		const IrInstr& def = myFn.code[myDefAt[reg]];
+		if (def.op != IrOp::Const){ return false; }
+		value = static_cast<int32_t>(def.a);
+		return true;
+	}
+
+	//The outermost loop around loop (or loop itself) that in is
+	// invariant in and has a preheader, or IR_NONE
+	uint32_t target(const IrInstr& in, uint32_t loop) const{
+		if (in.dst == IR_NONE || !myDominant[in.dst]){ return IR_NONE; }
+		//The depth of the innermost loop in can't leave
+		uint32_t inside = 0;
+		int32_t divisor;
+		if (in.op == IrOp::Div){
+			if (!constant(in.b, divisor) || divisor == 0){ return IR_NONE; }
+		} else if (in.op == IrOp::Load || in.op == IrOp::LoadGlobal){
+			if (myMemoryIn[loop] != IR_NONE){
+				inside = myDepth[myMemoryIn[loop]];
+			}
+		} else if (!speculable(in.op)){
+			return IR_NONE;
+		}
+		forEachUse(myFn, in, [&](uint32_t reg){
+			if (inside == myDepth[loop]){ return; }
+			if (myDefs[reg] == 1 && !myDominant[reg]){
+				inside = myDepth[loop];
+			} else {
+				inside = std::max(inside, writtenAt(reg, loop));
+			}
+		});
+		for (uint32_t depth = inside + 1; depth <= myDepth[loop]; depth++){
+			uint32_t around = enclosing(loop, depth);
+			if (myLoops[around].preheader != IR_NONE){ return around; }
+		}
+		return IR_NONE;
+	}
+
+	//Add an instruction to the end of block b, before its
+	// terminator
+	uint32_t append(uint32_t b, const IrInstr& in){
+		uint32_t at = static_cast<uint32_t>(myFn.code.size());
+		myFn.code.push_back(in);
+		std::vector<uint32_t>& body = myBody[b];
+		body.insert(body.end() - 1, at);
+		return at;
+	}
+
+	//A new register, written defs times in the loops given
+	uint32_t newReg(uint32_t defs, std::vector<uint32_t> loops){
+		std::sort(loops.begin(), loops.end());
+		myWrites.insert(myWrites.end(), loops.begin(), loops.end());
+		myWriteFirst.push_back(static_cast<uint32_t>(myWrites.size()));
+		myDefs.push_back(defs);
+		myDefAt.push_back(IR_NONE);
+		myDominant.push_back(false);
+		myStepped.push_back(0);
+		mySame.push_back(IR_NONE);
+		return myFn.regs++;
+	}
+
+	//Whether in (the instruction after body[prev]) steps an
+	// induction variable: a move from a register that was just
+	// set to it plus or minus an invariant
+	bool steps(const IrInstr& in, uint32_t prev, uint32_t loop,
+	  Step& step) const{
+		if (in.op != IrOp::Move || prev == IR_NONE){ return false; }
+		const IrInstr& sum = myFn.code[prev];
+		if (sum.dst != in.a || myDefs[in.a] != 1){ return false; }
+		step.down = sum.op == IrOp::Sub;
+		if (sum.op == IrOp::Add && sum.b == in.dst && sum.a != in.dst){
+			step.step = sum.a;
+		} else if ((sum.op == IrOp::Add || sum.op == IrOp::Sub)
+		  && sum.a == in.dst && sum.b != in.dst){
+			step.step = sum.b;
+		} else {
+			return false;
+		}
+		return invariant(step.step, loop);
+	}
+
+	//Start a register holding var times factor: set it in the
+	// preheader, and step it wherever var is
+	uint32_t start(uint32_t loop, uint32_t var, uint32_t factor,
+	  const std::vector<std::pair<uint32_t, Step>>& stepping,
+	  std::vector<Insert>& after){
+		const uint32_t preheader = myLoops[loop].preheader;
+		const uint32_t outside = myLoopOf[preheader];
+		auto first = std::lower_bound(stepping.begin(), stepping.end(), var,
+		  [](const std::pair<uint32_t, Step>& s, uint32_t reg){
+			return s.first < reg;
+		});
+		auto last = first;
+		while (last != stepping.end() && last->first == var){ ++last; }
+		uint32_t product = newReg(1 + static_cast<uint32_t>(last - first),
+		  {outside, loop});
+		append(preheader, {IrOp::Mul, product, var, factor, 0});
+		int32_t k = 0;
+		int32_t f = 0;
+		bool known = constant(factor, f);
+		for (auto s = first; s != last; ++s){
+			const Step& step = s->second;
+			uint32_t by = newReg(1, {outside});
+			if (known && constant(step.step, k)){
+				uint64_t value = static_cast<uint64_t>(static_cast<int64_t>(k))
+				  * static_cast<uint64_t>(static_cast<int64_t>(f));
+				myDefAt[by] = append(preheader, {IrOp::Const, by,
+				  static_cast<uint32_t>(value), 0, 0});
+			} else {
+				myDefAt[by] = append(preheader,
+				  {IrOp::Mul, by, step.step, factor, 0});
+			}
+			//Read only in the loop, which the preheader dominates
+			myDominant[by] = true;
+			uint32_t at = static_cast<uint32_t>(myFn.code.size());
+			myFn.code.push_back({step.down ? IrOp::Sub : IrOp::Add, product,
+			  product, by, 0});
+			after.push_back({step.block, step.at, at});
+		}
+		return product;
+	}
+
+	IrFunction& myFn;
+	const DomTree& myDom;
+	const std::vector<IrLoop>& myLoops;
+	std::vector<std::vector<uint32_t>> myBody;
+	//How often each register is written, and where (if once)
+	std::vector<uint32_t> myDefs;
+	std::vector<uint32_t> myDefAt;
+	std::vector<bool> myDominant;
+	//The loops register r is written in (those it's written in
+	// outside them all as IR_NONE) are
+	// myWrites[myWriteFirst[r], myWriteFirst[r + 1]), sorted
+	std::vector<uint32_t> myWriteFirst;
+	std::vector<uint32_t> myWrites;
+	std::vector<uint32_t> myLoopOf;
+	std::vector<uint32_t> myDepth;
+	std::vector<std::vector<uint32_t>> myByDepth;
+	std::vector<uint32_t> myMemoryIn;
+	//Stamped for the induction variables of the loop at hand
+	std::vector<uint32_t> myStepped;
+	uint32_t myStamp;
+	//The constants hoisted to each preheader, by (preheader,
+	// value), and the register each other such constant is read
+	// from instead
+	std::unordered_map<uint64_t, uint32_t> myConsts;
+	std::vector<uint32_t> mySame;
+	bool myRenamed;
+};
+
+LoopCounts optimiseLoops(IrFunction& fn){
+	LoopCounts counts;
+	IrCfg cfg(fn);
+	DomTree dom = dominators(fn, cfg);
+	std::vector<IrLoop> loops = naturalLoops(fn, cfg, dom);
+	if (loops.empty()){ return counts; }
+	counts.loops = loops.size();
+	LoopOptimiser optimiser(fn, dom, loops);
+	optimiser.hoist(counts);
+	for (uint32_t l = 0; l < loops.size(); l++){
+		if (loops[l].preheader != IR_NONE){ optimiser.reduce(l, counts); }
+	}
+	optimiser.finish();
+	return counts;
+}
+
+}
@@ -0,0 +1,67 @@
+#ifndef DREWNO_MARS_LOOP_HPP
+#define DREWNO_MARS_LOOP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ssa.hpp"
+
+//Loop optimisation on the IR, after constants are propagated
+// through it and its values numbered (unless dmc -N).
+//
+//A loop is a natural loop: the blocks that can reach the source
+// of a back edge (an edge to a block that dominates it) without
+// passing its target, the loop's header. Lowering enters each
+// while's header from just the one block, by a jump, and that
+// block is the loop's preheader; a loop without one is left be.
+//
+//An instruction in a loop is invariant if it has no effect and
+// can't fail, its register is written nowhere else and read only
+// where it dominates, and none of what it reads is written in
+// the loop. (Loads count as having no effect in loops that don't
+// write memory or call.) Each invariant moves once, to the end of
+// the preheader of the outermost loop it is invariant in, found
+// from the loops each register is written in and the loop
+// nesting forest; so no block is looked at once per loop around
+// it. Then in each loop's own blocks, a multiplication of an
+// induction variable, a register the loop only ever adds an
+// invariant to (or takes one from), by an invariant is replaced
+// by a move from a new register that is set to their product in
+// the preheader and stepped beside the variable, so that each
+// time round costs an addition instead.
+namespace drewno_mars{
+
+struct IrLoop{
+	uint32_t header;
+	//The block that is the only way into the header from outside
+	// the loop, by a jump (or IR_NONE if there isn't one)
+	uint32_t preheader;
+	//The innermost loop this one is nested in (or IR_NONE), and
+	// one past the last loop nested in it, so that those nested in
+	// it at any depth come straight after it
+	uint32_t parent;
+	uint32_t end;
+	//The loop's blocks that are in no loop nested in it, in a
+	// preorder of the dominator tree (so the header first)
+	std::vector<uint32_t> blocks;
+};
+
+//fn's natural loops, one per header, in a preorder of the loop
+// nesting forest (so each before those nested in it)
+std::vector<IrLoop> naturalLoops(const IrFunction& fn, const IrCfg& cfg,
+  const DomTree& dom);
+
+struct LoopCounts{
+	size_t loops = 0;
+	//Instructions moved out of loops, and multiplications reduced
+	// to additions
+	size_t hoisted = 0;
+	size_t reduced = 0;
+	LoopCounts& operator+=(const LoopCounts& other);
+};
+
+LoopCounts optimiseLoops(IrFunction& fn);
+
+}
+
+#endif
@@ -0,0 +1,1047 @@
+#include <unordered_map>
+#include "errors.hpp"
+#include "ir.hpp"
+#include "symbol_table.hpp"
+#include "visitor.hpp"
+
+namespace drewno_mars{
+
+//The text a string literal (quotes, escapes and all) stands for
+static std::string unquote(const std::string& lit){
+	std::string text;
+	for (size_t i = 1; i + 1 < lit.size(); i++){
+		char c = lit[i];
+		if (c == '\\' && i + 2 < lit.size()){
+			c = lit[++i];
+			if (c == 'n'){ c = '\n'; }
+			if (c == 't'){ c = '\t'; }
+		}
+		text.push_back(c);
+	}
+	return text;
+}
+
+//What lowering knows of a value's type
+enum class LowerKind : unsigned char{ Bad, Void, Int, Bool, Str, Object, Fn };
+
+//Where lowering has put an expression's value
+struct Lowered{
+	enum Where : unsigned char{ Nowhere, Reg, Global, Mem, Fn, Str };
+	Where where = Nowhere;
+	LowerKind kind = LowerKind::Bad;
+	//The class of an object
+	uint32_t cls = IR_NONE;
+	//Reg: the value's register. Mem: the address of the object
+	// the value lies in. Fn: the receiver's address, if a method.
+	uint32_t reg = IR_NONE;
+	//Global: the slot. Mem: the offset from reg, in slots. Fn:
+	// the function. Str: the string.
+	uint32_t at = 0;
+};
+
+//What a node part way through lowering holds on to: a value
+// already worked out (the left of an operator, say), and the
+// blocks it has yet to start, or where its call's arguments
+// start
+struct LowerState{
+	Lowered held;
+	uint32_t first = IR_NONE;
+	uint32_t second = IR_NONE;
+};
+
+struct LowerField{
+	LowerKind kind;
+	uint32_t cls;
+	uint32_t offset;
+};
+
+struct LowerClass{
+	std::string name;
+	uint32_t size = 0;
+	bool laidOut = false;
+	std::unordered_map<std::string, LowerField> fields;
+	std::unordered_map<std::string, uint32_t> methods;
+	//The function that sets up a new object's fields, if any
+	// need more than zeroing
+	uint32_t init = IR_NONE;
+};
+
+//A function being lowered. Blocks are numbered as they are
+// made, and renumbered in the order they were started once the
+// function is finished.
+struct LowerFn{
+	uint32_t index;
+	uint32_t self = IR_NONE;
+	uint32_t cls = IR_NONE;
+	//Where to put the object the function returns, if it does
+	uint32_t result = IR_NONE;
+	//The block being added to, or none after a terminator
+	uint32_t block = IR_NONE;
+	std::vector<uint32_t> started;
+	std::vector<uint32_t> firsts;
+	//How many whiles each started block is in, and the
+	// statement being lowered is
+	std::vector<uint32_t> depths;
+	uint32_t loops = 0;
+	std::unordered_map<SemSymbol *, Lowered> locals;
+};
+
+class IrBuilder::Lowerer
+  : public AstMachine<IrBuilder::Lowerer, Lowered, LowerState>{
+public:
+	Lowerer() : myModule(new IrModule()), myOk(true){
+		myModule->start = newFunction("<start>", IR_NONE);
+		myFns.emplace_back();
+		myFns.back().index = myModule->start;
+		startBlock(newBlock());
+	}
+	~Lowerer(){ delete myModule; }
+
+	bool add(DeclNode * decl){
+		myOk = true;
+		run(decl);
+		return myOk;
+	}
+
+	IrModule * finish(){
+		auto main = myGlobalFns.find("main");
+		if (main != myGlobalFns.end() && arity(main->second) == 0){
+			call(main->second, 0);
+		}
+		endFunction();
+		IrModule * module = myModule;
+		myModule = nullptr;
+		return module;
+	}
+
+	Next step(Frame& f, const Lowered& last){
+		switch (f.node->kind()){
+		case NodeKind::ClassDefn: return classDefn(f, last);
+		case NodeKind::VarDecl: return varDecl(f, last);
+		case NodeKind::FnDecl: return fnDecl(f);
+		case NodeKind::AssignStmt: {
+			AssignStmtNode * node = static_cast<AssignStmtNode *>(f.node);
+			switch (f.step++){
+			case 0: return into(node->getDst());
+			case 1:
+				f.state.held = last;
+				return into(node->getSrc());
+			}
+			assign(f.state.held, last, node);
+			return done();
+		}
+		case NodeKind::TakeStmt: return takeStmt(f, last);
+		case NodeKind::GiveStmt: return giveStmt(f, last);
+		case NodeKind::PostDecStmt:
+		case NodeKind::PostIncStmt: return postStmt(f, last);
+		case NodeKind::IfStmt: return ifStmt(f, last);
+		case NodeKind::IfElseStmt: return ifElseStmt(f, last);
+		case NodeKind::WhileStmt: return whileStmt(f, last);
+		case NodeKind::ReturnStmt: return returnStmt(f, last);
+		case NodeKind::CallStmt:
+			if (f.step++ == 0){
+				return into(static_cast<CallStmtNode *>(f.node)->getCallExp());
+			}
+			return done();
+		case NodeKind::CallExp: return callExp(f, last);
+		case NodeKind::MemberFieldExp: return memberFieldExp(f, last);
+		case NodeKind::Plus: return binary(f, last, IrOp::Add);
+		case NodeKind::Minus: return binary(f, last, IrOp::Sub);
+		case NodeKind::Times: return binary(f, last, IrOp::Mul);
+		case NodeKind::Divide: return binary(f, last, IrOp::Div);
+		case NodeKind::And: return logical(f, last, true);
+		case NodeKind::Or: return logical(f, last, false);
+		case NodeKind::Equals: return binary(f, last, IrOp::Eq);
+		case NodeKind::NotEquals: return binary(f, last, IrOp::Ne);
+		case NodeKind::Less: return binary(f, last, IrOp::Lt);
+		case NodeKind::LessEq: return binary(f, last, IrOp::Le);
+		case NodeKind::Greater: return binary(f, last, IrOp::Gt);
+		case NodeKind::GreaterEq: return binary(f, last, IrOp::Ge);
+		case NodeKind::Neg: return unary(f, last, IrOp::Neg);
+		case NodeKind::Not: return unary(f, last, IrOp::Not);
+		default:
+			throw new InternalError("Unexpected node in IR lowering");
+		}
+	}
+
+	bool leaf(ASTNode * node, const LowerState& state, Lowered& result){
+		switch (node->kind()){
+		case NodeKind::ID:
+			result = id(static_cast<IDNode *>(node));
+			return true;
+		case NodeKind::ExitStmt:
+			terminate(IrOp::Exit, 0, 0, 0);
+			return true;
+		case NodeKind::IntLit:
+			result = scalar(LowerKind::Int, constant(
+			  static_cast<IntLitNode *>(node)->getNum()));
+			return true;
+		case NodeKind::True:
+			result = scalar(LowerKind::Bool, constant(1));
+			return true;
+		case NodeKind::False:
+			result = scalar(LowerKind::Bool, constant(0));
+			return true;
+		case NodeKind::Magic:
+			result = scalar(LowerKind::Bool, emit(IrOp::Magic, reg(), 0, 0, 0));
+			return true;
+		case NodeKind::StrLit:
+			result.where = Lowered::Str;
+			result.kind = LowerKind::Str;
+			result.at = string(unquote(
+			  static_cast<StrLitNode *>(node)->getStr()));
+			return true;
+		default:
+			return false;
+		}
+	}
+
+private:
+	IrFunction& fn(){ return myModule->functions[myFns.back().index]; }
+	LowerFn& ctx(){ return myFns.back(); }
+
+	void error(ASTNode * at, const std::string& msg){
+		Report::fatal(at->pos(), msg);
+		myOk = false;
+	}
+
+	uint32_t newFunction(const std::string& name, uint32_t cls){
+		uint32_t index = static_cast<uint32_t>(myModule->functions.size());
+		myModule->functions.emplace_back();
+		myModule->functions.back().name = name;
+		myFnClass.push_back(cls);
+		myReturns.emplace_back();
+		myReturns.back().kind = LowerKind::Void;
+		return index;
+	}
+
+	void beginFunction(uint32_t index, uint32_t cls){
+		myFns.emplace_back();
+		ctx().index = index;
+		ctx().cls = cls;
+		startBlock(newBlock());
+	}
+
+	//Close the function's last block (returning, if it gets
+	// there), and put its blocks in order
+	void endFunction(){
+		IrFunction& out = fn();
+		LowerFn& lf = ctx();
+		if (lf.block != IR_NONE){
+			uint32_t val = IR_NONE;
+			if (out.returnsValue){ val = constant(0); }
+			if (lf.result != IR_NONE){
+				emit(IrOp::Zero, IR_NONE, lf.result,
+				  myClasses[myReturns[lf.index].cls].size, 0);
+			}
+			terminate(IrOp::Return, val, 0, 0);
+		}
+		std::vector<uint32_t> number(lf.firsts.size(), IR_NONE);
+		for (size_t i = 0; i < lf.started.size(); i++){
+			number[lf.started[i]] = static_cast<uint32_t>(i);
+			uint32_t first = lf.firsts[lf.started[i]];
+			uint32_t end = static_cast<uint32_t>(out.code.size());
+			if (i + 1 < lf.started.size()){ end = lf.firsts[lf.started[i + 1]]; }
+			out.blocks.push_back({first, end, lf.depths[i]});
+		}
+		for (IrInstr& in : out.code){
+			if (in.op == IrOp::Jump){
+				in.a = number[in.a];
+			} else if (in.op == IrOp::Branch){
+				in.b = number[in.b];
+				in.c = number[in.c];
+			}
+		}
+		out.code.shrink_to_fit();
+		out.args.shrink_to_fit();
+		myFns.pop_back();
+	}
+
+	uint32_t newBlock(){
+		ctx().firsts.push_back(IR_NONE);
+		return static_cast<uint32_t>(ctx().firsts.size() - 1);
+	}
+
+	//Carry on in block, falling into it from the block before
+	void startBlock(uint32_t block){
+		if (ctx().block != IR_NONE){
+			terminate(IrOp::Jump, block, 0, 0);
+		}
+		ctx().firsts[block] = static_cast<uint32_t>(fn().code.size());
+		ctx().started.push_back(block);
+		ctx().depths.push_back(ctx().loops);
+		ctx().block = block;
+	}
+
+	uint32_t reg(){ return fn().regs++; }
+
+	uint32_t emit(IrOp op, uint32_t dst, uint32_t a, uint32_t b, uint32_t c){
+		//Code after a return or exit is unreachable, but still
+		// lowered, into a block of its own
+		if (ctx().block == IR_NONE){ startBlock(newBlock()); }
+		fn().code.push_back({op, dst, a, b, c});
+		return dst;
+	}
+
+	void terminate(IrOp op, uint32_t a, uint32_t b, uint32_t c){
+		emit(op, IR_NONE, a, b, c);
+		ctx().block = IR_NONE;
+	}
+
+	void jump(uint32_t block){
+		if (ctx().block != IR_NONE){
+			terminate(IrOp::Jump, block, 0, 0);
+		}
+	}
+
+	uint32_t constant(int32_t val){
+		return emit(IrOp::Const, reg(), static_cast<uint32_t>(val), 0, 0);
+	}
+
+	static Lowered scalar(LowerKind kind, uint32_t reg){
+		Lowered val;
+		val.where = Lowered::Reg;
+		val.kind = kind;
+		val.reg = reg;
+		return val;
+	}
+
+	uint32_t string(const std::string& str){
+		auto found = myStrings.find(str);
+		if (found != myStrings.end()){ return found->second; }
+		uint32_t at = static_cast<uint32_t>(myModule->strings.size());
+		myModule->strings.push_back(str);
+		myStrings[str] = at;
+		return at;
+	}
+
+	//The kind (and class) of a type named by type, whose class's
+	// members (if it is a class) are scope
+	Lowered typeOf(std::string type, ScopeTable * scope){
+		Lowered val;
+		if (type.compare(0, 8, "perfect ") == 0){ type = type.substr(8); }
+		if (type == "int"){
+			val.kind = LowerKind::Int;
+		} else if (type == "bool"){
+			val.kind = LowerKind::Bool;
+		} else if (type == "void"){
+			val.kind = LowerKind::Void;
+		} else {
+			auto found = scope != nullptr ? myClassByScope.find(scope)
+			  : myClassByScope.end();
+			if (found == myClassByScope.end()){
+				auto named = myClassByName.find(type);
+				if (named == myClassByName.end()){ return val; }
+				val.cls = named->second;
+			} else {
+				val.cls = found->second;
+			}
+			val.kind = LowerKind::Object;
+		}
+		return val;
+	}
+
+	Lowered typeOf(SemSymbol * symbol){
+		return typeOf(symbol->getType(), symbol->getScopeTable());
+	}
+
+	//The value of val, in a register. An object's value is its
+	// address.
+	uint32_t value(const Lowered& val, ASTNode * at){
+		switch (val.where){
+		case Lowered::Reg:
+			return val.reg;
+		case Lowered::Global:
+			return emit(IrOp::LoadGlobal, reg(), val.at, 0, 0);
+		case Lowered::Mem:
+			if (val.kind == LowerKind::Object){
+				if (val.at == 0){ return val.reg; }
+				return emit(IrOp::Field, reg(), val.reg, val.at, 0);
+			}
+			return emit(IrOp::Load, reg(), val.reg, val.at, 0);
+		case Lowered::Str:
+			error(at, "A string can only be given");
+			break;
+		case Lowered::Fn:
+			error(at, "A function is not a value");
+			break;
+		case Lowered::Nowhere:
+			if (val.kind != LowerKind::Bad){
+				error(at, "A void call has no value");
+			}
+			break;
+		}
+		return constant(0);
+	}
+
+	void store(const Lowered& dst, uint32_t src, ASTNode * at){
+		switch (dst.where){
+		case Lowered::Reg:
+			emit(IrOp::Move, dst.reg, src, 0, 0);
+			break;
+		case Lowered::Global:
+			emit(IrOp::StoreGlobal, IR_NONE, dst.at, src, 0);
+			break;
+		case Lowered::Mem:
+			emit(IrOp::Store, IR_NONE, dst.reg, dst.at, src);
+			break;
+		default:
+			if (dst.kind != LowerKind::Bad){ error(at, "Not a location"); }
+			break;
+		}
+	}
+
+	//Copy an object from src to the address dst
+	void copy(uint32_t dst, uint32_t dstCls, const Lowered& src,
+	  ASTNode * at){
+		if (src.kind != LowerKind::Object || src.cls != dstCls){
+			if (src.kind != LowerKind::Bad){
+				error(at, "Not an object of class " + myClasses[dstCls].name);
+			}
+			return;
+		}
+		uint32_t from = value(src, at);
+		emit(IrOp::Copy, IR_NONE, dst, from, myClasses[dstCls].size);
+	}
+
+	void assign(const Lowered& dst, const Lowered& src, ASTNode * at){
+		if (dst.kind == LowerKind::Object){
+			copy(value(dst, at), dst.cls, src, at);
+		} else {
+			store(dst, value(src, at), at);
+		}
+	}
+
+	//Set up a new object, zeroed, at addr
+	void construct(uint32_t addr, uint32_t cls){
+		emit(IrOp::Zero, IR_NONE, addr, myClasses[cls].size, 0);
+		uint32_t init = myClasses[cls].init;
+		if (init != IR_NONE){
+			uint32_t at = static_cast<uint32_t>(fn().args.size());
+			fn().args.push_back(addr);
+			emit(IrOp::Call, IR_NONE, init, at, 1);
+		}
+	}
+
+	Lowered id(IDNode * node){
+		Lowered val;
+		SemSymbol * symbol = node->getSymbol();
+		auto local = ctx().locals.find(symbol);
+		if (local != ctx().locals.end()){ return local->second; }
+		auto member = myMembers.find(symbol);
+		if (member != myMembers.end()){
+			if (ctx().cls != member->second.first){
+				error(node, "A field outside its class's methods");
+				return val;
+			}
+			const LowerField& field = member->second.second;
+			if (field.kind == LowerKind::Bad){ return val; }
+			val.where = Lowered::Mem;
+			val.kind = field.kind;
+			val.cls = field.cls;
+			val.reg = ctx().self;
+			val.at = field.offset;
+			return val;
+		}
+		auto global = myGlobals.find(symbol);
+		if (global != myGlobals.end()){
+			val = global->second;
+			if (val.kind == LowerKind::Object){
+				val.where = Lowered::Mem;
+				val.reg = emit(IrOp::GlobalAddr, reg(), global->second.at, 0, 0);
+				val.at = 0;
+			}
+			return val;
+		}
+		auto function = myFunctions.find(symbol);
+		if (function != myFunctions.end()){
+			val.where = Lowered::Fn;
+			val.kind = LowerKind::Fn;
+			val.at = function->second;
+			if (myFnClass[function->second] != IR_NONE){
+				if (ctx().cls != myFnClass[function->second]){
+					error(node, "A method outside its class's methods");
+				}
+				val.reg = ctx().self;
+			}
+			return val;
+		}
+		error(node, node->getName() + " has no code in this program");
+		return val;
+	}
+
+	Next classDefn(Frame& f, const Lowered& last){
+		ClassDefnNode * node = static_cast<ClassDefnNode *>(f.node);
+		std::list<DeclNode *> * members = node->getMembers();
+		uint32_t cls = f.state.first;
+		if (f.step == 0){
+			SemSymbol * symbol = node->ID()->getSymbol();
+			cls = static_cast<uint32_t>(myClasses.size());
+			myClasses.emplace_back();
+			myClasses.back().name = node->ID()->getName();
+			myClassByScope[symbol->getScopeTable()] = cls;
+			myClassByName[myClasses.back().name] = cls;
+			f.state.first = cls;
+			//Fields first, so that the class is laid out before
+			// any method makes (or calls) something of it
+			if (needsInit(members)){
+				myClasses[cls].init = newFunction(
+				  myClasses[cls].name + ".<init>", cls);
+				beginFunction(myClasses[cls].init, cls);
+				fn().params = 1;
+				ctx().self = reg();
+			}
+			f.start(members);
+			f.step = 1;
+		}
+		if (f.step == 1){
+			//Finish the field whose initialiser was just lowered
+			if (f.state.second != IR_NONE){
+				Lowered dst;
+				dst.where = Lowered::Mem;
+				dst.kind = f.state.held.kind;
+				dst.cls = f.state.held.cls;
+				dst.reg = ctx().self;
+				dst.at = f.state.second;
+				assign(dst, last, node);
+				f.state.second = IR_NONE;
+			}
+			while (DeclNode * member = f.next(members)){
+				if (member->kind() != NodeKind::VarDecl){ continue; }
+				VarDeclNode * decl = static_cast<VarDeclNode *>(member);
+				SemSymbol * symbol = decl->ID()->getSymbol();
+				Lowered type = typeOf(symbol);
+				LowerClass& lc = myClasses[cls];
+				LowerField field = {type.kind, type.cls, lc.size};
+				if (type.kind == LowerKind::Bad){
+					error(decl->ID(), "A field of a class from outside the program");
+				} else if (type.kind == LowerKind::Object
+				  && !myClasses[type.cls].laidOut){
+					error(decl->ID(), "A class can't contain itself");
+					field.kind = LowerKind::Bad;
+				}
+				if (field.kind == LowerKind::Bad){
+					lc.fields[decl->ID()->getName()] = field;
+					myMembers[symbol] = std::make_pair(cls, field);
+					continue;
+				}
+				lc.size += type.kind == LowerKind::Object
+				  ? myClasses[type.cls].size : 1;
+				lc.fields[decl->ID()->getName()] = field;
+				myMembers[symbol] = std::make_pair(cls, field);
+				if (decl->getInit() != nullptr){
+					f.state.held = type;
+					f.state.second = field.offset;
+					return into(decl->getInit());
+				}
+				if (type.kind == LowerKind::Object
+				  && myClasses[type.cls].init != IR_NONE){
+					uint32_t addr = emit(IrOp::Field, reg(), ctx().self,
+					  field.offset, 0);
+					construct(addr, type.cls);
+				}
+			}
+			myClasses[cls].laidOut = true;
+			if (myClasses[cls].init != IR_NONE){ endFunction(); }
+			f.start(members);
+			f.step = 2;
+		}
+		while (DeclNode * member = f.next(members)){
+			if (member->kind() == NodeKind::FnDecl){
+				return into(member, methodOf(cls));
+			}
+		}
+		return done();
+	}
+
+	static LowerState methodOf(uint32_t cls){
+		LowerState state;
+		state.first = cls;
+		return state;
+	}
+
+	//Whether objects of a class with these members need more
+	// setting up than zeroing
+	bool needsInit(std::list<DeclNode *> * members){
+		for (DeclNode * member : *members){
+			if (member->kind() != NodeKind::VarDecl){ continue; }
+			VarDeclNode * decl = static_cast<VarDeclNode *>(member);
+			if (decl->getInit() != nullptr){ return true; }
+			SemSymbol * symbol = decl->ID()->getSymbol();
+			Lowered type = typeOf(symbol);
+			if (type.kind == LowerKind::Object && myClasses[type.cls].laidOut
+			  && myClasses[type.cls].init != IR_NONE){
+				return true;
+			}
+		}
+		return false;
+	}
+
+	Next varDecl(Frame& f, const Lowered& last){
+		VarDeclNode * node = static_cast<VarDeclNode *>(f.node);
+		if (f.step == 0){
+			f.step = 1;
+			if (node->getInit() != nullptr){ return into(node->getInit()); }
+		}
+		SemSymbol * symbol = node->ID()->getSymbol();
+		Lowered val = typeOf(symbol);
+		if (val.kind == LowerKind::Bad){
+			error(node->ID(), "A variable of a class from outside the program");
+			if (myFns.size() == 1){
+				myGlobals[symbol] = val;
+			} else {
+				ctx().locals[symbol] = val;
+			}
+			return done();
+		}
+		uint32_t size = 1;
+		if (val.kind == LowerKind::Object){ size = myClasses[val.cls].size; }
+		bool global = myFns.size() == 1;
+		if (global){
+			val.where = Lowered::Global;
+			val.at = myModule->globalSlots;
+			myModule->globals.push_back({node->ID()->getName(), symbol->getType(),
+			  myModule->globalSlots, size});
+			myModule->globalSlots += size;
+			myGlobals[symbol] = val;
+		}
+		if (val.kind == LowerKind::Object){
+			uint32_t addr;
+			if (global){
+				addr = emit(IrOp::GlobalAddr, reg(), val.at, 0, 0);
+			} else {
+				addr = emit(IrOp::FrameAddr, reg(), fn().frameSlots, 0, 0);
+				fn().frameSlots += size;
+			}
+			if (node->getInit() != nullptr){
+				copy(addr, val.cls, last, node->getInit());
+			} else if (!global){
+				construct(addr, val.cls);
+			} else if (myClasses[val.cls].init != IR_NONE){
+				//Globals start zeroed
+				uint32_t at = static_cast<uint32_t>(fn().args.size());
+				fn().args.push_back(addr);
+				emit(IrOp::Call, IR_NONE, myClasses[val.cls].init, at, 1);
+			}
+			val.where = Lowered::Mem;
+			val.reg = addr;
+			val.at = 0;
+		} else if (global){
+			if (node->getInit() != nullptr){
+				store(val, value(last, node->getInit()), node);
+			}
+		} else {
+			val.where = Lowered::Reg;
+			val.reg = reg();
+			if (node->getInit() != nullptr){
+				emit(IrOp::Move, val.reg, value(last, node->getInit()), 0, 0);
+			} else {
+				emit(IrOp::Const, val.reg, 0, 0, 0);
+			}
+		}
+		if (!global){ ctx().locals[symbol] = val; }
+		return done();
+	}
+
+	Next fnDecl(Frame& f){
+		FnDeclNode * node = static_cast<FnDeclNode *>(f.node);
+		if (f.step == 0){
+			f.step = 1;
+			uint32_t cls = f.state.first;
+			SemSymbol * symbol = node->ID()->getSymbol();
+			std::string name = node->ID()->getName();
+			uint32_t index;
+			if (cls == IR_NONE){
+				index = newFunction(name, cls);
+				myGlobalFns[name] = index;
+			} else {
+				index = newFunction(myClasses[cls].name + "." + name, cls);
+				myClasses[cls].methods[name] = index;
+			}
+			myFunctions[symbol] = index;
+			Lowered ret = typeOf(node->getTypeNode()->getType(),
+			  node->getTypeNode()->getSymbol() == nullptr ? nullptr
+			  : node->getTypeNode()->getSymbol()->getScopeTable());
+			if (ret.kind == LowerKind::Bad){
+				error(node->getTypeNode(), "A class from outside the program");
+			}
+			myReturns[index] = ret;
+			myModule->functions[index].returnsValue =
+			  ret.kind == LowerKind::Int || ret.kind == LowerKind::Bool;
+			beginFunction(index, cls);
+			if (cls != IR_NONE){ ctx().self = reg(); }
+			for (FormalDeclNode * formal : *node->getFormals()){
+				SemSymbol * param = formal->ID()->getSymbol();
+				Lowered val = typeOf(param);
+				uint32_t at = reg();
+				if (val.kind == LowerKind::Bad){
+					error(formal->ID(), "A formal of a class from outside the program");
+				} else {
+					val.where = val.kind == LowerKind::Object ? Lowered::Mem
+					  : Lowered::Reg;
+					val.reg = at;
+				}
+				ctx().locals[param] = val;
+			}
+			//An object is returned by copying it to where the
+			// caller says, as if that were one more formal
+			if (ret.kind == LowerKind::Object){ ctx().result = reg(); }
+			fn().params = fn().regs;
+			f.start(node->getBody());
+		}
+		if (StmtNode * stmt = f.next(node->getBody())){
+			return into(stmt);
+		}
+		endFunction();
+		return done();
+	}
+
+	Next takeStmt(Frame& f, const Lowered& last){
+		TakeStmtNode * node = static_cast<TakeStmtNode *>(f.node);
+		if (f.step++ == 0){ return into(node->getDst()); }
+		if (last.kind == LowerKind::Int){
+			store(last, emit(IrOp::TakeInt, reg(), 0, 0, 0), node);
+		} else if (last.kind == LowerKind::Bool){
+			store(last, emit(IrOp::TakeBool, reg(), 0, 0, 0), node);
+		} else if (last.kind != LowerKind::Bad){
+			error(node->getDst(), "Only an int or bool can be taken");
+		}
+		return done();
+	}
+
+	Next giveStmt(Frame& f, const Lowered& last){
+		GiveStmtNode * node = static_cast<GiveStmtNode *>(f.node);
+		if (f.step++ == 0){ return into(node->getSrc()); }
+		if (last.where == Lowered::Str){
+			emit(IrOp::GiveStr, IR_NONE, last.at, 0, 0);
+		} else if (last.kind == LowerKind::Int){
+			emit(IrOp::GiveInt, IR_NONE, value(last, node->getSrc()), 0, 0);
+		} else if (last.kind == LowerKind::Bool){
+			emit(IrOp::GiveBool, IR_NONE, value(last, node->getSrc()), 0, 0);
+		} else if (last.kind != LowerKind::Bad){
+			error(node->getSrc(), "Only an int, bool or string can be given");
+		}
+		return done();
+	}
+
+	Next postStmt(Frame& f, const Lowered& last){
+		LocNode * loc;
+		if (f.node->kind() == NodeKind::PostIncStmt){
+			loc = static_cast<PostIncStmtNode *>(f.node)->getLoc();
+		} else {
+			loc = static_cast<PostDecStmtNode *>(f.node)->getLoc();
+		}
+		if (f.step++ == 0){ return into(loc); }
+		if (last.kind != LowerKind::Int){
+			if (last.kind != LowerKind::Bad){ error(loc, "Not an int"); }
+			return done();
+		}
+		uint32_t val = value(last, loc);
+		uint32_t one = constant(1);
+		IrOp op = f.node->kind() == NodeKind::PostIncStmt ? IrOp::Add
+		  : IrOp::Sub;
+		store(last, emit(op, reg(), val, one, 0), loc);
+		return done();
+	}
+
+	//Branch on cond to a new block, which is started, or to the
+	// block returned
+	uint32_t branch(const Lowered& cond, ASTNode * at, uint32_t taken){
+		uint32_t test = value(cond, at);
+		uint32_t other = newBlock();
+		terminate(IrOp::Branch, test, taken, other);
+		startBlock(taken);
+		return other;
+	}
+
+	Next ifStmt(Frame& f, const Lowered& last){
+		IfStmtNode * node = static_cast<IfStmtNode *>(f.node);
+		if (f.step == 0){
+			f.step = 1;
+			return into(node->getCond());
+		}
+		if (f.step == 1){
+			f.state.first = branch(last, node->getCond(), newBlock());
+			f.start(node->getBody());
+			f.step = 2;
+		}
+		if (StmtNode * stmt = f.next(node->getBody())){
+			return into(stmt);
+		}
+		startBlock(f.state.first);
+		return done();
+	}
+
+	Next ifElseStmt(Frame& f, const Lowered& last){
+		IfElseStmtNode * node = static_cast<IfElseStmtNode *>(f.node);
+		if (f.step == 0){
+			f.step = 1;
+			return into(node->getCond());
+		}
+		if (f.step == 1){
+			f.state.first = branch(last, node->getCond(), newBlock());
+			f.start(node->getBodyTrue());
+			f.step = 2;
+		}
+		if (f.step == 2){
+			if (StmtNode * stmt = f.next(node->getBodyTrue())){
+				return into(stmt);
+			}
+			f.state.second = newBlock();
+			jump(f.state.second);
+			startBlock(f.state.first);
+			f.start(node->getBodyFalse());
+			f.step = 3;
+		}
+		if (StmtNode * stmt = f.next(node->getBodyFalse())){
+			return into(stmt);
+		}
+		startBlock(f.state.second);
+		return done();
+	}
+
+	Next whileStmt(Frame& f, const Lowered& last){
+		WhileStmtNode * node = static_cast<WhileStmtNode *>(f.node);
+		if (f.step == 0){
+			f.step = 1;
+			f.state.first = newBlock();
+			ctx().loops++;
+			startBlock(f.state.first);
+			return into(node->getCond());
+		}
+		if (f.step == 1){
+			f.state.second = branch(last, node->getCond(), newBlock());
+			f.start(node->getBody());
+			f.step = 2;
+		}
+		if (StmtNode * stmt = f.next(node->getBody())){
+			return into(stmt);
+		}
+		jump(f.state.first);
+		ctx().loops--;
+		startBlock(f.state.second);
+		return done();
+	}
+
+	Next returnStmt(Frame& f, const Lowered& last){
+		ReturnStmtNode * node = static_cast<ReturnStmtNode *>(f.node);
+		if (f.step++ == 0 && node->getExp() != nullptr){
+			return into(node->getExp());
+		}
+		uint32_t val = IR_NONE;
+		if (ctx().result != IR_NONE){
+			if (node->getExp() == nullptr){
+				error(node, "Missing return value");
+			} else {
+				copy(ctx().result, myReturns[ctx().index].cls, last,
+				  node->getExp());
+			}
+		} else if (node->getExp() != nullptr){
+			val = value(last, node->getExp());
+			if (!fn().returnsValue){
+				error(node->getExp(), "Return with a value from a void function");
+				val = IR_NONE;
+			}
+		} else if (fn().returnsValue){
+			error(node, "Missing return value");
+			val = constant(0);
+		}
+		terminate(IrOp::Return, val, 0, 0);
+		return done();
+	}
+
+	Next callExp(Frame& f, const Lowered& last){
+		CallExpNode * node = static_cast<CallExpNode *>(f.node);
+		if (f.step == 0){
+			f.step = 1;
+			return into(node->getCallee());
+		}
+		if (f.step == 1){
+			f.state.held = last;
+			f.state.first = static_cast<uint32_t>(myArgs.size());
+			if (last.where != Lowered::Fn && last.kind != LowerKind::Bad){
+				error(node->getCallee(), "Not a function");
+			}
+			if (last.where == Lowered::Fn && last.reg != IR_NONE){
+				myArgs.push_back(last.reg);
+			}
+			f.start(node->getArgs());
+			f.step = 2;
+		} else {
+			myArgs.push_back(value(last, node));
+		}
+		if (ExpNode * arg = f.next(node->getArgs())){
+			return into(arg);
+		}
+
+		const Lowered& callee = f.state.held;
+		uint32_t count = static_cast<uint32_t>(myArgs.size() - f.state.first);
+		if (callee.where == Lowered::Fn){
+			if (arity(callee.at) != count){
+				error(node, "Wrong number of arguments");
+			} else {
+				f.result = call(callee.at, f.state.first);
+			}
+		}
+		myArgs.resize(f.state.first);
+		return done();
+	}
+
+	//How many arguments a function takes (its receiver being
+	// one), not counting where it returns an object to
+	uint32_t arity(uint32_t function){
+		uint32_t params = myModule->functions[function].params;
+		if (myReturns[function].kind == LowerKind::Object){ params--; }
+		return params;
+	}
+
+	//Call a function with the arguments myArgs holds from first on
+	Lowered call(uint32_t function, uint32_t first){
+		Lowered result = myReturns[function];
+		if (result.kind == LowerKind::Object){
+			result.where = Lowered::Mem;
+			result.reg = emit(IrOp::FrameAddr, reg(), fn().frameSlots, 0, 0);
+			result.at = 0;
+			fn().frameSlots += myClasses[result.cls].size;
+			myArgs.push_back(result.reg);
+		}
+		uint32_t at = static_cast<uint32_t>(fn().args.size());
+		uint32_t count = static_cast<uint32_t>(myArgs.size() - first);
+		fn().args.insert(fn().args.end(), myArgs.begin() + first, myArgs.end());
+		myArgs.resize(first);
+		uint32_t dst = IR_NONE;
+		if (myModule->functions[function].returnsValue){
+			dst = reg();
+			result.where = Lowered::Reg;
+			result.reg = dst;
+		}
+		emit(IrOp::Call, dst, function, at, count);
+		return result;
+	}
+
+	Next memberFieldExp(Frame& f, const Lowered& last){
+		MemberFieldExpNode * node = static_cast<MemberFieldExpNode *>(f.node);
+		if (f.step++ == 0){ return into(node->getBase()); }
+		if (last.kind != LowerKind::Object){
+			if (last.kind != LowerKind::Bad){
+				error(node->getBase(), "Not an object");
+			}
+			return done();
+		}
+		const LowerClass& lc = myClasses[last.cls];
+		const std::string& name = node->getField()->getName();
+		auto field = lc.fields.find(name);
+		if (field != lc.fields.end()){
+			if (field->second.kind == LowerKind::Bad){ return done(); }
+			f.result = last;
+			f.result.kind = field->second.kind;
+			f.result.cls = field->second.cls;
+			f.result.at += field->second.offset;
+			return done();
+		}
+		auto method = lc.methods.find(name);
+		if (method != lc.methods.end()){
+			f.result.where = Lowered::Fn;
+			f.result.kind = LowerKind::Fn;
+			f.result.at = method->second;
+			f.result.reg = value(last, node->getBase());
+			return done();
+		}
+		error(node->getField(), lc.name + " has no member " + name);
+		return done();
+	}
+
+	Next binary(Frame& f, const Lowered& last, IrOp op){
+		BinaryExpNode * node = static_cast<BinaryExpNode *>(f.node);
+		switch (f.step++){
+		case 0: return into(node->getExp1());
+		case 1:
+			//Work out the left's value before the right can change it
+			f.state.held = scalar(last.kind, value(last, node->getExp1()));
+			return into(node->getExp2());
+		}
+		if (f.state.held.kind == LowerKind::Object
+		  || last.kind == LowerKind::Object){
+			error(node, "Objects can't be operands");
+		}
+		uint32_t right = value(last, node->getExp2());
+		LowerKind kind = LowerKind::Bool;
+		if (op == IrOp::Add || op == IrOp::Sub || op == IrOp::Mul
+		  || op == IrOp::Div){
+			kind = LowerKind::Int;
+		}
+		f.result = scalar(kind, emit(op, reg(), f.state.held.reg, right, 0));
+		return done();
+	}
+
+	//and, or: the right is only worked out if the left doesn't
+	// already decide the answer
+	Next logical(Frame& f, const Lowered& last, bool isAnd){
+		BinaryExpNode * node = static_cast<BinaryExpNode *>(f.node);
+		switch (f.step++){
+		case 0: return into(node->getExp1());
+		case 1: {
+			uint32_t result = reg();
+			uint32_t left = value(last, node->getExp1());
+			emit(IrOp::Move, result, left, 0, 0);
+			uint32_t right = newBlock();
+			uint32_t join = newBlock();
+			if (isAnd){
+				terminate(IrOp::Branch, left, right, join);
+			} else {
+				terminate(IrOp::Branch, left, join, right);
+			}
+			startBlock(right);
+			f.state.held = scalar(LowerKind::Bool, result);
+			f.state.first = join;
+			return into(node->getExp2());
+		}
+		}
+		emit(IrOp::Move, f.state.held.reg, value(last, node->getExp2()), 0, 0);
+		startBlock(f.state.first);
+		f.result = f.state.held;
+		return done();
+	}
+
+	Next unary(Frame& f, const Lowered& last, IrOp op){
+		UnaryExpNode * node = static_cast<UnaryExpNode *>(f.node);
+		if (f.step++ == 0){ return into(node->getExp()); }
+		LowerKind kind = op == IrOp::Neg ? LowerKind::Int : LowerKind::Bool;
+		f.result = scalar(kind, emit(op, reg(), value(last, node->getExp()),
+		  0, 0));
+		return done();
+	}
+
+	IrModule * myModule;
+	bool myOk;
+	std::vector<LowerFn> myFns;
+	std::vector<LowerClass> myClasses;
+	//Per function: the class it is a method of, and what it
+	// returns
+	std::vector<uint32_t> myFnClass;
+	std::vector<Lowered> myReturns;
+	std::unordered_map<ScopeTable *, uint32_t> myClassByScope;
+	std::unordered_map<std::string, uint32_t> myClassByName;
+	std::unordered_map<SemSymbol *, uint32_t> myFunctions;
+	std::unordered_map<std::string, uint32_t> myGlobalFns;
+	std::unordered_map<SemSymbol *, Lowered> myGlobals;
+	std::unordered_map<SemSymbol *, std::pair<uint32_t, LowerField>>
+	  myMembers;
+	std::unordered_map<std::string, uint32_t> myStrings;
+	//The arguments of the calls being lowered
+	std::vector<uint32_t> myArgs;
+};
+
+IrBuilder::IrBuilder() : myLowerer(new Lowerer()){ }
+
+IrBuilder::~IrBuilder(){ delete myLowerer; }
+
+bool IrBuilder::add(DeclNode * decl){
+	return myLowerer->add(decl);
+}
+
+IrModule * IrBuilder::finish(){
+	return myLowerer->finish();
+}
+
+}
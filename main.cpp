@@ -2,24 +2,197 @@
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <vector>
+#include <cctype>
+#include <climits>
+#include <cerrno>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "binary_ast.hpp"
+#include "cache.hpp"
+#include "descent.hpp"
 #include "errors.hpp"
+#include "flat_ast.hpp"
+#include "fold.hpp"
+#include "dce.hpp"
+#include "ir.hpp"
 #include "scanner.hpp"
 #include "name_analysis.hpp"
+#include "pipeline.hpp"
+#include "server.hpp"
+#include "ssa.hpp"
+#include "gvn.hpp"
+#include "inline.hpp"
+#include "loop.hpp"
+#include "stats.hpp"
+#include "stream.hpp"
+#include "summary.hpp"
+#include "x64.hpp"
+#include "vm.hpp"
+#include "xref.hpp"
 
 using namespace drewno_mars;
 
-static void usageAndDie(){
-	std::cerr << "Usage: dmc <infile>"
+//Options that change how (rather than what) dmc compiles
+struct Tuning{
+	unsigned int unparseThreads = 0;
+	bool pipelineLexer = false;
+	bool streaming = false;
+	bool memoize = false;
+	bool flat = false;
+	bool descent = false;
+	const char * cacheDir = nullptr;
+	uint64_t cacheLimit = 256 << 20;
+};
+static Tuning tuning;
+
+static bool usage(){
+	std::cerr << "Usage: dmc <infile | - for stdin>"
 	<< " [-u <unparseFile>]: Output canonical program form\n"
 	<< " [-p]: Parse the input to check syntax\n"
 	<< " [-t <tokensFile>]: Output tokens to <tokensFile>\n"
 	<< " [-n <nameFile>]: Output canonical form with bindings to <nameFile>\n"
+	<< " [-b <binaryFile>]: Output the AST in binary form, which dmc\n"
+	<< "    accepts in place of source (with bindings, if -n succeeds)\n"
+	<< " [-x <xrefFile>]: Output a cross-reference index of the names\n"
+	<< "    that name analysis binds, for dmc --query\n"
+	<< " [-S <summaryFile>]: Output a summary of the global declarations,\n"
+	<< "    for other programs to be compiled against with -I\n"
+	<< " [-a <irFile>]: Output the program lowered to the linear IR\n"
+	<< " [-o <asmFile>]: Output the program as x86-64 assembly, which\n"
+	<< "    cc builds into an executable\n"
+	<< " [-r]: Run the program on the bytecode interpreter\n"
+	<< " [-N]: Lower the program as written, without optimising it\n"
+	<< " [-I <summaryFile>]: Compile as if the program summarised (by -S)\n"
+	<< "    came first\n"
+	<< " [-j <threads>]: Unparse globals in parallel on <threads> threads\n"
+	<< " [-l]: Lex on a separate thread, pipelined with parsing\n"
+	<< " [-v]: Report timings and counters on stderr\n"
+	<< " [-s]: Stream: unparse/analyse each declaration as it is parsed\n"
+	<< " [-m]: Reuse the name analysis of repeated functions and classes\n"
+	<< " [-f]: Hold the AST flat, rebuilding a declaration at a time\n"
+	<< " [-d]: Parse by hand-written recursive descent, not bison's tables\n"
+	<< " [-k <dir>]: Reuse (and keep) results cached in <dir>\n"
+	<< " [-K <megabytes>]: Cap the size of the -k cache (default 256)\n"
+	<< "Or: dmc --server <socket>: Serve compile requests on <socket>\n"
+	<< "    dmc --client <socket> <usual arguments>: Compile via a server\n"
+	<< "    dmc --client <socket> --stop: Shut a server down\n"
+	<< "Or: dmc --query <xrefFile> def|refs <line>:<col> | <offset>: Find\n"
+	<< "    the definition of, or references to, the name at a location\n"
 	;
-	exit(1);
+	return false;
+}
+
+//What dmc was asked to do
+struct Request{
+	const char * inFile = nullptr;
+	const char * tokensFile = nullptr;
+	bool checkParse = false;
+	const char * unparseFile = nullptr;
+	const char * namesFile = nullptr;
+	const char * binaryFile = nullptr;
+	const char * xrefFile = nullptr;
+	const char * summaryFile = nullptr;
+	const char * irFile = nullptr;
+	const char * asmFile = nullptr;
+	bool runProgram = false;
+	const char * preludeFile = nullptr;
+	bool checkTypes = false;
+	//Whether to optimise the program as it is lowered (see -N)
+	bool optimise = true;
+
+	//Whether anything asked for needs name analysis
+	bool analyse() const{
+		return namesFile != nullptr || xrefFile != nullptr
+		  || summaryFile != nullptr || lower();
+	}
+
+	//Whether anything asked for needs the IR
+	bool lower() const{
+		return irFile != nullptr || asmFile != nullptr || runProgram;
+	}
+
+	//The file the output flag role (t, u, n, b, x, S, a or o) names
+	const char * output(char role) const{
+		switch (role){
+		case 't': return tokensFile;
+		case 'u': return unparseFile;
+		case 'n': return namesFile;
+		case 'b': return binaryFile;
+		case 'x': return xrefFile;
+		case 'S': return summaryFile;
+		case 'a': return irFile;
+		case 'o': return asmFile;
+		default: return nullptr;
+		}
+	}
+};
+
+//The output flags, in the order their files are written
+static const char outputRoles[] = {'t', 'u', 'n', 'b', 'x', 'S', 'a', 'o'};
+
+//Standard input can only be read once, so it is kept here and
+// replayed for each pass that reads "-"
+static std::string stdinText;
+static bool stdinRead = false;
+
+//When set (by the compile server), output files are captured
+// here, by path, instead of being written
+static std::map<std::string, std::ostringstream> * capturedFiles = nullptr;
+
+//Open the program to compile
+static std::unique_ptr<std::istream> openInput(const char * inPath){
+	if (strcmp(inPath, "-") == 0){
+		if (!stdinRead){
+			std::ostringstream text;
+			text << std::cin.rdbuf();
+			stdinText = text.str();
+			stdinRead = true;
+		}
+		return std::unique_ptr<std::istream>(
+		  new std::istringstream(stdinText));
+	}
+	return std::unique_ptr<std::istream>(new std::ifstream(inPath));
+}
+
+//A binary AST (see -b) given in place of source, or null
+static AstImage * openImage(const char * inPath){
+	if (strcmp(inPath, "-") == 0){
+		openInput(inPath);
+		if (!AstImage::isImage(stdinText.data(), stdinText.size())){
+			return nullptr;
+		}
+		return AstImage::copy(stdinText);
+	}
+	return AstImage::map(inPath);
+}
+
+static std::ostream * openOutput(const char * outPath,
+  std::ofstream& file){
+	if (outPath == nullptr){ return nullptr; }
+	if (strcmp(outPath, "--") == 0){ return &std::cout; }
+	if (capturedFiles != nullptr){
+		std::ostringstream& captured = (*capturedFiles)[outPath];
+		captured.str("");
+		return &captured;
+	}
+	file.open(outPath);
+	if (!file.good()){
+		std::string msg = "Bad output file ";
+		msg += outPath;
+		throw new drewno_mars::InternalError(msg.c_str());
+	}
+	return &file;
 }
 
 static void writeTokenStream(const char * inPath, const char * outPath){
-	std::ifstream inStream(inPath);
+	std::unique_ptr<std::istream> input = openInput(inPath);
+	std::istream& inStream = *input;
 	if (!inStream.good()){
 		std::string msg = "Bad input stream";
 		msg += inPath;
@@ -29,25 +202,52 @@ static void writeTokenStream(const char * inPath, const char * outPath){
 		std::string msg = "No tokens output file given";
 		throw new InternalError(msg.c_str());
 	}
+	std::unique_ptr<AstImage> image(openImage(inPath));
+	if (image != nullptr){
+		throw new UserError("A binary AST has no tokens to output");
+	}
 
 	Scanner scanner(&inStream);
-	if (strcmp(outPath, "--") == 0){
-		scanner.outputTokens(std::cout);
+	std::ofstream outFile;
+	scanner.outputTokens(*openOutput(outPath, outFile));
+}
+
+static int parseFrom(drewno_mars::Scanner& scanner,
+  drewno_mars::ProgramNode ** root, drewno_mars::DeclSink * sink){
+	if (tuning.descent){
+		drewno_mars::DescentParser parser(scanner, root, sink);
+		return parser.parse();
+	}
+	drewno_mars::Parser parser(scanner, root, sink);
+	return parser.parse();
+}
+
+static int runParser(std::istream * in, drewno_mars::ProgramNode ** root,
+  drewno_mars::DeclSink * sink){
+	Stopwatch timer;
+	int errCode;
+	if (tuning.pipelineLexer){
+		drewno_mars::PipelinedScanner scanner(in);
+		errCode = parseFrom(scanner, root, sink);
 	} else {
-		std::ofstream outStream(outPath);
-		if (!outStream.good()){
-			std::string msg = "Bad output file ";
-			msg += outPath;
-			throw new InternalError(msg.c_str());
-		}
-		scanner.outputTokens(outStream);
-		outStream.close();
+		drewno_mars::Scanner scanner(in);
+		errCode = parseFrom(scanner, root, sink);
 	}
+	Stats::time("lex+parse", timer.seconds());
+	return errCode;
 }
 
 static drewno_mars::ProgramNode * parse(const char * inFile){
-	std::ifstream inStream(inFile);
-	if (!inStream.good()){
+	std::unique_ptr<AstImage> image(openImage(inFile));
+	if (image != nullptr){
+		Stopwatch timer;
+		drewno_mars::ProgramNode * root = image->rebuild();
+		Stats::time("binary AST load", timer.seconds());
+		return root;
+	}
+
+	std::unique_ptr<std::istream> inStream = openInput(inFile);
+	if (!inStream->good()){
 		std::string msg = "Bad input stream ";
 		msg += inFile;
 		throw new UserError(msg.c_str());
@@ -57,27 +257,167 @@ static drewno_mars::ProgramNode * parse(const char * inFile){
 	// AST after parsing
 	drewno_mars::ProgramNode * root = nullptr;
 
-	drewno_mars::Scanner scanner(&inStream);
-	drewno_mars::Parser parser(scanner, &root);
-
-	int errCode = parser.parse();
-	if (errCode != 0){ return nullptr; }
+	int errCode = runParser(inStream.get(), &root, nullptr);
+	if (errCode != 0){
+		//The parser may have finished the program before
+		// finding the error
+		delete root;
+		return nullptr;
+	}
 
 	return root;
 }
 
-static void outputAST(ASTNode * ast, const char * outPath){
+//The summary a program is compiled against (see -I), if any
+static Summary * openPrelude(const char * path){
+	if (path == nullptr){ return nullptr; }
+	Stopwatch timer;
+	Summary * prelude = Summary::map(path);
+	Stats::time("prelude load", timer.seconds());
+	return prelude;
+}
+
+//Parse, unparse and name-analyse in a single pass, one
+// declaration at a time (see DeclStream). Reads standard
+// input directly rather than buffering it.
+static int doStreaming(const char * inPath, const char * unparsePath,
+  const char * namesPath, const char * preludePath){
+	std::ifstream file;
+	std::istream * in = &std::cin;
+	if (strcmp(inPath, "-") != 0){
+		std::unique_ptr<AstImage> image(AstImage::map(inPath));
+		if (image != nullptr){
+			throw new UserError("-s needs source, not a binary AST");
+		}
+		file.open(inPath);
+		if (!file.good()){
+			std::string msg = "Bad input stream ";
+			msg += inPath;
+			throw new UserError(msg.c_str());
+		}
+		in = &file;
+	}
+
+	std::ofstream unparseFile;
+	std::ofstream namesFile;
+	std::ostream * unparseOut = openOutput(unparsePath, unparseFile);
+	std::ostream * namesOut = openOutput(namesPath, namesFile);
+
+	drewno_mars::DeclStream stream(unparseOut, namesOut,
+	  openPrelude(preludePath));
+	drewno_mars::ProgramNode * root = nullptr;
+	int errCode = runParser(in, &root, &stream);
+	delete root;
+	Stats::count("streamed declarations", stream.declCount());
+
+	if (errCode != 0){
+		std::cerr << "Parse failed" << std::endl;
+		return 1;
+	}
+	if (!stream.analysisOK()){
+		std::cerr << "Name Analysis Failed\n";
+		return 1;
+	}
+	return 0;
+}
+
+static void writeBuffers(const std::vector<std::string>& buffers,
+  const char * outPath){
+	if (capturedFiles != nullptr){
+		std::ofstream unused;
+		std::ostream * out = openOutput(outPath, unused);
+		for (const std::string& buf : buffers){ *out << buf; }
+		return;
+	}
+
+	int fd = STDOUT_FILENO;
 	if (strcmp(outPath, "--") == 0){
-		ast->unparse(std::cout, 0);
+		//Anything already queued on cout has to come out first
+		std::cout.flush();
 	} else {
-		std::ofstream outStream(outPath);
-		if (!outStream.good()){
+		fd = open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0){
 			std::string msg = "Bad output file ";
 			msg += outPath;
 			throw new drewno_mars::InternalError(msg.c_str());
 		}
-		ast->unparse(outStream, 0);
 	}
+
+	std::vector<struct iovec> iov;
+	for (const std::string& buf : buffers){
+		if (buf.empty()){ continue; }
+		struct iovec v;
+		v.iov_base = const_cast<char *>(buf.data());
+		v.iov_len = buf.size();
+		iov.push_back(v);
+	}
+
+	//Hand the buffers to the kernel as a single gather write
+	// (in batches of at most IOV_MAX), picking up after any
+	// short write where it left off
+	size_t first = 0;
+	while (first < iov.size()){
+		size_t count = iov.size() - first;
+		if (count > IOV_MAX){ count = IOV_MAX; }
+		ssize_t written = writev(fd, &iov[first],
+		  static_cast<int>(count));
+		if (written < 0){
+			if (errno == EINTR){ continue; }
+			throw new drewno_mars::InternalError("Output write failed");
+		}
+		size_t remaining = static_cast<size_t>(written);
+		while (first < iov.size() && remaining >= iov[first].iov_len){
+			remaining -= iov[first].iov_len;
+			first++;
+		}
+		if (remaining > 0){
+			iov[first].iov_base =
+			  static_cast<char *>(iov[first].iov_base) + remaining;
+			iov[first].iov_len -= remaining;
+		}
+	}
+
+	if (fd != STDOUT_FILENO){ close(fd); }
+}
+
+static void outputAST(ProgramNode * ast, const char * outPath){
+	Stopwatch timer;
+	if (tuning.unparseThreads > 0){
+		writeBuffers(ast->unparseGlobals(0, tuning.unparseThreads),
+		  outPath);
+	} else {
+		std::ofstream outFile;
+		ast->unparse(*openOutput(outPath, outFile), 0);
+	}
+	Stats::time("unparse", timer.seconds());
+}
+
+static void writeBinary(ProgramNode * ast, const char * outPath){
+	Stopwatch timer;
+	AstWriter writer;
+	uint32_t root = writer.tree(ast);
+	std::ofstream outFile;
+	writer.write(*openOutput(outPath, outFile), root);
+	Stats::time("binary AST write", timer.seconds());
+}
+
+//Write out the cross-reference index of analysed trees (see
+// -x). Byte offsets can only be looked up in it if the program
+// was given as source.
+static void writeXref(XrefWriter& xref, const char * inPath,
+  const char * outPath){
+	Stopwatch timer;
+	std::unique_ptr<AstImage> image(openImage(inPath));
+	if (image == nullptr){
+		std::unique_ptr<std::istream> input = openInput(inPath);
+		std::ostringstream text;
+		text << input->rdbuf();
+		xref.source(text.str());
+	}
+	std::ofstream outFile;
+	xref.write(*openOutput(outPath, outFile));
+	Stats::count("xref references", xref.refCount());
+	Stats::time("xref write", timer.seconds());
 }
 
 static bool doUnparsing(const char * inputPath, const char * outPath){
@@ -88,103 +428,546 @@ static bool doUnparsing(const char * inputPath, const char * outPath){
 	}
 
 	outputAST(ast, outPath);
+	delete ast;
 	return true;
 }
 
-static drewno_mars::NameAnalysis * doNameAnalysis(const char * inputPath){
+//Run name analysis on a parsed tree, which the analysis (or,
+// if it fails, this) takes
+static drewno_mars::NameAnalysis * analyseTree(drewno_mars::ProgramNode * ast,
+  const char * preludePath){
+	Summary * prelude;
+	try {
+		prelude = openPrelude(preludePath);
+	} catch (UserError *){
+		delete ast;
+		throw;
+	}
+	Stopwatch timer;
+	drewno_mars::NameAnalysis * na = drewno_mars::NameAnalysis::build(ast,
+	  tuning.memoize, prelude);
+	Stats::time("name analysis", timer.seconds());
+	if (na == nullptr){
+		delete ast;
+	} else if (prelude != nullptr){
+		Stats::count("prelude symbols loaded", prelude->loaded());
+	}
+	return na;
+}
+
+static drewno_mars::NameAnalysis * doNameAnalysis(const char * inputPath,
+  const char * preludePath){
 	drewno_mars::ProgramNode * ast = parse(inputPath);
 	if (ast == nullptr){ return nullptr; }
+	return analyseTree(ast, preludePath);
+}
 
-	return drewno_mars::NameAnalysis::build(ast);
+//Write out a summary of the globals declared in scope (see -S)
+static void writeSummary(ScopeTable * globals, const char * outPath){
+	Stopwatch timer;
+	SummaryWriter writer;
+	std::ofstream outFile;
+	writer.write(*openOutput(outPath, outFile), globals);
+	Stats::time("summary write", timer.seconds());
 }
 
+static void countFolding(const ConstantFolder& folder){
+	Stats::count("expressions folded", folder.folded());
+	Stats::count("branches pruned", folder.pruned());
+}
 
-int 
-main( const int argc, const char **argv )
-{
-	if (argc <= 1){ usageAndDie(); }
-	std::ifstream * input = new std::ifstream(argv[1]);
-	if (input == nullptr){ usageAndDie(); }
-	if (!input->good()){
-		std::cerr << "Bad path " << argv[1] << std::endl;
-		usageAndDie();
+static void countDeadCode(const DeadCodeEliminator& dce){
+	Stats::count("dead statements removed", dce.total());
+	for (auto& fn : dce.removed()){
+		Stats::count("dead statements removed from " + fn.first, fn.second);
+	}
+}
+
+//Inline small functions into their callers (see inline.hpp),
+// then propagate constants through each of module's functions
+// (see ssa.hpp) and optimise its loops (see loop.hpp)
+static void optimiseIr(IrModule& module){
+	Stopwatch inlining;
+	InlineCounts inlined = inlineCalls(module);
+	Stats::time("inlining", inlining.seconds());
+	Stats::count("calls inlined", inlined.calls);
+	Stats::count("instructions added by inlining", inlined.growth);
+	Stats::count("recursive functions", inlined.recursive);
+	double ssaSeconds = 0;
+	double sccpSeconds = 0;
+	double gvnSeconds = 0;
+	double loopSeconds = 0;
+	size_t phis = 0;
+	SccpCounts counts;
+	GvnCounts numbered;
+	LoopCounts loops;
+	for (IrFunction& fn : module.functions){
+		Stopwatch timer;
+		SsaForm ssa(fn);
+		ssaSeconds += timer.seconds();
+		phis += ssa.phis.size();
+		timer.reset();
+		counts += propagateConstants(fn, ssa);
+		sccpSeconds += timer.seconds();
+		//Constant propagation leaves its SSA form no good
+		timer.reset();
+		SsaForm numbering(fn);
+		ssaSeconds += timer.seconds();
+		timer.reset();
+		numbered += numberValues(fn, numbering);
+		gvnSeconds += timer.seconds();
+		timer.reset();
+		loops += optimiseLoops(fn);
+		loopSeconds += timer.seconds();
 	}
+	Stats::time("SSA construction", ssaSeconds);
+	Stats::count("SSA phis", phis);
+	Stats::time("constant propagation", sccpSeconds);
+	Stats::count("constants propagated", counts.constants);
+	Stats::count("branches straightened", counts.branches);
+	Stats::count("unreachable blocks removed", counts.blocks);
+	Stats::count("unread instructions removed", counts.dead + numbered.dead);
+	Stats::time("value numbering", gvnSeconds);
+	Stats::count("redundant instructions replaced", numbered.redundant);
+	Stats::time("loop optimisation", loopSeconds);
+	Stats::count("loops", loops.loops);
+	Stats::count("loop invariants hoisted", loops.hoisted);
+	Stats::count("multiplications strength-reduced", loops.reduced);
+}
 
-	const char * inFile = NULL;
-	const char * tokensFile = NULL;
-	bool checkParse = false;
-	const char * unparseFile = NULL;
-	const char * namesFile = NULL;
-	bool checkTypes = false;
+//Do what was asked of the IR a builder lowered, once every
+// declaration has been added to it: write it out (see -a),
+// compile it to assembly (see -o) and run it (see -r). Returns
+// dmc's exit status.
+static int useIr(IrBuilder& builder, const Request& req){
+	std::unique_ptr<IrModule> module(builder.finish());
+	if (req.optimise){ optimiseIr(*module); }
+	Stats::count("IR functions", module->functions.size());
+	Stats::count("IR instructions", module->instrCount());
+	if (req.irFile != nullptr){
+		Stopwatch timer;
+		std::ofstream outFile;
+		module->dump(*openOutput(req.irFile, outFile));
+		Stats::time("IR dump", timer.seconds());
+	}
+	if (req.asmFile != nullptr){
+		Stopwatch timer;
+		std::ofstream outFile;
+		X64Writer writer(*module);
+		writer.write(*openOutput(req.asmFile, outFile));
+		Stats::time("x86-64 codegen", timer.seconds());
+	}
+	if (!req.runProgram){ return 0; }
+
+	Stopwatch timer;
+	Vm vm(*module);
+	module.reset();
+	Stats::time("bytecode compile", timer.seconds());
+	Stats::count("bytecode words", vm.codeWords());
+	Stats::note("VM dispatch", Vm::dispatch());
+	timer.reset();
+	int status = vm.run(std::cin, std::cout);
+	double seconds = timer.seconds();
+	Stats::time("VM run", seconds);
+	Stats::count("VM instructions", vm.executed());
+	if (seconds > 0){
+		Stats::count("VM instructions/sec",
+		  static_cast<size_t>(static_cast<double>(vm.executed()) / seconds));
+	}
+	return status;
+}
+
+//Parse into a FlatAst (see -f). A binary AST given in place of
+// source is flattened too, a declaration at a time.
+static FlatAst * parseFlat(const char * inFile){
+	std::unique_ptr<FlatAst> flat(new FlatAst());
+	std::unique_ptr<AstImage> image(openImage(inFile));
+	if (image != nullptr){
+		Stopwatch timer;
+		ProgramNode * root = image->rebuild();
+		std::list<DeclNode *> * globals = root->getGlobals();
+		while (!globals->empty()){
+			flat->accept(globals->front());
+			globals->pop_front();
+		}
+		delete root;
+		Stats::time("binary AST load", timer.seconds());
+	} else {
+		std::unique_ptr<std::istream> inStream = openInput(inFile);
+		if (!inStream->good()){
+			std::string msg = "Bad input stream ";
+			msg += inFile;
+			throw new UserError(msg.c_str());
+		}
+		ProgramNode * root = nullptr;
+		int errCode = runParser(inStream.get(), &root, flat.get());
+		delete root;
+		if (errCode != 0){ return nullptr; }
+	}
+	flat->shrink();
+	Stats::count("flat AST nodes", flat->nodeCount());
+	Stats::count("flat AST bytes", flat->bytes());
+	return flat.release();
+}
+
+//Everything compile does past -t, over a program parsed once
+// into a FlatAst. Each pass rebuilds one global declaration
+// at a time and frees it before the next.
+static int doFlat(const Request& req){
+	std::unique_ptr<FlatAst> flat(parseFlat(req.inFile));
+	if (flat == nullptr){
+		if (req.checkParse){ std::cerr << "Parse failed" << std::endl; }
+		if (req.unparseFile != nullptr){ std::cerr << "No AST built\n"; }
+		if (req.analyse()){
+			std::cerr << "Name Analysis Failed\n";
+			return 1;
+		}
+		if (req.binaryFile != nullptr){
+			std::cerr << "No AST built\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	if (req.unparseFile != nullptr){
+		Stopwatch timer;
+		std::ofstream outFile;
+		std::ostream * out = openOutput(req.unparseFile, outFile);
+		for (size_t i = 0; i < flat->globalCount(); i++){
+			std::unique_ptr<DeclNode> decl(flat->global(i));
+			decl->unparse(*out, 0);
+		}
+		Stats::time("unparse", timer.seconds());
+	}
+
+	//Name analysis keeps every symbol (the binary AST refers to
+	// them), and its output until it is known to have succeeded
+	std::unique_ptr<SymbolTable> symTab;
+	std::ostringstream names;
+	AstWriter writer;
+	XrefWriter xref;
+	IrBuilder ir;
+	ConstantFolder folder;
+	DeadCodeEliminator dce;
+	bool lowered = true;
+	std::vector<uint32_t> globals;
+	if (req.analyse()){
+		symTab.reset(new SymbolTable());
+		symTab->usePrelude(openPrelude(req.preludeFile));
+		Stopwatch timer;
+		symTab->enterGlobalScope();
+		bool ok = true;
+		for (size_t i = 0; i < flat->globalCount(); i++){
+			std::unique_ptr<DeclNode> decl(flat->global(i));
+			ok = decl->nameAnalysis(symTab.get()) && ok;
+			if (!ok){ continue; }
+			if (req.namesFile != nullptr){ decl->unparse(names, 0); }
+			if (req.xrefFile != nullptr){ xref.add(decl.get()); }
+			if (req.binaryFile != nullptr){
+				globals.push_back(writer.tree(decl.get()));
+			}
+			//Last, as folding changes the declaration
+			if (req.lower()){
+				if (req.optimise){
+					folder.fold(decl.get());
+					dce.eliminate(decl.get());
+				}
+				lowered = ir.add(decl.get()) && lowered;
+			}
+		}
+		symTab->leaveScope();
+		Stats::time("name analysis", timer.seconds());
+		if (!ok){
+			std::cerr << "Name Analysis Failed\n";
+			return 1;
+		}
+		if (req.namesFile != nullptr){
+			std::ofstream outFile;
+			*openOutput(req.namesFile, outFile) << names.str();
+		}
+	} else if (req.binaryFile != nullptr){
+		for (size_t i = 0; i < flat->globalCount(); i++){
+			std::unique_ptr<DeclNode> decl(flat->global(i));
+			globals.push_back(writer.tree(decl.get()));
+		}
+	}
+
+	if (req.binaryFile != nullptr){
+		Stopwatch timer;
+		Position pos = flat->position();
+		uint32_t list = writer.node(NodeKind::List, nullptr, globals);
+		uint32_t root = writer.node(NodeKind::Program, &pos, {list});
+		std::ofstream outFile;
+		writer.write(*openOutput(req.binaryFile, outFile), root);
+		Stats::time("binary AST write", timer.seconds());
+	}
+	if (req.xrefFile != nullptr){
+		writeXref(xref, req.inFile, req.xrefFile);
+	}
+	if (req.summaryFile != nullptr){
+		writeSummary(symTab->globals(), req.summaryFile);
+	}
+	if (req.lower()){
+		if (req.optimise){
+			countFolding(folder);
+			countDeadCode(dce);
+		}
+		if (!lowered){
+			std::cerr << "IR Lowering Failed\n";
+			return 1;
+		}
+		return useIr(ir, req);
+	}
+	return 0;
+}
+
+//Read the command line into req (and the global tuning).
+// Returns false, after explaining why, if it doesn't make sense.
+static bool readArgs(const int argc, const char **argv, Request& req){
+	if (argc <= 1){ return usage(); }
 
 	bool useful = false;
-	int i = 1;
 	for (int i = 1 ; i < argc ; i++){
-		if (argv[i][0] == '-'){
+		if (argv[i][0] == '-' && argv[i][1] != '\0'){
 			if (argv[i][1] == 't'){
 				i++;
-				tokensFile = argv[i];
+				req.tokensFile = argv[i];
 				useful = true;
 			} else if (argv[i][1] == 'p'){
-				checkParse = true;
+				req.checkParse = true;
 				useful = true;
 			} else if (argv[i][1] == 'u'){
 				i++;
-				if (i >= argc){ usageAndDie(); }
-				unparseFile = argv[i];
+				if (i >= argc){ return usage(); }
+				req.unparseFile = argv[i];
 				useful = true;
 			} else if (argv[i][1] == 'n'){
 				i++;
-				if (i >= argc){ usageAndDie(); }
-				namesFile = argv[i];
+				if (i >= argc){ return usage(); }
+				req.namesFile = argv[i];
+				useful = true;
+			} else if (argv[i][1] == 'b'){
+				i++;
+				if (i >= argc){ return usage(); }
+				req.binaryFile = argv[i];
+				useful = true;
+			} else if (argv[i][1] == 'x'){
+				i++;
+				if (i >= argc){ return usage(); }
+				req.xrefFile = argv[i];
+				useful = true;
+			} else if (argv[i][1] == 'S'){
+				i++;
+				if (i >= argc){ return usage(); }
+				req.summaryFile = argv[i];
+				useful = true;
+			} else if (argv[i][1] == 'a'){
+				i++;
+				if (i >= argc){ return usage(); }
+				req.irFile = argv[i];
+				useful = true;
+			} else if (argv[i][1] == 'o'){
+				i++;
+				if (i >= argc){ return usage(); }
+				req.asmFile = argv[i];
 				useful = true;
+			} else if (argv[i][1] == 'r'){
+				req.runProgram = true;
+				useful = true;
+			} else if (argv[i][1] == 'N'){
+				req.optimise = false;
+			} else if (argv[i][1] == 'I'){
+				i++;
+				if (i >= argc){ return usage(); }
+				req.preludeFile = argv[i];
 			} else if (argv[i][1] == 'c'){
-				checkTypes = true;
+				req.checkTypes = true;
 				useful = true;
+			} else if (argv[i][1] == 'j'){
+				i++;
+				if (i >= argc){ return usage(); }
+				int threads = atoi(argv[i]);
+				if (threads <= 0){ return usage(); }
+				tuning.unparseThreads = static_cast<unsigned int>(threads);
+			} else if (argv[i][1] == 'l'){
+				tuning.pipelineLexer = true;
+			} else if (argv[i][1] == 'v'){
+				Stats::enable();
+			} else if (argv[i][1] == 's'){
+				tuning.streaming = true;
+			} else if (argv[i][1] == 'm'){
+				tuning.memoize = true;
+			} else if (argv[i][1] == 'f'){
+				tuning.flat = true;
+			} else if (argv[i][1] == 'd'){
+				tuning.descent = true;
+			} else if (argv[i][1] == 'k'){
+				i++;
+				if (i >= argc){ return usage(); }
+				tuning.cacheDir = argv[i];
+			} else if (argv[i][1] == 'K'){
+				i++;
+				if (i >= argc){ return usage(); }
+				int megabytes = atoi(argv[i]);
+				if (megabytes <= 0){ return usage(); }
+				tuning.cacheLimit = static_cast<uint64_t>(megabytes) << 20;
 			} else {
 				std::cerr << "Unrecognized argument: ";
 				std::cerr << argv[i] << std::endl;
-				usageAndDie();
+				return usage();
 			}
 		} else {
-			if (inFile == NULL){
-				inFile = argv[i];
+			if (req.inFile == nullptr){
+				req.inFile = argv[i];
 			} else {
 				std::cerr << "Only 1 input file allowed";
 				std::cerr << argv[i] << std::endl;
-				usageAndDie();
+				return usage();
 			}
 		}
 	}
-	if (inFile == NULL){
-		usageAndDie();
+	if (req.inFile == nullptr){
+		return usage();
 	}
 	if (!useful){
 		std::cerr << "Hey, you didn't tell dmc to do anything!\n";
-		usageAndDie();
+		return usage();
 	}
 
+	if (tuning.streaming && req.tokensFile != nullptr){
+		std::cerr << "-t cannot be combined with -s\n";
+		return usage();
+	}
+	if (tuning.streaming && req.binaryFile != nullptr){
+		std::cerr << "-b cannot be combined with -s\n";
+		return usage();
+	}
+	if (tuning.streaming && req.xrefFile != nullptr){
+		std::cerr << "-x cannot be combined with -s\n";
+		return usage();
+	}
+	if (tuning.streaming && req.summaryFile != nullptr){
+		std::cerr << "-S cannot be combined with -s\n";
+		return usage();
+	}
+	if (tuning.streaming && req.irFile != nullptr){
+		std::cerr << "-a cannot be combined with -s\n";
+		return usage();
+	}
+	if (tuning.streaming && req.asmFile != nullptr){
+		std::cerr << "-o cannot be combined with -s\n";
+		return usage();
+	}
+	if (tuning.streaming && req.runProgram){
+		std::cerr << "-r cannot be combined with -s\n";
+		return usage();
+	}
+	if (tuning.streaming && tuning.cacheDir != nullptr){
+		std::cerr << "-k cannot be combined with -s\n";
+		return usage();
+	}
+	//A run reads its input as it goes, so can't be replayed
+	if (req.runProgram && tuning.cacheDir != nullptr){
+		std::cerr << "-r cannot be combined with -k\n";
+		return usage();
+	}
+	if (tuning.flat && tuning.streaming){
+		std::cerr << "-f cannot be combined with -s\n";
+		return usage();
+	}
+	if (tuning.flat && (tuning.memoize || tuning.unparseThreads > 0)){
+		std::cerr << "-f cannot be combined with -m or -j\n";
+		return usage();
+	}
+	return true;
+}
+
+//Carry out a request, returning dmc's exit status
+static int compile(const Request& req){
 	try {
-		if (tokensFile != nullptr){
-			writeTokenStream(inFile, tokensFile);
+		if (tuning.streaming){
+			return doStreaming(req.inFile, req.unparseFile, req.namesFile,
+			  req.preludeFile);
+		}
+		if (req.tokensFile != nullptr){
+			writeTokenStream(req.inFile, req.tokensFile);
+		}
+		if (tuning.flat){
+			return doFlat(req);
 		}
-		if (checkParse){
-			bool parsed = parse(inFile);
+		if (req.checkParse){
+			drewno_mars::ProgramNode * parsed = parse(req.inFile);
 			if (!parsed){
 				std::cerr << "Parse failed" << std::endl;
 			}
+			delete parsed;
 		}
-		if (unparseFile != nullptr){
-			doUnparsing(inFile, unparseFile);
+		if (req.unparseFile != nullptr){
+			doUnparsing(req.inFile, req.unparseFile);
 		}
-		if (namesFile){
+		if (req.analyse()){
 			drewno_mars::NameAnalysis * na;
-			na = doNameAnalysis(inFile);
+			na = doNameAnalysis(req.inFile, req.preludeFile);
 			if (na == nullptr){
 				std::cerr << "Name Analysis Failed\n";
 				return 1;
 			}
-			outputAST(na->ast, namesFile);
+			if (req.namesFile){
+				outputAST(na->ast, req.namesFile);
+			}
+			if (req.xrefFile){
+				XrefWriter xref;
+				xref.add(na->ast);
+				writeXref(xref, req.inFile, req.xrefFile);
+			}
+			if (req.binaryFile != nullptr){
+				writeBinary(na->ast, req.binaryFile);
+			}
+			if (req.summaryFile){
+				writeSummary(na->globals(), req.summaryFile);
+			}
+			if (req.lower()){
+				if (req.optimise){
+					Stopwatch timer;
+					ConstantFolder folder;
+					for (DeclNode * decl : *na->ast->getGlobals()){
+						folder.fold(decl);
+					}
+					Stats::time("constant folding", timer.seconds());
+					countFolding(folder);
+					timer.reset();
+					DeadCodeEliminator dce;
+					for (DeclNode * decl : *na->ast->getGlobals()){
+						dce.eliminate(decl);
+					}
+					Stats::time("dead code elimination", timer.seconds());
+					countDeadCode(dce);
+				}
+				Stopwatch timer;
+				IrBuilder ir;
+				bool lowered = true;
+				for (DeclNode * decl : *na->ast->getGlobals()){
+					lowered = ir.add(decl) && lowered;
+				}
+				Stats::time("IR lowering", timer.seconds());
+				if (!lowered){
+					delete na;
+					std::cerr << "IR Lowering Failed\n";
+					return 1;
+				}
+				int status = useIr(ir, req);
+				delete na;
+				return status;
+			}
+			delete na;
+		} else if (req.binaryFile != nullptr){
+			drewno_mars::ProgramNode * ast = parse(req.inFile);
+			if (ast == nullptr){
+				std::cerr << "No AST built\n";
+				return 1;
+			}
+			writeBinary(ast, req.binaryFile);
+			delete ast;
 		}
 	} catch (drewno_mars::ToDoError * e){
 		std::cerr << "ToDoError: " << e->msg() << std::endl;
@@ -196,7 +979,653 @@ main( const int argc, const char **argv )
 	} catch (UserError * e){
 		std::string msg = "The user made a mistake: ";
 		std::cerr << msg << e->msg() << std::endl;
-		exit(1);
+		return 1;
 	}
 	return 0;
 }
+
+//Run a compile, with everything it would print or write (and
+// its exit status) captured into result instead
+static void captureOutput(const std::function<int()>& run,
+  CompileResult& result){
+	std::ostringstream out;
+	std::ostringstream err;
+	std::streambuf * oldOut = std::cout.rdbuf(out.rdbuf());
+	std::streambuf * oldErr = std::cerr.rdbuf(err.rdbuf());
+	std::map<std::string, std::ostringstream> files;
+	std::map<std::string, std::ostringstream> * oldFiles = capturedFiles;
+	capturedFiles = &files;
+
+	result.status = run();
+	std::cout.flush();
+
+	capturedFiles = oldFiles;
+	std::cout.rdbuf(oldOut);
+	std::cerr.rdbuf(oldErr);
+	for (auto& file : files){
+		result.files.push_back(std::make_pair(file.first, file.second.str()));
+	}
+	result.out = out.str();
+	result.err = err.str();
+}
+
+//A prelude changes what the program means
+static void hashPrelude(const Request& req, CacheHasher& hasher){
+	if (req.preludeFile == nullptr){ return; }
+	std::ifstream prelude(req.preludeFile);
+	std::ostringstream text;
+	text << prelude.rdbuf();
+	hasher.add(text.str());
+}
+
+//The cache key for req compiling source: everything that
+// decides what it prints and writes, but not where its output
+// files are, nor how it goes about the work (-j, -l, -v)
+static CacheKey cacheKey(const Request& req, const std::string& source){
+	CacheHasher hasher;
+	hashCompiler(hasher);
+	std::string options;
+	for (char role : outputRoles){
+		const char * path = req.output(role);
+		if (path == nullptr){ continue; }
+		options += role;
+		//Output to stdout lands in a different part of the entry
+		if (strcmp(path, "--") == 0){ options += '-'; }
+	}
+	if (req.checkParse){ options += 'p'; }
+	if (req.checkTypes){ options += 'c'; }
+	if (!req.optimise){ options += 'N'; }
+	if (req.preludeFile != nullptr){ options += 'I'; }
+	hasher.add(options);
+	hasher.add(source);
+	hashPrelude(req, hasher);
+	return hasher.key();
+}
+
+//What the front end made of a program, for each of its stages
+// that has been run: the outputs the stage alone produces (-t;
+// -u and -b; -n and -b with bindings) and what it printed on the
+// way. It is kept in the -k cache under a key of the program
+// alone, so that asking for another of these outputs later needs
+// no lexing, parsing or name analysis.
+struct FrontEnd{
+	bool lexed = false;
+	std::string tokens;
+	std::string tokenOut;
+	std::string tokenErr;
+
+	bool parseRun = false;
+	bool parsed = false;
+	std::string parseOut;
+	std::string parseErr;
+	std::string unparsed;
+	std::string image;
+
+	bool analysisRun = false;
+	bool analysed = false;
+	std::string nameOut;
+	std::string nameErr;
+	std::string named;
+	std::string boundImage;
+};
+
+//The names a FrontEnd's texts are kept under in its cache entry
+static const char * const frontEndFiles[] = {
+	"tokens", "tokens.out", "tokens.err",
+	"parse.out", "parse.err", "unparse", "image",
+	"names.out", "names.err", "names", "bound image"
+};
+
+static std::string * frontEndText(FrontEnd& fe, const std::string& file){
+	std::string * texts[] = {
+		&fe.tokens, &fe.tokenOut, &fe.tokenErr,
+		&fe.parseOut, &fe.parseErr, &fe.unparsed, &fe.image,
+		&fe.nameOut, &fe.nameErr, &fe.named, &fe.boundImage
+	};
+	for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++){
+		if (file == frontEndFiles[i]){ return texts[i]; }
+	}
+	return nullptr;
+}
+
+//The flags a cache entry holds in its status
+enum FrontEndFlag{
+	LEXED = 1, PARSE_RUN = 2, PARSED = 4, ANALYSIS_RUN = 8, ANALYSED = 16
+};
+
+static void packFrontEnd(FrontEnd& fe, CompileResult& entry){
+	for (const char * file : frontEndFiles){
+		entry.files.push_back(std::make_pair(file, *frontEndText(fe, file)));
+	}
+	entry.status = (fe.lexed ? LEXED : 0) | (fe.parseRun ? PARSE_RUN : 0)
+	  | (fe.parsed ? PARSED : 0) | (fe.analysisRun ? ANALYSIS_RUN : 0)
+	  | (fe.analysed ? ANALYSED : 0);
+}
+
+static void unpackFrontEnd(const CompileResult& entry, FrontEnd& fe){
+	for (auto& file : entry.files){
+		std::string * text = frontEndText(fe, file.first);
+		if (text != nullptr){ *text = file.second; }
+	}
+	fe.lexed = (entry.status & LEXED) != 0;
+	fe.parseRun = (entry.status & PARSE_RUN) != 0;
+	fe.parsed = (entry.status & PARSED) != 0;
+	fe.analysisRun = (entry.status & ANALYSIS_RUN) != 0;
+	fe.analysed = (entry.status & ANALYSED) != 0;
+}
+
+//Whether everything req asks for comes from the front end
+static bool frontEndOnly(const Request& req){
+	return !tuning.flat && req.xrefFile == nullptr
+	  && req.summaryFile == nullptr && !req.lower();
+}
+
+//Run one stage of the front end with its output captured. A
+// stage that throws is abandoned, for the usual path to report.
+static bool runStage(const std::function<void()>& stage,
+  CompileResult& captured){
+	captureOutput([&](){
+		try {
+			stage();
+		} catch (UserError *){
+			return 1;
+		} catch (InternalError *){
+			return 1;
+		}
+		return 0;
+	}, captured);
+	return captured.status == 0;
+}
+
+static std::string capturedFile(const CompileResult& captured,
+  const char * path){
+	for (auto& file : captured.files){
+		if (file.first == path){ return file.second; }
+	}
+	return "";
+}
+
+//Run the stages of the front end that req needs and fe lacks,
+// on req's input (which is source). Returns false if one of them
+// could not be run.
+static bool runFrontEnd(const Request& req, FrontEnd& fe){
+	if (req.tokensFile != nullptr && !fe.lexed){
+		CompileResult captured;
+		if (!runStage([&](){ writeTokenStream(req.inFile, "t"); }, captured)){
+			return false;
+		}
+		fe.lexed = true;
+		fe.tokens = capturedFile(captured, "t");
+		fe.tokenOut = captured.out;
+		fe.tokenErr = captured.err;
+	}
+
+	bool parseNeeded = req.checkParse || req.unparseFile != nullptr
+	  || req.binaryFile != nullptr || req.analyse();
+	drewno_mars::ProgramNode * ast = nullptr;
+	if (parseNeeded && !fe.parseRun){
+		CompileResult captured;
+		bool ran = runStage([&](){
+			ast = parse(req.inFile);
+			if (ast == nullptr){ return; }
+			outputAST(ast, "u");
+			writeBinary(ast, "b");
+		}, captured);
+		if (!ran){
+			delete ast;
+			return false;
+		}
+		fe.parseRun = true;
+		fe.parsed = ast != nullptr;
+		fe.parseOut = captured.out;
+		fe.parseErr = captured.err;
+		fe.unparsed = capturedFile(captured, "u");
+		fe.image = capturedFile(captured, "b");
+	}
+
+	if (req.analyse() && fe.parsed && !fe.analysisRun){
+		if (ast == nullptr){
+			//Parsed by an earlier run: start from its tree
+			std::unique_ptr<AstImage> image(AstImage::copy(fe.image));
+			ast = image->rebuild();
+		}
+		CompileResult captured;
+		bool analysed = false;
+		bool ran = runStage([&](){
+			drewno_mars::ProgramNode * tree = ast;
+			ast = nullptr;
+			drewno_mars::NameAnalysis * na = analyseTree(tree,
+			  req.preludeFile);
+			if (na == nullptr){ return; }
+			analysed = true;
+			try {
+				outputAST(na->ast, "n");
+				writeBinary(na->ast, "B");
+			} catch (...){
+				delete na;
+				throw;
+			}
+			delete na;
+		}, captured);
+		if (!ran){ return false; }
+		fe.analysisRun = true;
+		fe.analysed = analysed;
+		fe.nameOut = captured.out;
+		fe.nameErr = captured.err;
+		fe.named = capturedFile(captured, "n");
+		fe.boundImage = capturedFile(captured, "B");
+	}
+	delete ast;
+	return true;
+}
+
+static void writeOutput(const char * path, const std::string& text){
+	std::ofstream outFile;
+	*openOutput(path, outFile) << text;
+}
+
+//Carry out req, which asks only for front-end outputs, from what
+// the front end made of its input: what compile would print and
+// write, in the order it would
+static int replayFrontEnd(const Request& req, const FrontEnd& fe){
+	if (req.tokensFile != nullptr){
+		std::cout << fe.tokenOut;
+		std::cerr << fe.tokenErr;
+		writeOutput(req.tokensFile, fe.tokens);
+	}
+	if (req.checkParse){
+		std::cout << fe.parseOut;
+		std::cerr << fe.parseErr;
+		if (!fe.parsed){
+			std::cerr << "Parse failed" << std::endl;
+		}
+	}
+	if (req.unparseFile != nullptr){
+		std::cout << fe.parseOut;
+		std::cerr << fe.parseErr;
+		if (fe.parsed){
+			writeOutput(req.unparseFile, fe.unparsed);
+		} else {
+			std::cerr << "No AST built\n";
+		}
+	}
+	if (req.analyse()){
+		std::cout << fe.parseOut << fe.nameOut;
+		std::cerr << fe.parseErr << fe.nameErr;
+		if (!fe.analysed){
+			std::cerr << "Name Analysis Failed\n";
+			return 1;
+		}
+		if (req.namesFile != nullptr){
+			writeOutput(req.namesFile, fe.named);
+		}
+		if (req.binaryFile != nullptr){
+			writeOutput(req.binaryFile, fe.boundImage);
+		}
+	} else if (req.binaryFile != nullptr){
+		std::cout << fe.parseOut;
+		std::cerr << fe.parseErr;
+		if (!fe.parsed){
+			std::cerr << "No AST built\n";
+			return 1;
+		}
+		writeOutput(req.binaryFile, fe.image);
+	}
+	return 0;
+}
+
+//Carry out req, which asks only for front-end outputs, on
+// source via the front end's cache entry for it, running and
+// storing whatever stages the entry lacks. Returns false if the
+// usual path has to do it instead.
+static bool compileFrontEnd(const Request& req, const std::string& source,
+  ResultCache& cache, CompileResult& result){
+	if (AstImage::isImage(source.data(), source.size())){ return false; }
+	CacheHasher hasher;
+	hashCompiler(hasher);
+	hasher.add("front end");
+	hasher.add(source);
+	hashPrelude(req, hasher);
+	CacheKey key = hasher.key();
+
+	Stopwatch timer;
+	FrontEnd fe;
+	CompileResult entry;
+	if (cache.lookup(key, entry)){ unpackFrontEnd(entry, fe); }
+	Stats::time("front end cache lookup", timer.seconds());
+	FrontEnd before = fe;
+	if (!runFrontEnd(req, fe)){ return false; }
+	bool ran = fe.lexed != before.lexed || fe.parseRun != before.parseRun
+	  || fe.analysisRun != before.analysisRun;
+	Stats::note("front end cache", ran ? "miss" : "hit");
+	if (ran){
+		timer.reset();
+		CompileResult updated;
+		packFrontEnd(fe, updated);
+		cache.store(key, updated);
+		Stats::time("front end cache store", timer.seconds());
+	}
+	captureOutput([&](){ return replayFrontEnd(req, fe); }, result);
+	return true;
+}
+
+//Carry out a request via the result cache (see -k): replay a
+// stored result for the same program and options if there is
+// one, otherwise compile (from what the front end made of the
+// program before, if only its outputs are asked for) and store
+// what that produced
+static int compileCached(const Request& req){
+	try {
+		ResultCache cache(tuning.cacheDir, tuning.cacheLimit);
+		std::unique_ptr<std::istream> input = openInput(req.inFile);
+		if (!input->good()){
+			//Let the usual path explain the problem
+			return compile(req);
+		}
+		Stopwatch timer;
+		std::string source;
+		if (strcmp(req.inFile, "-") == 0){
+			source = stdinText;
+		} else {
+			std::ostringstream text;
+			text << input->rdbuf();
+			source = text.str();
+		}
+		CacheKey key = cacheKey(req, source);
+
+		CompileResult result;
+		if (cache.lookup(key, result)){
+			Stats::time("cache lookup", timer.seconds());
+			Stats::note("cache", "hit");
+		} else {
+			Stats::time("cache lookup", timer.seconds());
+			Stats::note("cache", "miss");
+			//Compile the text that was hashed, even if the file
+			// has changed since
+			stdinText = source;
+			stdinRead = true;
+			Request fromText = req;
+			fromText.inFile = "-";
+			CompileResult captured;
+			if (!frontEndOnly(req)
+			  || !compileFrontEnd(fromText, source, cache, captured)){
+				captured = CompileResult();
+				captureOutput([&](){ return compile(fromText); }, captured);
+			}
+
+			//Output files are kept by flag, not by path
+			result.out = captured.out;
+			result.err = captured.err;
+			result.status = captured.status;
+			for (char role : outputRoles){
+				const char * path = req.output(role);
+				if (path == nullptr || strcmp(path, "--") == 0){ continue; }
+				for (auto& file : captured.files){
+					if (file.first != path){ continue; }
+					result.files.push_back(
+					  std::make_pair(std::string(1, role), file.second));
+				}
+			}
+			timer.reset();
+			cache.store(key, result);
+			Stats::time("cache store", timer.seconds());
+		}
+
+		for (auto& file : result.files){
+			std::ofstream outFile;
+			*openOutput(req.output(file.first[0]), outFile) << file.second;
+		}
+		std::cout << result.out;
+		std::cerr << result.err;
+		return result.status;
+	} catch (UserError * e){
+		std::cerr << "The user made a mistake: " << e->msg() << std::endl;
+		return 1;
+	} catch (InternalError * e){
+		std::cerr << "Something in the compiler is broken: "
+		  << e->msg() << std::endl;
+		return 1;
+	}
+}
+
+//Handle one compile server request as if dmc had been run
+// with args, with source on standard input. Everything the
+// request would print or write is captured into result.
+static void serveRequest(const std::vector<std::string>& args,
+  const std::string& source, CompileResult& result){
+	tuning = Tuning();
+	//What a request's -v records goes back with its stderr
+	Stats::disable();
+	Stats::clear();
+	stdinText = source;
+	stdinRead = true;
+
+	std::istringstream in(source);
+	std::streambuf * oldIn = std::cin.rdbuf(in.rdbuf());
+	captureOutput([&](){
+		std::vector<const char *> argv;
+		argv.push_back("dmc");
+		for (const std::string& arg : args){ argv.push_back(arg.c_str()); }
+		Request req;
+		int argc = static_cast<int>(argv.size());
+		if (!readArgs(argc, argv.data(), req)){ return 1; }
+		if (req.runProgram){
+			std::cerr << "-r cannot be combined with --client\n";
+			usage();
+			return 1;
+		}
+		//Nothing may escape with std::cout still captured
+		try {
+			if (tuning.cacheDir != nullptr){ return compileCached(req); }
+			return compile(req);
+		} catch (std::exception& e){
+			std::cerr << "Something in the compiler is broken: "
+			  << e.what() << std::endl;
+			return 1;
+		}
+	}, result);
+	std::cin.rdbuf(oldIn);
+	if (Stats::enabled()){
+		std::ostringstream report;
+		Stats::report(report);
+		result.err += report.str();
+	}
+	Stats::disable();
+	Stats::clear();
+	stdinText.clear();
+	stdinRead = false;
+}
+
+//path as the server, which may run in another directory, has
+// to be given it
+static std::string absolutePath(const char * path){
+	if (path[0] == '/'){ return path; }
+	char cwd[PATH_MAX];
+	if (getcwd(cwd, sizeof(cwd)) == nullptr){
+		throw new UserError("Could not find the working directory");
+	}
+	return std::string(cwd) + "/" + path;
+}
+
+//dmc --client <socket> <args>: have the server do the work,
+// then write out what it sends back
+static int runClient(const char * socketPath, const int argc,
+  const char **argv){
+	std::vector<std::string> args;
+	std::string source;
+	if (argc == 1 && strcmp(argv[0], "--stop") == 0){
+		args.push_back(argv[0]);
+	} else {
+		std::vector<const char *> local;
+		local.push_back("dmc");
+		for (int i = 0; i < argc; i++){ local.push_back(argv[i]); }
+		Request req;
+		if (!readArgs(static_cast<int>(local.size()), local.data(), req)){
+			return 1;
+		}
+		//A run reads its input as it goes, and the server has only
+		// the program text to give it
+		if (req.runProgram){
+			std::cerr << "-r cannot be combined with --client\n";
+			usage();
+			return 1;
+		}
+		std::unique_ptr<std::istream> input = openInput(req.inFile);
+		if (!input->good()){
+			std::cerr << "Bad input stream " << req.inFile << std::endl;
+			return 1;
+		}
+		std::ostringstream text;
+		text << input->rdbuf();
+		source = text.str();
+		//The server gets the program text, not the path, and the
+		// paths it reads itself made absolute
+		for (int i = 0; i < argc; i++){
+			if (argv[i] == req.inFile){
+				args.push_back("-");
+			} else if (argv[i] == req.preludeFile
+			  || argv[i] == tuning.cacheDir){
+				args.push_back(absolutePath(argv[i]));
+			} else {
+				args.push_back(argv[i]);
+			}
+		}
+	}
+
+	Stopwatch timer;
+	CompileResult result;
+	requestCompile(socketPath, args, source, result);
+	Stats::time("server round trip", timer.seconds());
+
+	for (auto file : result.files){
+		std::ofstream out(file.first);
+		if (!out.good()){
+			std::cerr << "Bad output file " << file.first << std::endl;
+			return 1;
+		}
+		out << file.second;
+	}
+	std::cout << result.out;
+	std::cerr << result.err;
+	Stats::report(std::cerr);
+	return result.status;
+}
+
+//Read a location given to --query: <line>:<col>, or a byte
+// offset, which index has to turn into a line and column
+static bool readLocation(const char * text, const XrefIndex& index,
+  size_t& line, size_t& col){
+	if (!isdigit(static_cast<unsigned char>(text[0]))){ return false; }
+	char * end;
+	size_t first = strtoull(text, &end, 10);
+	if (*end == ':'){
+		if (!isdigit(static_cast<unsigned char>(end[1]))){ return false; }
+		line = first;
+		col = strtoull(end + 1, &end, 10);
+		return *end == '\0';
+	}
+	if (*end != '\0'){ return false; }
+	if (!index.locate(first, line, col)){
+		throw new UserError("The index has no line starts: give <line>:<col>");
+	}
+	return true;
+}
+
+//dmc --query <index> def|refs <location>: answer from an index
+// written by -x, without compiling anything
+static int runQuery(const int argc, const char **argv){
+	if (argc != 3){
+		usage();
+		return 1;
+	}
+	bool def = strcmp(argv[1], "def") == 0;
+	if (!def && strcmp(argv[1], "refs") != 0){
+		usage();
+		return 1;
+	}
+	std::unique_ptr<XrefIndex> index(XrefIndex::map(argv[0]));
+	size_t line;
+	size_t col;
+	if (!readLocation(argv[2], *index, line, col)){
+		usage();
+		return 1;
+	}
+	uint32_t ref = index->find(line, col);
+	if (ref == XrefIndex::NO_REF){
+		std::cerr << "No name at " << argv[2] << std::endl;
+		return 1;
+	}
+	uint32_t symbol = index->symbol(ref);
+	if (def){
+		uint32_t defRef = index->definition(symbol);
+		if (defRef == XrefIndex::NO_REF){
+			std::cerr << "No definition of " << index->symbolPart(symbol, 0)
+			  << " in the index" << std::endl;
+			return 1;
+		}
+		std::cout << index->position(defRef).span()
+		  << " " << index->symbolPart(symbol, 0)
+		  << " " << index->symbolPart(symbol, 1)
+		  << " " << index->symbolPart(symbol, 2) << "\n";
+		return 0;
+	}
+	for (size_t i = 0; i < index->useCount(symbol); i++){
+		std::cout << index->position(index->use(symbol, i)).span() << "\n";
+	}
+	return 0;
+}
+
+int 
+main( const int argc, const char **argv )
+{
+	if (argc >= 3 && strcmp(argv[1], "--server") == 0){
+		try {
+			CompileServer server(argv[2], serveRequest);
+			server.run();
+		} catch (UserError * e){
+			std::cerr << "The user made a mistake: " << e->msg() << std::endl;
+			return 1;
+		} catch (InternalError * e){
+			std::cerr << "Something in the compiler is broken: "
+			  << e->msg() << std::endl;
+			return 1;
+		}
+		return 0;
+	}
+	if (argc >= 3 && strcmp(argv[1], "--client") == 0){
+		try {
+			return runClient(argv[2], argc - 3, argv + 3);
+		} catch (UserError * e){
+			std::cerr << "The user made a mistake: " << e->msg() << std::endl;
+			return 1;
+		} catch (InternalError * e){
+			std::cerr << "Something in the compiler is broken: "
+			  << e->msg() << std::endl;
+			return 1;
+		}
+	}
+
+	if (argc >= 2 && strcmp(argv[1], "--query") == 0){
+		try {
+			return runQuery(argc - 2, argv + 2);
+		} catch (UserError * e){
+			std::cerr << "The user made a mistake: " << e->msg() << std::endl;
+			return 1;
+		} catch (InternalError * e){
+			std::cerr << "Something in the compiler is broken: "
+			  << e->msg() << std::endl;
+			return 1;
+		}
+	}
+
+	Request req;
+	if (!readArgs(argc, argv, req)){ return 1; }
+	int status;
+	if (tuning.cacheDir != nullptr){
+		status = compileCached(req);
+	} else {
+		status = compile(req);
+	}
+	Stats::report(std::cerr);
+	return status;
+}
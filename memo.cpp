@@ -0,0 +1,411 @@
+#include <memory>
+#include <unordered_map>
+#include "memo.hpp"
+#include "visitor.hpp"
+
+namespace drewno_mars{
+
+//Declarations whose shape keeps turning up in different
+// surroundings only keep this many analyses each
+static const size_t MAX_ENTRIES_PER_SHAPE = 4;
+
+DeclMemo::DeclMemo() : myOuterSink(nullptr), myHits(0), myMisses(0){ }
+
+DeclMemo::~DeclMemo(){ }
+
+bool DeclMemo::begin(SymbolTable * symTab, DeclNode * decl,
+  uint64_t shape, bool& result){
+	DeclMemo * memo = symTab->memo();
+	if (memo == nullptr){ return false; }
+	return memo->start(symTab, decl, shape, result);
+}
+
+void DeclMemo::end(SymbolTable * symTab, bool result){
+	DeclMemo * memo = symTab->memo();
+	if (memo == nullptr){ return; }
+	memo->finish(result);
+}
+
+void DeclMemo::abandon(SymbolTable * symTab){
+	DeclMemo * memo = symTab->memo();
+	if (memo == nullptr || memo->myStarted.empty()){ return; }
+	for (Recording * rec : memo->myStarted){ delete rec; }
+	memo->myStarted.clear();
+	memo->myRecordings.clear();
+	Report::sink() = memo->myOuterSink;
+}
+
+//The IDs of a subtree, in the order a walk meets them
+class IDCollector : public AstWalker<IDCollector>{
+public:
+	IDCollector(std::vector<IDNode *>& ids) : myIDs(ids){ }
+	bool pre(ASTNode * node){
+		if (node->kind() == NodeKind::ID){
+			myIDs.push_back(static_cast<IDNode *>(node));
+		}
+		return true;
+	}
+private:
+	std::vector<IDNode *>& myIDs;
+};
+
+void DeclMemo::expect(ProgramNode * prog){
+	for (DeclNode * global : *prog->getGlobals()){
+		if (FnDeclNode * fn = dynamic_cast<FnDeclNode *>(global)){
+			myExpected[fn->shapeHash()]++;
+		}
+		ClassDefnNode * cls = dynamic_cast<ClassDefnNode *>(global);
+		if (cls == nullptr){ continue; }
+		myExpected[cls->shapeHash()]++;
+		for (DeclNode * member : *cls->getMembers()){
+			if (FnDeclNode * fn = dynamic_cast<FnDeclNode *>(member)){
+				myExpected[fn->shapeHash()]++;
+			}
+		}
+	}
+}
+
+bool DeclMemo::start(SymbolTable * symTab, DeclNode * decl, uint64_t shape,
+  bool& result){
+	if (!myExpected.empty()){
+		auto expected = myExpected.find(shape);
+		if (expected == myExpected.end() || expected->second < 2){
+			myMisses++;
+			myStarted.push_back(nullptr);
+			return false;
+		}
+	}
+	auto found = myEntries.find(shape);
+	if (found != myEntries.end()){
+		std::vector<IDNode *> ids;
+		IDCollector(ids).walk(decl);
+		for (const Entry& entry : found->second){
+			if (replay(entry, symTab, ids, result)){
+				myHits++;
+				return true;
+			}
+		}
+		if (found->second.size() >= MAX_ENTRIES_PER_SHAPE){
+			myMisses++;
+			myStarted.push_back(nullptr);
+			return false;
+		}
+	}
+	myMisses++;
+	record(symTab, decl, shape);
+	return false;
+}
+
+//Replay entry for a declaration whose IDs are ids, if the
+// answers it depends on still hold here. Changes nothing if
+// they don't.
+bool DeclMemo::replay(const Entry& entry, SymbolTable * symTab,
+  const std::vector<IDNode *>& ids, bool& result){
+	if (!entry.replayable || ids.size() != entry.idNames.size()){
+		return false;
+	}
+	//The shape is only a hash, so make sure it's the same
+	// declaration at least as far as names go
+	for (size_t i = 0; i < ids.size(); i++){
+		if (ids[i]->getName() != entry.idNames[i]){ return false; }
+	}
+
+	ScopeTable * top = symTab->getScope();
+	for (const Dependency& dep : entry.dependencies){
+		//Lookups that went on to find this declaration's own
+		// symbol found it in top, where (since top gives the
+		// same collision answer) replaying declares it again
+		if (!dep.collision && dep.found.kind == Ref::OWN){ continue; }
+		ScopeTable * scope = dep.scope.kind == Ref::TOP ? top : dep.scope.scope;
+		if (dep.collision){
+			bool collides;
+			if (dep.scope.kind == Ref::TOP){
+				collides = symTab->collision(dep.name);
+			} else {
+				collides = scope->collision(dep.name);
+				checked(scope, dep.name, collides);
+			}
+			if (collides != dep.collides){ return false; }
+			continue;
+		}
+		SemSymbol * symbol;
+		if (dep.scope.kind == Ref::CHAIN){
+			symbol = symTab->lookup(dep.name);
+			if (dep.found.kind == Ref::TOP){
+				//Any symbol will do, as long as it's top's and
+				// leads to the same class scope (which symbols
+				// declared with it as their type take on)
+				if (symbol == nullptr || top->lookup(dep.name) != symbol
+				  || symbol->getScopeTable()
+				  != dep.found.symbol->getScopeTable()){
+					return false;
+				}
+				continue;
+			}
+		} else {
+			symbol = scope->lookup(dep.name);
+			//Recordings still under way need to know this was
+			// asked too
+			for (Recording * rec : myRecordings){
+				if (rec->scopes.count(scope) != 0){ continue; }
+				Dependency asked = dep;
+				asked.scope = scopeRef(rec, scope);
+				asked.found = symbolRef(rec, symbol);
+				depend(rec, asked);
+			}
+		}
+		if (symbol != dep.found.symbol){ return false; }
+	}
+
+	//Only scopes something is declared in (or, for a class, is
+	// the scope of) are ever seen again, so the rest (the
+	// scopes of most blocks) needn't be made at all
+	std::vector<ScopeTable *> scopes(entry.scopeCount, nullptr);
+	auto scopeFor = [&](const Ref& ref) -> ScopeTable * {
+		switch (ref.kind){
+		case Ref::OWN:
+			if (scopes[ref.index] == nullptr){
+				scopes[ref.index] = symTab->enterScope();
+				symTab->leaveScope();
+			}
+			return scopes[ref.index];
+		case Ref::TOP: return top;
+		case Ref::OUTSIDE: return ref.scope;
+		default: return nullptr;
+		}
+	};
+	std::vector<SemSymbol *> symbols;
+	for (const OwnSymbol& own : entry.symbols){
+		SemSymbol * symbol = new SemSymbol(own.name, own.kind, own.type,
+		  scopeFor(own.scope));
+		if (!symTab->insertInto(scopeFor(own.declaredIn), symbol)){
+			throw new InternalError("Replayed declaration collided");
+		}
+		symbols.push_back(symbol);
+	}
+	for (size_t i = 0; i < ids.size(); i++){
+		const Ref& bound = entry.bindings[i];
+		if (bound.kind == Ref::OWN){
+			ids[i]->attachSymbol(symbols[bound.index]);
+		} else if (bound.kind == Ref::OUTSIDE){
+			ids[i]->attachSymbol(bound.symbol);
+		} else if (bound.kind == Ref::TOP){
+			ids[i]->attachSymbol(top->lookup(ids[i]->getName()));
+		}
+	}
+	for (const auto& error : entry.errors){
+		Report::fatal(ids[error.first]->pos(), error.second);
+	}
+	result = entry.result;
+	return true;
+}
+
+void DeclMemo::record(SymbolTable * symTab, DeclNode * decl,
+  uint64_t shape){
+	Recording * rec = new Recording();
+	rec->decl = decl;
+	rec->shape = shape;
+	rec->base = symTab->depth();
+	rec->top = symTab->getScope();
+	rec->replayable = true;
+	if (myRecordings.empty()){
+		myOuterSink = Report::sink();
+		Report::sink() = this;
+	}
+	myRecordings.push_back(rec);
+	myStarted.push_back(rec);
+}
+
+void DeclMemo::finish(bool result){
+	Recording * started = myStarted.back();
+	myStarted.pop_back();
+	if (started == nullptr){ return; }
+	std::unique_ptr<Recording> owned(started);
+	Recording& rec = *started;
+	myRecordings.pop_back();
+	if (myRecordings.empty()){ Report::sink() = myOuterSink; }
+
+	Entry entry;
+	entry.replayable = rec.replayable;
+	entry.result = result;
+	entry.scopeCount = rec.scopes.size();
+	entry.dependencies = rec.dependencies;
+	std::vector<IDNode *> ids;
+	IDCollector(ids).walk(rec.decl);
+	std::unordered_map<const Position *, size_t> idAt;
+	for (size_t i = 0; i < ids.size(); i++){
+		entry.idNames.push_back(ids[i]->getName());
+		Ref bound = symbolRef(&rec, ids[i]->getSymbol());
+		if (bound.kind == Ref::OUTSIDE && rec.viaTop.count(bound.symbol) != 0){
+			//Which of top's symbols this is depends on where the
+			// declaration is, unless it was also found some other
+			// way (as a member, say), which pins it down
+			if (rec.viaScope.count(bound.symbol) != 0){
+				entry.replayable = false;
+			}
+			bound.kind = Ref::TOP;
+		}
+		entry.bindings.push_back(bound);
+		idAt[ids[i]->pos()] = i;
+	}
+	for (size_t i = 0; i < rec.symbols.size(); i++){
+		SemSymbol * symbol = rec.symbols[i];
+		OwnSymbol own;
+		own.name = symbol->getName();
+		own.kind = symbol->getKind();
+		own.type = symbol->getType();
+		if (symbol->getScopeTable() != nullptr){
+			own.scope = scopeRef(&rec, symbol->getScopeTable());
+		}
+		own.declaredIn = rec.declaredIn[i];
+		entry.symbols.push_back(own);
+	}
+	//Every name analysis error is reported at an ID
+	for (const auto& error : rec.errors){
+		auto at = idAt.find(error.first);
+		if (at == idAt.end()){
+			entry.replayable = false;
+			break;
+		}
+		entry.errors.push_back(std::make_pair(at->second, error.second));
+	}
+	myEntries[rec.shape].push_back(entry);
+}
+
+void DeclMemo::depend(Recording * rec, const Dependency& dep){
+	//A member lookup that found one of the declaration's own
+	// symbols was made in the scope the declaration was
+	// declared in, and would find the original there, not the
+	// replayed copy
+	if (dep.scope.kind == Ref::OUTSIDE && dep.found.kind == Ref::OWN){
+		rec->replayable = false;
+	}
+	if (dep.scope.kind == Ref::OUTSIDE && dep.found.kind == Ref::OUTSIDE){
+		rec->viaScope.insert(dep.found.symbol);
+	}
+	auto key = std::make_tuple(static_cast<int>(dep.scope.kind),
+	  dep.scope.scope, dep.collision, dep.name);
+	auto found = rec->asked.find(key);
+	if (found == rec->asked.end()){
+		rec->asked[key] = rec->dependencies.size();
+		rec->dependencies.push_back(dep);
+		return;
+	}
+	//The same question got different answers at different
+	// points (i.e. either side of the declaration's own
+	// symbol being declared), so one check can't cover both
+	const Dependency& earlier = rec->dependencies[found->second];
+	if (!(earlier.found == dep.found) || earlier.collides != dep.collides){
+		rec->replayable = false;
+	}
+}
+
+DeclMemo::Ref DeclMemo::scopeRef(Recording * rec, ScopeTable * scope){
+	Ref ref;
+	auto own = rec->scopes.find(scope);
+	if (own != rec->scopes.end()){
+		ref.kind = Ref::OWN;
+		ref.index = own->second;
+	} else {
+		ref.kind = Ref::OUTSIDE;
+		ref.scope = scope;
+	}
+	return ref;
+}
+
+DeclMemo::Ref DeclMemo::symbolRef(Recording * rec, SemSymbol * symbol){
+	Ref ref;
+	if (symbol == nullptr){ return ref; }
+	auto own = rec->symbolIds.find(symbol);
+	if (own != rec->symbolIds.end()){
+		ref.kind = Ref::OWN;
+		ref.index = own->second;
+	} else {
+		ref.kind = Ref::OUTSIDE;
+		ref.symbol = symbol;
+	}
+	return ref;
+}
+
+void DeclMemo::opened(ScopeTable * scope){
+	for (Recording * rec : myRecordings){
+		size_t id = rec->scopes.size();
+		rec->scopes[scope] = id;
+	}
+}
+
+void DeclMemo::lookedUp(const std::list<ScopeTable *>& chain, size_t depth,
+  const std::string& name, SemSymbol * found){
+	for (Recording * rec : myRecordings){
+		Dependency dep;
+		dep.name = name;
+		dep.collision = false;
+		dep.collides = false;
+		//Scopes entered since the declaration began are either
+		// its own, or ones from outside it entered to look up a
+		// member; for each of those the lookup passed through,
+		// what it found (or didn't) there matters
+		size_t above = chain.size() - rec->base;
+		bool done = false;
+		auto scope = chain.begin();
+		for (size_t i = 0; i < above && !done; i++, scope++){
+			done = i == depth;
+			if (rec->scopes.count(*scope) != 0){ continue; }
+			dep.scope = scopeRef(rec, *scope);
+			dep.found = symbolRef(rec, done ? found : nullptr);
+			depend(rec, dep);
+		}
+		if (!done){
+			dep.scope.kind = Ref::CHAIN;
+			dep.found = symbolRef(rec, found);
+			//Top comes next in the chain, and a name found there
+			// is whatever that name is in top
+			if (dep.found.kind == Ref::OUTSIDE
+			  && rec->top->lookup(name) == found){
+				dep.found.kind = Ref::TOP;
+				rec->viaTop.insert(found);
+			}
+			depend(rec, dep);
+		}
+	}
+}
+
+void DeclMemo::checked(ScopeTable * scope, const std::string& name,
+  bool collides){
+	for (Recording * rec : myRecordings){
+		if (rec->scopes.count(scope) != 0){ continue; }
+		Dependency dep;
+		dep.scope = scopeRef(rec, scope);
+		if (scope == rec->top){ dep.scope.kind = Ref::TOP; }
+		dep.name = name;
+		dep.collision = true;
+		dep.collides = collides;
+		depend(rec, dep);
+	}
+}
+
+void DeclMemo::inserted(ScopeTable * scope, SemSymbol * symbol){
+	for (Recording * rec : myRecordings){
+		Ref in = scopeRef(rec, scope);
+		if (scope == rec->top){
+			in.kind = Ref::TOP;
+		} else if (in.kind == Ref::OUTSIDE){
+			rec->replayable = false;
+			continue;
+		}
+		rec->symbolIds[symbol] = rec->symbols.size();
+		rec->symbols.push_back(symbol);
+		rec->declaredIn.push_back(in);
+	}
+}
+
+void DeclMemo::report(const Position * pos, const std::string& msg){
+	for (Recording * rec : myRecordings){
+		rec->errors.push_back(std::make_pair(pos, msg));
+	}
+	Report::sink() = myOuterSink;
+	Report::fatal(pos, msg);
+	Report::sink() = this;
+}
+
+}
@@ -0,0 +1,182 @@
+#ifndef DREWNO_MARS_MEMO_HPP
+#define DREWNO_MARS_MEMO_HPP
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "ast.hpp"
+#include "binary_ast.hpp"
+#include "errors.hpp"
+#include "symbol_table.hpp"
+
+namespace drewno_mars{
+
+//A structural hash of a subtree (see shape.cpp): the kind of
+// each node, names and literal values, but no positions, so two
+// copies of a declaration hash the same wherever they are
+class DeclShape{
+public:
+	DeclShape() : myHash(0xcbf29ce484222325ULL){ }
+	void add(uint64_t val){
+		myHash = (myHash ^ val) * 0x100000001b3ULL;
+		myHash ^= myHash >> 29;
+	}
+	void add(bool val){ add(static_cast<uint64_t>(val)); }
+	void add(NodeKind kind){ add(static_cast<uint64_t>(kind)); }
+	void add(const std::string& str){
+		add(static_cast<uint64_t>(std::hash<std::string>()(str)));
+	}
+	uint64_t hash() const{ return myHash; }
+private:
+	uint64_t myHash;
+};
+
+//Remembers the name analysis of each FnDeclNode and
+// ClassDefnNode (see SymbolTable::enableMemo), so that a later
+// declaration with the same shape can reuse it rather than
+// being walked again.
+//
+//What is remembered is everything the analysis did: the scopes
+// it opened, the symbols it declared and where, the symbol (if
+// any) each of its IDs was bound to, its errors, and every
+// question it asked of scopes that aren't its own (which name
+// a lookup found, and whether a name collided). A later
+// declaration of the same shape reuses all that if, where it
+// sits, every one of those questions has the same answer;
+// otherwise it is analysed afresh.
+//
+//Symbols and scopes from outside are remembered by address, so
+// a memo is only good while none of them are freed: for one
+// compilation, with one SymbolTable that keeps all its scopes.
+// The exception is names found in the scope the declaration
+// sits in (a method using its class's fields, say), which are
+// remembered by name, so the same method in another class can
+// still be reused.
+class DeclMemo : private ReportSink{
+public:
+	DeclMemo();
+	~DeclMemo();
+
+	//Start analysing decl (whose shape hash is shape). If an
+	// earlier analysis could be replayed instead, that is done,
+	// result is set, and true is returned; otherwise decl is to
+	// be analysed as usual, then end called with the result.
+	static bool begin(SymbolTable * symTab, DeclNode * decl,
+	  uint64_t shape, bool& result);
+	static void end(SymbolTable * symTab, bool result);
+	//Drop the analyses under way, if one of them threw
+	static void abandon(SymbolTable * symTab);
+
+	//Count the declarations in prog by shape. Only those whose
+	// shape is counted more than once are recorded, since only
+	// they can be reused.
+	void expect(ProgramNode * prog);
+
+	size_t hits(){ return myHits; }
+	size_t misses(){ return myMisses; }
+
+	//What the SymbolTable reports while an analysis is being
+	// recorded
+	void opened(ScopeTable * scope);
+	void lookedUp(const std::list<ScopeTable *>& chain, size_t depth,
+	  const std::string& name, SemSymbol * found);
+	void checked(ScopeTable * scope, const std::string& name,
+	  bool collides);
+	void inserted(ScopeTable * scope, SemSymbol * symbol);
+
+private:
+	//A scope or symbol as a recording saw it: NONE (no
+	// symbol), one of the declaration's OWN (by index), one
+	// from OUTSIDE it (by address), or the TOP scope (whichever
+	// one is current when it starts), where the declaration
+	// declares itself, or a symbol found there by name. A
+	// lookup that got past every scope entered since the
+	// declaration started went on to the rest of the CHAIN.
+	struct Ref{
+		enum Kind : unsigned char{ NONE, OWN, OUTSIDE, TOP, CHAIN };
+		Kind kind = NONE;
+		size_t index = 0;
+		SemSymbol * symbol = nullptr;
+		ScopeTable * scope = nullptr;
+		bool operator==(const Ref& other) const{
+			return kind == other.kind && index == other.index
+			  && symbol == other.symbol && scope == other.scope;
+		}
+	};
+	//A question asked of a scope that isn't the declaration's
+	// own: what name finds there (found), or if it collides
+	struct Dependency{
+		Ref scope;
+		std::string name;
+		bool collision;
+		Ref found;
+		bool collides;
+	};
+	struct OwnSymbol{
+		std::string name;
+		std::string kind;
+		std::string type;
+		Ref scope;
+		Ref declaredIn;
+	};
+	struct Entry{
+		bool replayable;
+		bool result;
+		std::vector<std::string> idNames;
+		std::vector<Ref> bindings;
+		size_t scopeCount;
+		std::vector<OwnSymbol> symbols;
+		std::vector<Dependency> dependencies;
+		std::vector<std::pair<size_t, std::string>> errors;
+	};
+	struct Recording{
+		DeclNode * decl;
+		uint64_t shape;
+		size_t base;
+		ScopeTable * top;
+		HashMap<ScopeTable *, size_t> scopes;
+		std::vector<SemSymbol *> symbols;
+		HashMap<SemSymbol *, size_t> symbolIds;
+		std::vector<Ref> declaredIn;
+		std::vector<Dependency> dependencies;
+		std::map<std::tuple<int, ScopeTable *, bool, std::string>, size_t>
+		  asked;
+		std::vector<std::pair<const Position *, std::string>> errors;
+		//Symbols found in top by name, and symbols found by
+		// looking in a scope from outside
+		std::unordered_set<SemSymbol *> viaTop;
+		std::unordered_set<SemSymbol *> viaScope;
+		bool replayable;
+	};
+
+	bool start(SymbolTable * symTab, DeclNode * decl, uint64_t shape,
+	  bool& result);
+	bool replay(const Entry& entry, SymbolTable * symTab,
+	  const std::vector<IDNode *>& ids, bool& result);
+	void record(SymbolTable * symTab, DeclNode * decl, uint64_t shape);
+	void finish(bool result);
+	void depend(Recording * rec, const Dependency& dep);
+	Ref scopeRef(Recording * rec, ScopeTable * scope);
+	Ref symbolRef(Recording * rec, SemSymbol * symbol);
+	void report(const Position * pos, const std::string& msg) override;
+
+	std::map<uint64_t, std::vector<Entry>> myEntries;
+	std::unordered_map<uint64_t, size_t> myExpected;
+	std::vector<Recording *> myRecordings;
+	//Each analysis begun and not yet ended: its recording, or
+	// null if it isn't being recorded
+	std::vector<Recording *> myStarted;
+	ReportSink * myOuterSink;
+	size_t myHits;
+	size_t myMisses;
+};
+
+}
+
+#endif
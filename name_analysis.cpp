@@ -1,91 +1,198 @@
 #include "ast.hpp"
 #include "symbol_table.hpp"
 #include "errName.hpp"
+#include "memo.hpp"
+#include "visitor.hpp"
 
 namespace drewno_mars{
 
-bool ASTNode::nameAnalysis(SymbolTable * symTab){
-	throw new ToDoError("This function should have"
-		"been overriden in the subclass!");
-}
-
-bool ProgramNode::nameAnalysis(SymbolTable * symTab){
-    symTab->enterScope();
-	bool res = true;
-	for (auto global : *myGlobals){
-		res = global->nameAnalysis(symTab) && res;
-	}
-    symTab->leaveScope();
-	return res;
-}
-
-bool IDNode::nameAnalysis(SymbolTable *symTab) {
-    SemSymbol * symbol = symTab->lookup(name);
-    if (symbol == nullptr){
-        return NameErr::undeclID(pos());
-    }
-    this->attachSymbol(symbol);
-    return true;
-}
-
-void IDNode::attachSymbol(SemSymbol * symbolIn){
-    this->mySymbol = symbolIn;
-}
-
-bool ClassDefnNode::nameAnalysis(SymbolTable *symTab) {
-    std::string className = this->ID()->getName();
-
-    ScopeTable * oldScope = symTab->getScope();
-    ScopeTable * newScope = symTab->enterScope();
-
+//What name analysis keeps for a declaration it is part way
+// through: the scope it is being declared in, and whether its
+// name was free there
+struct DeclScratch{
+    ScopeTable * outer = nullptr;
     bool noCollision = true;
-    if (oldScope->collision(className)){
-        NameErr::multiDecl(ID()->pos());
-        noCollision = false;
-    }
-
-    if (noCollision){
-        auto * symbol = new SemSymbol(className, "class", className, newScope);
-        oldScope->insert(symbol);
-        this->ID()->attachSymbol(symbol);
-    }
-
-    bool goodMemberDecls = true;
-    std::list<DeclNode *> * decls = this->getMembers();
-    for (auto decl : *decls) {
-        goodMemberDecls = decl->nameAnalysis(symTab) && goodMemberDecls;
+};
+
+//Binds each ID to the symbol it names, declaring symbols (and
+// opening scopes) as declarations are met. Each node's result
+// is whether its subtree was free of name errors.
+class NameAnalyser : public AstMachine<NameAnalyser, bool, DeclScratch>{
+public:
+    NameAnalyser(SymbolTable * symTabIn)
+    : symTab(symTabIn), myField(nullptr), myFieldSymbol(nullptr){ }
+
+    Next step(Frame& f, bool last){
+        if (f.step == 0){
+            f.result = true;
+        } else {
+            f.result = last && f.result;
+        }
+        switch (f.node->kind()){
+        case NodeKind::Program: return program(f);
+        case NodeKind::ClassDefn: return classDefn(f);
+        case NodeKind::VarDecl:
+        case NodeKind::FormalDecl:
+            return varDecl(f);
+        case NodeKind::FnDecl: return fnDecl(f);
+        case NodeKind::AssignStmt: {
+            AssignStmtNode * node = static_cast<AssignStmtNode *>(f.node);
+            return children(f, node->getDst(), node->getSrc());
+        }
+        case NodeKind::TakeStmt:
+            return children(f, static_cast<TakeStmtNode *>(f.node)->getDst());
+        case NodeKind::GiveStmt:
+            return children(f, static_cast<GiveStmtNode *>(f.node)->getSrc());
+        case NodeKind::PostDecStmt:
+            return children(f, static_cast<PostDecStmtNode *>(f.node)->getLoc());
+        case NodeKind::PostIncStmt:
+            return children(f, static_cast<PostIncStmtNode *>(f.node)->getLoc());
+        case NodeKind::IfStmt: {
+            IfStmtNode * node = static_cast<IfStmtNode *>(f.node);
+            return block(f, node->getCond(), node->getBody());
+        }
+        case NodeKind::IfElseStmt: return ifElseStmt(f);
+        case NodeKind::WhileStmt: {
+            WhileStmtNode * node = static_cast<WhileStmtNode *>(f.node);
+            return block(f, node->getCond(), node->getBody());
+        }
+        case NodeKind::ReturnStmt:
+            return children(f, static_cast<ReturnStmtNode *>(f.node)->getExp());
+        case NodeKind::CallStmt:
+            return children(f,
+              static_cast<CallStmtNode *>(f.node)->getCallExp());
+        case NodeKind::CallExp: return callExp(f);
+        case NodeKind::MemberFieldExp: return memberFieldExp(f);
+        case NodeKind::Plus: case NodeKind::Minus:
+        case NodeKind::Times: case NodeKind::Divide:
+        case NodeKind::And: case NodeKind::Or:
+        case NodeKind::Equals: case NodeKind::NotEquals:
+        case NodeKind::Less: case NodeKind::LessEq:
+        case NodeKind::Greater: case NodeKind::GreaterEq: {
+            BinaryExpNode * node = static_cast<BinaryExpNode *>(f.node);
+            return children(f, node->getExp1(), node->getExp2());
+        }
+        case NodeKind::Neg: case NodeKind::Not:
+            return children(f, static_cast<UnaryExpNode *>(f.node)->getExp());
+        case NodeKind::ClassType:
+            return children(f, static_cast<ClassTypeNode *>(f.node)->ID());
+        case NodeKind::ID: case NodeKind::ExitStmt:
+        case NodeKind::VoidType: case NodeKind::PerfectType:
+        case NodeKind::IntType: case NodeKind::BoolType:
+        case NodeKind::IntLit: case NodeKind::StrLit:
+        case NodeKind::True: case NodeKind::False: case NodeKind::Magic:
+            leaf(f.node, f.state, f.result);
+            return done();
+        case NodeKind::List: case NodeKind::KindCount:
+            break;
+        }
+        throw new InternalError("Name analysed a list as a node");
     }
 
-    symTab->leaveScope();
-    return (noCollision && goodMemberDecls);
-}
-
-bool VarDeclNode::nameAnalysis(SymbolTable * symTab){
-    std::string type = this->getTypeNode()->getType();
-    std::string name = this->ID()->getName();
-
-
-    bool goodType = type != "void";
-    if (!goodType){
-        NameErr::badVarType(ID()->pos());
+    bool leaf(ASTNode * node, const DeclScratch& state, bool& result){
+        switch (node->kind()){
+        case NodeKind::ID: {
+            IDNode * id = static_cast<IDNode *>(node);
+            SemSymbol * symbol = symTab->lookup(id->getName());
+            if (symbol == nullptr){
+                result = NameErr::undeclID(id->pos());
+            } else {
+                id->attachSymbol(symbol);
+                result = true;
+            }
+            return true;
+        }
+        //void, int, bool and perfect types name nothing (name
+        // analysis may never even get down to them, but if it
+        // does, it has not failed), and nor do literals
+        case NodeKind::ExitStmt:
+        case NodeKind::VoidType: case NodeKind::PerfectType:
+        case NodeKind::IntType: case NodeKind::BoolType:
+        case NodeKind::IntLit: case NodeKind::StrLit:
+        case NodeKind::True: case NodeKind::False: case NodeKind::Magic:
+            result = true;
+            return true;
+        default:
+            return false;
+        }
     }
 
-    bool noCollision = !symTab->collision(name);
-    if (!noCollision){
-        NameErr::multiDecl(ID()->pos());
+private:
+    Next program(Frame& f){
+        std::list<DeclNode *> * globals =
+          static_cast<ProgramNode *>(f.node)->getGlobals();
+        if (f.step == 0){
+            symTab->enterGlobalScope();
+            f.start(globals);
+            f.step = 1;
+        }
+        if (DeclNode * global = f.next(globals)){
+            return into(global);
+        }
+        symTab->leaveScope();
+        return done();
     }
 
-    bool goodAssignment = true;
-    if(myInit != nullptr) {
-        goodAssignment = myInit->nameAnalysis(symTab);
+    Next classDefn(Frame& f){
+        ClassDefnNode * node = static_cast<ClassDefnNode *>(f.node);
+        if (f.step == 0){
+            if (DeclMemo::begin(symTab, node, node->shapeHash(), f.result)){
+                return done();
+            }
+            std::string className = node->ID()->getName();
+
+            if (symTab->collision(className)){
+                NameErr::multiDecl(node->ID()->pos());
+                f.state.noCollision = false;
+                f.result = false;
+            }
+
+            ScopeTable * oldScope = symTab->getScope();
+            ScopeTable * newScope = symTab->enterScope();
+
+            if (f.state.noCollision){
+                auto * symbol = new SemSymbol(className, "class", className, newScope);
+                symTab->insertInto(oldScope, symbol);
+                node->ID()->attachSymbol(symbol);
+            }
+            f.start(node->getMembers());
+            f.step = 1;
+        }
+        if (DeclNode * decl = f.next(node->getMembers())){
+            return into(decl);
+        }
+        symTab->leaveScope();
+        DeclMemo::end(symTab, f.result);
+        return done();
     }
 
-    bool goodClass = this->myType->nameAnalysis(symTab);
-
-    if (!goodType || !noCollision || !goodAssignment || !goodClass){
-        return false;
-    } else {
-        SemSymbol * classSymbol = myType->getSymbol();
+    Next varDecl(Frame& f){
+        VarDeclNode * node = static_cast<VarDeclNode *>(f.node);
+        if (f.step == 0){
+            std::string type = node->getTypeNode()->getType();
+            if (type == "void"){
+                NameErr::badVarType(node->ID()->pos());
+                f.result = false;
+            }
+            if (symTab->collision(node->ID()->getName())){
+                NameErr::multiDecl(node->ID()->pos());
+                f.result = false;
+            }
+            f.step = 1;
+            if (node->getInit() != nullptr){
+                return into(node->getInit());
+            }
+        }
+        if (f.step == 1){
+            f.step = 2;
+            return into(node->getTypeNode());
+        }
+        if (!f.result){
+            return done();
+        }
+        std::string name = node->ID()->getName();
+        std::string type = node->getTypeNode()->getType();
+        SemSymbol * classSymbol = node->getTypeNode()->getSymbol();
         SemSymbol * symbol;
         if (classSymbol != nullptr) {
             ScopeTable * classScope = classSymbol->getScopeTable();
@@ -95,201 +202,194 @@ bool VarDeclNode::nameAnalysis(SymbolTable * symTab){
             symbol = new SemSymbol(name, "var", type);
         }
         symTab->insert(symbol);
-        this->ID()->attachSymbol(symbol);
-        return true;
+        node->ID()->attachSymbol(symbol);
+        return done();
     }
-}
-
-bool FnDeclNode::nameAnalysis(SymbolTable * symTab){
-    std::string funcName = this->ID()->getName();
-
-    bool goodReturnType = this->myRetType->nameAnalysis(symTab);
-
-    ScopeTable * oldFuncScope = symTab->getScope();
-    ScopeTable * newFuncScope = symTab->enterScope();
 
-    bool noCollision = true;
-    if (oldFuncScope->collision(funcName)){
-        NameErr::multiDecl(ID()->pos());
-        noCollision = false;
+    Next fnDecl(Frame& f){
+        FnDeclNode * node = static_cast<FnDeclNode *>(f.node);
+        if (f.step == 0){
+            if (DeclMemo::begin(symTab, node, node->shapeHash(), f.result)){
+                return done();
+            }
+            f.step = 1;
+            return into(node->getTypeNode());
+        }
+        if (f.step == 1){
+            if (symTab->collision(node->ID()->getName())){
+                NameErr::multiDecl(node->ID()->pos());
+                f.state.noCollision = false;
+                f.result = false;
+            }
+
+            f.state.outer = symTab->getScope();
+            symTab->enterScope();
+            f.start(node->getFormals());
+            f.step = 2;
+        }
+        if (f.step == 2){
+            if (FormalDeclNode * formal = f.next(node->getFormals())){
+                return into(formal);
+            }
+
+            std::string type = "(";
+            bool firstFormal = true;
+            for (auto formal : *node->getFormals()) {
+                if (firstFormal) {
+                    firstFormal = false;
+                } else {
+                    type += ",";
+                }
+                type += formal->getTypeNode()->getType();
+            }
+            type += ")->";
+            type += node->getTypeNode()->getType();
+
+            if (f.state.noCollision){
+                auto * symbol = new SemSymbol(node->ID()->getName(), "fn", type);
+                symTab->insertInto(f.state.outer, symbol);
+                node->ID()->attachSymbol(symbol);
+            }
+            f.start(node->getBody());
+            f.step = 3;
+        }
+        if (StmtNode * stmt = f.next(node->getBody())){
+            return into(stmt);
+        }
+        symTab->leaveScope();
+        DeclMemo::end(symTab, f.result);
+        return done();
     }
 
-    bool goodFormals = true;
-
-    std::string type = "(";
-    std::list<FormalDeclNode *> * formals = this->getFormals();
-
-    bool firstFormal = true;
-    for (auto formal : *formals) {
-        goodFormals = formal->nameAnalysis(symTab) && goodFormals;
-        if (firstFormal) {
-            firstFormal = false;
-        } else {
-            type += ",";
+    //Up to two children, in order (either may be absent)
+    Next children(Frame& f, ASTNode * first, ASTNode * second = nullptr){
+        switch (f.step++){
+        case 0:
+            if (first != nullptr){ return into(first); }
+            f.step++;
+            if (second != nullptr){ return into(second); }
+            break;
+        case 1:
+            if (second != nullptr){ return into(second); }
+            break;
         }
-        type += formal->getTypeNode()->getType();
+        return done();
     }
-    type += ")->";
-    type += this->getTypeNode()->getType();
 
-    if (noCollision){
-        auto * symbol = new SemSymbol(funcName, "fn", type);
-        oldFuncScope->insert(symbol);
-        this->ID()->attachSymbol(symbol);
+    //An if or while: a condition, then a block, in a scope of
+    // its own
+    Next block(Frame& f, ExpNode * cond, std::list<StmtNode *> * body){
+        if (f.step == 0){
+            f.step = 1;
+            return into(cond);
+        }
+        if (f.step == 1){
+            symTab->enterScope();
+            f.start(body);
+            f.step = 2;
+        }
+        if (StmtNode * stmt = f.next(body)){
+            return into(stmt);
+        }
+        symTab->leaveScope();
+        return done();
     }
 
-    bool goodBody = true;
-    for (auto stmt : *myBody){
-        goodBody = stmt->nameAnalysis(symTab) && goodBody;
+    Next ifElseStmt(Frame& f){
+        IfElseStmtNode * node = static_cast<IfElseStmtNode *>(f.node);
+        if (f.step == 0){
+            f.step = 1;
+            return into(node->getCond());
+        }
+        if (f.step == 1){
+            symTab->enterScope();
+            f.start(node->getBodyTrue());
+            f.step = 2;
+        }
+        if (f.step == 2){
+            if (StmtNode * stmt = f.next(node->getBodyTrue())){
+                return into(stmt);
+            }
+            symTab->leaveScope();
+            symTab->enterScope();
+            f.start(node->getBodyFalse());
+            f.step = 3;
+        }
+        if (StmtNode * stmt = f.next(node->getBodyFalse())){
+            return into(stmt);
+        }
+        symTab->leaveScope();
+        return done();
     }
 
-    symTab->leaveScope();
-    return (goodReturnType && goodFormals && noCollision && goodBody);
-}
-
-bool AssignStmtNode::nameAnalysis(SymbolTable * symTab){
-    bool result = myDst->nameAnalysis(symTab);
-    result = mySrc->nameAnalysis(symTab) && result;
-    return result;
-}
-
-bool TakeStmtNode::nameAnalysis(SymbolTable *symTab) {
-    return myDst->nameAnalysis(symTab);
-}
-
-bool GiveStmtNode::nameAnalysis(SymbolTable *symTab) {
-    return mySrc->nameAnalysis(symTab);
-}
-
-bool ExitStmtNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool PostDecStmtNode::nameAnalysis(SymbolTable *symTab) {
-    return myLoc->nameAnalysis(symTab);
-}
-
-bool PostIncStmtNode::nameAnalysis(SymbolTable *symTab) {
-    return myLoc->nameAnalysis(symTab);
-}
-
-bool IfStmtNode::nameAnalysis(SymbolTable *symTab) {
-    bool result = myCond->nameAnalysis(symTab);
-    symTab->enterScope();
-    for (auto stmt : *myBody){
-        result = stmt->nameAnalysis(symTab) && result;
+    Next callExp(Frame& f){
+        CallExpNode * node = static_cast<CallExpNode *>(f.node);
+        if (f.step == 0){
+            f.step = 1;
+            return into(node->getCallee());
+        }
+        if (f.step == 1){
+            f.start(node->getArgs());
+            f.step = 2;
+        }
+        if (ExpNode * arg = f.next(node->getArgs())){
+            return into(arg);
+        }
+        return done();
     }
-    symTab->leaveScope();
-    return result;
-}
 
-bool IfElseStmtNode::nameAnalysis(SymbolTable *symTab) {
-    bool result = myCond->nameAnalysis(symTab);
-    symTab->enterScope();
-    for (auto stmt : *myBodyTrue){
-        result = stmt->nameAnalysis(symTab) && result;
-    }
-    symTab->leaveScope();
-    symTab->enterScope();
-    for (auto stmt : *myBodyFalse){
-        result = stmt->nameAnalysis(symTab) && result;
+    Next memberFieldExp(Frame& f){
+        MemberFieldExpNode * node = static_cast<MemberFieldExpNode *>(f.node);
+        switch (f.step++){
+        case 0:
+            return into(node->getBase());
+        case 1: {
+            //A field chain's symbol is that of its innermost base,
+            // which the base (if it's a field too) has just found
+            // (so a long chain isn't walked once per field)
+            SemSymbol * symbol;
+            if (node->getBase() == myField){
+                symbol = myFieldSymbol;
+            } else {
+                symbol = node->getSymbol();
+            }
+            myField = node;
+            myFieldSymbol = symbol;
+            if (symbol == nullptr){
+                f.result = false;
+                return done();
+            }
+            ScopeTable * scope = symbol->getScopeTable();
+            symTab->enterScope(scope);
+            return into(node->getField());
+        }
+        }
+        symTab->leaveScope();
+        return done();
     }
-    symTab->leaveScope();
-    return result;
-}
 
-bool WhileStmtNode::nameAnalysis(SymbolTable *symTab) {
-    bool result = myCond->nameAnalysis(symTab);
-    symTab->enterScope();
-    for (auto stmt : *myBody){
-        result = stmt->nameAnalysis(symTab) && result;
-    }
-    symTab->leaveScope();
-    return result;
-}
+    SymbolTable * symTab;
+    //The last field expression analysed, and its symbol
+    MemberFieldExpNode * myField;
+    SemSymbol * myFieldSymbol;
+};
 
-bool ReturnStmtNode::nameAnalysis(SymbolTable *symTab) {
-    if (myExp == nullptr) {
-        return true;
+bool ASTNode::nameAnalysis(SymbolTable * symTab){
+    try {
+        return NameAnalyser(symTab).run(this);
+    } catch (...){
+        DeclMemo::abandon(symTab);
+        throw;
     }
-    return myExp->nameAnalysis(symTab);
 }
 
-bool CallExpNode::nameAnalysis(SymbolTable* symTab){
-    bool result = myCallee->nameAnalysis(symTab);
-    for (auto arg : *myArgs){
-        result = arg->nameAnalysis(symTab) && result;
-    }
-    return result;
-}
+BindingObserver * IDNode::observer = nullptr;
 
-bool MemberFieldExpNode::nameAnalysis(SymbolTable *symTab) {
-    bool result = myBase->nameAnalysis(symTab);
-    SemSymbol * symbol = getSymbol();
-    if(symbol != nullptr) {
-        ScopeTable * scope = symbol->getScopeTable();
-        symTab->enterScope(scope);
-        result = myField->nameAnalysis(symTab) && result;
-        symTab->leaveScope();
-        return result;
+void IDNode::attachSymbol(SemSymbol * symbolIn){
+    this->mySymbol = symbolIn;
+    if (observer != nullptr){
+        observer->bound(this, symbolIn);
     }
-    return false;
-}
-
-bool BinaryExpNode::nameAnalysis(SymbolTable *symTab) {
-    bool result = myExp1->nameAnalysis(symTab);
-    result = myExp2->nameAnalysis(symTab) && result;
-    return result;
-}
-
-bool UnaryExpNode::nameAnalysis(SymbolTable *symTab) {
-    return myExp->nameAnalysis(symTab);
 }
 
-bool VoidTypeNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool ClassTypeNode::nameAnalysis(SymbolTable *symTab) {
-    return myID->nameAnalysis(symTab);
-}
-
-bool PerfectTypeNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool IntTypeNode::nameAnalysis(SymbolTable* symTab){
-    // Name analysis may never even recurse down to IntTypeNode,
-    // but if it does, just return true to indicate that
-    // name analysis has not failed, and add nothing to the symbol table
-    return true;
-}
-
-bool BoolTypeNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool IntLitNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool StrLitNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool TrueNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool FalseNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool MagicNode::nameAnalysis(SymbolTable *symTab) {
-    return true;
-}
-
-bool CallStmtNode::nameAnalysis(SymbolTable* symTab){
-    return myCallExp->nameAnalysis(symTab);
-}
 }
@@ -2,26 +2,55 @@
 #define DREWNO_MARS_NAME_ANALYSIS
 
 #include "ast.hpp"
+#include "memo.hpp"
+#include "stats.hpp"
 #include "symbol_table.hpp"
 
 namespace drewno_mars{
 
 class NameAnalysis{
 public:
-	static NameAnalysis * build(ProgramNode * astIn){
-		NameAnalysis * nameAnalysis = new NameAnalysis;
+	//With memoize, repeated declarations reuse the analysis
+	// of the first (see DeclMemo). With a prelude, the
+	// program's globals are declared alongside its (and the
+	// analysis takes ownership of it).
+	static NameAnalysis * build(ProgramNode * astIn,
+	  bool memoize = false, Summary * prelude = nullptr){
 		SymbolTable * symTab = new SymbolTable();
+		symTab->usePrelude(prelude);
+		if (memoize){
+			symTab->enableMemo();
+			symTab->memo()->expect(astIn);
+		}
 		bool res = astIn->nameAnalysis(symTab);
-		delete symTab;
-		if (!res){ return nullptr; }
+		if (memoize){
+			Stats::count("memo hits", symTab->memo()->hits());
+			Stats::count("memo misses", symTab->memo()->misses());
+		}
+		if (!res){
+			delete symTab;
+			return nullptr;
+		}
 
+		NameAnalysis * nameAnalysis = new NameAnalysis;
 		nameAnalysis->ast = astIn;
+		nameAnalysis->symTab = symTab;
 		return nameAnalysis;
 	}
 
+	//The analysis owns the tree, and the symbol table whose
+	// symbols the tree's IDs are bound to
+	~NameAnalysis(){
+		delete ast;
+		delete symTab;
+	}
+
 	ProgramNode * ast;
+	//The scope the program's globals were declared in
+	ScopeTable * globals(){ return symTab->globals(); }
 
 private:
+	SymbolTable * symTab;
 	NameAnalysis(){
 		//This private constructor means the only way
 		// to get a nameAnalysis instance is through
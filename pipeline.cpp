@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <sstream>
+#include "pipeline.hpp"
+
+namespace drewno_mars{
+
+using TokenKind = drewno_mars::Parser::token;
+
+//How often a side yields to the other before sleeping: the ring
+// usually fills or drains within a few, but input from a slow
+// pipe can leave it empty for as long as the writer likes
+static const int spinsBeforeSleep = 64;
+
+PipelinedScanner::PipelinedScanner(std::istream * in)
+: Scanner(in), myLexer(in), myCancelled(false),
+  myParserAsleep(false), myLexerAsleep(false), myDone(false),
+  myWallSeconds(0), myLexSeconds(0), myProducerWaitSeconds(0),
+  myProducerWaits(0), myTokens(0), myConsumerWaitSeconds(0),
+  myConsumerWaits(0){
+	//Tokens change hands in the ring; whoever pops one owns it
+	myLexer.handOffTokens();
+	//Start the producer last, once everything it touches exists
+	myProducer = std::thread(&PipelinedScanner::produce, this);
+}
+
+PipelinedScanner::~PipelinedScanner(){
+	//The parser may have given up before reaching the end
+	// of the input, leaving the producer blocked on a full ring
+	myCancelled.store(true, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(mySleep);
+		mySlotFree.notify_one();
+	}
+	myProducer.join();
+	if (!myDone){ myWallSeconds = myClock.seconds(); }
+	LexedToken unread;
+	while (myRing.tryPop(unread)){ delete unread.lexeme; }
+
+	if (!Stats::enabled()){ return; }
+	double parseSeconds = myWallSeconds - myConsumerWaitSeconds;
+	double serial = myLexSeconds + parseSeconds;
+	double overlap = std::max(0.0, serial - myWallSeconds);
+	Stats::count("pipeline tokens", myTokens);
+	Stats::time("pipeline lexer busy", myLexSeconds);
+	Stats::time("pipeline parser busy", parseSeconds);
+	Stats::time("pipeline wall", myWallSeconds);
+	Stats::count("pipeline lexer waits (ring full)", myProducerWaits);
+	Stats::time("pipeline lexer wait time", myProducerWaitSeconds);
+	Stats::count("pipeline parser waits (ring empty)", myConsumerWaits);
+	Stats::time("pipeline parser wait time", myConsumerWaitSeconds);
+	std::ostringstream pct;
+	pct.precision(1);
+	pct << std::fixed << (serial > 0 ? 100 * overlap / serial : 0)
+	  << "% of serial lex+parse time";
+	Stats::time("pipeline overlap", overlap);
+	Stats::note("pipeline overlap share", pct.str());
+}
+
+void PipelinedScanner::produce(){
+	Stopwatch running;
+	drewno_mars::Parser::semantic_type lval;
+	while (true){
+		int kind = myLexer.yylex(&lval);
+		LexedToken tok;
+		tok.kind = kind;
+		tok.lexeme = nullptr;
+		if (kind != TokenKind::END){
+			//Empty lval again for the next token
+			tok.lexeme = lval.as<drewno_mars::Token *>();
+			lval.destroy<drewno_mars::Token *>();
+		}
+		myTokens++;
+
+		if (!myRing.tryPush(tok)){
+			Stopwatch waiting;
+			myProducerWaits++;
+			bool pushed = false;
+			for (int spin = 0; spin < spinsBeforeSleep && !pushed; spin++){
+				if (myCancelled.load(std::memory_order_relaxed)){ break; }
+				std::this_thread::yield();
+				pushed = myRing.tryPush(tok);
+			}
+			if (!pushed){
+				std::unique_lock<std::mutex> lock(mySleep);
+				myLexerAsleep.store(true, std::memory_order_relaxed);
+				//Pairs with the fence in wakeLexer, so that either
+				// this sees the slot freed or the parser sees this
+				// asleep
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				mySlotFree.wait(lock, [&](){
+					pushed = myRing.tryPush(tok);
+					return pushed
+					  || myCancelled.load(std::memory_order_relaxed);
+				});
+				myLexerAsleep.store(false, std::memory_order_relaxed);
+			}
+			myProducerWaitSeconds += waiting.seconds();
+			if (!pushed){
+				delete tok.lexeme;
+				myLexSeconds = running.seconds() - myProducerWaitSeconds;
+				return;
+			}
+		}
+		wakeParser();
+		if (kind == TokenKind::END){ break; }
+	}
+	myLexSeconds = running.seconds() - myProducerWaitSeconds;
+}
+
+int PipelinedScanner::yylex(drewno_mars::Parser::semantic_type * const lval){
+	if (myDone){ return TokenKind::END; }
+
+	LexedToken tok;
+	if (!myRing.tryPop(tok)){
+		Stopwatch waiting;
+		myConsumerWaits++;
+		bool popped = false;
+		for (int spin = 0; spin < spinsBeforeSleep && !popped; spin++){
+			std::this_thread::yield();
+			popped = myRing.tryPop(tok);
+		}
+		if (!popped){
+			std::unique_lock<std::mutex> lock(mySleep);
+			myParserAsleep.store(true, std::memory_order_relaxed);
+			//Pairs with the fence in wakeParser
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			myTokenReady.wait(lock, [&](){ return myRing.tryPop(tok); });
+			myParserAsleep.store(false, std::memory_order_relaxed);
+		}
+		myConsumerWaitSeconds += waiting.seconds();
+	}
+	wakeLexer();
+	if (tok.kind == TokenKind::END){
+		myDone = true;
+		myWallSeconds = myClock.seconds();
+	} else {
+		lval->emplace<drewno_mars::Token *>(keep(tok.lexeme));
+	}
+	return tok.kind;
+}
+
+void PipelinedScanner::wakeParser(){
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (myParserAsleep.load(std::memory_order_relaxed)){
+		//Taking the lock waits out a parser between its last look
+		// at the ring and going to sleep
+		std::lock_guard<std::mutex> lock(mySleep);
+		myTokenReady.notify_one();
+	}
+}
+
+void PipelinedScanner::wakeLexer(){
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (myLexerAsleep.load(std::memory_order_relaxed)){
+		std::lock_guard<std::mutex> lock(mySleep);
+		mySlotFree.notify_one();
+	}
+}
+
+}
@@ -0,0 +1,70 @@
+#ifndef DREWNO_MARS_PIPELINE_HPP
+#define DREWNO_MARS_PIPELINE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include "scanner.hpp"
+#include "stats.hpp"
+#include "token_ring.hpp"
+
+namespace drewno_mars{
+
+//A Scanner that does its lexing on a separate producer
+// thread. Tokens are handed to the parser (which calls
+// yylex as usual) through a lock-free ring, so reading and
+// lexing the input overlaps with parsing it. A side that finds
+// the ring full (or empty) yields for a while and then sleeps
+// until the other side wakes it. Lexical errors
+// are still reported, but may now come out ahead of syntax
+// errors for earlier tokens.
+class PipelinedScanner : public Scanner{
+public:
+	PipelinedScanner(std::istream * in);
+	virtual ~PipelinedScanner();
+
+	using Scanner::yylex;
+	int yylex(drewno_mars::Parser::semantic_type * const lval) override;
+
+private:
+	//What travels through the ring: the token kind plus
+	// the lexeme the lexer built for it (if any)
+	struct LexedToken{
+		int kind;
+		Token * lexeme;
+	};
+
+	void produce();
+	//Wake the other side if it has gone to sleep on the ring
+	void wakeParser();
+	void wakeLexer();
+
+	Scanner myLexer;
+	SpscRing<LexedToken, 4096> myRing;
+	std::atomic<bool> myCancelled;
+	std::mutex mySleep;
+	std::condition_variable myTokenReady;
+	std::condition_variable mySlotFree;
+	std::atomic<bool> myParserAsleep;
+	std::atomic<bool> myLexerAsleep;
+	bool myDone;
+	Stopwatch myClock;
+	double myWallSeconds;
+
+	//Written only by the producer, read after it is joined
+	double myLexSeconds;
+	double myProducerWaitSeconds;
+	size_t myProducerWaits;
+	size_t myTokens;
+
+	//Written only by the consumer
+	double myConsumerWaitSeconds;
+	size_t myConsumerWaits;
+
+	std::thread myProducer;
+};
+
+}
+
+#endif
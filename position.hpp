@@ -14,12 +14,17 @@ public:
 	: myLineI(start->myLineI), myColI(start->myColI),
 	  myLineE(end->myLineE),myColE(end->myColE){
 	}
+	virtual ~Position(){ }
 	virtual void expand(const Position * start, const Position * end){
 	  myLineI = start->myLineI;
 	  myColI = start->myColI;
 	  myLineE = end->myLineE;
 	  myColE = end->myColE;
 	}
+	size_t lineBegin() const{ return myLineI; }
+	size_t colBegin() const{ return myColI; }
+	size_t lineEnd() const{ return myLineE; }
+	size_t colEnd() const{ return myColE; }
 	virtual std::string begin() const{
 		std::string result = "[" 
 		+ std::to_string(myLineI)
@@ -0,0 +1,267 @@
+#ifndef DREWNO_MARS_REBUILD_HPP
+#define DREWNO_MARS_REBUILD_HPP
+
+#include <list>
+#include <vector>
+#include "ast.hpp"
+
+namespace drewno_mars{
+
+//Builds a fresh tree, as the parser would have, from one laid
+// out flat: a binary AST (AstNodeView) or a FlatAst
+// (FlatAst::View). A View has kind(), childCount(),
+// hasChild(i), child(i), name(), intValue() and position(),
+// children are laid out as binary_ast.hpp describes, and
+// View::corrupt() throws if they don't make sense.
+//
+//Nodes are built children first, off an explicit stack, so a
+// deep tree can't overflow the C++ one. Each node's built
+// children (with each list's items in its place, and null for
+// an absent child) are on the end of built when it is.
+template <typename View>
+class TreeBuilder{
+public:
+	static ASTNode * build(const View& root){
+		struct Pending{
+			View view;
+			size_t next;
+			size_t arity;
+			size_t base;
+		};
+		std::vector<Pending> pending;
+		std::vector<ASTNode *> built;
+		pending.push_back({root, 0, arity(root), 0});
+		while (true){
+			Pending& p = pending.back();
+			if (p.next < p.arity && p.next < p.view.childCount()){
+				size_t i = p.next++;
+				if (!p.view.hasChild(i)){
+					built.push_back(nullptr);
+				} else {
+					View child = p.view.child(i);
+					pending.push_back({child, 0, arity(child), built.size()});
+				}
+				continue;
+			}
+			//A list's items stay where they are, for its node to take
+			if (p.view.kind() == NodeKind::List){
+				pending.pop_back();
+				continue;
+			}
+			ASTNode * node = make(p.view, built.begin()
+			  + static_cast<long>(p.base));
+			built.resize(p.base);
+			built.push_back(node);
+			pending.pop_back();
+			if (pending.empty()){
+				return node;
+			}
+		}
+	}
+
+private:
+	typedef std::vector<ASTNode *>::const_iterator Built;
+
+	//Where the i'th child's built node (or a list's first item) is,
+	// after each earlier child's, or all of its items
+	static Built slot(const View& view, size_t i, Built at){
+		if (i >= view.childCount()){ View::corrupt(); }
+		for (size_t k = 0; k < i; k++){
+			if (view.hasChild(k) && view.child(k).kind() == NodeKind::List){
+				at += static_cast<long>(view.child(k).childCount());
+			} else {
+				at++;
+			}
+		}
+		return at;
+	}
+
+	template <typename T>
+	static T * built(const View& view, size_t i, Built at,
+	  bool optional){
+		if (!view.hasChild(i)){
+			if (!optional){ View::corrupt(); }
+			return nullptr;
+		}
+		if (view.child(i).kind() == NodeKind::List){ View::corrupt(); }
+		T * result = dynamic_cast<T *>(*at);
+		if (result == nullptr){ View::corrupt(); }
+		return result;
+	}
+
+	//The i'th child, which must be a T (or, if optional, absent)
+	template <typename T>
+	static T * child(const View& view, size_t i, Built at,
+	  bool optional = false){
+		return built<T>(view, i, slot(view, i, at), optional);
+	}
+
+	template <typename T>
+	static std::list<T *> childList(const View& view, size_t i,
+	  Built at){
+		Built item = slot(view, i, at);
+		View list = view.child(i);
+		if (list.kind() != NodeKind::List){ View::corrupt(); }
+		std::list<T *> items;
+		for (size_t k = 0; k < list.childCount(); k++){
+			items.push_back(built<T>(list, k, item++, false));
+		}
+		return items;
+	}
+
+	static ASTNode * make(const View& view, Built at){
+		Position p = view.position();
+		switch (view.kind()){
+		case NodeKind::Program:
+			return new ProgramNode(childList<DeclNode>(view, 0, at));
+		case NodeKind::ClassDefn:
+			return new ClassDefnNode(&p, child<IDNode>(view, 0, at),
+			  childList<DeclNode>(view, 1, at));
+		case NodeKind::VarDecl:
+			return new VarDeclNode(&p, child<IDNode>(view, 0, at),
+			  child<TypeNode>(view, 1, at), child<ExpNode>(view, 2, at, true));
+		case NodeKind::FormalDecl:
+			return new FormalDeclNode(&p, child<IDNode>(view, 0, at),
+			  child<TypeNode>(view, 1, at));
+		case NodeKind::FnDecl:
+			return new FnDeclNode(&p, child<IDNode>(view, 0, at),
+			  childList<FormalDeclNode>(view, 1, at), child<TypeNode>(view, 2, at),
+			  childList<StmtNode>(view, 3, at));
+		case NodeKind::AssignStmt:
+			return new AssignStmtNode(&p, child<LocNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::TakeStmt:
+			return new TakeStmtNode(&p, child<LocNode>(view, 0, at));
+		case NodeKind::GiveStmt:
+			return new GiveStmtNode(&p, child<ExpNode>(view, 0, at));
+		case NodeKind::ExitStmt:
+			return new ExitStmtNode(&p);
+		case NodeKind::PostDecStmt:
+			return new PostDecStmtNode(&p, child<LocNode>(view, 0, at));
+		case NodeKind::PostIncStmt:
+			return new PostIncStmtNode(&p, child<LocNode>(view, 0, at));
+		case NodeKind::IfStmt:
+			return new IfStmtNode(&p, child<ExpNode>(view, 0, at),
+			  childList<StmtNode>(view, 1, at));
+		case NodeKind::IfElseStmt:
+			return new IfElseStmtNode(&p, child<ExpNode>(view, 0, at),
+			  childList<StmtNode>(view, 1, at), childList<StmtNode>(view, 2, at));
+		case NodeKind::WhileStmt:
+			return new WhileStmtNode(&p, child<ExpNode>(view, 0, at),
+			  childList<StmtNode>(view, 1, at));
+		case NodeKind::ReturnStmt:
+			return new ReturnStmtNode(&p, child<ExpNode>(view, 0, at, true));
+		case NodeKind::CallStmt:
+			return new CallStmtNode(&p, child<CallExpNode>(view, 0, at));
+		case NodeKind::CallExp:
+			return new CallExpNode(&p, child<LocNode>(view, 0, at),
+			  childList<ExpNode>(view, 1, at));
+		case NodeKind::MemberFieldExp:
+			return new MemberFieldExpNode(&p, child<LocNode>(view, 0, at),
+			  child<IDNode>(view, 1, at));
+		case NodeKind::ID:
+			return new IDNode(&p, view.name());
+		case NodeKind::Plus:
+			return new PlusNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::Minus:
+			return new MinusNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::Times:
+			return new TimesNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::Divide:
+			return new DivideNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::And:
+			return new AndNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::Or:
+			return new OrNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::Equals:
+			return new EqualsNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::NotEquals:
+			return new NotEqualsNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::Less:
+			return new LessNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::LessEq:
+			return new LessEqNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::Greater:
+			return new GreaterNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::GreaterEq:
+			return new GreaterEqNode(&p, child<ExpNode>(view, 0, at),
+			  child<ExpNode>(view, 1, at));
+		case NodeKind::Neg:
+			return new NegNode(&p, child<ExpNode>(view, 0, at));
+		case NodeKind::Not:
+			return new NotNode(&p, child<ExpNode>(view, 0, at));
+		case NodeKind::VoidType:
+			return new VoidTypeNode(&p);
+		case NodeKind::ClassType:
+			return new ClassTypeNode(&p, child<IDNode>(view, 0, at));
+		case NodeKind::PerfectType:
+			return new PerfectTypeNode(&p, child<TypeNode>(view, 0, at));
+		case NodeKind::IntType:
+			return new IntTypeNode(&p);
+		case NodeKind::BoolType:
+			return new BoolTypeNode(&p);
+		case NodeKind::IntLit:
+			return new IntLitNode(&p, view.intValue());
+		case NodeKind::StrLit:
+			return new StrLitNode(&p, view.name());
+		case NodeKind::True:
+			return new TrueNode(&p);
+		case NodeKind::False:
+			return new FalseNode(&p);
+		case NodeKind::Magic:
+			return new MagicNode(&p);
+		case NodeKind::List:
+		case NodeKind::KindCount:
+			break;
+		}
+		View::corrupt();
+		return nullptr;
+	}
+
+	//How many of a node's children build takes (any more are
+	// ignored, as they were never written)
+	static size_t arity(const View& view){
+		switch (view.kind()){
+		case NodeKind::List:
+			return view.childCount();
+		case NodeKind::VarDecl: case NodeKind::IfElseStmt:
+			return 3;
+		case NodeKind::FnDecl:
+			return 4;
+		case NodeKind::ClassDefn: case NodeKind::FormalDecl:
+		case NodeKind::AssignStmt: case NodeKind::IfStmt:
+		case NodeKind::WhileStmt: case NodeKind::CallExp:
+		case NodeKind::MemberFieldExp:
+		case NodeKind::Plus: case NodeKind::Minus:
+		case NodeKind::Times: case NodeKind::Divide:
+		case NodeKind::And: case NodeKind::Or:
+		case NodeKind::Equals: case NodeKind::NotEquals:
+		case NodeKind::Less: case NodeKind::LessEq:
+		case NodeKind::Greater: case NodeKind::GreaterEq:
+			return 2;
+		case NodeKind::Program: case NodeKind::TakeStmt:
+		case NodeKind::GiveStmt: case NodeKind::PostDecStmt:
+		case NodeKind::PostIncStmt: case NodeKind::ReturnStmt:
+		case NodeKind::CallStmt: case NodeKind::Neg: case NodeKind::Not:
+		case NodeKind::ClassType: case NodeKind::PerfectType:
+			return 1;
+		default:
+			return 0;
+		}
+	}
+};
+
+}
+
+#endif
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <cstddef>
+#include "regalloc.hpp"
+
+namespace drewno_mars{
+
+//Loops nested deeper than this weigh no more than this deep
+static const uint32_t MAX_WEIGHTED_DEPTH = 8;
+
+static uint64_t depthWeight(uint32_t depth){
+	uint64_t weight = 1;
+	for (uint32_t i = 0; i < depth && i < MAX_WEIGHTED_DEPTH; i++){
+		weight *= 10;
+	}
+	return weight;
+}
+
+//An interval runs over positions: instruction i reads its
+// operands at 2i and writes its result at 2i + 1, so a result
+// can take the machine register of an operand last read there
+static uint32_t usePos(uint32_t instr){ return 2 * instr; }
+static uint32_t defPos(uint32_t instr){ return 2 * instr + 1; }
+
+RegAllocation allocateRegisters(const IrFunction& fn,
+  uint32_t callerSaved, uint32_t calleeSaved,
+  const std::vector<bool>& calls){
+	const uint32_t regs = fn.regs;
+	const uint32_t blocks = static_cast<uint32_t>(fn.blocks.size());
+	RegAllocation alloc;
+	alloc.where.resize(regs);
+	alloc.liveOnEntry.assign(regs, false);
+
+	//Each block's predecessors, grouped by block
+	std::vector<uint32_t> predFirst(blocks + 1, 0);
+	std::vector<uint32_t> preds;
+	{
+		std::vector<std::pair<uint32_t, uint32_t>> edges;
+		for (uint32_t b = 0; b < blocks; b++){
+			const IrInstr& term = fn.terminator(b);
+			if (term.op == IrOp::Jump){
+				edges.push_back(std::make_pair(term.a, b));
+			} else if (term.op == IrOp::Branch){
+				edges.push_back(std::make_pair(term.b, b));
+				edges.push_back(std::make_pair(term.c, b));
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (auto& edge : edges){
+			predFirst[edge.first + 1]++;
+			preds.push_back(edge.second);
+		}
+		for (uint32_t b = 0; b < blocks; b++){ predFirst[b + 1] += predFirst[b]; }
+	}
+
+	//Where each register is read and written, and the blocks
+	// that read it before writing it (so it is live into them)
+	// and that write it
+	const uint32_t NONE = IR_NONE;
+	std::vector<uint32_t> start(regs, NONE);
+	std::vector<uint32_t> end(regs, 0);
+	std::vector<uint64_t> weight(regs, 0);
+	std::vector<uint32_t> writtenIn(regs, NONE);
+	std::vector<std::pair<uint32_t, uint32_t>> exposed;
+	std::vector<std::pair<uint32_t, uint32_t>> written;
+	std::vector<uint32_t> callsAt;
+	for (uint32_t b = 0; b < blocks; b++){
+		const IrBlock& block = fn.blocks[b];
+		uint64_t w = depthWeight(block.depth);
+		for (uint32_t i = block.first; i < block.end; i++){
+			const IrInstr& in = fn.code[i];
+			forEachUse(fn, in, [&](uint32_t reg){
+				start[reg] = std::min(start[reg], usePos(i));
+				end[reg] = std::max(end[reg], usePos(i));
+				weight[reg] += w;
+				if (writtenIn[reg] != b){
+					exposed.push_back(std::make_pair(reg, b));
+				}
+			});
+			if (in.dst != IR_NONE){
+				start[in.dst] = std::min(start[in.dst], defPos(i));
+				end[in.dst] = std::max(end[in.dst], defPos(i));
+				weight[in.dst] += w;
+				if (writtenIn[in.dst] != b){
+					writtenIn[in.dst] = b;
+					written.push_back(std::make_pair(in.dst, b));
+				}
+			}
+			if (calls[i]){ callsAt.push_back(i); }
+		}
+	}
+	std::sort(exposed.begin(), exposed.end());
+	std::sort(written.begin(), written.end());
+
+	//Spread each register's liveness back from the blocks it is
+	// live into, through predecessors that don't write it,
+	// stretching its interval over every block it is live in or
+	// out of. The marks are stamped with the register walked.
+	std::vector<uint32_t> writes(blocks, NONE);
+	std::vector<uint32_t> liveIn(blocks, NONE);
+	std::vector<uint32_t> work;
+	size_t e = 0;
+	size_t d = 0;
+	while (e < exposed.size()){
+		uint32_t reg = exposed[e].first;
+		for (; d < written.size() && written[d].first <= reg; d++){
+			if (written[d].first == reg){ writes[written[d].second] = reg; }
+		}
+		for (; e < exposed.size() && exposed[e].first == reg; e++){
+			uint32_t b = exposed[e].second;
+			if (liveIn[b] != reg){
+				liveIn[b] = reg;
+				work.push_back(b);
+			}
+		}
+		while (!work.empty()){
+			uint32_t b = work.back();
+			work.pop_back();
+			start[reg] = std::min(start[reg], usePos(fn.blocks[b].first));
+			if (b == 0){ alloc.liveOnEntry[reg] = true; }
+			for (uint32_t p = predFirst[b]; p < predFirst[b + 1]; p++){
+				uint32_t pred = preds[p];
+				end[reg] = std::max(end[reg], defPos(fn.blocks[pred].end - 1));
+				if (writes[pred] != reg && liveIn[pred] != reg){
+					liveIn[pred] = reg;
+					work.push_back(pred);
+				}
+			}
+		}
+	}
+
+	std::vector<uint32_t> order;
+	for (uint32_t reg = 0; reg < regs; reg++){
+		if (start[reg] != NONE){ order.push_back(reg); }
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+		return start[a] < start[b] || (start[a] == start[b] && a < b);
+	});
+
+	//Whether reg must survive a call: it is live before one
+	// and read after it
+	auto crossesCall = [&](uint32_t reg){
+		auto call = std::lower_bound(callsAt.begin(), callsAt.end(),
+		  (start[reg] + 1) / 2);
+		return call != callsAt.end() && usePos(*call + 1) <= end[reg];
+	};
+
+	const uint32_t machines = callerSaved + calleeSaved;
+	const uint32_t all = machines == 0 ? 0 : (uint32_t(1) << machines) - 1;
+	const uint32_t callerMask = (uint32_t(1) << callerSaved) - 1;
+	const uint32_t calleeMask = all & ~callerMask;
+	uint32_t free = all;
+	//The intervals holding machine registers, by their ends
+	std::vector<uint32_t> active;
+	auto activate = [&](uint32_t reg){
+		auto at = std::upper_bound(active.begin(), active.end(), reg,
+		  [&](uint32_t a, uint32_t b){ return end[a] < end[b]; });
+		active.insert(at, reg);
+	};
+	auto spill = [&](uint32_t reg){
+		alloc.where[reg].kind = RegLocation::Spilled;
+		alloc.where[reg].index = alloc.spillSlots++;
+	};
+	for (uint32_t reg : order){
+		size_t expired = 0;
+		while (expired < active.size() && end[active[expired]] < start[reg]){
+			free |= uint32_t(1) << alloc.where[active[expired]].index;
+			expired++;
+		}
+		active.erase(active.begin(),
+		  active.begin() + static_cast<std::ptrdiff_t>(expired));
+
+		uint32_t allowed = crossesCall(reg) ? calleeMask : all;
+		uint32_t avail = free & allowed;
+		if (avail != 0){
+			if ((avail & callerMask) != 0){ avail &= callerMask; }
+			uint32_t machine = 0;
+			while ((avail & (uint32_t(1) << machine)) == 0){ machine++; }
+			free &= ~(uint32_t(1) << machine);
+			alloc.where[reg].kind = RegLocation::Machine;
+			alloc.where[reg].index = machine;
+			alloc.machineUsed |= uint32_t(1) << machine;
+			activate(reg);
+			continue;
+		}
+
+		//Spill the cheapest of reg and the intervals holding
+		// registers it could have, the longest-lived of equals
+		uint32_t victim = reg;
+		for (uint32_t other : active){
+			if ((allowed & (uint32_t(1) << alloc.where[other].index)) == 0){
+				continue;
+			}
+			if (weight[other] < weight[victim]
+			  || (weight[other] == weight[victim] && end[other] > end[victim])){
+				victim = other;
+			}
+		}
+		if (victim == reg){
+			spill(reg);
+			continue;
+		}
+		alloc.where[reg] = alloc.where[victim];
+		spill(victim);
+		active.erase(std::find(active.begin(), active.end(), victim));
+		activate(reg);
+	}
+	return alloc;
+}
+
+}
@@ -0,0 +1,56 @@
+#ifndef DREWNO_MARS_REGALLOC_HPP
+#define DREWNO_MARS_REGALLOC_HPP
+
+#include <cstdint>
+#include <vector>
+#include "ir.hpp"
+
+//Linear-scan register allocation (Poletto and Sarkar) of an IR
+// function's virtual registers to a backend's machine registers.
+//
+//Liveness is solved over the blocks, and each virtual register
+// gets one interval, from the first point it is live to the
+// last, in code order. Intervals are handed machine registers
+// in order of their start. One that lives across a call may
+// only have a callee-saved register; one that doesn't prefers a
+// caller-saved one, which costs no save and restore. When none
+// is free, whichever of the contenders is cheapest to spill
+// goes to memory for the whole of its interval: a register's
+// spill cost is how often it is read and written, each time
+// weighted by 10 to the power of how many whiles it is inside.
+namespace drewno_mars{
+
+struct RegLocation{
+	enum Kind : unsigned char{
+		//The register is never read or written
+		Unused,
+		//In machine register index
+		Machine,
+		//In spill slot index
+		Spilled
+	};
+	Kind kind = Unused;
+	uint32_t index = 0;
+};
+
+struct RegAllocation{
+	//Where each virtual register lives
+	std::vector<RegLocation> where;
+	uint32_t spillSlots = 0;
+	//Bit i is set if machine register i is used
+	uint32_t machineUsed = 0;
+	//Which registers (formals among them) are live on entry
+	std::vector<bool> liveOnEntry;
+};
+
+//Allocate fn's registers to machine registers [0, callerSaved)
+// (clobbered by calls) and [callerSaved, callerSaved +
+// calleeSaved) (which calls preserve). calls says which of fn's
+// instructions call out.
+RegAllocation allocateRegisters(const IrFunction& fn,
+  uint32_t callerSaved, uint32_t calleeSaved,
+  const std::vector<bool>& calls);
+
+}
+
+#endif
@@ -18,8 +18,10 @@ void Scanner::outputTokens(std::ostream& outstream){
 			  << std::endl;
 			return;
 		} else {
-			outstream << lex.lexeme->toString()
+			outstream << lex.as<Token *>()->toString()
 			  << std::endl;
+			lex.destroy<Token *>();
+			releaseTokens();
 		}
 	}
 }
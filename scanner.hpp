@@ -5,6 +5,7 @@
 #include <FlexLexer.h>
 #endif
 
+#include <vector>
 #include "frontend.hh" // Token kind definitions
 #include "errors.hpp"  // Error reporting
 
@@ -21,6 +22,7 @@ public:
 	colNum = 1;
    };
    virtual ~Scanner() {
+	for (Token * tok : myTokens){ delete tok; }
    };
 
    //get rid of override virtual function warning
@@ -31,14 +33,36 @@ public:
 
    int makeBareToken(int tagIn){
 	size_t len = static_cast<size_t>(yyleng);
-	Position * pos = new Position(
+	Position pos(
 	  this->lineNum, this->colNum,
 	  this->lineNum, this->colNum+len);
-        this->yylval->lexeme = new Token(pos, tagIn);
+        this->yylval->emplace<drewno_mars::Token *>(
+          keep(new Token(&pos, tagIn)));
         colNum += len;
         return tagIn;
    }
 
+   //The scanner owns the tokens it hands out (the AST copies
+   // whatever it needs out of them), unless told to hand
+   // ownership off along with the token
+   Token * keep(Token * tok){
+	if (myOwnsTokens){ myTokens.push_back(tok); }
+	return tok;
+   }
+
+   void handOffTokens(){ myOwnsTokens = false; }
+
+   //Free every token handed out so far except the most recent
+   // one, which may still be the parser's lookahead
+   void releaseTokens(){
+	if (myTokens.size() < 2){ return; }
+	Token * last = myTokens.back();
+	myTokens.pop_back();
+	for (Token * tok : myTokens){ delete tok; }
+	myTokens.clear();
+	myTokens.push_back(last);
+   }
+
    void errIllegal(Position * pos, std::string match){
 	drewno_mars::Report::fatal(pos, "Illegal character "
 		+ match);
@@ -82,6 +106,8 @@ private:
    drewno_mars::Parser::semantic_type *yylval = nullptr;
    size_t lineNum;
    size_t colNum;
+   std::vector<Token *> myTokens;
+   bool myOwnsTokens = true;
 };
 
 } /* end namespace */
@@ -0,0 +1,340 @@
+#include "ssa.hpp"
+
+namespace drewno_mars{
+
+SccpCounts& SccpCounts::operator+=(const SccpCounts& other){
+	constants += other.constants;
+	branches += other.branches;
+	blocks += other.blocks;
+	dead += other.dead;
+	return *this;
+}
+
+//What is known of a value: nothing yet (no definition of it has
+// been reached), that it is always the one constant, or that it
+// isn't a constant
+enum class Lattice : unsigned char{ Top, Constant, Bottom };
+
+static int32_t wrap(uint64_t value){
+	return static_cast<int32_t>(static_cast<uint32_t>(value));
+}
+
+//What op makes of constants a (and b), as the runtime works it
+// out; false if it doesn't make a constant (as a division by
+// zero fails instead)
+static bool evaluate(IrOp op, int32_t a, int32_t b, int32_t& result){
+	uint64_t x = static_cast<uint64_t>(static_cast<int64_t>(a));
+	uint64_t y = static_cast<uint64_t>(static_cast<int64_t>(b));
+	switch (op){
+	case IrOp::Move: result = a; break;
+	case IrOp::Neg: result = wrap(0 - x); break;
+	case IrOp::Not: result = a == 0; break;
+	case IrOp::Add: result = wrap(x + y); break;
+	case IrOp::Sub: result = wrap(x - y); break;
+	case IrOp::Mul: result = wrap(x * y); break;
+	case IrOp::Div:
+		if (b == 0){ return false; }
+		result = b == -1 ? wrap(0 - x) : a / b;
+		break;
+	case IrOp::Eq: result = a == b; break;
+	case IrOp::Ne: result = a != b; break;
+	case IrOp::Lt: result = a < b; break;
+	case IrOp::Le: result = a <= b; break;
+	case IrOp::Gt: result = a > b; break;
+	case IrOp::Ge: result = a >= b; break;
+	default: return false;
+	}
+	return true;
+}
+
+//Whether all an instruction does is define its result, so that
+// it can go if nothing reads that
+static bool pure(IrOp op){
+	switch (op){
+	case IrOp::Const: case IrOp::Move: case IrOp::Neg: case IrOp::Not:
+	case IrOp::Add: case IrOp::Sub: case IrOp::Mul:
+	case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Le:
+	case IrOp::Gt: case IrOp::Ge:
+	case IrOp::LoadGlobal: case IrOp::GlobalAddr: case IrOp::FrameAddr:
+	case IrOp::Field: case IrOp::Load:
+		return true;
+	default:
+		return false;
+	}
+}
+
+size_t removeUnread(const IrFunction& fn, std::vector<bool>& removed){
+	const uint32_t NONE = IR_NONE;
+	const uint32_t instrs = static_cast<uint32_t>(fn.code.size());
+	size_t count = 0;
+	std::vector<uint32_t> reads(fn.regs, 0);
+	std::vector<uint32_t> writeFirst(fn.regs + 1, 0);
+	std::vector<uint32_t> writes;
+	for (uint32_t i = 0; i < instrs; i++){
+		if (removed[i]){ continue; }
+		const IrInstr& in = fn.code[i];
+		forEachUse(fn, in, [&](uint32_t reg){ reads[reg]++; });
+		if (in.dst != NONE && pure(in.op)){ writeFirst[in.dst + 1]++; }
+	}
+	for (uint32_t reg = 0; reg < fn.regs; reg++){
+		writeFirst[reg + 1] += writeFirst[reg];
+	}
+	writes.resize(writeFirst[fn.regs]);
+	{
+		std::vector<uint32_t> next(writeFirst.begin(), writeFirst.end() - 1);
+		for (uint32_t i = 0; i < instrs; i++){
+			const IrInstr& in = fn.code[i];
+			if (!removed[i] && in.dst != NONE && pure(in.op)){
+				writes[next[in.dst]++] = i;
+			}
+		}
+	}
+	std::vector<uint32_t> unread;
+	for (uint32_t reg = 0; reg < fn.regs; reg++){
+		if (reads[reg] == 0){ unread.push_back(reg); }
+	}
+	while (!unread.empty()){
+		uint32_t reg = unread.back();
+		unread.pop_back();
+		for (uint32_t w = writeFirst[reg]; w < writeFirst[reg + 1]; w++){
+			uint32_t i = writes[w];
+			removed[i] = true;
+			count++;
+			forEachUse(fn, fn.code[i], [&](uint32_t read){
+				if (--reads[read] == 0){ unread.push_back(read); }
+			});
+		}
+	}
+	return count;
+}
+
+SccpCounts propagateConstants(IrFunction& fn, const SsaForm& ssa){
+	const uint32_t NONE = IR_NONE;
+	const IrCfg& cfg = ssa.cfg;
+	const uint32_t blocks = static_cast<uint32_t>(fn.blocks.size());
+	const uint32_t instrs = static_cast<uint32_t>(fn.code.size());
+	const uint32_t phis = static_cast<uint32_t>(ssa.phis.size());
+	SccpCounts counts;
+
+	std::vector<uint32_t> blockOf(instrs);
+	for (uint32_t b = 0; b < blocks; b++){
+		for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+			blockOf[i] = b;
+		}
+	}
+
+	//What reads each value: user i < instrs is instruction i,
+	// and user instrs + p is phi p
+	std::vector<uint32_t> userFirst(ssa.values + 1, 0);
+	std::vector<uint32_t> users;
+	for (uint32_t v : ssa.uses){
+		if (v != NONE){ userFirst[v + 1]++; }
+	}
+	for (uint32_t v : ssa.args){
+		if (v != NONE){ userFirst[v + 1]++; }
+	}
+	for (uint32_t v = 0; v < ssa.values; v++){ userFirst[v + 1] += userFirst[v]; }
+	users.resize(userFirst[ssa.values]);
+	{
+		std::vector<uint32_t> next(userFirst.begin(), userFirst.end() - 1);
+		for (uint32_t i = 0; i < instrs; i++){
+			for (uint32_t u = ssa.useFirst[i]; u < ssa.useFirst[i + 1]; u++){
+				if (ssa.uses[u] != NONE){ users[next[ssa.uses[u]]++] = i; }
+			}
+		}
+		for (uint32_t p = 0; p < phis; p++){
+			uint32_t block = ssa.phis[p].block;
+			uint32_t count = cfg.predFirst[block + 1] - cfg.predFirst[block];
+			for (uint32_t j = 0; j < count; j++){
+				uint32_t v = ssa.args[ssa.argFirst[p] + j];
+				if (v != NONE){ users[next[v]++] = instrs + p; }
+			}
+		}
+	}
+
+	//What the registers hold on entry is unknown
+	std::vector<Lattice> state(ssa.values, Lattice::Top);
+	std::vector<int32_t> constant(ssa.values, 0);
+	for (uint32_t reg = 0; reg < fn.regs; reg++){ state[reg] = Lattice::Bottom; }
+	std::vector<uint32_t> valueWork;
+	//Meet what is known of v with what is known of it now
+	auto meet = [&](uint32_t v, Lattice known, int32_t c){
+		if (state[v] == Lattice::Bottom || known == Lattice::Top){ return; }
+		if (state[v] == Lattice::Constant){
+			if (known == Lattice::Constant && constant[v] == c){ return; }
+			known = Lattice::Bottom;
+		}
+		state[v] = known;
+		constant[v] = c;
+		valueWork.push_back(v);
+	};
+
+	std::vector<bool> blockLive(blocks, false);
+	std::vector<bool> edgeLive(cfg.preds.size(), false);
+	//Edges newly found to be taken, as indices into cfg.succs
+	std::vector<uint32_t> edgeWork;
+	auto follow = [&](uint32_t k){
+		uint32_t e = cfg.edges[k];
+		if (e == NONE || edgeLive[e]){ return; }
+		edgeLive[e] = true;
+		edgeWork.push_back(k);
+	};
+
+	auto visitPhi = [&](uint32_t p){
+		const SsaPhi& phi = ssa.phis[p];
+		uint32_t first = cfg.predFirst[phi.block];
+		for (uint32_t e = first; e < cfg.predFirst[phi.block + 1]; e++){
+			if (!edgeLive[e]){ continue; }
+			uint32_t arg = ssa.args[ssa.argFirst[p] + e - first];
+			meet(phi.value, state[arg], constant[arg]);
+		}
+	};
+	auto visitInstr = [&](uint32_t i){
+		const IrInstr& in = fn.code[i];
+		const uint32_t * reads = ssa.uses.data() + ssa.useFirst[i];
+		uint32_t b = blockOf[i];
+		if (in.op == IrOp::Jump){
+			follow(2 * b);
+			return;
+		}
+		if (in.op == IrOp::Branch){
+			if (state[reads[0]] == Lattice::Constant){
+				follow(constant[reads[0]] != 0 ? 2 * b : 2 * b + 1);
+			} else if (state[reads[0]] == Lattice::Bottom){
+				follow(2 * b);
+				follow(2 * b + 1);
+			}
+			return;
+		}
+		uint32_t v = ssa.defs[i];
+		if (v == NONE){ return; }
+		int32_t result = 0;
+		switch (in.op){
+		case IrOp::Const:
+			meet(v, Lattice::Constant, static_cast<int32_t>(in.a));
+			return;
+		case IrOp::Move: case IrOp::Neg: case IrOp::Not:
+			if (state[reads[0]] != Lattice::Constant){
+				meet(v, state[reads[0]], 0);
+			} else if (evaluate(in.op, constant[reads[0]], 0, result)){
+				meet(v, Lattice::Constant, result);
+			} else {
+				meet(v, Lattice::Bottom, 0);
+			}
+			return;
+		case IrOp::Add: case IrOp::Sub: case IrOp::Mul: case IrOp::Div:
+		case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Le:
+		case IrOp::Gt: case IrOp::Ge:
+			if (state[reads[0]] == Lattice::Bottom
+			  || state[reads[1]] == Lattice::Bottom){
+				meet(v, Lattice::Bottom, 0);
+			} else if (state[reads[0]] == Lattice::Top
+			  || state[reads[1]] == Lattice::Top){
+				return;
+			} else if (evaluate(in.op, constant[reads[0]], constant[reads[1]],
+			  result)){
+				meet(v, Lattice::Constant, result);
+			} else {
+				meet(v, Lattice::Bottom, 0);
+			}
+			return;
+		default:
+			meet(v, Lattice::Bottom, 0);
+			return;
+		}
+	};
+	auto reach = [&](uint32_t b){
+		for (uint32_t p = ssa.phiFirst[b]; p < ssa.phiFirst[b + 1]; p++){
+			visitPhi(p);
+		}
+		if (blockLive[b]){ return; }
+		blockLive[b] = true;
+		for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+			visitInstr(i);
+		}
+	};
+
+	reach(0);
+	while (!edgeWork.empty() || !valueWork.empty()){
+		if (!edgeWork.empty()){
+			uint32_t k = edgeWork.back();
+			edgeWork.pop_back();
+			reach(cfg.succs[k]);
+			continue;
+		}
+		uint32_t v = valueWork.back();
+		valueWork.pop_back();
+		for (uint32_t u = userFirst[v]; u < userFirst[v + 1]; u++){
+			uint32_t user = users[u];
+			if (user >= instrs){
+				if (blockLive[ssa.phis[user - instrs].block]){
+					visitPhi(user - instrs);
+				}
+			} else if (blockLive[blockOf[user]]){
+				visitInstr(user);
+			}
+		}
+	}
+
+	//Load the constants found, and straighten the branches
+	for (uint32_t b = 0; b < blocks; b++){
+		if (!blockLive[b]){ continue; }
+		const IrBlock& block = fn.blocks[b];
+		for (uint32_t i = block.first; i + 1 < block.end; i++){
+			IrInstr& in = fn.code[i];
+			uint32_t v = ssa.defs[i];
+			if (v == NONE || in.op == IrOp::Const
+			  || state[v] != Lattice::Constant){
+				continue;
+			}
+			in = {IrOp::Const, in.dst, static_cast<uint32_t>(constant[v]), 0, 0};
+			counts.constants++;
+		}
+		IrInstr& term = fn.code[block.end - 1];
+		if (term.op != IrOp::Branch){ continue; }
+		uint32_t cond = ssa.uses[ssa.useFirst[block.end - 1]];
+		if (state[cond] != Lattice::Constant){ continue; }
+		term = {IrOp::Jump, NONE, constant[cond] != 0 ? term.b : term.c, 0, 0};
+		counts.branches++;
+	}
+
+	//Then what nothing reads any more
+	std::vector<bool> removed(instrs, false);
+	for (uint32_t i = 0; i < instrs; i++){
+		removed[i] = !blockLive[blockOf[i]];
+	}
+	counts.dead = removeUnread(fn, removed);
+
+	//Put the code that is left back together, renumbering blocks
+	std::vector<uint32_t> renumber(blocks, NONE);
+	uint32_t kept = 0;
+	for (uint32_t b = 0; b < blocks; b++){
+		if (blockLive[b]){ renumber[b] = kept++; }
+	}
+	counts.blocks = blocks - kept;
+	std::vector<IrInstr> code;
+	std::vector<IrBlock> out;
+	code.reserve(instrs - counts.dead);
+	out.reserve(kept);
+	for (uint32_t b = 0; b < blocks; b++){
+		if (!blockLive[b]){ continue; }
+		uint32_t first = static_cast<uint32_t>(code.size());
+		for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+			if (!removed[i]){ code.push_back(fn.code[i]); }
+		}
+		IrInstr& term = code.back();
+		if (term.op == IrOp::Jump){
+			term.a = renumber[term.a];
+		} else if (term.op == IrOp::Branch){
+			term.b = renumber[term.b];
+			term.c = renumber[term.c];
+		}
+		out.push_back({first, static_cast<uint32_t>(code.size()),
+		  fn.blocks[b].depth});
+	}
+	fn.code.swap(code);
+	fn.blocks.swap(out);
+	return counts;
+}
+
+}
@@ -0,0 +1,271 @@
+#include "ast.hpp"
+#include "binary_ast.hpp"
+#include "flat_ast.hpp"
+#include "visitor.hpp"
+
+namespace drewno_mars{
+
+//Where a node's children's offsets start on the stack of them,
+// and where the list being written does
+struct SerialSlots{
+	size_t node = 0;
+	size_t list = 0;
+	bool inList = false;
+	bool awaiting = false;
+};
+
+//Adds each node's record once its children's are added, in the
+// order the node's parts come in. Each child's offset goes on
+// myOffsets until its parent (or list) takes it. Out is an
+// AstWriter, or a FlatAst, which lays nodes out the same way.
+template <typename Out>
+class Serializer
+: public AstMachine<Serializer<Out>, uint32_t, SerialSlots>{
+	typedef AstMachine<Serializer<Out>, uint32_t, SerialSlots> Machine;
+	typedef typename Machine::Frame Frame;
+	typedef typename Machine::Next Next;
+	using Machine::into;
+	using Machine::done;
+public:
+	Serializer(Out& out) : myOut(out){ }
+
+	Next step(Frame& f, uint32_t last){
+		if (f.step == 0 && !f.state.awaiting){
+			f.state.node = myOffsets.size();
+		}
+		if (f.state.awaiting){
+			myOffsets.push_back(last);
+			f.state.awaiting = false;
+		}
+		return parts(f);
+	}
+
+	bool leaf(ASTNode * node, const SerialSlots& state, uint32_t& result){
+		const Position * pos = node->pos();
+		switch (node->kind()){
+		case NodeKind::ID: {
+			IDNode * id = static_cast<IDNode *>(node);
+			uint32_t name = myOut.name(id->getName());
+			result = myOut.node(NodeKind::ID, pos, myNone, name,
+			  id->getSymbol());
+			return true;
+		}
+		case NodeKind::IntLit:
+			result = myOut.node(NodeKind::IntLit, pos, myNone,
+			  static_cast<uint32_t>(static_cast<IntLitNode *>(node)->getNum()));
+			return true;
+		case NodeKind::StrLit: {
+			uint32_t str = myOut.name(static_cast<StrLitNode *>(node)->getStr());
+			result = myOut.node(NodeKind::StrLit, pos, myNone, str);
+			return true;
+		}
+		case NodeKind::ExitStmt:
+		case NodeKind::VoidType: case NodeKind::IntType:
+		case NodeKind::BoolType:
+		case NodeKind::True: case NodeKind::False: case NodeKind::Magic:
+			result = myOut.node(node->kind(), pos, myNone);
+			return true;
+		default:
+			return false;
+		}
+	}
+
+private:
+	//Each node's parts: a child, an optional child, or a list
+	Next parts(Frame& f){
+		switch (f.node->kind()){
+		case NodeKind::Program:
+			if (f.step == 0){
+				return list(f, 1,
+				  static_cast<ProgramNode *>(f.node)->getGlobals());
+			}
+			break;
+		case NodeKind::ClassDefn: {
+			ClassDefnNode * node = static_cast<ClassDefnNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->ID());
+			case 1: return list(f, 2, node->getMembers());
+			}
+			break;
+		}
+		case NodeKind::VarDecl: {
+			VarDeclNode * node = static_cast<VarDeclNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->ID());
+			case 1: return child(f, 2, node->getTypeNode());
+			case 2: return child(f, 3, node->getInit());
+			}
+			break;
+		}
+		case NodeKind::FormalDecl: {
+			FormalDeclNode * node = static_cast<FormalDeclNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->ID());
+			case 1: return child(f, 2, node->getTypeNode());
+			}
+			break;
+		}
+		case NodeKind::FnDecl: {
+			FnDeclNode * node = static_cast<FnDeclNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->ID());
+			case 1: return list(f, 2, node->getFormals());
+			case 2: return child(f, 3, node->getTypeNode());
+			case 3: return list(f, 4, node->getBody());
+			}
+			break;
+		}
+		case NodeKind::AssignStmt: {
+			AssignStmtNode * node = static_cast<AssignStmtNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->getDst());
+			case 1: return child(f, 2, node->getSrc());
+			}
+			break;
+		}
+		case NodeKind::TakeStmt:
+			return only(f, static_cast<TakeStmtNode *>(f.node)->getDst());
+		case NodeKind::GiveStmt:
+			return only(f, static_cast<GiveStmtNode *>(f.node)->getSrc());
+		case NodeKind::PostDecStmt:
+			return only(f, static_cast<PostDecStmtNode *>(f.node)->getLoc());
+		case NodeKind::PostIncStmt:
+			return only(f, static_cast<PostIncStmtNode *>(f.node)->getLoc());
+		case NodeKind::IfStmt: {
+			IfStmtNode * node = static_cast<IfStmtNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->getCond());
+			case 1: return list(f, 2, node->getBody());
+			}
+			break;
+		}
+		case NodeKind::IfElseStmt: {
+			IfElseStmtNode * node = static_cast<IfElseStmtNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->getCond());
+			case 1: return list(f, 2, node->getBodyTrue());
+			case 2: return list(f, 3, node->getBodyFalse());
+			}
+			break;
+		}
+		case NodeKind::WhileStmt: {
+			WhileStmtNode * node = static_cast<WhileStmtNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->getCond());
+			case 1: return list(f, 2, node->getBody());
+			}
+			break;
+		}
+		case NodeKind::ReturnStmt:
+			return only(f, static_cast<ReturnStmtNode *>(f.node)->getExp());
+		case NodeKind::CallStmt:
+			return only(f, static_cast<CallStmtNode *>(f.node)->getCallExp());
+		case NodeKind::CallExp: {
+			CallExpNode * node = static_cast<CallExpNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->getCallee());
+			case 1: return list(f, 2, node->getArgs());
+			}
+			break;
+		}
+		case NodeKind::MemberFieldExp: {
+			MemberFieldExpNode * node = static_cast<MemberFieldExpNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->getBase());
+			case 1: return child(f, 2, node->getField());
+			}
+			break;
+		}
+		case NodeKind::Plus: case NodeKind::Minus:
+		case NodeKind::Times: case NodeKind::Divide:
+		case NodeKind::And: case NodeKind::Or:
+		case NodeKind::Equals: case NodeKind::NotEquals:
+		case NodeKind::Less: case NodeKind::LessEq:
+		case NodeKind::Greater: case NodeKind::GreaterEq: {
+			BinaryExpNode * node = static_cast<BinaryExpNode *>(f.node);
+			switch (f.step){
+			case 0: return child(f, 1, node->getExp1());
+			case 1: return child(f, 2, node->getExp2());
+			}
+			break;
+		}
+		case NodeKind::Neg: case NodeKind::Not:
+			return only(f, static_cast<UnaryExpNode *>(f.node)->getExp());
+		case NodeKind::ClassType:
+			return only(f, static_cast<ClassTypeNode *>(f.node)->ID());
+		case NodeKind::PerfectType:
+			return only(f, static_cast<PerfectTypeNode *>(f.node)->getSub());
+		case NodeKind::List: case NodeKind::KindCount:
+			throw new InternalError("Serialized a list as a node");
+		default:
+			//A leaf, as the root of what's being written
+			leaf(f.node, f.state, f.result);
+			return done();
+		}
+		return record(f, f.state.node, f.node->kind(), f.node->pos());
+	}
+
+	//The next part is child (absent if null), after which the
+	// node goes on from part after
+	Next child(Frame& f, unsigned int after, ASTNode * child){
+		f.step = after;
+		if (child == nullptr){
+			uint32_t absent = Out::NO_NODE;
+			myOffsets.push_back(absent);
+			return parts(f);
+		}
+		f.state.awaiting = true;
+		return into(child);
+	}
+
+	Next only(Frame& f, ASTNode * node){
+		if (f.step == 0){ return child(f, 1, node); }
+		return record(f, f.state.node, f.node->kind(), f.node->pos());
+	}
+
+	template <typename T>
+	Next list(Frame& f, unsigned int after, std::list<T *> * items){
+		if (!f.state.inList){
+			f.state.inList = true;
+			f.state.list = myOffsets.size();
+			f.start(items);
+		}
+		if (T * item = f.next(items)){
+			f.state.awaiting = true;
+			return into(item);
+		}
+		f.state.inList = false;
+		uint32_t at = add(f.state.list, NodeKind::List, nullptr);
+		myOffsets.push_back(at);
+		f.step = after;
+		return parts(f);
+	}
+
+	//Add a record whose children are the offsets from first on
+	uint32_t add(size_t first, NodeKind kind, const Position * pos){
+		myChildren.assign(myOffsets.begin() + static_cast<long>(first),
+		  myOffsets.end());
+		myOffsets.resize(first);
+		return myOut.node(kind, pos, myChildren);
+	}
+
+	Next record(Frame& f, size_t first, NodeKind kind, const Position * pos){
+		f.result = add(first, kind, pos);
+		return done();
+	}
+
+	Out& myOut;
+	std::vector<uint32_t> myOffsets;
+	std::vector<uint32_t> myChildren;
+	const std::vector<uint32_t> myNone;
+};
+
+uint32_t AstWriter::tree(ASTNode * root){
+	return Serializer<AstWriter>(*this).run(root);
+}
+
+uint32_t FlatAst::tree(ASTNode * root){
+	return Serializer<FlatAst>(*this).run(root);
+}
+
+}
@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "errors.hpp"
+#include "server.hpp"
+
+namespace drewno_mars{
+
+//Wire format: every integer is little-endian. A request is the
+// magic, an argument count, each argument (length + bytes) and
+// the program text (length + bytes). The response is a series
+// of frames, each a tag byte followed by its fields.
+static const char requestMagic[4] = {'D', 'M', 'C', '1'};
+static const char frameFile = 'F';    //path, contents
+static const char frameOut = 'O';     //stdout text
+static const char frameErr = 'E';     //stderr text
+static const char frameStatus = 'S';  //exit status; last frame
+
+//The most a request may carry; the server drops one that says
+// it has more rather than make room for it
+static const uint64_t maxArgs = 1024;
+static const uint64_t maxArgLength = 64 << 10;
+static const uint64_t maxSourceLength = 1 << 30;
+static const uint64_t noLimit = std::numeric_limits<uint64_t>::max();
+//Strings are read this much at a time, so that a length that
+// lies costs no more than the bytes that do arrive
+static const uint64_t readChunk = 1 << 20;
+//How long the server waits on a client that stops sending or
+// reading
+static const time_t ioTimeoutSeconds = 10;
+
+static bool writeAll(int fd, const char * data, size_t len){
+	while (len > 0){
+		ssize_t n = write(fd, data, len);
+		if (n < 0){
+			if (errno == EINTR){ continue; }
+			return false;
+		}
+		data += n;
+		len -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+static bool readAll(int fd, char * data, size_t len){
+	while (len > 0){
+		ssize_t n = read(fd, data, len);
+		if (n < 0 && errno == EINTR){ continue; }
+		if (n <= 0){ return false; }
+		data += n;
+		len -= static_cast<size_t>(n);
+	}
+	return true;
+}
+
+static bool writeNum(int fd, uint64_t val){
+	char bytes[8];
+	for (int i = 0; i < 8; i++){
+		bytes[i] = static_cast<char>((val >> (8 * i)) & 0xff);
+	}
+	return writeAll(fd, bytes, 8);
+}
+
+static bool readNum(int fd, uint64_t& val){
+	unsigned char bytes[8];
+	if (!readAll(fd, reinterpret_cast<char *>(bytes), 8)){ return false; }
+	val = 0;
+	for (int i = 0; i < 8; i++){
+		val |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+	}
+	return true;
+}
+
+static bool writeStr(int fd, const std::string& str){
+	return writeNum(fd, str.size()) && writeAll(fd, str.data(), str.size());
+}
+
+static bool readStr(int fd, std::string& str, uint64_t limit){
+	uint64_t len;
+	if (!readNum(fd, len) || len > limit){ return false; }
+	str.clear();
+	while (str.size() < len){
+		size_t at = str.size();
+		size_t chunk = static_cast<size_t>(std::min(len - at, readChunk));
+		str.resize(at + chunk);
+		if (!readAll(fd, &str[at], chunk)){ return false; }
+	}
+	return true;
+}
+
+static sockaddr_un socketAddress(const std::string& path){
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(addr.sun_path)){
+		std::string msg = "Socket path too long: " + path;
+		throw new UserError(msg.c_str());
+	}
+	strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+	return addr;
+}
+
+CompileServer::CompileServer(const std::string& socketPath,
+  CompileHandler handler)
+: myPath(socketPath), myHandler(handler), myListener(-1),
+  myConnections(0), myStopping(false){
+	//A client that hangs up early must not take the server down
+	signal(SIGPIPE, SIG_IGN);
+
+	sockaddr_un addr = socketAddress(myPath);
+	myListener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (myListener < 0){
+		throw new InternalError("Could not create server socket");
+	}
+	unlink(myPath.c_str());
+	if (bind(myListener, reinterpret_cast<sockaddr *>(&addr),
+	  sizeof(addr)) != 0 || listen(myListener, 64) != 0){
+		std::string msg = "Could not listen on " + myPath;
+		throw new UserError(msg.c_str());
+	}
+}
+
+CompileServer::~CompileServer(){
+	if (myListener >= 0){
+		close(myListener);
+		unlink(myPath.c_str());
+	}
+}
+
+void CompileServer::run(){
+	while (true){
+		int conn = accept(myListener, nullptr, nullptr);
+		if (conn < 0){
+			int error = errno;
+			std::lock_guard<std::mutex> lock(myLock);
+			if (myStopping){ break; }
+			if (error == EINTR || error == ECONNABORTED){ continue; }
+			throw new InternalError("Compile server accept failed");
+		}
+		timeval timeout;
+		timeout.tv_sec = ioTimeoutSeconds;
+		timeout.tv_usec = 0;
+		setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		{
+			std::lock_guard<std::mutex> lock(myLock);
+			myConnections++;
+		}
+		auto done = [this, conn](){
+			close(conn);
+			std::lock_guard<std::mutex> lock(myLock);
+			myConnections--;
+			myIdle.notify_all();
+		};
+		try {
+			std::thread([this, conn, done](){
+				//Whatever goes wrong, only this connection is dropped
+				try {
+					serve(conn);
+				} catch (...){
+				}
+				done();
+			}).detach();
+		} catch (std::exception& e){
+			done();
+		}
+	}
+	std::unique_lock<std::mutex> lock(myLock);
+	myIdle.wait(lock, [this](){ return myConnections == 0; });
+}
+
+//Stop taking connections; run wakes from accept and returns
+// once those being served are done
+void CompileServer::stop(){
+	std::lock_guard<std::mutex> lock(myLock);
+	myStopping = true;
+	shutdown(myListener, SHUT_RDWR);
+}
+
+//Handle one connection. A malformed, oversized or stalled
+// request just drops the connection.
+void CompileServer::serve(int conn){
+	char magic[4];
+	if (!readAll(conn, magic, 4) || memcmp(magic, requestMagic, 4) != 0){
+		return;
+	}
+	uint64_t argc;
+	if (!readNum(conn, argc) || argc > maxArgs){ return; }
+	std::vector<std::string> args;
+	for (uint64_t i = 0; i < argc; i++){
+		std::string arg;
+		if (!readStr(conn, arg, maxArgLength)){ return; }
+		args.push_back(arg);
+	}
+	std::string source;
+	if (!readStr(conn, source, maxSourceLength)){ return; }
+
+	if (args.size() == 1 && args[0] == "--stop"){
+		stop();
+		writeAll(conn, &frameStatus, 1);
+		writeNum(conn, 0);
+		return;
+	}
+
+	CompileResult result;
+	{
+		std::lock_guard<std::mutex> compiling(myCompiling);
+		myHandler(args, source, result);
+	}
+
+	for (auto file : result.files){
+		if (!writeAll(conn, &frameFile, 1) || !writeStr(conn, file.first)
+		  || !writeStr(conn, file.second)){
+			return;
+		}
+	}
+	if (!result.out.empty()){
+		writeAll(conn, &frameOut, 1);
+		writeStr(conn, result.out);
+	}
+	if (!result.err.empty()){
+		writeAll(conn, &frameErr, 1);
+		writeStr(conn, result.err);
+	}
+	writeAll(conn, &frameStatus, 1);
+	writeNum(conn, static_cast<uint64_t>(result.status));
+}
+
+void requestCompile(const std::string& socketPath,
+  const std::vector<std::string>& args, const std::string& source,
+  CompileResult& result){
+	sockaddr_un addr = socketAddress(socketPath);
+	int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (conn < 0 || connect(conn, reinterpret_cast<sockaddr *>(&addr),
+	  sizeof(addr)) != 0){
+		if (conn >= 0){ close(conn); }
+		std::string msg = "No compile server at " + socketPath;
+		throw new UserError(msg.c_str());
+	}
+
+	bool sent = writeAll(conn, requestMagic, 4)
+	  && writeNum(conn, args.size());
+	for (size_t i = 0; sent && i < args.size(); i++){
+		sent = writeStr(conn, args[i]);
+	}
+	sent = sent && writeStr(conn, source);
+
+	bool done = false;
+	while (sent && !done){
+		char tag;
+		if (!readAll(conn, &tag, 1)){ break; }
+		if (tag == frameFile){
+			std::pair<std::string, std::string> file;
+			if (!readStr(conn, file.first, noLimit)
+			  || !readStr(conn, file.second, noLimit)){
+				break;
+			}
+			result.files.push_back(file);
+		} else if (tag == frameOut){
+			if (!readStr(conn, result.out, noLimit)){ break; }
+		} else if (tag == frameErr){
+			if (!readStr(conn, result.err, noLimit)){ break; }
+		} else if (tag == frameStatus){
+			uint64_t status;
+			if (!readNum(conn, status)){ break; }
+			result.status = static_cast<int>(status);
+			done = true;
+		} else {
+			break;
+		}
+	}
+	close(conn);
+	if (!done){
+		throw new InternalError("Compile server dropped the request");
+	}
+}
+
+}
@@ -0,0 +1,67 @@
+#ifndef DREWNO_MARS_SERVER_HPP
+#define DREWNO_MARS_SERVER_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace drewno_mars{
+
+//Everything a compile request produced: the contents of each
+// output file it named, what it printed, and its exit status
+struct CompileResult{
+	std::vector<std::pair<std::string, std::string>> files;
+	std::string out;
+	std::string err;
+	int status = 0;
+};
+
+//Compiles source as if dmc had been run with args (input "-")
+typedef std::function<void(const std::vector<std::string>& args,
+  const std::string& source, CompileResult& result)> CompileHandler;
+
+//A long-lived dmc that takes compile requests over a Unix
+// domain socket, so that CI-style workloads don't pay process
+// startup for every file. Requests carry the usual command-line
+// options plus the program text; results are sent back as a
+// sequence of frames (output files, stdout, stderr and finally
+// the exit status). Each connection is read and answered on a
+// thread of its own, with a timeout on each read and write, so
+// a stalled client holds up no one else; the compiling itself
+// is done one request at a time, as the compiler keeps global
+// state.
+class CompileServer{
+public:
+	CompileServer(const std::string& socketPath, CompileHandler handler);
+	~CompileServer();
+	//Serve requests until a client asks the server to stop, then
+	// wait for those under way
+	void run();
+private:
+	void serve(int conn);
+	void stop();
+	std::string myPath;
+	CompileHandler myHandler;
+	int myListener;
+	std::mutex myCompiling;
+	//Connections being served, and whether a client has asked
+	// the server to stop
+	std::mutex myLock;
+	std::condition_variable myIdle;
+	size_t myConnections;
+	bool myStopping;
+};
+
+//The client half: send one request to the server listening on
+// socketPath and collect what comes back. An args list of just
+// "--stop" shuts the server down.
+void requestCompile(const std::string& socketPath,
+  const std::vector<std::string>& args, const std::string& source,
+  CompileResult& result);
+
+}
+
+#endif
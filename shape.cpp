@@ -0,0 +1,82 @@
+#include "ast.hpp"
+#include "memo.hpp"
+#include "visitor.hpp"
+
+namespace drewno_mars{
+
+//Hashes a subtree as a walk meets its nodes: each one's kind,
+// its name or value, and how long each of its lists is and
+// whether its optional child is there, which is all it takes
+// for the order to pin down the tree
+class ShapeHasher : public AstWalker<ShapeHasher>{
+public:
+	bool pre(ASTNode * node){
+		s.add(node->kind());
+		switch (node->kind()){
+		case NodeKind::Program:
+			size(static_cast<ProgramNode *>(node)->getGlobals());
+			break;
+		case NodeKind::ClassDefn:
+			size(static_cast<ClassDefnNode *>(node)->getMembers());
+			break;
+		case NodeKind::VarDecl:
+			s.add(static_cast<VarDeclNode *>(node)->getInit() != nullptr);
+			break;
+		case NodeKind::FnDecl:
+			size(static_cast<FnDeclNode *>(node)->getFormals());
+			size(static_cast<FnDeclNode *>(node)->getBody());
+			break;
+		case NodeKind::IfStmt:
+			size(static_cast<IfStmtNode *>(node)->getBody());
+			break;
+		case NodeKind::IfElseStmt:
+			size(static_cast<IfElseStmtNode *>(node)->getBodyTrue());
+			size(static_cast<IfElseStmtNode *>(node)->getBodyFalse());
+			break;
+		case NodeKind::WhileStmt:
+			size(static_cast<WhileStmtNode *>(node)->getBody());
+			break;
+		case NodeKind::ReturnStmt:
+			s.add(static_cast<ReturnStmtNode *>(node)->getExp() != nullptr);
+			break;
+		case NodeKind::CallExp:
+			size(static_cast<CallExpNode *>(node)->getArgs());
+			break;
+		case NodeKind::ID:
+			s.add(static_cast<IDNode *>(node)->getName());
+			break;
+		case NodeKind::IntLit:
+			s.add(static_cast<uint64_t>(static_cast<uint32_t>(
+			  static_cast<IntLitNode *>(node)->getNum())));
+			break;
+		case NodeKind::StrLit:
+			s.add(static_cast<StrLitNode *>(node)->getStr());
+			break;
+		default:
+			break;
+		}
+		return true;
+	}
+
+	DeclShape s;
+
+private:
+	template <typename T>
+	void size(std::list<T *> * items){
+		s.add(static_cast<uint64_t>(items->size()));
+	}
+};
+
+uint64_t ClassDefnNode::hashShape(){
+	ShapeHasher hasher;
+	hasher.walk(this);
+	return hasher.s.hash();
+}
+
+uint64_t FnDeclNode::hashShape(){
+	ShapeHasher hasher;
+	hasher.walk(this);
+	return hasher.s.hash();
+}
+
+}
@@ -0,0 +1,314 @@
+#include <algorithm>
+#include "errors.hpp"
+#include "ssa.hpp"
+
+namespace drewno_mars{
+
+IrCfg::IrCfg(const IrFunction& fn){
+	const uint32_t blocks = static_cast<uint32_t>(fn.blocks.size());
+	succs.assign(2 * blocks, IR_NONE);
+	edges.assign(2 * blocks, IR_NONE);
+	predFirst.assign(blocks + 1, 0);
+	for (uint32_t b = 0; b < blocks; b++){
+		const IrInstr& term = fn.terminator(b);
+		if (term.op == IrOp::Jump){
+			succs[2 * b] = term.a;
+		} else if (term.op == IrOp::Branch){
+			succs[2 * b] = term.b;
+			succs[2 * b + 1] = term.c;
+		}
+		for (uint32_t k = 2 * b; k < 2 * b + 2; k++){
+			if (succs[k] != IR_NONE){ predFirst[succs[k] + 1]++; }
+		}
+	}
+	for (uint32_t b = 0; b < blocks; b++){ predFirst[b + 1] += predFirst[b]; }
+	preds.resize(predFirst[blocks]);
+	std::vector<uint32_t> next(predFirst.begin(), predFirst.end() - 1);
+	for (uint32_t k = 0; k < 2 * blocks; k++){
+		if (succs[k] == IR_NONE){ continue; }
+		edges[k] = next[succs[k]]++;
+		preds[edges[k]] = k / 2;
+	}
+}
+
+DomTree dominators(const IrFunction& fn, const IrCfg& cfg){
+	const uint32_t NONE = IR_NONE;
+	const uint32_t blocks = static_cast<uint32_t>(fn.blocks.size());
+	DomTree dom;
+	dom.idom.assign(blocks, NONE);
+
+	//Number the blocks the entry reaches depth first, noting
+	// each one's parent in the spanning tree that makes. A
+	// block's entry on the stack is stale if an earlier one has
+	// been taken off since.
+	std::vector<uint32_t> num(blocks, NONE);
+	std::vector<uint32_t> vertex;
+	std::vector<uint32_t> parent;
+	std::vector<std::pair<uint32_t, uint32_t>> stack;
+	stack.push_back(std::make_pair(0, NONE));
+	while (!stack.empty()){
+		uint32_t b = stack.back().first;
+		uint32_t from = stack.back().second;
+		stack.pop_back();
+		if (num[b] != NONE){ continue; }
+		num[b] = static_cast<uint32_t>(vertex.size());
+		vertex.push_back(b);
+		parent.push_back(from);
+		for (uint32_t k = 2 * b + 2; k-- > 2 * b;){
+			uint32_t s = cfg.succs[k];
+			if (s != NONE && num[s] == NONE){
+				stack.push_back(std::make_pair(s, num[b]));
+			}
+		}
+	}
+
+	//Lengauer and Tarjan's algorithm (the simple version, with
+	// path compression), over the blocks' numbers: each block's
+	// semidominator is found from its predecessors, and its
+	// immediate dominator from those of the blocks on the path
+	// up to that
+	const uint32_t n = static_cast<uint32_t>(vertex.size());
+	std::vector<uint32_t> semi(n);
+	std::vector<uint32_t> label(n);
+	std::vector<uint32_t> ancestor(n, NONE);
+	std::vector<uint32_t> idom(n, NONE);
+	std::vector<uint32_t> bucket(n, NONE);
+	std::vector<uint32_t> bucketNext(n, NONE);
+	for (uint32_t v = 0; v < n; v++){
+		semi[v] = v;
+		label[v] = v;
+	}
+	std::vector<uint32_t> path;
+	auto eval = [&](uint32_t v){
+		if (ancestor[v] == NONE){ return v; }
+		uint32_t u = v;
+		while (ancestor[ancestor[u]] != NONE){
+			path.push_back(u);
+			u = ancestor[u];
+		}
+		while (!path.empty()){
+			uint32_t x = path.back();
+			path.pop_back();
+			uint32_t a = ancestor[x];
+			if (semi[label[a]] < semi[label[x]]){ label[x] = label[a]; }
+			ancestor[x] = ancestor[a];
+		}
+		return label[v];
+	};
+	for (uint32_t w = n; w-- > 1;){
+		uint32_t b = vertex[w];
+		for (uint32_t e = cfg.predFirst[b]; e < cfg.predFirst[b + 1]; e++){
+			uint32_t p = num[cfg.preds[e]];
+			if (p == NONE){ continue; }
+			uint32_t u = eval(p);
+			if (semi[u] < semi[w]){ semi[w] = semi[u]; }
+		}
+		bucketNext[w] = bucket[semi[w]];
+		bucket[semi[w]] = w;
+		ancestor[w] = parent[w];
+		for (uint32_t v = bucket[parent[w]]; v != NONE; v = bucketNext[v]){
+			uint32_t u = eval(v);
+			idom[v] = semi[u] < semi[v] ? u : parent[w];
+		}
+		bucket[parent[w]] = NONE;
+	}
+	for (uint32_t w = 1; w < n; w++){
+		if (idom[w] != semi[w]){ idom[w] = idom[idom[w]]; }
+		dom.idom[vertex[w]] = vertex[idom[w]];
+	}
+
+	//The tree, its preorder and the size of each subtree
+	dom.childFirst.assign(blocks + 1, 0);
+	for (uint32_t b = 0; b < blocks; b++){
+		if (dom.idom[b] != NONE){ dom.childFirst[dom.idom[b] + 1]++; }
+	}
+	for (uint32_t b = 0; b < blocks; b++){
+		dom.childFirst[b + 1] += dom.childFirst[b];
+	}
+	dom.children.resize(dom.childFirst[blocks]);
+	std::vector<uint32_t> next(dom.childFirst.begin(),
+	  dom.childFirst.end() - 1);
+	for (uint32_t b = 0; b < blocks; b++){
+		if (dom.idom[b] != NONE){ dom.children[next[dom.idom[b]]++] = b; }
+	}
+	dom.pre.assign(blocks, NONE);
+	dom.size.assign(blocks, 0);
+	std::vector<uint32_t> todo;
+	todo.push_back(0);
+	while (!todo.empty()){
+		uint32_t b = todo.back();
+		todo.pop_back();
+		dom.pre[b] = static_cast<uint32_t>(dom.order.size());
+		dom.order.push_back(b);
+		for (uint32_t c = dom.childFirst[b + 1]; c-- > dom.childFirst[b];){
+			todo.push_back(dom.children[c]);
+		}
+	}
+	for (uint32_t i = n; i-- > 0;){
+		uint32_t b = dom.order[i];
+		dom.size[b]++;
+		if (dom.idom[b] != NONE){ dom.size[dom.idom[b]] += dom.size[b]; }
+	}
+	return dom;
+}
+
+SsaForm::SsaForm(const IrFunction& fn)
+: cfg(fn), dom(dominators(fn, cfg)), values(fn.regs){
+	const uint32_t NONE = IR_NONE;
+	const uint32_t regs = fn.regs;
+	const uint32_t blocks = static_cast<uint32_t>(fn.blocks.size());
+	//What registers hold on entry would need phis too
+	if (cfg.predFirst[1] != 0){
+		throw new InternalError("Jump back to a function's entry block");
+	}
+
+	//Dominance frontiers: a join is in the frontier of each block
+	// on the way up the tree from each of its predecessors to
+	// its immediate dominator (Cooper, Harvey and Kennedy). A
+	// walk that meets a block already given the join stops, as
+	// the rest of the way up has been given it too.
+	std::vector<std::pair<uint32_t, uint32_t>> frontier;
+	{
+		std::vector<uint32_t> given(blocks, NONE);
+		for (uint32_t b : dom.order){
+			for (uint32_t e = cfg.predFirst[b]; e < cfg.predFirst[b + 1]; e++){
+				uint32_t runner = cfg.preds[e];
+				if (!dom.reached(runner)){ continue; }
+				while (runner != dom.idom[b] && given[runner] != b){
+					given[runner] = b;
+					frontier.push_back(std::make_pair(runner, b));
+					runner = dom.idom[runner];
+				}
+			}
+		}
+	}
+	std::sort(frontier.begin(), frontier.end());
+	std::vector<uint32_t> frontierFirst(blocks + 1, 0);
+	for (auto& f : frontier){ frontierFirst[f.first + 1]++; }
+	for (uint32_t b = 0; b < blocks; b++){
+		frontierFirst[b + 1] += frontierFirst[b];
+	}
+
+	//Where each register is written, and which registers are
+	// read in a block before being written there (only they can
+	// need a phi)
+	std::vector<bool> crosses(regs, false);
+	std::vector<std::pair<uint32_t, uint32_t>> writes;
+	{
+		std::vector<uint32_t> writtenIn(regs, NONE);
+		for (uint32_t b : dom.order){
+			for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+				const IrInstr& in = fn.code[i];
+				forEachUse(fn, in, [&](uint32_t reg){
+					if (writtenIn[reg] != b){ crosses[reg] = true; }
+				});
+				if (in.dst != NONE && writtenIn[in.dst] != b){
+					writtenIn[in.dst] = b;
+					writes.push_back(std::make_pair(in.dst, b));
+				}
+			}
+		}
+	}
+	std::sort(writes.begin(), writes.end());
+
+	//Phis go on the iterated dominance frontier of each
+	// register's writes. The marks are stamped with the register.
+	std::vector<std::pair<uint32_t, uint32_t>> placed;
+	{
+		std::vector<uint32_t> hasPhi(blocks, NONE);
+		std::vector<uint32_t> queued(blocks, NONE);
+		std::vector<uint32_t> work;
+		size_t w = 0;
+		while (w < writes.size()){
+			uint32_t reg = writes[w].first;
+			for (; w < writes.size() && writes[w].first == reg; w++){
+				if (!crosses[reg]){ continue; }
+				queued[writes[w].second] = reg;
+				work.push_back(writes[w].second);
+			}
+			while (!work.empty()){
+				uint32_t b = work.back();
+				work.pop_back();
+				for (uint32_t f = frontierFirst[b]; f < frontierFirst[b + 1]; f++){
+					uint32_t join = frontier[f].second;
+					if (hasPhi[join] == reg){ continue; }
+					hasPhi[join] = reg;
+					placed.push_back(std::make_pair(join, reg));
+					if (queued[join] != reg){
+						queued[join] = reg;
+						work.push_back(join);
+					}
+				}
+			}
+		}
+	}
+	std::sort(placed.begin(), placed.end());
+	phiFirst.assign(blocks + 1, 0);
+	uint32_t argCount = 0;
+	for (auto& place : placed){
+		phiFirst[place.first + 1]++;
+		phis.push_back({place.second, place.first, values++});
+		argFirst.push_back(argCount);
+		argCount += cfg.predFirst[place.first + 1] - cfg.predFirst[place.first];
+	}
+	for (uint32_t b = 0; b < blocks; b++){ phiFirst[b + 1] += phiFirst[b]; }
+	args.assign(argCount, NONE);
+
+	const uint32_t instrs = static_cast<uint32_t>(fn.code.size());
+	defs.assign(instrs, NONE);
+	useFirst.assign(instrs + 1, 0);
+	for (uint32_t i = 0; i < instrs; i++){
+		uint32_t count = 0;
+		forEachUse(fn, fn.code[i], [&](uint32_t){ count++; });
+		useFirst[i + 1] = useFirst[i] + count;
+	}
+	uses.assign(useFirst[instrs], NONE);
+
+	//Rename down the dominator tree: each register's current
+	// value is the one its nearest write (or phi) above defines,
+	// and is put back, from the log of what was replaced, once
+	// the walk leaves the subtree below that write
+	std::vector<uint32_t> current(regs);
+	for (uint32_t reg = 0; reg < regs; reg++){ current[reg] = reg; }
+	std::vector<std::pair<uint32_t, uint32_t>> log;
+	//Blocks whose subtrees are still being walked: where each
+	// subtree ends in the preorder, and the log as it was
+	std::vector<std::pair<uint32_t, size_t>> open;
+	auto define = [&](uint32_t reg, uint32_t value){
+		log.push_back(std::make_pair(reg, current[reg]));
+		current[reg] = value;
+	};
+	for (uint32_t at = 0; at < dom.order.size(); at++){
+		uint32_t b = dom.order[at];
+		while (!open.empty() && open.back().first <= at){
+			for (size_t mark = open.back().second; log.size() > mark;){
+				current[log.back().first] = log.back().second;
+				log.pop_back();
+			}
+			open.pop_back();
+		}
+		open.push_back(std::make_pair(at + dom.size[b], log.size()));
+		for (uint32_t p = phiFirst[b]; p < phiFirst[b + 1]; p++){
+			define(phis[p].reg, phis[p].value);
+		}
+		for (uint32_t i = fn.blocks[b].first; i < fn.blocks[b].end; i++){
+			const IrInstr& in = fn.code[i];
+			uint32_t u = useFirst[i];
+			forEachUse(fn, in, [&](uint32_t reg){ uses[u++] = current[reg]; });
+			if (in.dst != NONE){
+				defs[i] = values++;
+				define(in.dst, defs[i]);
+			}
+		}
+		for (uint32_t k = 2 * b; k < 2 * b + 2; k++){
+			uint32_t s = cfg.succs[k];
+			if (s == NONE){ continue; }
+			uint32_t j = cfg.edges[k] - cfg.predFirst[s];
+			for (uint32_t p = phiFirst[s]; p < phiFirst[s + 1]; p++){
+				args[argFirst[p] + j] = current[phis[p].reg];
+			}
+		}
+	}
+}
+
+}
@@ -0,0 +1,122 @@
+#ifndef DREWNO_MARS_SSA_HPP
+#define DREWNO_MARS_SSA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "ir.hpp"
+
+//Static single assignment form for the IR, and the sparse
+// conditional constant propagation (Wegman and Zadeck) that runs
+// on it before the backends do (unless dmc -N).
+//
+//The SSA form is built beside a function's code rather than in
+// it, so the IR the backends see never has phis: it names the
+// value each instruction defines and each of its reads reads,
+// with a phi wherever two definitions of a register meet.
+// Dominators are found by Lengauer and Tarjan's algorithm, phis
+// placed on the iterated dominance frontiers (Cytron et al.) of
+// each register's definitions, but only for registers that are
+// read in a block they aren't first written in (semi-pruned
+// form), and renamed by a walk of the dominator tree. Lowering
+// never jumps back to a function's entry block, which the form
+// relies on. None of it
+// recurses, and all of it is near linear in the size of the
+// function.
+namespace drewno_mars{
+
+struct IrCfg{
+	explicit IrCfg(const IrFunction& fn);
+	//Block b's predecessors are preds[predFirst[b], predFirst[b +
+	// 1]), an edge per predecessor (so twice, for a branch to b
+	// either way)
+	std::vector<uint32_t> predFirst;
+	std::vector<uint32_t> preds;
+	//Block b's successors are succs[2 * b] and succs[2 * b + 1]
+	// (either IR_NONE if there's no such edge), the edges in
+	// preds at edges[2 * b] and edges[2 * b + 1]
+	std::vector<uint32_t> succs;
+	std::vector<uint32_t> edges;
+};
+
+struct DomTree{
+	//Each block's immediate dominator: IR_NONE for the entry,
+	// and for blocks it doesn't reach
+	std::vector<uint32_t> idom;
+	//Block b's children in the tree are
+	// children[childFirst[b], childFirst[b + 1])
+	std::vector<uint32_t> childFirst;
+	std::vector<uint32_t> children;
+	//The blocks the entry reaches, in a preorder of the tree;
+	// each one's place in it (IR_NONE if it isn't reached), and
+	// how many blocks its subtree has, so its descendants come
+	// straight after it
+	std::vector<uint32_t> order;
+	std::vector<uint32_t> pre;
+	std::vector<uint32_t> size;
+
+	bool reached(uint32_t b) const{ return pre[b] != IR_NONE; }
+	//Whether block a dominates block b (both reached)
+	bool dominates(uint32_t a, uint32_t b) const{
+		return pre[a] <= pre[b] && pre[b] < pre[a] + size[a];
+	}
+};
+
+DomTree dominators(const IrFunction& fn, const IrCfg& cfg);
+
+struct SsaPhi{
+	uint32_t reg;
+	uint32_t block;
+	uint32_t value;
+};
+
+struct SsaForm{
+	explicit SsaForm(const IrFunction& fn);
+	IrCfg cfg;
+	DomTree dom;
+	//Values [0, regs) are what the registers hold on entry; the
+	// rest are defined by an instruction or a phi
+	uint32_t values;
+	//Block b's phis are phis[phiFirst[b], phiFirst[b + 1]). Phi
+	// p's argument from the predecessor at preds[predFirst[b] +
+	// j] is args[argFirst[p] + j] (IR_NONE from a block that
+	// isn't reached).
+	std::vector<SsaPhi> phis;
+	std::vector<uint32_t> phiFirst;
+	std::vector<uint32_t> argFirst;
+	std::vector<uint32_t> args;
+	//The value each instruction defines (or IR_NONE), and what
+	// it reads, in forEachUse's order, at
+	// uses[useFirst[i], useFirst[i + 1])
+	std::vector<uint32_t> defs;
+	std::vector<uint32_t> useFirst;
+	std::vector<uint32_t> uses;
+};
+
+struct SccpCounts{
+	//Instructions found to define a constant (and rewritten to
+	// load it), branches found to go only one way, and blocks
+	// found unreachable and removed
+	size_t constants = 0;
+	size_t branches = 0;
+	size_t blocks = 0;
+	//Instructions removed as nothing reads what they define
+	size_t dead = 0;
+	SccpCounts& operator+=(const SccpCounts& other);
+};
+
+//Propagate constants through fn (whose SSA form is ssa): rewrite
+// each instruction that always defines the same constant to load
+// it, and each branch that can only go one way to a jump, remove
+// the blocks that can't be reached and then the instructions
+// left with nothing reading them. ssa is no good afterwards.
+SccpCounts propagateConstants(IrFunction& fn, const SsaForm& ssa);
+
+//Mark, in removed, each instruction not already marked that
+// only writes a register no instruction left reads (which may
+// leave more unread), and say how many were marked
+size_t removeUnread(const IrFunction& fn, std::vector<bool>& removed);
+
+}
+
+#endif
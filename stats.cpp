@@ -0,0 +1,38 @@
+#include <iomanip>
+#include <sstream>
+#include "stats.hpp"
+
+namespace drewno_mars{
+
+std::vector<std::pair<std::string, std::string>>& Stats::entries(){
+	static std::vector<std::pair<std::string, std::string>> all;
+	return all;
+}
+
+void Stats::count(const std::string& what, size_t n){
+	note(what, std::to_string(n));
+}
+
+void Stats::time(const std::string& what, double seconds){
+	std::ostringstream val;
+	val << std::fixed << std::setprecision(3) << seconds * 1000 << " ms";
+	note(what, val.str());
+}
+
+void Stats::note(const std::string& what, const std::string& value){
+	if (!enabled()){ return; }
+	entries().push_back(std::make_pair(what, value));
+}
+
+void Stats::report(std::ostream& out){
+	for (auto entry : entries()){
+		out << "[stats] " << entry.first << ": " << entry.second << "\n";
+	}
+	entries().clear();
+}
+
+void Stats::clear(){
+	entries().clear();
+}
+
+}
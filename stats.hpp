@@ -0,0 +1,50 @@
+#ifndef DREWNO_MARS_STATS_HPP
+#define DREWNO_MARS_STATS_HPP
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace drewno_mars{
+
+//Measures elapsed wall-clock time from its construction
+// (or the last reset)
+class Stopwatch{
+public:
+	Stopwatch() : myStart(std::chrono::steady_clock::now()){ }
+	void reset(){ myStart = std::chrono::steady_clock::now(); }
+	double seconds() const{
+		std::chrono::duration<double> d =
+		  std::chrono::steady_clock::now() - myStart;
+		return d.count();
+	}
+private:
+	std::chrono::steady_clock::time_point myStart;
+};
+
+//Collects the timings and counters requested with -v. They
+// are reported on stderr, in the order they were recorded,
+// once dmc is done. Recording is a no-op unless enabled.
+class Stats{
+public:
+	static void enable(){ on() = true; }
+	static void disable(){ on() = false; }
+	static bool enabled(){ return on(); }
+	static void count(const std::string& what, size_t n);
+	static void time(const std::string& what, double seconds);
+	static void note(const std::string& what, const std::string& value);
+	static void report(std::ostream& out);
+	//Forget what has been recorded without reporting it
+	static void clear();
+private:
+	static bool& on(){
+		static bool enabled = false;
+		return enabled;
+	}
+	static std::vector<std::pair<std::string, std::string>>& entries();
+};
+
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include "stream.hpp"
+
+namespace drewno_mars{
+
+DeclStream::DeclStream(std::ostream * unparseOut, std::ostream * namesOut,
+  Summary * prelude)
+: myUnparseOut(unparseOut), myNamesOut(namesOut),
+  mySymTab(new SymbolTable()), myAnalysisOK(true), myDecls(0){
+	mySymTab->usePrelude(prelude);
+	//The global scope stays open for the whole stream
+	mySymTab->enterGlobalScope();
+}
+
+DeclStream::~DeclStream(){
+	mySymTab->leaveScope();
+	delete mySymTab;
+}
+
+void DeclStream::accept(DeclNode * decl){
+	myDecls++;
+	if (myUnparseOut != nullptr){
+		decl->unparse(*myUnparseOut, 0);
+	}
+	if (myNamesOut != nullptr){
+		bool ok = decl->nameAnalysis(mySymTab);
+		myAnalysisOK = ok && myAnalysisOK;
+		if (myAnalysisOK){
+			decl->unparse(*myNamesOut, 0);
+		}
+
+		//A class's member scope lives on in its symbol, since
+		// later declarations can still name its members
+		std::list<ScopeTable *> keep;
+		SemSymbol * sym = decl->ID()->getSymbol();
+		if (sym != nullptr && sym->getKind() == "class"){
+			keep.push_back(sym->getScopeTable());
+		}
+		mySymTab->sweepScopes(keep);
+	}
+	delete decl;
+}
+
+}
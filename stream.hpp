@@ -0,0 +1,47 @@
+#ifndef DREWNO_MARS_STREAM_HPP
+#define DREWNO_MARS_STREAM_HPP
+
+#include <ostream>
+#include "ast.hpp"
+#include "symbol_table.hpp"
+
+namespace drewno_mars{
+
+//Receives each top-level declaration as soon as the parser
+// reduces it, in place of collecting it into the ProgramNode.
+// The sink takes ownership of the declaration.
+class DeclSink{
+public:
+	virtual ~DeclSink(){ }
+	virtual void accept(DeclNode * decl) = 0;
+};
+
+//Unparses and name-analyses each declaration as it arrives,
+// then frees it along with any scopes it opened. Only the
+// global scope (and class member scopes) outlive a declaration,
+// so memory use does not grow with the length of the program.
+//
+//Since earlier declarations are already written out by the
+// time a later one is analysed, the names output stops at the
+// first declaration that fails name analysis (the diagnostics
+// for the rest are still reported).
+class DeclStream : public DeclSink{
+public:
+	//Takes ownership of prelude, if given (see -I)
+	DeclStream(std::ostream * unparseOut, std::ostream * namesOut,
+	  Summary * prelude = nullptr);
+	~DeclStream();
+	void accept(DeclNode * decl) override;
+	bool analysisOK(){ return myAnalysisOK; }
+	size_t declCount(){ return myDecls; }
+private:
+	std::ostream * myUnparseOut;
+	std::ostream * myNamesOut;
+	SymbolTable * mySymTab;
+	bool myAnalysisOK;
+	size_t myDecls;
+};
+
+}
+
+#endif
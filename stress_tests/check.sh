@@ -0,0 +1,18 @@
+#!/bin/sh
+# Compile <file> with dmc under each of the given modes, with an
+# 8 MB stack (and no input, for -r), and fail if any of them does
+# not succeed
+#  check.sh <dmc> <file> <mode>...
+dmc=$1
+file=$2
+shift 2
+ulimit -s 8192
+status=0
+for mode in "$@"; do
+	if ! $dmc $file $mode < /dev/null > /dev/null 2> $file.err; then
+		echo "FAIL $file $mode: $(head -n 1 $file.err)"
+		status=1
+	fi
+done
+rm -f $file.err
+exit $status
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Write a program nested <depth> deep in one way to stdout
+#  deep.sh chain|right|paren|neg|not|fields|ifs|ifelse|whiles <depth>
+shape=$1
+depth=$2
+if [ -z "$shape" ] || [ -z "$depth" ]; then
+	echo "Usage: $0 <shape> <depth>" >&2
+	exit 1
+fi
+awk -v shape="$shape" -v depth="$depth" '
+# s n times over, doubling rather than adding a copy at a time
+function rep(s, n,    out){
+	out = ""
+	for (; n > 0; n = int(n / 2)){
+		if (n % 2){ out = out s }
+		s = s s
+	}
+	return out
+}
+BEGIN {
+	if (shape == "fields"){
+		print "P : class { p : perfect P; v : int; };"
+		print "f : () int {"
+		print "\tq : P;"
+		print "\tq" rep("--p", depth) "--v = 1;"
+		print "}"
+		exit 0
+	}
+	if (shape == "not"){
+		print "f : () bool {"
+		print "\tx : bool = true;"
+		print "\tx = " rep("!", depth) "x;"
+		print "}"
+		exit 0
+	}
+	print "f : () int {"
+	print "\tx : int = 0;"
+	if (shape == "chain"){
+		print "\tx = " rep("x + ", depth) "1;"
+	} else if (shape == "right"){
+		print "\tx = " rep("x + (", depth) "x" rep(")", depth) ";"
+	} else if (shape == "paren"){
+		print "\tx = " rep("(", depth) "x" rep(")", depth) ";"
+	} else if (shape == "neg"){
+		print "\tx = " rep("-(", depth) "x" rep(")", depth) ";"
+	} else if (shape == "ifs" || shape == "ifelse" || shape == "whiles"){
+		head = shape == "whiles" ? "while (x < 1) {" : "if (x < 1) {"
+		tail = shape == "ifelse" ? "} else { x--; }" : "}"
+		for (i = 0; i < depth; i++){ print head }
+		print "x++;"
+		for (i = 0; i < depth; i++){ print tail }
+	} else {
+		print "Unknown shape " shape > "/dev/stderr"
+		exit 1
+	}
+	print "}"
+}'
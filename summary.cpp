@@ -0,0 +1,265 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "errors.hpp"
+#include "summary.hpp"
+
+namespace drewno_mars{
+
+static const char MAGIC[4] = {'D', 'M', 'C', 'S'};
+static const uint32_t VERSION = 1;
+static const size_t HEADER_WORDS = 7;
+static const size_t SCOPE_WORDS = 2;
+static const size_t SYMBOL_WORDS = 4;
+
+static void put32(std::vector<unsigned char>& bytes, uint32_t val){
+	for (int i = 0; i < 4; i++){
+		bytes.push_back(static_cast<unsigned char>(val >> (8 * i)));
+	}
+}
+
+static uint32_t get32(const unsigned char * bytes){
+	return static_cast<uint32_t>(bytes[0])
+	  | static_cast<uint32_t>(bytes[1]) << 8
+	  | static_cast<uint32_t>(bytes[2]) << 16
+	  | static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+static void corrupt(){
+	throw new UserError("Corrupt declaration summary");
+}
+
+static uint32_t narrow(size_t val){
+	if (val > 0xffffffff){
+		throw new InternalError("Program too big for a declaration summary");
+	}
+	return static_cast<uint32_t>(val);
+}
+
+uint32_t SummaryWriter::scope(ScopeTable * scope){
+	if (scope == nullptr){ return Summary::NO_SCOPE; }
+	auto found = myScopeIds.find(scope);
+	if (found != myScopeIds.end()){ return found->second; }
+	uint32_t id = narrow(myScopes.size());
+	myScopeIds[scope] = id;
+	myScopes.push_back(scope);
+	return id;
+}
+
+uint32_t SummaryWriter::name(const std::string& str){
+	auto found = myStringIds.find(str);
+	if (found != myStringIds.end()){ return found->second; }
+	uint32_t at = narrow(myStrings.size());
+	myStringIds[str] = at;
+	myStrings += str;
+	myStrings.push_back('\0');
+	return at;
+}
+
+void SummaryWriter::write(std::ostream& out, ScopeTable * globals){
+	scope(globals);
+	std::vector<unsigned char> scopes;
+	std::vector<unsigned char> symbols;
+	uint32_t symbolCount = 0;
+	//Scopes are numbered as symbols lead to them, so the list
+	// grows while it is written
+	for (size_t i = 0; i < myScopes.size(); i++){
+		std::vector<SemSymbol *> contents = myScopes[i]->contents();
+		std::sort(contents.begin(), contents.end(),
+		  [](SemSymbol * a, SemSymbol * b){
+			return a->getName() < b->getName();
+		});
+		put32(scopes, symbolCount);
+		put32(scopes, narrow(contents.size()));
+		for (SemSymbol * symbol : contents){
+			put32(symbols, name(symbol->getName()));
+			put32(symbols, name(symbol->getKind()));
+			put32(symbols, name(symbol->getType()));
+			put32(symbols, scope(symbol->getScopeTable()));
+		}
+		symbolCount = narrow(symbolCount + contents.size());
+	}
+
+	std::vector<unsigned char> header(MAGIC, MAGIC + 4);
+	size_t scopesAt = 4 * HEADER_WORDS;
+	size_t symbolsAt = scopesAt + scopes.size();
+	size_t stringsAt = symbolsAt + symbols.size();
+	narrow(stringsAt + myStrings.size());
+	put32(header, VERSION);
+	put32(header, narrow(myScopes.size()));
+	put32(header, symbolCount);
+	put32(header, narrow(scopesAt));
+	put32(header, narrow(symbolsAt));
+	put32(header, narrow(stringsAt));
+
+	out.write(reinterpret_cast<const char *>(header.data()),
+	  static_cast<std::streamsize>(header.size()));
+	out.write(reinterpret_cast<const char *>(scopes.data()),
+	  static_cast<std::streamsize>(scopes.size()));
+	out.write(reinterpret_cast<const char *>(symbols.data()),
+	  static_cast<std::streamsize>(symbols.size()));
+	out << myStrings;
+}
+
+//One of a summary's scopes. A name is looked for among the
+// symbols already made (or declared here since), then in the
+// summary, making its symbol on the spot if it is there.
+class Summary::Scope : public ScopeTable{
+public:
+	Scope(Summary * summary, uint32_t index)
+	: mySummary(summary), myIndex(index){ }
+
+	SemSymbol * lookup(std::string name) override{
+		SemSymbol * made = ScopeTable::lookup(name);
+		if (made != nullptr){ return made; }
+		//The scope's symbols are sorted by name
+		size_t low = first();
+		size_t high = low + count();
+		while (low < high){
+			size_t mid = low + (high - low) / 2;
+			int cmp = strcmp(name.c_str(), part(mid, 0));
+			if (cmp == 0){ return make(mid); }
+			if (cmp < 0){
+				high = mid;
+			} else {
+				low = mid + 1;
+			}
+		}
+		return nullptr;
+	}
+
+	bool insert(SemSymbol * symbol) override{
+		if (lookup(symbol->getName()) != nullptr){ return false; }
+		keep(symbol);
+		return true;
+	}
+
+	std::vector<SemSymbol *> contents() override{
+		for (size_t i = first(); i < first() + count(); i++){
+			lookup(part(i, 0));
+		}
+		return ScopeTable::contents();
+	}
+
+private:
+	size_t first() const{
+		return mySummary->word(4, SCOPE_WORDS * myIndex);
+	}
+	size_t count() const{
+		return mySummary->word(4, SCOPE_WORDS * myIndex + 1);
+	}
+	//The name, kind or type of symbol i
+	const char * part(size_t i, size_t which) const{
+		return mySummary->string(mySummary->word(5, SYMBOL_WORDS * i + which));
+	}
+
+	SemSymbol * make(size_t i){
+		uint32_t scopeIndex = mySummary->word(5, SYMBOL_WORDS * i + 3);
+		ScopeTable * scope = nullptr;
+		if (scopeIndex != NO_SCOPE){ scope = mySummary->scope(scopeIndex); }
+		SemSymbol * symbol = new SemSymbol(part(i, 0), part(i, 1), part(i, 2),
+		  scope);
+		keep(symbol);
+		mySummary->myLoaded++;
+		return symbol;
+	}
+
+	Summary * mySummary;
+	uint32_t myIndex;
+};
+
+Summary::Summary(const unsigned char * bytes, size_t size)
+: myBytes(bytes), mySize(size), myLoaded(0){
+}
+
+Summary::~Summary(){
+	for (Scope * scope : myScopes){ delete scope; }
+	munmap(const_cast<unsigned char *>(myBytes), mySize);
+}
+
+//Check that the sections all lie within the summary, in order,
+// and that each scope's symbols lie within the symbols, so
+// that lookups only need to check the offsets they follow
+static void checkLayout(const unsigned char * bytes, size_t size){
+	if (size < 4 * HEADER_WORDS || memcmp(bytes, MAGIC, 4) != 0){
+		corrupt();
+	}
+	if (get32(bytes + 4) != VERSION){
+		throw new UserError("Unsupported declaration summary version");
+	}
+	uint64_t scopes = get32(bytes + 8);
+	uint64_t symbols = get32(bytes + 12);
+	uint64_t scopesAt = get32(bytes + 16);
+	uint64_t symbolsAt = get32(bytes + 20);
+	uint64_t stringsAt = get32(bytes + 24);
+	bool good = scopes > 0
+	  && scopesAt == 4 * HEADER_WORDS
+	  && scopesAt + 4 * SCOPE_WORDS * scopes <= symbolsAt
+	  && symbolsAt + 4 * SYMBOL_WORDS * symbols <= stringsAt
+	  && stringsAt <= size
+	  && (stringsAt == size || bytes[size - 1] == 0);
+	for (uint64_t i = 0; good && i < scopes; i++){
+		const unsigned char * scope = bytes + scopesAt + 4 * SCOPE_WORDS * i;
+		good = static_cast<uint64_t>(get32(scope)) + get32(scope + 4) <= symbols;
+	}
+	if (!good){ corrupt(); }
+}
+
+Summary * Summary::map(const char * path){
+	int fd = open(path, O_RDONLY);
+	if (fd < 0){
+		std::string msg = "Bad declaration summary ";
+		msg += path;
+		throw new UserError(msg.c_str());
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)
+	  || static_cast<size_t>(info.st_size) < 4 * HEADER_WORDS){
+		close(fd);
+		corrupt();
+	}
+	size_t size = static_cast<size_t>(info.st_size);
+	void * bytes = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (bytes == MAP_FAILED){
+		throw new InternalError("Couldn't map the declaration summary");
+	}
+	Summary * summary = new Summary(
+	  static_cast<const unsigned char *>(bytes), size);
+	try {
+		checkLayout(summary->myBytes, size);
+	} catch (UserError *){
+		delete summary;
+		throw;
+	}
+	summary->myScopes.resize(get32(summary->myBytes + 8), nullptr);
+	return summary;
+}
+
+ScopeTable * Summary::scope(uint32_t index){
+	if (index >= myScopes.size()){ corrupt(); }
+	if (myScopes[index] == nullptr){
+		myScopes[index] = new Scope(this, index);
+	}
+	return myScopes[index];
+}
+
+uint32_t Summary::header(size_t i) const{
+	return get32(myBytes + 4 * i);
+}
+
+//Word i of the section whose offset is header word at
+uint32_t Summary::word(size_t at, size_t i) const{
+	return get32(myBytes + header(at) + 4 * i);
+}
+
+const char * Summary::string(uint32_t offset) const{
+	size_t at = header(6) + static_cast<size_t>(offset);
+	if (at >= mySize){ corrupt(); }
+	return reinterpret_cast<const char *>(myBytes + at);
+}
+
+}
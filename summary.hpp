@@ -0,0 +1,76 @@
+#ifndef DREWNO_MARS_SUMMARY_HPP
+#define DREWNO_MARS_SUMMARY_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "symbol_table.hpp"
+
+//The declaration summary format (written by -S, and preloaded
+// with -I): the global scope a program's name analysis ended
+// with, and every scope its symbols lead to (class members).
+// As in the binary AST, numbers are 32-bit little-endian and
+// every reference is an index or offset, so a file can be
+// mapped into memory and read where it lies.
+//
+// header:  "DMCS" version scopeCount symbolCount
+//          scopesAt symbolsAt stringsAt
+// scopes:  scopeCount (first, count): the scope's symbols are
+//          symbols[first] onwards, sorted by name. Scope 0 is
+//          the global scope.
+// symbols: symbolCount (name, kind, type, scope); name, kind
+//          and type are offsets into strings, and scope is the
+//          index of the symbol's scope (a class's members, or
+//          those of a variable's class), or NO_SCOPE
+// strings: NUL-terminated bytes
+namespace drewno_mars{
+
+//Writes out a global scope, and the scopes it leads to
+class SummaryWriter{
+public:
+	void write(std::ostream& out, ScopeTable * globals);
+private:
+	uint32_t scope(ScopeTable * scope);
+	uint32_t name(const std::string& str);
+
+	std::vector<ScopeTable *> myScopes;
+	HashMap<ScopeTable *, uint32_t> myScopeIds;
+	std::string myStrings;
+	HashMap<std::string, uint32_t> myStringIds;
+};
+
+//A summary, mapped from a file. Its scopes make symbols for
+// the names looked up in them as they are first asked for, so
+// a program only pays for the part of a prelude it uses.
+class Summary{
+public:
+	static const uint32_t NO_SCOPE = 0xffffffff;
+
+	//Throws a UserError if path isn't a summary
+	static Summary * map(const char * path);
+	~Summary();
+
+	//The prelude's global scope, which a program preloaded
+	// with it declares its own globals into as well
+	ScopeTable * globals(){ return scope(0); }
+	//How many of the summary's symbols have been made
+	size_t loaded() const{ return myLoaded; }
+
+private:
+	class Scope;
+	Summary(const unsigned char * bytes, size_t size);
+	ScopeTable * scope(uint32_t index);
+	uint32_t header(size_t i) const;
+	uint32_t word(size_t at, size_t i) const;
+	const char * string(uint32_t offset) const;
+
+	const unsigned char * myBytes;
+	size_t mySize;
+	std::vector<Scope *> myScopes;
+	size_t myLoaded;
+};
+
+}
+
+#endif
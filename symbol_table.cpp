@@ -1,3 +1,6 @@
+#include <algorithm>
+#include "memo.hpp"
+#include "summary.hpp"
 #include "symbol_table.hpp"
 namespace drewno_mars{
 
@@ -5,6 +8,13 @@ ScopeTable::ScopeTable(){
 	symbols = new HashMap<std::string, SemSymbol *>();
 }
 
+ScopeTable::~ScopeTable(){
+    for (auto entry : *symbols){
+        delete entry.second;
+    }
+    delete symbols;
+}
+
 bool ScopeTable::collision(std::string name) {
     SemSymbol * collisionFound = lookup(name);
     if (collisionFound != nullptr){
@@ -21,36 +31,100 @@ SemSymbol * ScopeTable::lookup(std::string name){
     return symbolFound->second;
 }
 
+std::vector<SemSymbol *> ScopeTable::contents(){
+    std::vector<SemSymbol *> result;
+    for (auto entry : *symbols){
+        result.push_back(entry.second);
+    }
+    return result;
+}
+
 bool ScopeTable::insert(SemSymbol * symbol){
     std::string symbolName = symbol->getName();
     bool inCurrentScope = (this->lookup(symbolName) != nullptr);
     if (inCurrentScope){
         return false;
     }
-    this->symbols->insert(std::make_pair(symbolName, symbol));
+    keep(symbol);
     return true;
 }
 
-SymbolTable::SymbolTable(){
+void ScopeTable::keep(SemSymbol * symbol){
+    this->symbols->insert(std::make_pair(symbol->getName(), symbol));
+}
+
+SymbolTable::SymbolTable()
+: myMemo(nullptr), myPrelude(nullptr), myGlobals(nullptr){
 	scopeTableChain = new std::list<ScopeTable *>();
 }
 
+SymbolTable::~SymbolTable(){
+    //Scopes handed in from outside (class scopes re-entered for
+    // member lookups) are never in opened, so aren't freed twice
+    for (ScopeTable * scope : opened) {
+        delete scope;
+    }
+    for (ScopeTable * scope : retained) {
+        delete scope;
+    }
+    delete scopeTableChain;
+    delete myMemo;
+    //The prelude's scopes are never in opened either
+    delete myPrelude;
+}
+
 ScopeTable * SymbolTable::enterScope(ScopeTable *scope) {
     ScopeTable * newScopeTable;
+    Entered entry;
     if(scope == nullptr){
         newScopeTable = new ScopeTable();
         scopeTableChain->push_front(newScopeTable);
+        opened.push_back(newScopeTable);
+        if (myMemo != nullptr) {
+            myMemo->opened(newScopeTable);
+        }
+        indexedAt[newScopeTable] = entered.size();
+        entry.indexed = true;
     } else {
         newScopeTable = scope;
         scopeTableChain->push_front(newScopeTable);
+        unindexed.push_back(entered.size());
+        entry.indexed = false;
     }
+    entry.scope = newScopeTable;
+    entered.push_back(entry);
 
     return newScopeTable;
 }
 
+ScopeTable * SymbolTable::enterGlobalScope() {
+    if (myPrelude != nullptr) {
+        myGlobals = enterScope(myPrelude->globals());
+    } else {
+        myGlobals = enterScope();
+    }
+    return myGlobals;
+}
+
+void SymbolTable::usePrelude(Summary * prelude) {
+    delete myPrelude;
+    myPrelude = prelude;
+}
+
 void SymbolTable::leaveScope() {
     if (!scopeTableChain->empty()) {
         scopeTableChain->pop_front();
+        Entered& top = entered.back();
+        if (top.indexed) {
+            //Its symbols are the innermost of their names
+            for (const std::string& name : top.names) {
+                visible[name].pop_back();
+            }
+            indexedAt.erase(top.scope);
+        } else {
+            unindexed.pop_back();
+        }
+        entered.pop_back();
     }
 }
 
@@ -59,20 +133,115 @@ ScopeTable * SymbolTable::getScope() {
 }
 
 bool SymbolTable::collision(std::string name) {
-    return getScope()->collision(name);
+    bool collides = getScope()->collision(name);
+    if (myMemo != nullptr) {
+        myMemo->checked(getScope(), name, collides);
+    }
+    return collides;
 }
 
 SemSymbol * SymbolTable::lookup(std::string name) {
-    for (ScopeTable * scopeTable : *scopeTableChain) {
-        SemSymbol * symbol = scopeTable->lookup(name);
-        if (symbol != nullptr) {
-            return symbol;
+    //The innermost indexed declaration of name, unless an
+    // unindexed scope inside it declares name too
+    bool found = false;
+    size_t at = 0;
+    SemSymbol * symbol = nullptr;
+    auto indexed = visible.find(name);
+    if (indexed != visible.end() && !indexed->second.empty()) {
+        found = true;
+        at = indexed->second.back().first;
+        symbol = indexed->second.back().second;
+    }
+    for (auto pos = unindexed.rbegin(); pos != unindexed.rend(); ++pos) {
+        if (found && *pos < at) {
+            break;
+        }
+        SemSymbol * inScope = entered[*pos].scope->lookup(name);
+        if (inScope != nullptr) {
+            found = true;
+            at = *pos;
+            symbol = inScope;
+            break;
         }
     }
-    return nullptr;
+    //How many scopes the lookup got past
+    size_t depth = found ? entered.size() - 1 - at : entered.size();
+    if (myMemo != nullptr) {
+        myMemo->lookedUp(*scopeTableChain, depth, name, symbol);
+    }
+    return symbol;
 }
 
 bool SymbolTable::insert(SemSymbol * symbol) {
-    return scopeTableChain->front()->insert(symbol);
+    return insertInto(scopeTableChain->front(), symbol);
+}
+
+bool SymbolTable::insertInto(ScopeTable * scope, SemSymbol * symbol) {
+    bool inserted = scope->insert(symbol);
+    if (inserted) {
+        auto at = indexedAt.find(scope);
+        if (at != indexedAt.end()) {
+            index(at->second, symbol);
+        }
+    }
+    if (inserted && myMemo != nullptr) {
+        myMemo->inserted(scope, symbol);
+    }
+    return inserted;
+}
+
+void SymbolTable::index(size_t at, SemSymbol * symbol) {
+    entered[at].names.push_back(symbol->getName());
+    //Usually it goes innermost, but a function or class is
+    // declared in the scope outside the one it has just opened
+    auto& found = visible[symbol->getName()];
+    auto pos = found.end();
+    while (pos != found.begin() && (pos - 1)->first > at) {
+        --pos;
+    }
+    found.insert(pos, std::make_pair(at, symbol));
+}
+
+size_t SymbolTable::depth() {
+    return scopeTableChain->size();
+}
+
+void SymbolTable::enableMemo() {
+    if (myMemo == nullptr) {
+        myMemo = new DeclMemo();
+    }
+}
+
+void SymbolTable::sweepScopes(const std::list<ScopeTable *>& keep) {
+    std::list<ScopeTable *> stillOpen;
+    for (ScopeTable * scope : opened) {
+        auto inChain = std::find(scopeTableChain->begin(),
+          scopeTableChain->end(), scope);
+        auto kept = std::find(keep.begin(), keep.end(), scope);
+        if (inChain != scopeTableChain->end()) {
+            stillOpen.push_back(scope);
+        } else if (kept == keep.end()) {
+            delete scope;
+        } else {
+            retained.push_back(scope);
+        }
+    }
+    opened = stillOpen;
+}
+
+std::list<ScopeTable *> SymbolTable::takeScopes() {
+    std::list<ScopeTable *> taken;
+    std::list<ScopeTable *> stillOpen;
+    for (ScopeTable * scope : opened) {
+        auto inChain = std::find(scopeTableChain->begin(),
+          scopeTableChain->end(), scope);
+        if (inChain != scopeTableChain->end()) {
+            stillOpen.push_back(scope);
+        } else {
+            taken.push_back(scope);
+        }
+    }
+    opened = stillOpen;
+    return taken;
 }
 }
@@ -3,6 +3,7 @@
 #include <string>
 #include <unordered_map>
 #include <list>
+#include <vector>
 #include "ast.hpp"
 
 //Use an alias template so that we can use
@@ -15,6 +16,8 @@ using namespace std;
 namespace drewno_mars{
 
 class ScopeTable;
+class DeclMemo;
+class Summary;
 //A semantic symbol, which represents a single
 // variable, function, etc. Semantic symbols 
 // exist for the lifetime of a scope in the 
@@ -56,9 +59,16 @@ private:
 class ScopeTable {
 	public:
 		ScopeTable();
-        SemSymbol * lookup(std::string name);
-        bool insert(SemSymbol * symbol);
-        bool collision(std::string name);
+		virtual ~ScopeTable();
+        virtual SemSymbol * lookup(std::string name);
+        virtual bool insert(SemSymbol * symbol);
+        virtual bool collision(std::string name);
+        //Every symbol in the scope, in no particular order
+        virtual std::vector<SemSymbol *> contents();
+
+	protected:
+		//Hold symbol, without checking for one of its name
+		void keep(SemSymbol * symbol);
 
 	private:
 		HashMap<std::string, SemSymbol *> * symbols;
@@ -67,14 +77,68 @@ class ScopeTable {
 class SymbolTable{
 	public:
 		SymbolTable();
+		~SymbolTable();
         ScopeTable * enterScope(ScopeTable * scope = nullptr);
+        //Enter the scope a program's globals are declared in:
+        // the prelude's (see usePrelude), or else a new one
+        ScopeTable * enterGlobalScope();
+        //The scope last entered by enterGlobalScope
+        ScopeTable * globals(){ return myGlobals; }
+        //Declare globals alongside those of a prelude (see -I),
+        // as if its program came first. The table takes
+        // ownership of the summary.
+        void usePrelude(Summary * prelude);
         void leaveScope();
         ScopeTable * getScope();
         bool insert(SemSymbol * symbol);
+        //Insert into scope, which need not be the current one
+        bool insertInto(ScopeTable * scope, SemSymbol * symbol);
         SemSymbol * lookup(std::string name);
         bool collision(std::string name);
+        //How many scopes are entered
+        size_t depth();
+        //Reuse the analyses of declarations that repeat (see
+        // DeclMemo). The memo is null unless enabled.
+        void enableMemo();
+        DeclMemo * memo(){ return myMemo; }
+        //Delete the scopes this table opened and has since left,
+        // except those in keep, which are kept until the table
+        // itself is deleted. Only safe once nothing refers to the
+        // swept scopes' symbols any more.
+        void sweepScopes(const std::list<ScopeTable *>& keep);
+        //Hand over the scopes this table opened and has since
+        // left; the caller becomes responsible for deleting them
+        std::list<ScopeTable *> takeScopes();
 	private:
+		//A scope in the chain. One this table opened for it is
+		// indexed: its symbols are in visible, under the names
+		// listed here, so lookups needn't search it. One entered
+		// from outside, which may already hold symbols (or, like
+		// the incremental compiler's globals, answer lookups its
+		// own way), isn't, and is searched when lookups pass it.
+		struct Entered{
+			ScopeTable * scope;
+			bool indexed;
+			std::vector<std::string> names;
+		};
+		void index(size_t at, SemSymbol * symbol);
+
 		std::list<ScopeTable *> * scopeTableChain;
+		//The chain again, outermost first
+		std::vector<Entered> entered;
+		HashMap<ScopeTable *, size_t> indexedAt;
+		//Where in entered the unindexed scopes are
+		std::vector<size_t> unindexed;
+		//For each name, where in entered it is declared, and
+		// its symbol there, outermost first (so lookups are as
+		// quick however deep the chain is)
+		HashMap<std::string, std::vector<std::pair<size_t, SemSymbol *>>>
+		  visible;
+		std::list<ScopeTable *> opened;
+		std::list<ScopeTable *> retained;
+		DeclMemo * myMemo;
+		Summary * myPrelude;
+		ScopeTable * myGlobals;
 };
 
 	
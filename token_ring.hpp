@@ -0,0 +1,59 @@
+#ifndef DREWNO_MARS_TOKEN_RING_HPP
+#define DREWNO_MARS_TOKEN_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+
+namespace drewno_mars{
+
+//A bounded, lock-free queue for exactly one producer thread
+// and one consumer thread. Each side owns one index and only
+// reads the other's, so a push or pop is a plain store plus
+// a release/acquire pair. Each side also keeps a private copy
+// of the other side's index and only re-reads the shared one
+// when that copy says the ring is full (or empty), which
+// keeps the two cache lines from bouncing on every token.
+template <typename T, size_t Capacity>
+class SpscRing{
+	static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0,
+	  "SpscRing capacity must be a power of two");
+public:
+	SpscRing() : myHead(0), myTailSeen(0), myTail(0), myHeadSeen(0){ }
+
+	//Producer side. Returns false if the ring is full
+	bool tryPush(const T& item){
+		size_t tail = myTail.load(std::memory_order_relaxed);
+		if (tail - myHeadSeen == Capacity){
+			myHeadSeen = myHead.load(std::memory_order_acquire);
+			if (tail - myHeadSeen == Capacity){ return false; }
+		}
+		mySlots[tail & (Capacity - 1)] = item;
+		myTail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	//Consumer side. Returns false if the ring is empty
+	bool tryPop(T& item){
+		size_t head = myHead.load(std::memory_order_relaxed);
+		if (head == myTailSeen){
+			myTailSeen = myTail.load(std::memory_order_acquire);
+			if (head == myTailSeen){ return false; }
+		}
+		item = mySlots[head & (Capacity - 1)];
+		myHead.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+private:
+	//Consumer-owned line
+	alignas(64) std::atomic<size_t> myHead;
+	size_t myTailSeen;
+	//Producer-owned line
+	alignas(64) std::atomic<size_t> myTail;
+	size_t myHeadSeen;
+	alignas(64) T mySlots[Capacity];
+};
+
+}
+
+#endif
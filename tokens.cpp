@@ -1,3 +1,4 @@
+#include <utility>
 #include "tokens.hpp" // Get the class declarations
 #include "frontend.hh" // Get the TokenKind definitions
 
@@ -54,13 +55,15 @@ static std::string tokenKindString(int tokKind){
 	}
 }
 
-Token::Token(Position * posIn, int kindIn)
-  : myPos(posIn), myKind(kindIn){
+Token::Token(const Position * posIn, int kindIn)
+  : myPos(*posIn), myKind(kindIn){
 }
 
+Token::~Token(){ }
+
 std::string Token::toString(){
 	return tokenKindString(kind())
-	+ " " + myPos->begin();
+	+ " " + myPos.begin();
 }
 
 int Token::kind() const { 
@@ -68,42 +71,42 @@ int Token::kind() const {
 }
 
 const Position * Token::pos() const {
-	return myPos;
+	return &myPos;
 }
 
-IDToken::IDToken(Position * posIn, std::string vIn)
-  : Token(posIn, TokenKind::ID), myValue(vIn){ 
+IDToken::IDToken(const Position * posIn, std::string vIn)
+  : Token(posIn, TokenKind::ID), myValue(std::move(vIn)){ 
 }
 
 std::string IDToken::toString(){
 	return tokenKindString(kind()) + ":"
-	+ myValue + " " + myPos->begin();
+	+ myValue + " " + myPos.begin();
 }
 
-const std::string IDToken::value() const { 
+const std::string& IDToken::value() const { 
 	return this->myValue; 
 }
 
-StrToken::StrToken(Position * posIn, std::string sIn)
-  : Token(posIn, TokenKind::STRINGLITERAL), myStr(sIn){
+StrToken::StrToken(const Position * posIn, std::string sIn)
+  : Token(posIn, TokenKind::STRINGLITERAL), myStr(std::move(sIn)){
 }
 
 std::string StrToken::toString(){
 	return tokenKindString(kind()) + ":"
-	+ this->myStr + " " + myPos->begin();
+	+ this->myStr + " " + myPos.begin();
 }
 
-const std::string StrToken::str() const {
+const std::string& StrToken::str() const {
 	return this->myStr;
 }
 
-IntLitToken::IntLitToken(Position * pos, int numIn)
+IntLitToken::IntLitToken(const Position * pos, int numIn)
   : Token(pos, TokenKind::INTLITERAL), myNum(numIn){}
 
 std::string IntLitToken::toString(){
 	return tokenKindString(kind()) + ":"
 	+ std::to_string(this->myNum) + " "
-	+ myPos->begin();
+	+ myPos.begin();
 }
 
 int IntLitToken::num() const {
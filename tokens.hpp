@@ -8,22 +8,23 @@ namespace drewno_mars{
 
 class Token{
 public:
-	Token(Position * pos, int kindIn);
+	Token(const Position * pos, int kindIn);
+	virtual ~Token();
 	virtual std::string toString();
 	size_t line() const;
 	size_t col() const;
 	int kind() const;
 	const Position * pos() const;
 protected:
-	const Position * myPos;
+	const Position myPos;
 private:
 	const int myKind;
 };
 
 class IDToken : public Token{
 public:
-	IDToken(Position * posIn, std::string valIn);
-	const std::string value() const;
+	IDToken(const Position * posIn, std::string valIn);
+	const std::string& value() const;
 	virtual std::string toString() override;
 private:
 	const std::string myValue;
@@ -32,16 +33,16 @@ private:
 
 class StrToken : public Token{
 public:
-	StrToken(Position * posIn, std::string valIn);
+	StrToken(const Position * posIn, std::string valIn);
 	virtual std::string toString() override;
-	const std::string str() const;
+	const std::string& str() const;
 private:
 	const std::string myStr;
 };
 
 class IntLitToken : public Token{
 public:
-	IntLitToken(Position * posIn, int numIn);
+	IntLitToken(const Position * posIn, int numIn);
 	virtual std::string toString() override;
 	int num() const;
 private:
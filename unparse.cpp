@@ -1,6 +1,9 @@
+#include <atomic>
+#include <thread>
 #include "ast.hpp"
 #include "errors.hpp"
 #include "symbol_table.hpp"
+#include "visitor.hpp"
 
 namespace drewno_mars{
 
@@ -8,354 +11,447 @@ static void doIndent(std::ostream& out, int indent){
 	for (int k = 0 ; k < indent; k++){ out << "    "; }
 }
 
-void ProgramNode::unparse(std::ostream& out, int indent){
-	for (DeclNode * decl : *myGlobals){
-		decl->unparse(out, indent);
+//Writes nodes out as source. A frame's state is the indent of
+// its node: statements and declarations start on a new line,
+// indented that many levels, and end with one; expressions and
+// types are written inline (with indent 0). The -1 indent is
+// for statements written inline, as parts of others. Results
+// are unused.
+class Unparser : public AstMachine<Unparser, bool, int>{
+public:
+	Unparser(std::ostream& out) : myOut(out){ }
+
+	Next step(Frame& f, bool last){
+		switch (f.node->kind()){
+		case NodeKind::Program: return program(f);
+		case NodeKind::ClassDefn: return classDefn(f);
+		case NodeKind::VarDecl: return varDecl(f);
+		case NodeKind::FormalDecl: return formalDecl(f);
+		case NodeKind::FnDecl: return fnDecl(f);
+		case NodeKind::AssignStmt: return assignStmt(f);
+		case NodeKind::TakeStmt:
+			return prefixed(f, "take ",
+			  static_cast<TakeStmtNode *>(f.node)->getDst(), ";\n");
+		case NodeKind::GiveStmt:
+			return prefixed(f, "give ",
+			  static_cast<GiveStmtNode *>(f.node)->getSrc(), ";\n");
+		case NodeKind::ExitStmt:
+			doIndent(myOut, f.state);
+			myOut << "today I don't feel like doing any work";
+			myOut << ";\n";
+			return done();
+		case NodeKind::PostDecStmt:
+			return inlineStmt(f,
+			  static_cast<PostDecStmtNode *>(f.node)->getLoc(), "--");
+		case NodeKind::PostIncStmt:
+			return inlineStmt(f,
+			  static_cast<PostIncStmtNode *>(f.node)->getLoc(), "++");
+		case NodeKind::IfStmt: {
+			IfStmtNode * node = static_cast<IfStmtNode *>(f.node);
+			return block(f, "if (", node->getCond(), node->getBody());
+		}
+		case NodeKind::IfElseStmt: return ifElseStmt(f);
+		case NodeKind::WhileStmt: {
+			WhileStmtNode * node = static_cast<WhileStmtNode *>(f.node);
+			return block(f, "while (", node->getCond(), node->getBody());
+		}
+		case NodeKind::ReturnStmt: return returnStmt(f);
+		case NodeKind::CallStmt:
+			return inlineStmt(f,
+			  static_cast<CallStmtNode *>(f.node)->getCallExp(), "");
+		case NodeKind::CallExp: return callExp(f);
+		case NodeKind::MemberFieldExp: return memberFieldExp(f);
+		case NodeKind::Plus: return binary(f, " + ");
+		case NodeKind::Minus: return binary(f, " - ");
+		case NodeKind::Times: return binary(f, " * ");
+		case NodeKind::Divide: return binary(f, " / ");
+		case NodeKind::And: return binary(f, " and ");
+		case NodeKind::Or: return binary(f, " or ");
+		case NodeKind::Equals: return binary(f, " == ");
+		case NodeKind::NotEquals: return binary(f, " != ");
+		case NodeKind::Less: return binary(f, " < ");
+		case NodeKind::LessEq: return binary(f, " <= ");
+		case NodeKind::Greater: return binary(f, " > ");
+		case NodeKind::GreaterEq: return binary(f, " >= ");
+		case NodeKind::Neg: return unary(f, "-");
+		case NodeKind::Not: return unary(f, "!");
+		case NodeKind::ClassType:
+			return prefixed(f, "",
+			  static_cast<ClassTypeNode *>(f.node)->ID(), "");
+		case NodeKind::PerfectType:
+			return prefixed(f, "perfect ",
+			  static_cast<PerfectTypeNode *>(f.node)->getSub(), "");
+		case NodeKind::ID:
+		case NodeKind::VoidType: case NodeKind::IntType:
+		case NodeKind::BoolType:
+		case NodeKind::IntLit: case NodeKind::StrLit:
+		case NodeKind::True: case NodeKind::False: case NodeKind::Magic:
+			leaf(f.node, f.state, f.result);
+			return done();
+		case NodeKind::List: case NodeKind::KindCount:
+			break;
+		}
+		throw new InternalError("Unparsed a list as a node");
 	}
-}
 
-void VarDeclNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent); 
-	myID->unparse(out, 0);
-	out << " : ";
-	myType->unparse(out, 0);
-	if (myInit != nullptr){
-		out << " = ";
-		myInit->unparse(out, 0);
+	bool leaf(ASTNode * node, int indent, bool& result){
+		switch (node->kind()){
+		case NodeKind::ID: {
+			IDNode * id = static_cast<IDNode *>(node);
+			doIndent(myOut, indent);
+			myOut << id->getName();
+			if (id->getSymbol() != nullptr){
+				myOut << "{" << id->getSymbol()->getType() << "}";
+			}
+			return true;
+		}
+		case NodeKind::VoidType: return word(indent, "void");
+		case NodeKind::IntType: return word(indent, "int");
+		case NodeKind::BoolType: return word(indent, "bool");
+		case NodeKind::IntLit:
+			doIndent(myOut, indent);
+			myOut << static_cast<IntLitNode *>(node)->getNum();
+			return true;
+		case NodeKind::StrLit:
+			doIndent(myOut, indent);
+			myOut << static_cast<StrLitNode *>(node)->getStr();
+			return true;
+		case NodeKind::True: return word(indent, "true");
+		case NodeKind::False: return word(indent, "false");
+		case NodeKind::Magic: return word(indent, "24Kmagic");
+		default:
+			return false;
+		}
 	}
-	out << ";\n";
-}
-
-void ClassDefnNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myID->unparse(out, 0);
-	out << " : class {\n";
-	for(auto member : *myMembers){
-		member->unparse(out, indent+1);
-	}  
-	out << "};\n";
-}
-
-void FormalDeclNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent); 
-	ID()->unparse(out, 0);
-	out << " : ";
-	getTypeNode()->unparse(out, 0);
-}
 
-void FnDeclNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent); 
-	myID->unparse(out, 0);
-	out << " : ";
-	out << "(";
-	bool firstFormal = true;
-	for(auto formal : *myFormals){
-		if (firstFormal) { firstFormal = false; }
-		else { out << ", "; }
-		formal->unparse(out, 0);
+private:
+	Next program(Frame& f){
+		std::list<DeclNode *> * globals =
+		  static_cast<ProgramNode *>(f.node)->getGlobals();
+		if (f.step == 0){
+			f.start(globals);
+			f.step = 1;
+		}
+		if (DeclNode * decl = f.next(globals)){
+			return into(decl, f.state);
+		}
+		return done();
 	}
-	out << ") ";
-	myRetType->unparse(out, 0); 
-	out << " ";
-	out << " {\n";
-	for(auto stmt : *myBody){
-		stmt->unparse(out, indent+1);
-	}
-	doIndent(out, indent);
-	out << "}\n";
-}
-
-void AssignStmtNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myDst->unparse(out, 0);
-	out << " = ";
-	mySrc->unparse(out, 0);
-	out << ";\n";
-}
-
-void TakeStmtNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "take ";
-	myDst->unparse(out,0);
-	out << ";\n";
-}
-
-void MemberFieldExpNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myBase->unparse(out, 0);
-	out << "--";
-	myField->unparse(out, 0);
-}
-
-void GiveStmtNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "give ";
-	mySrc->unparse(out,0);
-	out << ";\n";
-}
-
-void ExitStmtNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "today I don't feel like doing any work";
-	out << ";\n";
-}
-
-void PostIncStmtNode::unparse(std::ostream& out, int indent){
-	if (indent != -1){ doIndent(out, indent); }
-	
-	this->myLoc->unparse(out,0);
-	out << "++";
-
-	if (indent != -1){ out << ";\n"; }
-}
-
-void PostDecStmtNode::unparse(std::ostream& out, int indent){
-	if (indent != -1){ doIndent(out, indent); }
-	this->myLoc->unparse(out,0);
-	out << "--";
-	if (indent != -1){ out << ";\n"; }
-}
 
-void IfStmtNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "if (";
-	myCond->unparse(out, 0);
-	out << "){\n";
-	for (auto stmt : *myBody){
-		stmt->unparse(out, indent + 1);
+	Next varDecl(Frame& f){
+		VarDeclNode * node = static_cast<VarDeclNode *>(f.node);
+		switch (f.step++){
+		case 0:
+			doIndent(myOut, f.state);
+			return into(node->ID());
+		case 1:
+			myOut << " : ";
+			return into(node->getTypeNode());
+		case 2:
+			if (node->getInit() != nullptr){
+				myOut << " = ";
+				return into(node->getInit());
+			}
+			break;
+		}
+		myOut << ";\n";
+		return done();
 	}
-	doIndent(out, indent);
-	out << "}\n";
-}
 
-void IfElseStmtNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "if (";
-	myCond->unparse(out, 0);
-	out << "){\n";
-	for (auto stmt : *myBodyTrue){
-		stmt->unparse(out, indent + 1);
-	}
-	doIndent(out, indent);
-	out << "} else {\n";
-	for (auto stmt : *myBodyFalse){
-		stmt->unparse(out, indent + 1);
+	Next classDefn(Frame& f){
+		ClassDefnNode * node = static_cast<ClassDefnNode *>(f.node);
+		if (f.step == 0){
+			doIndent(myOut, f.state);
+			f.step = 1;
+			return into(node->ID());
+		}
+		if (f.step == 1){
+			myOut << " : class {\n";
+			f.start(node->getMembers());
+			f.step = 2;
+		}
+		if (DeclNode * member = f.next(node->getMembers())){
+			return into(member, f.state + 1);
+		}
+		myOut << "};\n";
+		return done();
 	}
-	doIndent(out, indent);
-	out << "}\n";
-}
 
-void WhileStmtNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "while (";
-	myCond->unparse(out, 0);
-	out << "){\n";
-	for (auto stmt : *myBody){
-		stmt->unparse(out, indent + 1);
+	Next formalDecl(Frame& f){
+		FormalDeclNode * node = static_cast<FormalDeclNode *>(f.node);
+		switch (f.step++){
+		case 0:
+			doIndent(myOut, f.state);
+			return into(node->ID());
+		case 1:
+			myOut << " : ";
+			return into(node->getTypeNode());
+		}
+		return done();
 	}
-	doIndent(out, indent);
-	out << "}\n";
-}
 
-void ReturnStmtNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "return";
-	if (myExp != nullptr){
-		out << " ";
-		myExp->unparse(out, 0);
+	Next fnDecl(Frame& f){
+		FnDeclNode * node = static_cast<FnDeclNode *>(f.node);
+		if (f.step == 0){
+			doIndent(myOut, f.state);
+			f.step = 1;
+			return into(node->ID());
+		}
+		if (f.step == 1){
+			myOut << " : ";
+			myOut << "(";
+			f.start(node->getFormals());
+			f.step = 2;
+		}
+		if (f.step == 2){
+			if (f.taken > 0 && f.taken < node->getFormals()->size()){
+				myOut << ", ";
+			}
+			if (FormalDeclNode * formal = f.next(node->getFormals())){
+				return into(formal);
+			}
+			myOut << ") ";
+			f.step = 3;
+			return into(node->getTypeNode());
+		}
+		if (f.step == 3){
+			myOut << " ";
+			myOut << " {\n";
+			f.start(node->getBody());
+			f.step = 4;
+		}
+		if (StmtNode * stmt = f.next(node->getBody())){
+			return into(stmt, f.state + 1);
+		}
+		doIndent(myOut, f.state);
+		myOut << "}\n";
+		return done();
 	}
-	out << ";\n";
-}
 
-void CallStmtNode::unparse(std::ostream& out, int indent){
-	if (indent != -1){ doIndent(out, indent); }
-	myCallExp->unparse(out, 0);
-	if (indent != -1){ out << ";\n"; }
-}
-
-void ExpNode::unparseNested(std::ostream& out){
-	out << "(";
-	unparse(out, 0);
-	out << ")";
-}
-
-void CallExpNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myCallee->unparse(out, 0);
-	out << "(";
-	
-	bool firstArg = true;
-	for(auto arg : *myArgs){
-		if (firstArg) { firstArg = false; }
-		else { out << ", "; }
-		arg->unparse(out, 0);
+	Next assignStmt(Frame& f){
+		AssignStmtNode * node = static_cast<AssignStmtNode *>(f.node);
+		switch (f.step++){
+		case 0:
+			doIndent(myOut, f.state);
+			return into(node->getDst());
+		case 1:
+			myOut << " = ";
+			return into(node->getSrc());
+		}
+		myOut << ";\n";
+		return done();
 	}
-	out << ")";
-}
-void CallExpNode::unparseNested(std::ostream& out){
-	unparse(out, 0);
-}
 
-void MinusNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " - ";
-	myExp2->unparseNested(out);
-}
-
-void PlusNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " + ";
-	myExp2->unparseNested(out);
-}
-
-void TimesNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " * ";
-	myExp2->unparseNested(out);
-}
-
-void DivideNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " / ";
-	myExp2->unparseNested(out);
-}
-
-void AndNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " and ";
-	myExp2->unparseNested(out);
-}
-
-void OrNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " or ";
-	myExp2->unparseNested(out);
-}
-
-void EqualsNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " == ";
-	myExp2->unparseNested(out);
-}
-
-void NotEqualsNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " != ";
-	myExp2->unparseNested(out);
-}
-
-void GreaterNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " > ";
-	myExp2->unparseNested(out);
-}
-
-void GreaterEqNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " >= ";
-	myExp2->unparseNested(out);
-}
-
-void LessNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " < ";
-	myExp2->unparseNested(out);
-}
-
-void LessEqNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myExp1->unparseNested(out); 
-	out << " <= ";
-	myExp2->unparseNested(out);
-}
-
-void NotNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "!";
-	myExp->unparseNested(out); 
-}
-
-void NegNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "-";
-	myExp->unparseNested(out); 
-}
-
-void ClassTypeNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	myID->unparse(out, 0);
-}
-
-void PerfectTypeNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "perfect ";
-	mySub->unparse(out, 0);
-}
+	//Text, a child, then more text
+	Next prefixed(Frame& f, const char * text, ASTNode * child,
+	  const char * end){
+		if (f.step++ == 0){
+			doIndent(myOut, f.state);
+			myOut << text;
+			return into(child);
+		}
+		myOut << end;
+		return done();
+	}
 
+	//A statement that may be written inline (with indent -1)
+	Next inlineStmt(Frame& f, ASTNode * child, const char * suffix){
+		if (f.step++ == 0){
+			if (f.state != -1){ doIndent(myOut, f.state); }
+			return into(child);
+		}
+		myOut << suffix;
+		if (f.state != -1){ myOut << ";\n"; }
+		return done();
+	}
 
-void VoidTypeNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "void";
-}
+	//An if or while: a condition, then a body
+	Next block(Frame& f, const char * keyword, ExpNode * cond,
+	  std::list<StmtNode *> * body){
+		if (f.step == 0){
+			doIndent(myOut, f.state);
+			myOut << keyword;
+			f.step = 1;
+			return into(cond);
+		}
+		if (f.step == 1){
+			myOut << "){\n";
+			f.start(body);
+			f.step = 2;
+		}
+		if (StmtNode * stmt = f.next(body)){
+			return into(stmt, f.state + 1);
+		}
+		doIndent(myOut, f.state);
+		myOut << "}\n";
+		return done();
+	}
 
-void IntTypeNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "int";
-}
+	Next ifElseStmt(Frame& f){
+		IfElseStmtNode * node = static_cast<IfElseStmtNode *>(f.node);
+		if (f.step == 0){
+			doIndent(myOut, f.state);
+			myOut << "if (";
+			f.step = 1;
+			return into(node->getCond());
+		}
+		if (f.step == 1){
+			myOut << "){\n";
+			f.start(node->getBodyTrue());
+			f.step = 2;
+		}
+		if (f.step == 2){
+			if (StmtNode * stmt = f.next(node->getBodyTrue())){
+				return into(stmt, f.state + 1);
+			}
+			doIndent(myOut, f.state);
+			myOut << "} else {\n";
+			f.start(node->getBodyFalse());
+			f.step = 3;
+		}
+		if (StmtNode * stmt = f.next(node->getBodyFalse())){
+			return into(stmt, f.state + 1);
+		}
+		doIndent(myOut, f.state);
+		myOut << "}\n";
+		return done();
+	}
 
-void BoolTypeNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "bool";
-}
+	Next returnStmt(Frame& f){
+		ExpNode * exp = static_cast<ReturnStmtNode *>(f.node)->getExp();
+		if (f.step++ == 0){
+			doIndent(myOut, f.state);
+			myOut << "return";
+			if (exp != nullptr){
+				myOut << " ";
+				return into(exp);
+			}
+		}
+		myOut << ";\n";
+		return done();
+	}
 
-void IDNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << name;
-    if (getSymbol() != nullptr){
-        out << "{" << getSymbol()->getType() << "}";
-    }
-	//TODO: should add something here to print out the 
-	// symbol attached during name analysis
-}
+	Next callExp(Frame& f){
+		CallExpNode * node = static_cast<CallExpNode *>(f.node);
+		if (f.step == 0){
+			doIndent(myOut, f.state);
+			f.step = 1;
+			return into(node->getCallee());
+		}
+		if (f.step == 1){
+			myOut << "(";
+			f.start(node->getArgs());
+			f.step = 2;
+		}
+		if (f.taken > 0 && f.taken < node->getArgs()->size()){
+			myOut << ", ";
+		}
+		if (ExpNode * arg = f.next(node->getArgs())){
+			return into(arg);
+		}
+		myOut << ")";
+		return done();
+	}
 
-void IDNode::unparseNested(std::ostream& out){
-	this->unparse(out, 0);
-}
+	Next memberFieldExp(Frame& f){
+		MemberFieldExpNode * node = static_cast<MemberFieldExpNode *>(f.node);
+		switch (f.step++){
+		case 0:
+			doIndent(myOut, f.state);
+			return into(node->getBase());
+		case 1:
+			myOut << "--";
+			return into(node->getField());
+		}
+		return done();
+	}
 
-void FalseNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "false";
-}
+	bool word(int indent, const char * text){
+		doIndent(myOut, indent);
+		myOut << text;
+		return true;
+	}
 
-void MagicNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "24Kmagic";
-}
+	Next binary(Frame& f, const char * op){
+		BinaryExpNode * node = static_cast<BinaryExpNode *>(f.node);
+		switch (f.step++){
+		case 0:
+			doIndent(myOut, f.state);
+			return open(node->getExp1());
+		case 1:
+			close(node->getExp1());
+			myOut << op;
+			return open(node->getExp2());
+		}
+		close(node->getExp2());
+		return done();
+	}
 
-void IntLitNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << myNum;
-}
+	Next unary(Frame& f, const char * op){
+		UnaryExpNode * node = static_cast<UnaryExpNode *>(f.node);
+		if (f.step++ == 0){
+			doIndent(myOut, f.state);
+			myOut << op;
+			return open(node->getExp());
+		}
+		close(node->getExp());
+		return done();
+	}
 
-void StrLitNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << myStr;
-}
+	//An operand is parenthesised, unless it can't be split
+	static bool bare(ExpNode * exp){
+		switch (exp->kind()){
+		case NodeKind::ID: case NodeKind::CallExp:
+		case NodeKind::IntLit: case NodeKind::StrLit:
+		case NodeKind::True: case NodeKind::False: case NodeKind::Magic:
+			return true;
+		default:
+			return false;
+		}
+	}
+	Next open(ExpNode * exp){
+		if (!bare(exp)){ myOut << "("; }
+		return into(exp);
+	}
+	void close(ExpNode * exp){
+		if (!bare(exp)){ myOut << ")"; }
+	}
 
-void TrueNode::unparse(std::ostream& out, int indent){
-	doIndent(out, indent);
-	out << "true";
+	std::ostream& myOut;
+};
+
+void ASTNode::unparse(std::ostream& out, int indent){
+	Unparser(out).run(this, indent);
+}
+
+std::vector<std::string> ProgramNode::unparseGlobals(int indent,
+  unsigned int numThreads){
+	std::vector<DeclNode *> decls(myGlobals.begin(), myGlobals.end());
+	std::vector<std::string> buffers(decls.size());
+
+	//Unparsing only reads the tree (and the symbols attached
+	// to it), so workers can share it freely. Each worker
+	// claims the next unrendered global until none are left.
+	std::atomic<size_t> next(0);
+	auto worker = [&](){
+		size_t idx;
+		while ((idx = next++) < decls.size()){
+			std::ostringstream out;
+			decls[idx]->unparse(out, indent);
+			buffers[idx] = out.str();
+		}
+	};
+
+	if (numThreads > decls.size()){
+		numThreads = static_cast<unsigned int>(decls.size());
+	}
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < numThreads; i++){
+		pool.emplace_back(worker);
+	}
+	worker();
+	for (auto& t : pool){ t.join(); }
+	return buffers;
 }
 
 } //End namespace drewno_mars
@@ -0,0 +1,559 @@
+#ifndef DREWNO_MARS_VISITOR_HPP
+#define DREWNO_MARS_VISITOR_HPP
+
+#include <algorithm>
+#include <list>
+#include <vector>
+#include "ast.hpp"
+#include "errors.hpp"
+
+namespace drewno_mars{
+
+//A pass over the AST, written as a class Derived that inherits
+// AstVisitor<Derived, Result>. visit(node) calls Derived's
+// visit method for the node's class (visitPlus, visitIfStmt,
+// ...), found by the node's kind in a table made for Derived at
+// compile time. Nothing is virtual, so a node needs no method
+// for a pass, and Derived's methods are inlined into the
+// table's functions. A pass only needs methods for
+// the nodes it cares about: the rest fall back to the method
+// for their category (visitBinaryExp, visitUnaryExp, visitLoc,
+// visitExp, visitType, visitDecl, visitStmt), then visitNode,
+// which returns a default Result.
+template <typename Derived, typename Result = void>
+class AstVisitor{
+public:
+	Result visit(ASTNode * node){
+		return table()[static_cast<size_t>(node->kind())](self(), node);
+	}
+
+	//The fallbacks, most specific first
+	Result visitProgram(ProgramNode * node){ return self().visitNode(node); }
+	Result visitClassDefn(ClassDefnNode * node){ return self().visitDecl(node); }
+	Result visitVarDecl(VarDeclNode * node){ return self().visitDecl(node); }
+	Result visitFormalDecl(FormalDeclNode * node){
+		return self().visitVarDecl(node);
+	}
+	Result visitFnDecl(FnDeclNode * node){ return self().visitDecl(node); }
+	Result visitAssignStmt(AssignStmtNode * node){
+		return self().visitStmt(node);
+	}
+	Result visitTakeStmt(TakeStmtNode * node){ return self().visitStmt(node); }
+	Result visitGiveStmt(GiveStmtNode * node){ return self().visitStmt(node); }
+	Result visitExitStmt(ExitStmtNode * node){ return self().visitStmt(node); }
+	Result visitPostDecStmt(PostDecStmtNode * node){
+		return self().visitStmt(node);
+	}
+	Result visitPostIncStmt(PostIncStmtNode * node){
+		return self().visitStmt(node);
+	}
+	Result visitIfStmt(IfStmtNode * node){ return self().visitStmt(node); }
+	Result visitIfElseStmt(IfElseStmtNode * node){
+		return self().visitStmt(node);
+	}
+	Result visitWhileStmt(WhileStmtNode * node){ return self().visitStmt(node); }
+	Result visitReturnStmt(ReturnStmtNode * node){
+		return self().visitStmt(node);
+	}
+	Result visitCallStmt(CallStmtNode * node){ return self().visitStmt(node); }
+	Result visitCallExp(CallExpNode * node){ return self().visitExp(node); }
+	Result visitMemberFieldExp(MemberFieldExpNode * node){
+		return self().visitLoc(node);
+	}
+	Result visitID(IDNode * node){ return self().visitLoc(node); }
+	Result visitPlus(PlusNode * node){ return self().visitBinaryExp(node); }
+	Result visitMinus(MinusNode * node){ return self().visitBinaryExp(node); }
+	Result visitTimes(TimesNode * node){ return self().visitBinaryExp(node); }
+	Result visitDivide(DivideNode * node){ return self().visitBinaryExp(node); }
+	Result visitAnd(AndNode * node){ return self().visitBinaryExp(node); }
+	Result visitOr(OrNode * node){ return self().visitBinaryExp(node); }
+	Result visitEquals(EqualsNode * node){ return self().visitBinaryExp(node); }
+	Result visitNotEquals(NotEqualsNode * node){
+		return self().visitBinaryExp(node);
+	}
+	Result visitLess(LessNode * node){ return self().visitBinaryExp(node); }
+	Result visitLessEq(LessEqNode * node){ return self().visitBinaryExp(node); }
+	Result visitGreater(GreaterNode * node){
+		return self().visitBinaryExp(node);
+	}
+	Result visitGreaterEq(GreaterEqNode * node){
+		return self().visitBinaryExp(node);
+	}
+	Result visitNeg(NegNode * node){ return self().visitUnaryExp(node); }
+	Result visitNot(NotNode * node){ return self().visitUnaryExp(node); }
+	Result visitVoidType(VoidTypeNode * node){ return self().visitType(node); }
+	Result visitClassType(ClassTypeNode * node){ return self().visitType(node); }
+	Result visitPerfectType(PerfectTypeNode * node){
+		return self().visitType(node);
+	}
+	Result visitIntType(IntTypeNode * node){ return self().visitType(node); }
+	Result visitBoolType(BoolTypeNode * node){ return self().visitType(node); }
+	Result visitIntLit(IntLitNode * node){ return self().visitExp(node); }
+	Result visitStrLit(StrLitNode * node){ return self().visitExp(node); }
+	Result visitTrue(TrueNode * node){ return self().visitExp(node); }
+	Result visitFalse(FalseNode * node){ return self().visitExp(node); }
+	Result visitMagic(MagicNode * node){ return self().visitExp(node); }
+
+	Result visitDecl(DeclNode * node){ return self().visitStmt(node); }
+	Result visitStmt(StmtNode * node){ return self().visitNode(node); }
+	Result visitBinaryExp(BinaryExpNode * node){ return self().visitExp(node); }
+	Result visitUnaryExp(UnaryExpNode * node){ return self().visitExp(node); }
+	Result visitLoc(LocNode * node){ return self().visitExp(node); }
+	Result visitExp(ExpNode * node){ return self().visitNode(node); }
+	Result visitType(TypeNode * node){ return self().visitNode(node); }
+	Result visitNode(ASTNode * node){ return Result(); }
+
+protected:
+	Derived& self(){ return *static_cast<Derived *>(this); }
+
+private:
+	typedef Result (*Thunk)(Derived&, ASTNode *);
+	static const size_t KINDS = static_cast<size_t>(NodeKind::KindCount);
+
+	//Each kind's visit method gets a function of its own to be
+	// inlined into (a switch here would inline them all into
+	// one function, too big to recurse through cheaply), called
+	// through a table indexed by kind
+	static const Thunk * table(){
+		static const Thunk thunks[KINDS] = {
+			&noNode,
+			&onProgram,
+			&onClassDefn,
+			&onVarDecl,
+			&onFormalDecl,
+			&onFnDecl,
+			&onAssignStmt,
+			&onTakeStmt,
+			&onGiveStmt,
+			&onExitStmt,
+			&onPostDecStmt,
+			&onPostIncStmt,
+			&onIfStmt,
+			&onIfElseStmt,
+			&onWhileStmt,
+			&onReturnStmt,
+			&onCallStmt,
+			&onCallExp,
+			&onMemberFieldExp,
+			&onID,
+			&onPlus,
+			&onMinus,
+			&onTimes,
+			&onDivide,
+			&onAnd,
+			&onOr,
+			&onEquals,
+			&onNotEquals,
+			&onLess,
+			&onLessEq,
+			&onGreater,
+			&onGreaterEq,
+			&onNeg,
+			&onNot,
+			&onVoidType,
+			&onClassType,
+			&onPerfectType,
+			&onIntType,
+			&onBoolType,
+			&onIntLit,
+			&onStrLit,
+			&onTrue,
+			&onFalse,
+			&onMagic
+		};
+		return thunks;
+	}
+	static Result noNode(Derived& v, ASTNode * node){
+		throw new InternalError("Visited a list as a node");
+	}
+	static Result onProgram(Derived& v, ASTNode * node){
+		return v.visitProgram(static_cast<ProgramNode *>(node));
+	}
+	static Result onClassDefn(Derived& v, ASTNode * node){
+		return v.visitClassDefn(static_cast<ClassDefnNode *>(node));
+	}
+	static Result onVarDecl(Derived& v, ASTNode * node){
+		return v.visitVarDecl(static_cast<VarDeclNode *>(node));
+	}
+	static Result onFormalDecl(Derived& v, ASTNode * node){
+		return v.visitFormalDecl(static_cast<FormalDeclNode *>(node));
+	}
+	static Result onFnDecl(Derived& v, ASTNode * node){
+		return v.visitFnDecl(static_cast<FnDeclNode *>(node));
+	}
+	static Result onAssignStmt(Derived& v, ASTNode * node){
+		return v.visitAssignStmt(static_cast<AssignStmtNode *>(node));
+	}
+	static Result onTakeStmt(Derived& v, ASTNode * node){
+		return v.visitTakeStmt(static_cast<TakeStmtNode *>(node));
+	}
+	static Result onGiveStmt(Derived& v, ASTNode * node){
+		return v.visitGiveStmt(static_cast<GiveStmtNode *>(node));
+	}
+	static Result onExitStmt(Derived& v, ASTNode * node){
+		return v.visitExitStmt(static_cast<ExitStmtNode *>(node));
+	}
+	static Result onPostDecStmt(Derived& v, ASTNode * node){
+		return v.visitPostDecStmt(static_cast<PostDecStmtNode *>(node));
+	}
+	static Result onPostIncStmt(Derived& v, ASTNode * node){
+		return v.visitPostIncStmt(static_cast<PostIncStmtNode *>(node));
+	}
+	static Result onIfStmt(Derived& v, ASTNode * node){
+		return v.visitIfStmt(static_cast<IfStmtNode *>(node));
+	}
+	static Result onIfElseStmt(Derived& v, ASTNode * node){
+		return v.visitIfElseStmt(static_cast<IfElseStmtNode *>(node));
+	}
+	static Result onWhileStmt(Derived& v, ASTNode * node){
+		return v.visitWhileStmt(static_cast<WhileStmtNode *>(node));
+	}
+	static Result onReturnStmt(Derived& v, ASTNode * node){
+		return v.visitReturnStmt(static_cast<ReturnStmtNode *>(node));
+	}
+	static Result onCallStmt(Derived& v, ASTNode * node){
+		return v.visitCallStmt(static_cast<CallStmtNode *>(node));
+	}
+	static Result onCallExp(Derived& v, ASTNode * node){
+		return v.visitCallExp(static_cast<CallExpNode *>(node));
+	}
+	static Result onMemberFieldExp(Derived& v, ASTNode * node){
+		return v.visitMemberFieldExp(static_cast<MemberFieldExpNode *>(node));
+	}
+	static Result onID(Derived& v, ASTNode * node){
+		return v.visitID(static_cast<IDNode *>(node));
+	}
+	static Result onPlus(Derived& v, ASTNode * node){
+		return v.visitPlus(static_cast<PlusNode *>(node));
+	}
+	static Result onMinus(Derived& v, ASTNode * node){
+		return v.visitMinus(static_cast<MinusNode *>(node));
+	}
+	static Result onTimes(Derived& v, ASTNode * node){
+		return v.visitTimes(static_cast<TimesNode *>(node));
+	}
+	static Result onDivide(Derived& v, ASTNode * node){
+		return v.visitDivide(static_cast<DivideNode *>(node));
+	}
+	static Result onAnd(Derived& v, ASTNode * node){
+		return v.visitAnd(static_cast<AndNode *>(node));
+	}
+	static Result onOr(Derived& v, ASTNode * node){
+		return v.visitOr(static_cast<OrNode *>(node));
+	}
+	static Result onEquals(Derived& v, ASTNode * node){
+		return v.visitEquals(static_cast<EqualsNode *>(node));
+	}
+	static Result onNotEquals(Derived& v, ASTNode * node){
+		return v.visitNotEquals(static_cast<NotEqualsNode *>(node));
+	}
+	static Result onLess(Derived& v, ASTNode * node){
+		return v.visitLess(static_cast<LessNode *>(node));
+	}
+	static Result onLessEq(Derived& v, ASTNode * node){
+		return v.visitLessEq(static_cast<LessEqNode *>(node));
+	}
+	static Result onGreater(Derived& v, ASTNode * node){
+		return v.visitGreater(static_cast<GreaterNode *>(node));
+	}
+	static Result onGreaterEq(Derived& v, ASTNode * node){
+		return v.visitGreaterEq(static_cast<GreaterEqNode *>(node));
+	}
+	static Result onNeg(Derived& v, ASTNode * node){
+		return v.visitNeg(static_cast<NegNode *>(node));
+	}
+	static Result onNot(Derived& v, ASTNode * node){
+		return v.visitNot(static_cast<NotNode *>(node));
+	}
+	static Result onVoidType(Derived& v, ASTNode * node){
+		return v.visitVoidType(static_cast<VoidTypeNode *>(node));
+	}
+	static Result onClassType(Derived& v, ASTNode * node){
+		return v.visitClassType(static_cast<ClassTypeNode *>(node));
+	}
+	static Result onPerfectType(Derived& v, ASTNode * node){
+		return v.visitPerfectType(static_cast<PerfectTypeNode *>(node));
+	}
+	static Result onIntType(Derived& v, ASTNode * node){
+		return v.visitIntType(static_cast<IntTypeNode *>(node));
+	}
+	static Result onBoolType(Derived& v, ASTNode * node){
+		return v.visitBoolType(static_cast<BoolTypeNode *>(node));
+	}
+	static Result onIntLit(Derived& v, ASTNode * node){
+		return v.visitIntLit(static_cast<IntLitNode *>(node));
+	}
+	static Result onStrLit(Derived& v, ASTNode * node){
+		return v.visitStrLit(static_cast<StrLitNode *>(node));
+	}
+	static Result onTrue(Derived& v, ASTNode * node){
+		return v.visitTrue(static_cast<TrueNode *>(node));
+	}
+	static Result onFalse(Derived& v, ASTNode * node){
+		return v.visitFalse(static_cast<FalseNode *>(node));
+	}
+	static Result onMagic(Derived& v, ASTNode * node){
+		return v.visitMagic(static_cast<MagicNode *>(node));
+	}
+};
+
+//Call f on each of node's children, in source order, skipping
+// absent ones (a VarDecl's missing initializer, say)
+template <typename F>
+void forEachChild(ASTNode * node, F f){
+	auto each = [&f](auto * list){
+		for (auto * item : *list){ f(item); }
+	};
+	switch (node->kind()){
+	case NodeKind::Program:
+		each(static_cast<ProgramNode *>(node)->getGlobals());
+		break;
+	case NodeKind::ClassDefn: {
+		ClassDefnNode * cls = static_cast<ClassDefnNode *>(node);
+		f(cls->ID());
+		each(cls->getMembers());
+		break;
+	}
+	case NodeKind::VarDecl:
+	case NodeKind::FormalDecl: {
+		VarDeclNode * decl = static_cast<VarDeclNode *>(node);
+		f(decl->ID());
+		f(decl->getTypeNode());
+		if (decl->getInit() != nullptr){ f(decl->getInit()); }
+		break;
+	}
+	case NodeKind::FnDecl: {
+		FnDeclNode * fn = static_cast<FnDeclNode *>(node);
+		f(fn->ID());
+		each(fn->getFormals());
+		f(fn->getTypeNode());
+		each(fn->getBody());
+		break;
+	}
+	case NodeKind::AssignStmt:
+		f(static_cast<AssignStmtNode *>(node)->getDst());
+		f(static_cast<AssignStmtNode *>(node)->getSrc());
+		break;
+	case NodeKind::TakeStmt:
+		f(static_cast<TakeStmtNode *>(node)->getDst());
+		break;
+	case NodeKind::GiveStmt:
+		f(static_cast<GiveStmtNode *>(node)->getSrc());
+		break;
+	case NodeKind::PostDecStmt:
+		f(static_cast<PostDecStmtNode *>(node)->getLoc());
+		break;
+	case NodeKind::PostIncStmt:
+		f(static_cast<PostIncStmtNode *>(node)->getLoc());
+		break;
+	case NodeKind::IfStmt:
+		f(static_cast<IfStmtNode *>(node)->getCond());
+		each(static_cast<IfStmtNode *>(node)->getBody());
+		break;
+	case NodeKind::IfElseStmt:
+		f(static_cast<IfElseStmtNode *>(node)->getCond());
+		each(static_cast<IfElseStmtNode *>(node)->getBodyTrue());
+		each(static_cast<IfElseStmtNode *>(node)->getBodyFalse());
+		break;
+	case NodeKind::WhileStmt:
+		f(static_cast<WhileStmtNode *>(node)->getCond());
+		each(static_cast<WhileStmtNode *>(node)->getBody());
+		break;
+	case NodeKind::ReturnStmt: {
+		ExpNode * exp = static_cast<ReturnStmtNode *>(node)->getExp();
+		if (exp != nullptr){ f(exp); }
+		break;
+	}
+	case NodeKind::CallStmt:
+		f(static_cast<CallStmtNode *>(node)->getCallExp());
+		break;
+	case NodeKind::CallExp:
+		f(static_cast<CallExpNode *>(node)->getCallee());
+		each(static_cast<CallExpNode *>(node)->getArgs());
+		break;
+	case NodeKind::MemberFieldExp:
+		f(static_cast<MemberFieldExpNode *>(node)->getBase());
+		f(static_cast<MemberFieldExpNode *>(node)->getField());
+		break;
+	case NodeKind::Plus: case NodeKind::Minus:
+	case NodeKind::Times: case NodeKind::Divide:
+	case NodeKind::And: case NodeKind::Or:
+	case NodeKind::Equals: case NodeKind::NotEquals:
+	case NodeKind::Less: case NodeKind::LessEq:
+	case NodeKind::Greater: case NodeKind::GreaterEq:
+		f(static_cast<BinaryExpNode *>(node)->getExp1());
+		f(static_cast<BinaryExpNode *>(node)->getExp2());
+		break;
+	case NodeKind::Neg: case NodeKind::Not:
+		f(static_cast<UnaryExpNode *>(node)->getExp());
+		break;
+	case NodeKind::ClassType:
+		f(static_cast<ClassTypeNode *>(node)->ID());
+		break;
+	case NodeKind::PerfectType:
+		f(static_cast<PerfectTypeNode *>(node)->getSub());
+		break;
+	case NodeKind::ExitStmt: case NodeKind::ID:
+	case NodeKind::VoidType: case NodeKind::IntType: case NodeKind::BoolType:
+	case NodeKind::IntLit: case NodeKind::StrLit:
+	case NodeKind::True: case NodeKind::False: case NodeKind::Magic:
+	case NodeKind::List: case NodeKind::KindCount:
+		break;
+	}
+}
+
+//A walk over every node of a subtree, for passes that just
+// look at (or collect) nodes. Derived's pre(node) is called on
+// the way down and post(node) on the way back up, and may be
+// specialised per kind by switching on node->kind(). pre
+// returning false skips the node's children (but not its
+// post); calling stop() ends the walk as soon as the current
+// hook returns. The walk keeps its own stack, so the depth of
+// the tree is no limit.
+template <typename Derived>
+class AstWalker{
+public:
+	AstWalker() : myStopped(false){ }
+	//Returns false if the walk was stopped
+	bool walk(ASTNode * node){
+		//Each entry is a node still to enter, or (with up set)
+		// one whose children are done
+		struct Entry{ ASTNode * node; bool up; };
+		std::vector<Entry> stack;
+		stack.push_back({node, false});
+		while (!stack.empty() && !myStopped){
+			Entry top = stack.back();
+			stack.pop_back();
+			if (top.up){
+				self().post(top.node);
+				continue;
+			}
+			stack.push_back({top.node, true});
+			if (!self().pre(top.node)){ continue; }
+			size_t first = stack.size();
+			forEachChild(top.node, [&stack](ASTNode * child){
+				stack.push_back({child, false});
+			});
+			std::reverse(stack.begin() + static_cast<long>(first),
+			  stack.end());
+		}
+		return !myStopped;
+	}
+	void stop(){ myStopped = true; }
+	bool stopped() const{ return myStopped; }
+
+	bool pre(ASTNode * node){ return true; }
+	void post(ASTNode * node){ }
+
+protected:
+	Derived& self(){ return *static_cast<Derived *>(this); }
+private:
+	bool myStopped;
+};
+
+//A pass that has to do things between a node's children, not
+// just before and after them (open a scope once a condition is
+// done, say), but that mustn't recurse, so that no tree is too
+// deep for it. It runs on a stack of Frames of its own, one per
+// node it is part way through.
+//
+//Derived's step(frame, last) is called when a node is entered,
+// and again each time a child it asked for is done (last being
+// the child's result). Each call does what it can and returns
+// the next child to do, with into(child), or done() once the
+// node is finished and its frame's result is set. The frame's
+// step counts how far through the node the pass is, and is the
+// pass's to keep; State is anything else the pass needs per
+// node, like the indent for unparsing. Most nodes are leaves,
+// which Derived can deal with in leaf(node, state, result),
+// returning true, rather than have a frame made for them.
+template <typename Derived, typename Result, typename State = int>
+class AstMachine{
+public:
+	struct Frame{
+		Frame(ASTNode * nodeIn, State stateIn)
+		: node(nodeIn), step(0), result(), state(stateIn), taken(0){ }
+		ASTNode * node;
+		unsigned int step;
+		Result result;
+		State state;
+		//How many items next has given since start
+		size_t taken;
+
+		//Step through one of the node's lists: start(list),
+		// then next(list) until it gives null
+		template <typename T>
+		void start(std::list<T *> * list){
+			cursor(list) = list->begin();
+			taken = 0;
+		}
+		template <typename T>
+		T * next(std::list<T *> * list){
+			auto& at = cursor(list);
+			if (at == list->end()){ return nullptr; }
+			taken++;
+			return *at++;
+		}
+	private:
+		std::list<DeclNode *>::iterator& cursor(std::list<DeclNode *> *){
+			return myDecl;
+		}
+		std::list<FormalDeclNode *>::iterator& cursor(
+		  std::list<FormalDeclNode *> *){
+			return myFormal;
+		}
+		std::list<StmtNode *>::iterator& cursor(std::list<StmtNode *> *){
+			return myStmt;
+		}
+		std::list<ExpNode *>::iterator& cursor(std::list<ExpNode *> *){
+			return myExp;
+		}
+		std::list<DeclNode *>::iterator myDecl;
+		std::list<FormalDeclNode *>::iterator myFormal;
+		std::list<StmtNode *>::iterator myStmt;
+		std::list<ExpNode *>::iterator myExp;
+	};
+
+	//What step does next
+	struct Next{
+		ASTNode * child;
+		State state;
+	};
+
+	Result run(ASTNode * root, State state = State()){
+		myFrames.clear();
+		myFrames.emplace_back(root, state);
+		Result last = Result();
+		while (true){
+			Next next = self().step(myFrames.back(), last);
+			if (next.child != nullptr){
+				last = Result();
+				if (!self().leaf(next.child, next.state, last)){
+					myFrames.emplace_back(next.child, next.state);
+				}
+				continue;
+			}
+			last = myFrames.back().result;
+			myFrames.pop_back();
+			if (myFrames.empty()){ return last; }
+		}
+	}
+
+	bool leaf(ASTNode * node, const State& state, Result& result){
+		return false;
+	}
+
+	static Next into(ASTNode * child, State state = State()){
+		return {child, state};
+	}
+	static Next done(){ return {nullptr, State()}; }
+
+protected:
+	Derived& self(){ return *static_cast<Derived *>(this); }
+private:
+	std::vector<Frame> myFrames;
+};
+
+}
+
+#endif
@@ -0,0 +1,520 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include "errors.hpp"
+#include "stats.hpp"
+#include "vm.hpp"
+
+#if defined(__GNUC__) && !defined(DREWNO_MARS_SWITCH_DISPATCH)
+#define DREWNO_MARS_THREADED 1
+#else
+#define DREWNO_MARS_THREADED 0
+#endif
+
+namespace drewno_mars{
+
+//Every opcode, with how many operand words follow it (a call's
+// arguments come after its four)
+#define VM_OPS(X) \
+	X(Const, 2) X(Move, 2) X(Neg, 2) X(Not, 2) \
+	X(Add, 3) X(Sub, 3) X(Mul, 3) X(Div, 3) \
+	X(Eq, 3) X(Ne, 3) X(Lt, 3) X(Le, 3) X(Gt, 3) X(Ge, 3) \
+	X(LoadGlobal, 2) X(StoreGlobal, 2) X(GlobalAddr, 2) X(FrameAddr, 2) \
+	X(Field, 3) X(Load, 3) X(Store, 3) X(Copy, 3) X(Zero, 2) \
+	X(Call, 4) \
+	X(TakeInt, 1) X(TakeBool, 1) X(GiveInt, 1) X(GiveBool, 1) \
+	X(GiveStr, 1) X(Magic, 1) \
+	X(Jump, 1) X(BranchTrue, 2) X(BranchFalse, 2) \
+	X(JumpUnlessEq, 3) X(JumpUnlessNe, 3) X(JumpUnlessLt, 3) \
+	X(JumpUnlessLe, 3) X(JumpUnlessGt, 3) X(JumpUnlessGe, 3) \
+	X(Return, 1) X(ReturnVoid, 0) X(Exit, 0)
+
+#define VM_ENUM(name, operands) name,
+enum class VmOp : uint32_t{ VM_OPS(VM_ENUM) OpCount };
+#undef VM_ENUM
+
+#define VM_OPERANDS(name, operands) operands,
+static const uint32_t vmOperands[] = { VM_OPS(VM_OPERANDS) };
+#undef VM_OPERANDS
+
+//The most slots the stack of frames may use, and the deepest
+// calls may go
+static const size_t STACK_SLOTS = size_t(1) << 23;
+static const size_t MAX_CALLS = size_t(1) << 20;
+
+static uint32_t word(VmOp op){ return static_cast<uint32_t>(op); }
+
+//The fused compare-and-branch that jumps unless cmp holds,
+// or unless its opposite does
+static VmOp jumpUnless(IrOp cmp, bool opposite){
+	switch (cmp){
+	case IrOp::Eq: return opposite ? VmOp::JumpUnlessNe : VmOp::JumpUnlessEq;
+	case IrOp::Ne: return opposite ? VmOp::JumpUnlessEq : VmOp::JumpUnlessNe;
+	case IrOp::Lt: return opposite ? VmOp::JumpUnlessGe : VmOp::JumpUnlessLt;
+	case IrOp::Le: return opposite ? VmOp::JumpUnlessGt : VmOp::JumpUnlessLe;
+	case IrOp::Gt: return opposite ? VmOp::JumpUnlessLe : VmOp::JumpUnlessGt;
+	default: return opposite ? VmOp::JumpUnlessLt : VmOp::JumpUnlessGe;
+	}
+}
+
+static VmOp vmOp(IrOp op){
+	switch (op){
+	case IrOp::Const: return VmOp::Const;
+	case IrOp::Move: return VmOp::Move;
+	case IrOp::Neg: return VmOp::Neg;
+	case IrOp::Not: return VmOp::Not;
+	case IrOp::Add: return VmOp::Add;
+	case IrOp::Sub: return VmOp::Sub;
+	case IrOp::Mul: return VmOp::Mul;
+	case IrOp::Div: return VmOp::Div;
+	case IrOp::Eq: return VmOp::Eq;
+	case IrOp::Ne: return VmOp::Ne;
+	case IrOp::Lt: return VmOp::Lt;
+	case IrOp::Le: return VmOp::Le;
+	case IrOp::Gt: return VmOp::Gt;
+	case IrOp::Ge: return VmOp::Ge;
+	case IrOp::LoadGlobal: return VmOp::LoadGlobal;
+	case IrOp::StoreGlobal: return VmOp::StoreGlobal;
+	case IrOp::GlobalAddr: return VmOp::GlobalAddr;
+	case IrOp::FrameAddr: return VmOp::FrameAddr;
+	case IrOp::Field: return VmOp::Field;
+	case IrOp::Load: return VmOp::Load;
+	case IrOp::Store: return VmOp::Store;
+	case IrOp::Copy: return VmOp::Copy;
+	case IrOp::Zero: return VmOp::Zero;
+	case IrOp::TakeInt: return VmOp::TakeInt;
+	case IrOp::TakeBool: return VmOp::TakeBool;
+	case IrOp::GiveInt: return VmOp::GiveInt;
+	case IrOp::GiveBool: return VmOp::GiveBool;
+	case IrOp::GiveStr: return VmOp::GiveStr;
+	case IrOp::Magic: return VmOp::Magic;
+	default:
+		throw new InternalError("No bytecode for an IR instruction");
+	}
+}
+
+Vm::Vm(const IrModule& module)
+: myStrings(module.strings), myGlobalSlots(module.globalSlots),
+  myStart(module.start), myExecuted(0){
+	myFunctions.resize(module.functions.size());
+	for (uint32_t i = 0; i < module.functions.size(); i++){
+		compile(module, i);
+	}
+	myCode.shrink_to_fit();
+}
+
+void Vm::compile(const IrModule& module, uint32_t index){
+	const IrFunction& fn = module.functions[index];
+	uint32_t frameSize = fn.regs + fn.frameSlots;
+	myFunctions[index] = {static_cast<uint32_t>(myCode.size()), frameSize};
+
+	//How often each register is read, so that a compare only a
+	// branch reads can be fused into it
+	std::vector<uint32_t> reads = readCounts(fn);
+
+	std::vector<uint32_t> blockAt(fn.blocks.size());
+	//Words to be set to where a block starts, once it's known
+	std::vector<std::pair<size_t, uint32_t>> fixups;
+	auto target = [&](uint32_t block){
+		fixups.push_back(std::make_pair(myCode.size(), block));
+		myCode.push_back(0);
+	};
+	for (uint32_t b = 0; b < fn.blocks.size(); b++){
+		blockAt[b] = static_cast<uint32_t>(myCode.size());
+		const IrBlock& block = fn.blocks[b];
+		const IrInstr& term = fn.code[block.end - 1];
+		uint32_t end = block.end - 1;
+		const IrInstr * cmp = nullptr;
+		if (term.op == IrOp::Branch && end > block.first){
+			const IrInstr& before = fn.code[end - 1];
+			if (isCompare(before.op) && before.dst == term.a
+			  && reads[term.a] == 1){
+				cmp = &before;
+				end--;
+			}
+		}
+		for (uint32_t i = block.first; i < end; i++){
+			const IrInstr& in = fn.code[i];
+			switch (in.op){
+			case IrOp::StoreGlobal:
+				myCode.insert(myCode.end(), {word(VmOp::StoreGlobal), in.a, in.b});
+				break;
+			case IrOp::Store: case IrOp::Copy:
+				myCode.insert(myCode.end(), {word(vmOp(in.op)), in.a, in.b, in.c});
+				break;
+			case IrOp::Zero:
+				myCode.insert(myCode.end(), {word(VmOp::Zero), in.a, in.b});
+				break;
+			case IrOp::FrameAddr:
+				myCode.insert(myCode.end(),
+				  {word(VmOp::FrameAddr), in.dst, fn.regs + in.a});
+				break;
+			case IrOp::Call:
+				myCode.insert(myCode.end(),
+				  {word(VmOp::Call), in.dst, in.a, frameSize, in.c});
+				myCode.insert(myCode.end(), fn.args.begin() + in.b,
+				  fn.args.begin() + in.b + in.c);
+				break;
+			case IrOp::GiveInt: case IrOp::GiveBool: case IrOp::GiveStr:
+				myCode.insert(myCode.end(), {word(vmOp(in.op)), in.a});
+				break;
+			case IrOp::TakeInt: case IrOp::TakeBool: case IrOp::Magic:
+				myCode.insert(myCode.end(), {word(vmOp(in.op)), in.dst});
+				break;
+			default:
+				myCode.insert(myCode.end(), {word(vmOp(in.op)), in.dst, in.a});
+				if (vmOperands[word(vmOp(in.op))] == 3){ myCode.push_back(in.b); }
+				break;
+			}
+		}
+
+		uint32_t next = b + 1;
+		switch (term.op){
+		case IrOp::Jump:
+			if (term.a != next){
+				myCode.push_back(word(VmOp::Jump));
+				target(term.a);
+			}
+			break;
+		case IrOp::Branch:
+			if (cmp != nullptr){
+				bool flip = term.c == next;
+				myCode.insert(myCode.end(),
+				  {word(jumpUnless(cmp->op, flip)), cmp->a, cmp->b});
+				target(flip ? term.b : term.c);
+				if (term.b != next && term.c != next){
+					myCode.push_back(word(VmOp::Jump));
+					target(term.b);
+				}
+			} else if (term.b == next){
+				myCode.insert(myCode.end(), {word(VmOp::BranchFalse), term.a});
+				target(term.c);
+			} else {
+				myCode.insert(myCode.end(), {word(VmOp::BranchTrue), term.a});
+				target(term.b);
+				if (term.c != next){
+					myCode.push_back(word(VmOp::Jump));
+					target(term.c);
+				}
+			}
+			break;
+		case IrOp::Return:
+			if (term.a == IR_NONE){
+				myCode.push_back(word(VmOp::ReturnVoid));
+			} else {
+				myCode.insert(myCode.end(), {word(VmOp::Return), term.a});
+			}
+			break;
+		case IrOp::Exit:
+			myCode.push_back(word(VmOp::Exit));
+			break;
+		default:
+			throw new InternalError("A block without a terminator");
+		}
+	}
+	for (auto& fixup : fixups){
+		myCode[fixup.first] = blockAt[fixup.second];
+	}
+}
+
+//The state of one run: the stack of frames (and the calls that
+// made them), the globals, and the program's input and output
+class Vm::Runner{
+public:
+	Runner(Vm& vm, std::istream& in, std::ostream& out)
+	: myVm(vm), myStack(new int64_t[STACK_SLOTS]),
+	  myGlobals(vm.myGlobalSlots + 1, 0), myIn(in), myOut(out),
+	  myMagic(0x2545f491){ }
+
+	template <bool Count>
+	int execute();
+
+private:
+	struct CallRecord{
+		const uint32_t * pc;
+		int64_t * fp;
+		uint32_t dst;
+	};
+
+	static int64_t wrap(uint64_t val){
+		return static_cast<int32_t>(static_cast<uint32_t>(val));
+	}
+
+	int64_t take(){
+		std::string token;
+		if (!(myIn >> token)){ return 0; }
+		if (token == "true"){ return 1; }
+		if (token == "false"){ return 0; }
+		return wrap(static_cast<uint64_t>(strtoll(token.c_str(), nullptr, 10)));
+	}
+
+	void give(int64_t val){
+		char buf[24];
+		char * at = buf + sizeof(buf);
+		uint64_t mag = val < 0 ? 0 - static_cast<uint64_t>(val)
+		  : static_cast<uint64_t>(val);
+		do {
+			*--at = static_cast<char>('0' + mag % 10);
+			mag /= 10;
+		} while (mag != 0);
+		if (val < 0){ *--at = '-'; }
+		myOut.write(at, buf + sizeof(buf) - at);
+	}
+
+	bool magic(){
+		myMagic ^= myMagic << 13;
+		myMagic ^= myMagic >> 17;
+		myMagic ^= myMagic << 5;
+		return (myMagic & 1) != 0;
+	}
+
+	int fail(const char * msg){
+		myOut.flush();
+		std::cerr << "Runtime error: " << msg << std::endl;
+		return 1;
+	}
+
+	Vm& myVm;
+	std::unique_ptr<int64_t[]> myStack;
+	std::vector<int64_t> myGlobals;
+	std::vector<CallRecord> myCalls;
+	std::istream& myIn;
+	std::ostream& myOut;
+	uint32_t myMagic;
+};
+
+#if DREWNO_MARS_THREADED
+//Computed gotos (and label addresses) are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+template <bool Count>
+int Vm::Runner::execute(){
+#if DREWNO_MARS_THREADED
+	//Thread a copy of the code: each opcode word becomes how far
+	// its handler is from the first one's
+#define VM_OFFSET(name, operands) static_cast<int32_t>( \
+	  static_cast<char *>(&&op_##name) - static_cast<char *>(&&op_Const)),
+	static const int32_t offsets[] = { VM_OPS(VM_OFFSET) };
+#undef VM_OFFSET
+	char * const base = static_cast<char *>(&&op_Const);
+	std::vector<uint32_t> threaded = myVm.myCode;
+	for (size_t i = 0; i < threaded.size(); ){
+		uint32_t op = threaded[i];
+		size_t length = 1 + vmOperands[op];
+		if (op == word(VmOp::Call)){ length += threaded[i + 4]; }
+		threaded[i] = static_cast<uint32_t>(offsets[op]);
+		i += length;
+	}
+	const uint32_t * const code = threaded.data();
+#define VM_NEXT goto *(base + static_cast<int32_t>(*pc))
+#else
+	const uint32_t * const code = myVm.myCode.data();
+#define VM_NEXT goto dispatch
+#endif
+#define VM_COUNT if (Count){ executed++; }
+#define VM_STEP(operands) pc += (operands) + 1; VM_COUNT VM_NEXT
+#define VM_BINARY(name, expr) op_##name: { \
+	  int64_t a = fp[pc[2]]; \
+	  int64_t b = fp[pc[3]]; \
+	  fp[pc[1]] = (expr); \
+	  VM_STEP(3); }
+#define VM_JUMP_UNLESS(name, cmp) op_##name: \
+	  VM_COUNT \
+	  if (fp[pc[1]] cmp fp[pc[2]]){ \
+		  pc += 4; \
+	  } else { \
+		  pc = code + pc[3]; \
+	  } \
+	  VM_NEXT;
+
+	uint64_t executed = 0;
+	const Function * const fns = myVm.myFunctions.data();
+	int64_t * const stackEnd = myStack.get() + STACK_SLOTS;
+	int64_t * const globals = myGlobals.data();
+	myCalls.reserve(1024);
+	int64_t * fp = myStack.get();
+	const uint32_t * pc = code + fns[myVm.myStart].entry;
+	int status = 0;
+	if (fns[myVm.myStart].frameSize > STACK_SLOTS){
+		return fail("Stack overflow");
+	}
+	VM_NEXT;
+
+#if !DREWNO_MARS_THREADED
+dispatch:
+	switch (static_cast<VmOp>(*pc)){
+#define VM_CASE(name, operands) case VmOp::name: goto op_##name;
+	VM_OPS(VM_CASE)
+#undef VM_CASE
+	case VmOp::OpCount: break;
+	}
+	throw new InternalError("Bad bytecode");
+#endif
+
+op_Const:
+	fp[pc[1]] = static_cast<int32_t>(pc[2]);
+	VM_STEP(2);
+op_Move:
+	fp[pc[1]] = fp[pc[2]];
+	VM_STEP(2);
+op_Neg:
+	fp[pc[1]] = wrap(0 - static_cast<uint64_t>(fp[pc[2]]));
+	VM_STEP(2);
+op_Not:
+	fp[pc[1]] = fp[pc[2]] == 0;
+	VM_STEP(2);
+	VM_BINARY(Add, wrap(static_cast<uint64_t>(a) + static_cast<uint64_t>(b)))
+	VM_BINARY(Sub, wrap(static_cast<uint64_t>(a) - static_cast<uint64_t>(b)))
+	VM_BINARY(Mul, wrap(static_cast<uint64_t>(a) * static_cast<uint64_t>(b)))
+op_Div: {
+	int64_t a = fp[pc[2]];
+	int64_t b = fp[pc[3]];
+	if (b == 0){
+		status = fail("Division by zero");
+		goto finish;
+	}
+	//The one quotient that doesn't fit wraps back round
+	fp[pc[1]] = wrap(static_cast<uint64_t>(a / b));
+	VM_STEP(3);
+}
+	VM_BINARY(Eq, a == b)
+	VM_BINARY(Ne, a != b)
+	VM_BINARY(Lt, a < b)
+	VM_BINARY(Le, a <= b)
+	VM_BINARY(Gt, a > b)
+	VM_BINARY(Ge, a >= b)
+op_LoadGlobal:
+	fp[pc[1]] = globals[pc[2]];
+	VM_STEP(2);
+op_StoreGlobal:
+	globals[pc[1]] = fp[pc[2]];
+	VM_STEP(2);
+op_GlobalAddr:
+	fp[pc[1]] = reinterpret_cast<int64_t>(globals + pc[2]);
+	VM_STEP(2);
+op_FrameAddr:
+	fp[pc[1]] = reinterpret_cast<int64_t>(fp + pc[2]);
+	VM_STEP(2);
+op_Field:
+	fp[pc[1]] = reinterpret_cast<int64_t>(
+	  reinterpret_cast<int64_t *>(fp[pc[2]]) + pc[3]);
+	VM_STEP(3);
+op_Load:
+	fp[pc[1]] = reinterpret_cast<int64_t *>(fp[pc[2]])[pc[3]];
+	VM_STEP(3);
+op_Store:
+	reinterpret_cast<int64_t *>(fp[pc[1]])[pc[2]] = fp[pc[3]];
+	VM_STEP(3);
+op_Copy:
+	memmove(reinterpret_cast<int64_t *>(fp[pc[1]]),
+	  reinterpret_cast<int64_t *>(fp[pc[2]]), sizeof(int64_t) * pc[3]);
+	VM_STEP(3);
+op_Zero:
+	memset(reinterpret_cast<int64_t *>(fp[pc[1]]), 0,
+	  sizeof(int64_t) * pc[2]);
+	VM_STEP(2);
+op_Call: {
+	const Function& callee = fns[pc[2]];
+	int64_t * callFp = fp + pc[3];
+	if (callFp + callee.frameSize > stackEnd || myCalls.size() >= MAX_CALLS){
+		status = fail("Stack overflow");
+		goto finish;
+	}
+	uint32_t count = pc[4];
+	for (uint32_t i = 0; i < count; i++){ callFp[i] = fp[pc[5 + i]]; }
+	myCalls.push_back({pc + 5 + count, fp, pc[1]});
+	fp = callFp;
+	pc = code + callee.entry;
+	VM_COUNT
+	VM_NEXT;
+}
+op_TakeInt:
+	fp[pc[1]] = take();
+	VM_STEP(1);
+op_TakeBool:
+	fp[pc[1]] = take() != 0;
+	VM_STEP(1);
+op_GiveInt:
+	give(fp[pc[1]]);
+	VM_STEP(1);
+op_GiveBool:
+	myOut << (fp[pc[1]] != 0 ? "true" : "false");
+	VM_STEP(1);
+op_GiveStr:
+	myOut << myVm.myStrings[pc[1]];
+	VM_STEP(1);
+op_Magic:
+	fp[pc[1]] = magic();
+	VM_STEP(1);
+op_Jump:
+	pc = code + pc[1];
+	VM_COUNT
+	VM_NEXT;
+op_BranchTrue:
+	VM_COUNT
+	pc = fp[pc[1]] != 0 ? code + pc[2] : pc + 3;
+	VM_NEXT;
+op_BranchFalse:
+	VM_COUNT
+	pc = fp[pc[1]] == 0 ? code + pc[2] : pc + 3;
+	VM_NEXT;
+	VM_JUMP_UNLESS(JumpUnlessEq, ==)
+	VM_JUMP_UNLESS(JumpUnlessNe, !=)
+	VM_JUMP_UNLESS(JumpUnlessLt, <)
+	VM_JUMP_UNLESS(JumpUnlessLe, <=)
+	VM_JUMP_UNLESS(JumpUnlessGt, >)
+	VM_JUMP_UNLESS(JumpUnlessGe, >=)
+op_Return: {
+	VM_COUNT
+	if (myCalls.empty()){ goto finish; }
+	int64_t val = fp[pc[1]];
+	const CallRecord& call = myCalls.back();
+	fp = call.fp;
+	pc = call.pc;
+	if (call.dst != IR_NONE){ fp[call.dst] = val; }
+	myCalls.pop_back();
+	VM_NEXT;
+}
+op_ReturnVoid: {
+	VM_COUNT
+	if (myCalls.empty()){ goto finish; }
+	const CallRecord& call = myCalls.back();
+	fp = call.fp;
+	pc = call.pc;
+	myCalls.pop_back();
+	VM_NEXT;
+}
+op_Exit:
+	VM_COUNT
+	goto finish;
+
+finish:
+	myOut.flush();
+	myVm.myExecuted = executed;
+	return status;
+
+#undef VM_NEXT
+#undef VM_COUNT
+#undef VM_STEP
+#undef VM_BINARY
+#undef VM_JUMP_UNLESS
+}
+
+#if DREWNO_MARS_THREADED
+#pragma GCC diagnostic pop
+#endif
+
+int Vm::run(std::istream& in, std::ostream& out){
+	Runner runner(*this, in, out);
+	if (Stats::enabled()){ return runner.execute<true>(); }
+	return runner.execute<false>();
+}
+
+const char * Vm::dispatch(){
+	return DREWNO_MARS_THREADED ? "direct-threaded" : "switch";
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef DREWNO_MARS_VM_HPP
+#define DREWNO_MARS_VM_HPP
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ir.hpp"
+
+//The bytecode interpreter (dmc -r). A module's functions are
+// compiled into one array of 32-bit words: each instruction is
+// an opcode word and a fixed number of operand words (a call's
+// arguments follow it), and operands name registers by their
+// offset from the frame pointer. A frame holds its function's
+// registers and then its objects, on a stack of 64-bit slots.
+//
+//Dispatch is direct-threaded where the compiler has computed
+// gotos (each opcode word is replaced by the distance of its
+// handler from the first), and otherwise a switch; building with
+// DREWNO_MARS_SWITCH_DISPATCH defined forces the switch.
+namespace drewno_mars{
+
+class Vm{
+public:
+	explicit Vm(const IrModule& module);
+	//Run the program, taking from in and giving to out. Returns
+	// dmc's exit status: 1 after a runtime error (reported on
+	// std::cerr), else 0.
+	int run(std::istream& in, std::ostream& out);
+	//How many instructions the last run executed (counted only
+	// while Stats are enabled)
+	uint64_t executed() const{ return myExecuted; }
+	size_t codeWords() const{ return myCode.size(); }
+	static const char * dispatch();
+
+private:
+	struct Function{
+		uint32_t entry;
+		uint32_t frameSize;
+	};
+	class Runner;
+	void compile(const IrModule& module, uint32_t index);
+
+	std::vector<uint32_t> myCode;
+	std::vector<Function> myFunctions;
+	std::vector<std::string> myStrings;
+	uint32_t myGlobalSlots;
+	uint32_t myStart;
+	uint64_t myExecuted;
+};
+
+}
+
+#endif
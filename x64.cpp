@@ -0,0 +1,642 @@
+#include <cctype>
+#include "errors.hpp"
+#include "stats.hpp"
+#include "x64.hpp"
+
+namespace drewno_mars{
+
+//Where the first six arguments go
+static const char * const ARG_REGS[] = {
+	"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"
+};
+static const uint32_t ARG_REG_COUNT = 6;
+
+//The registers values are allocated to, caller-saved ones
+// first. rax, rcx, rdx, rsi and rdi are left for scratch, and
+// no value is given an argument register.
+struct MachineReg{
+	const char * full;
+	const char * low;
+};
+static const MachineReg MACHINE_REGS[] = {
+	{"%r10", "%r10d"}, {"%r11", "%r11d"},
+	{"%rbx", "%ebx"}, {"%r12", "%r12d"}, {"%r13", "%r13d"},
+	{"%r14", "%r14d"}, {"%r15", "%r15d"}
+};
+static const uint32_t CALLER_SAVED = 2;
+static const uint32_t CALLEE_SAVED = 5;
+
+//Objects of up to this many slots are copied and zeroed inline
+static const uint32_t INLINE_SLOTS = 8;
+
+//The runtime, after the functions: what take, give, exit, 24Kmagic
+// and the runtime errors call. Each of these is only ever called
+// (or, for the errors, jumped to) with the stack 16-byte aligned.
+static const char RUNTIME[] = R"(
+dm_take:
+	subq	$72, %rsp
+	leaq	.Ldm_token(%rip), %rdi
+	movq	%rsp, %rsi
+	xorl	%eax, %eax
+	call	scanf@PLT
+	cmpl	$1, %eax
+	jne	2f
+	movq	%rsp, %rdi
+	leaq	.Ldm_true(%rip), %rsi
+	call	strcmp@PLT
+	testl	%eax, %eax
+	je	3f
+	movq	%rsp, %rdi
+	leaq	.Ldm_false(%rip), %rsi
+	call	strcmp@PLT
+	testl	%eax, %eax
+	je	2f
+	movq	%rsp, %rdi
+	xorl	%esi, %esi
+	movl	$10, %edx
+	call	strtoll@PLT
+	jmp	1f
+2:	xorl	%eax, %eax
+	jmp	1f
+3:	movl	$1, %eax
+1:	addq	$72, %rsp
+	ret
+
+dm_give_int:
+	subq	$8, %rsp
+	movl	%edi, %esi
+	leaq	.Ldm_int(%rip), %rdi
+	xorl	%eax, %eax
+	call	printf@PLT
+	addq	$8, %rsp
+	ret
+
+dm_give_bool:
+	leaq	.Ldm_true(%rip), %rsi
+	leaq	.Ldm_false(%rip), %rax
+	testl	%edi, %edi
+	cmove	%rax, %rsi
+	jmp	1f
+dm_give_str:
+	movq	%rdi, %rsi
+1:	subq	$8, %rsp
+	leaq	.Ldm_str(%rip), %rdi
+	xorl	%eax, %eax
+	call	printf@PLT
+	addq	$8, %rsp
+	ret
+
+dm_magic:
+	movl	dm_magic_state(%rip), %eax
+	movl	%eax, %ecx
+	shll	$13, %ecx
+	xorl	%ecx, %eax
+	movl	%eax, %ecx
+	shrl	$17, %ecx
+	xorl	%ecx, %eax
+	movl	%eax, %ecx
+	shll	$5, %ecx
+	xorl	%ecx, %eax
+	movl	%eax, dm_magic_state(%rip)
+	andl	$1, %eax
+	ret
+
+dm_exit:
+	subq	$8, %rsp
+	xorl	%edi, %edi
+	call	exit@PLT
+
+dm_div_zero:
+	leaq	.Ldm_div_zero(%rip), %rbx
+	jmp	dm_fail
+dm_stack_overflow:
+	leaq	.Ldm_stack_overflow(%rip), %rbx
+dm_fail:
+	andq	$-16, %rsp
+	xorl	%edi, %edi
+	call	fflush@PLT
+	movl	$2, %edi
+	leaq	.Ldm_fail(%rip), %rsi
+	movq	%rbx, %rdx
+	xorl	%eax, %eax
+	call	dprintf@PLT
+	movl	$1, %edi
+	call	exit@PLT
+
+	.section	.rodata
+.Ldm_token:
+	.string	"%63s"
+.Ldm_int:
+	.string	"%d"
+.Ldm_str:
+	.string	"%s"
+.Ldm_true:
+	.string	"true"
+.Ldm_false:
+	.string	"false"
+.Ldm_fail:
+	.string	"Runtime error: %s\n"
+.Ldm_div_zero:
+	.string	"Division by zero"
+.Ldm_stack_overflow:
+	.string	"Stack overflow"
+
+	.data
+	.align	4
+dm_magic_state:
+	.long	0x2545f491
+)";
+
+//The condition code under which cmp holds, or fails
+static const char * condition(IrOp cmp, bool negate){
+	switch (cmp){
+	case IrOp::Eq: return negate ? "ne" : "e";
+	case IrOp::Ne: return negate ? "e" : "ne";
+	case IrOp::Lt: return negate ? "ge" : "l";
+	case IrOp::Le: return negate ? "g" : "le";
+	case IrOp::Gt: return negate ? "le" : "g";
+	default: return negate ? "l" : "ge";
+	}
+}
+
+static const char * arithmetic(IrOp op){
+	switch (op){
+	case IrOp::Add: return "addl";
+	case IrOp::Sub: return "subl";
+	default: return "imull";
+	}
+}
+
+static void writeString(std::ostream& out, const std::string& str){
+	static const char digits[] = "01234567";
+	out << '"';
+	for (char c : str){
+		unsigned char byte = static_cast<unsigned char>(c);
+		if (c == '"' || c == '\\'){
+			out << '\\' << c;
+		} else if (byte >= 0x20 && byte < 0x7f){
+			out << c;
+		} else {
+			out << '\\' << digits[byte >> 6] << digits[(byte >> 3) & 7]
+			  << digits[byte & 7];
+		}
+	}
+	out << '"';
+}
+
+X64Writer::X64Writer(const IrModule& module)
+: myModule(module), myOut(nullptr), myFn(nullptr), myIndex(0),
+  myFrameBytes(0), myAllocated(0), mySpilled(0){ }
+
+std::string X64Writer::symbol(uint32_t function) const{
+	std::string sym = "dm" + std::to_string(function) + "_";
+	for (char c : myModule.functions[function].name){
+		if (isalnum(static_cast<unsigned char>(c)) || c == '_'){
+			sym += c;
+		} else if (c == '.'){
+			sym += '_';
+		}
+	}
+	return sym;
+}
+
+std::string X64Writer::label(uint32_t block) const{
+	return ".L" + std::to_string(myIndex) + "_" + std::to_string(block);
+}
+
+bool X64Writer::inMachine(uint32_t reg) const{
+	return myAlloc.where[reg].kind == RegLocation::Machine;
+}
+
+std::string X64Writer::home(uint32_t reg) const{
+	const RegLocation& at = myAlloc.where[reg];
+	if (at.kind == RegLocation::Machine){ return MACHINE_REGS[at.index].full; }
+	if (at.kind == RegLocation::Unused){
+		throw new InternalError("A register with no home");
+	}
+	//Spill slots are below the callee-saved registers' saves
+	return "-" + std::to_string(8 * (mySaved.size() + at.index + 1))
+	  + "(%rbp)";
+}
+
+std::string X64Writer::home32(uint32_t reg) const{
+	const RegLocation& at = myAlloc.where[reg];
+	if (at.kind == RegLocation::Machine){ return MACHINE_REGS[at.index].low; }
+	return home(reg);
+}
+
+std::string X64Writer::base(uint32_t reg){
+	if (inMachine(reg)){ return home(reg); }
+	*myOut << "\tmovq\t" << home(reg) << ", %rax\n";
+	return "%rax";
+}
+
+void X64Writer::write(std::ostream& out){
+	myOut = &out;
+	out << "\t.text\n";
+	for (uint32_t i = 0; i < myModule.functions.size(); i++){
+		writeFunction(i);
+	}
+	writeRuntime();
+	Stats::count("x86-64 registers allocated", myAllocated);
+	Stats::count("x86-64 registers spilled", mySpilled);
+}
+
+void X64Writer::writeFunction(uint32_t index){
+	std::ostream& out = *myOut;
+	myIndex = index;
+	myFn = &myModule.functions[index];
+	const IrFunction& fn = *myFn;
+
+	std::vector<bool> calls(fn.code.size(), false);
+	for (size_t i = 0; i < fn.code.size(); i++){
+		const IrInstr& in = fn.code[i];
+		switch (in.op){
+		case IrOp::Call: case IrOp::TakeInt: case IrOp::TakeBool:
+		case IrOp::GiveInt: case IrOp::GiveBool: case IrOp::GiveStr:
+		case IrOp::Magic:
+			calls[i] = true;
+			break;
+		case IrOp::Copy:
+			calls[i] = in.c > INLINE_SLOTS;
+			break;
+		case IrOp::Zero:
+			calls[i] = in.b > INLINE_SLOTS;
+			break;
+		default:
+			break;
+		}
+	}
+#ifdef DREWNO_MARS_NO_REGALLOC
+	myAlloc = allocateRegisters(fn, 0, 0, calls);
+#else
+	myAlloc = allocateRegisters(fn, CALLER_SAVED, CALLEE_SAVED, calls);
+#endif
+	mySaved.clear();
+	for (uint32_t m = CALLER_SAVED; m < CALLER_SAVED + CALLEE_SAVED; m++){
+		if ((myAlloc.machineUsed & (uint32_t(1) << m)) != 0){
+			mySaved.push_back(m);
+		}
+	}
+	uint32_t allocated = 0;
+	for (const RegLocation& at : myAlloc.where){
+		if (at.kind == RegLocation::Machine){ allocated++; }
+	}
+	myAllocated += allocated;
+	mySpilled += myAlloc.spillSlots;
+
+	//The frame holds the callee-saved registers used, then the
+	// spilled registers, then the objects
+	uint64_t bytes = 8 * (uint64_t(mySaved.size()) + myAlloc.spillSlots
+	  + fn.frameSlots);
+	myFrameBytes = static_cast<uint32_t>((bytes + 15) & ~uint64_t(15));
+
+	out << "\n# " << fn.name << ": " << allocated << " in registers, "
+	  << myAlloc.spillSlots << " spilled\n"
+	  << symbol(index) << ":\n"
+	  << "\tpushq\t%rbp\n"
+	  << "\tmovq\t%rsp, %rbp\n";
+	if (myFrameBytes > 0){ out << "\tsubq\t$" << myFrameBytes << ", %rsp\n"; }
+	out << "\tcmpq\tdm_stack_limit(%rip), %rsp\n"
+	  << "\tjb\tdm_stack_overflow\n";
+	for (size_t i = 0; i < mySaved.size(); i++){
+		out << "\tmovq\t" << MACHINE_REGS[mySaved[i]].full << ", -"
+		  << 8 * (i + 1) << "(%rbp)\n";
+	}
+	for (uint32_t i = 0; i < fn.params; i++){
+		if (!myAlloc.liveOnEntry[i]){ continue; }
+		if (i < ARG_REG_COUNT){
+			out << "\tmovq\t" << ARG_REGS[i] << ", " << home(i) << "\n";
+		} else if (inMachine(i)){
+			out << "\tmovq\t" << 16 + 8 * (i - ARG_REG_COUNT) << "(%rbp), "
+			  << home(i) << "\n";
+		} else {
+			out << "\tmovq\t" << 16 + 8 * (i - ARG_REG_COUNT) << "(%rbp), %rax\n"
+			  << "\tmovq\t%rax, " << home(i) << "\n";
+		}
+	}
+
+	std::vector<uint32_t> reads = readCounts(fn);
+	for (uint32_t b = 0; b < fn.blocks.size(); b++){
+		const IrBlock& block = fn.blocks[b];
+		const IrInstr& term = fn.code[block.end - 1];
+		uint32_t end = block.end - 1;
+		//A compare only the branch reads sets the flags it tests
+		const IrInstr * cmp = nullptr;
+		if (term.op == IrOp::Branch && end > block.first){
+			const IrInstr& before = fn.code[end - 1];
+			if (isCompare(before.op) && before.dst == term.a
+			  && reads[term.a] == 1){
+				cmp = &before;
+				end--;
+			}
+		}
+		out << label(b) << ":\n";
+		for (uint32_t i = block.first; i < end; i++){
+			writeInstr(fn.code[i]);
+		}
+		writeTerminator(b, cmp);
+	}
+}
+
+void X64Writer::writeInstr(const IrInstr& in){
+	std::ostream& out = *myOut;
+	//Most results are worked out in the machine register that
+	// holds them, or else in rax and then stored
+	bool direct = in.dst != IR_NONE && inMachine(in.dst);
+	std::string dst = direct ? home(in.dst) : "%rax";
+	std::string dst32 = direct ? home32(in.dst) : "%eax";
+	switch (in.op){
+	case IrOp::Const:
+		out << "\tmovq\t$" << static_cast<int32_t>(in.a) << ", "
+		  << home(in.dst) << "\n";
+		return;
+	case IrOp::Move:
+		if (direct || inMachine(in.a)){
+			if (home(in.a) != home(in.dst)){
+				out << "\tmovq\t" << home(in.a) << ", " << home(in.dst) << "\n";
+			}
+			return;
+		}
+		out << "\tmovq\t" << home(in.a) << ", %rax\n";
+		break;
+	case IrOp::Neg:
+		if (home32(in.a) != dst32){
+			out << "\tmovl\t" << home32(in.a) << ", " << dst32 << "\n";
+		}
+		out << "\tnegl\t" << dst32 << "\n";
+		break;
+	case IrOp::Not:
+		out << "\tcmpl\t$0, " << home32(in.a) << "\n"
+		  << "\tsete\t%al\n"
+		  << "\tmovzbl\t%al, " << dst32 << "\n";
+		break;
+	case IrOp::Add: case IrOp::Sub: case IrOp::Mul:
+		if (!direct || home(in.dst) != home(in.b)){
+			if (home32(in.a) != dst32){
+				out << "\tmovl\t" << home32(in.a) << ", " << dst32 << "\n";
+			}
+			out << "\t" << arithmetic(in.op) << "\t" << home32(in.b) << ", "
+			  << dst32 << "\n";
+		} else if (in.op != IrOp::Sub){
+			out << "\t" << arithmetic(in.op) << "\t" << home32(in.a) << ", "
+			  << dst32 << "\n";
+		} else {
+			out << "\tmovl\t" << home32(in.a) << ", %eax\n"
+			  << "\tsubl\t" << dst32 << ", %eax\n"
+			  << "\tmovl\t%eax, " << dst32 << "\n";
+		}
+		break;
+	case IrOp::Div:
+		//idiv faults on INT_MIN / -1, so that is a negation
+		out << "\tmovl\t" << home32(in.a) << ", %eax\n"
+		  << "\tmovl\t" << home32(in.b) << ", %ecx\n"
+		  << "\ttestl\t%ecx, %ecx\n"
+		  << "\tje\tdm_div_zero\n"
+		  << "\tcmpl\t$-1, %ecx\n"
+		  << "\tjne\t1f\n"
+		  << "\tnegl\t%eax\n"
+		  << "\tjmp\t2f\n"
+		  << "1:\tcltd\n"
+		  << "\tidivl\t%ecx\n"
+		  << "2:\tmovq\t%rax, " << home(in.dst) << "\n";
+		return;
+	case IrOp::Eq: case IrOp::Ne: case IrOp::Lt: case IrOp::Le:
+	case IrOp::Gt: case IrOp::Ge:
+		writeCompare(in);
+		out << "\tset" << condition(in.op, false) << "\t%al\n"
+		  << "\tmovzbl\t%al, " << dst32 << "\n";
+		break;
+	case IrOp::LoadGlobal:
+		out << "\tmovq\tdm_globals+" << 8 * uint64_t(in.a) << "(%rip), "
+		  << dst << "\n";
+		break;
+	case IrOp::StoreGlobal: {
+		std::string val = base(in.b);
+		out << "\tmovq\t" << val << ", dm_globals+" << 8 * uint64_t(in.a)
+		  << "(%rip)\n";
+		return;
+	}
+	case IrOp::GlobalAddr:
+		out << "\tleaq\tdm_globals+" << 8 * uint64_t(in.a) << "(%rip), "
+		  << dst << "\n";
+		break;
+	case IrOp::FrameAddr:
+		//The frame's objects lie beneath everything else in it
+		out << "\tleaq\t-" << 8 * (uint64_t(mySaved.size())
+		  + myAlloc.spillSlots + myFn->frameSlots - in.a)
+		  << "(%rbp), " << dst << "\n";
+		break;
+	case IrOp::Field: {
+		std::string from = base(in.a);
+		out << "\tleaq\t" << 8 * uint64_t(in.b) << "(" << from << "), "
+		  << dst << "\n";
+		break;
+	}
+	case IrOp::Load: {
+		std::string from = base(in.a);
+		out << "\tmovq\t" << 8 * uint64_t(in.b) << "(" << from << "), "
+		  << dst << "\n";
+		break;
+	}
+	case IrOp::Store: {
+		std::string to = base(in.a);
+		std::string val = home(in.c);
+		if (!inMachine(in.c)){
+			out << "\tmovq\t" << val << ", %rcx\n";
+			val = "%rcx";
+		}
+		out << "\tmovq\t" << val << ", " << 8 * uint64_t(in.b) << "(" << to
+		  << ")\n";
+		return;
+	}
+	case IrOp::Copy:
+		out << "\tmovq\t" << home(in.a) << ", %rdi\n"
+		  << "\tmovq\t" << home(in.b) << ", %rsi\n";
+		if (in.c <= INLINE_SLOTS){
+			for (uint32_t i = 0; i < in.c; i++){
+				out << "\tmovq\t" << 8 * i << "(%rsi), %rax\n"
+				  << "\tmovq\t%rax, " << 8 * i << "(%rdi)\n";
+			}
+		} else {
+			out << "\tmovl\t$" << 8 * uint64_t(in.c) << ", %edx\n"
+			  << "\tcall\tmemmove@PLT\n";
+		}
+		return;
+	case IrOp::Zero:
+		if (in.b <= INLINE_SLOTS){
+			std::string to = base(in.a);
+			for (uint32_t i = 0; i < in.b; i++){
+				out << "\tmovq\t$0, " << 8 * i << "(" << to << ")\n";
+			}
+		} else {
+			out << "\tmovq\t" << home(in.a) << ", %rdi\n"
+			  << "\txorl\t%esi, %esi\n"
+			  << "\tmovl\t$" << 8 * uint64_t(in.b) << ", %edx\n"
+			  << "\tcall\tmemset@PLT\n";
+		}
+		return;
+	case IrOp::Call:
+		writeCall(in);
+		return;
+	case IrOp::TakeInt:
+		out << "\tcall\tdm_take\n"
+		  << "\tmovq\t%rax, " << home(in.dst) << "\n";
+		return;
+	case IrOp::TakeBool:
+		out << "\tcall\tdm_take\n"
+		  << "\ttestl\t%eax, %eax\n"
+		  << "\tsetne\t%al\n"
+		  << "\tmovzbl\t%al, " << dst32 << "\n";
+		break;
+	case IrOp::GiveInt:
+		out << "\tmovl\t" << home32(in.a) << ", %edi\n"
+		  << "\tcall\tdm_give_int\n";
+		return;
+	case IrOp::GiveBool:
+		out << "\tmovl\t" << home32(in.a) << ", %edi\n"
+		  << "\tcall\tdm_give_bool\n";
+		return;
+	case IrOp::GiveStr:
+		out << "\tleaq\t.Lstr" << in.a << "(%rip), %rdi\n"
+		  << "\tcall\tdm_give_str\n";
+		return;
+	case IrOp::Magic:
+		out << "\tcall\tdm_magic\n"
+		  << "\tmovq\t%rax, " << home(in.dst) << "\n";
+		return;
+	default:
+		throw new InternalError("A terminator inside a block");
+	}
+	if (!direct){ out << "\tmovq\t%rax, " << home(in.dst) << "\n"; }
+}
+
+//Compare cmp's operands, setting the flags
+void X64Writer::writeCompare(const IrInstr& cmp){
+	std::string lhs = home32(cmp.a);
+	if (!inMachine(cmp.a)){
+		*myOut << "\tmovl\t" << lhs << ", %eax\n";
+		lhs = "%eax";
+	}
+	*myOut << "\tcmpl\t" << home32(cmp.b) << ", " << lhs << "\n";
+}
+
+void X64Writer::writeCall(const IrInstr& in){
+	std::ostream& out = *myOut;
+	const uint32_t * args = myFn->args.data() + in.b;
+	uint32_t stacked = in.c > ARG_REG_COUNT ? in.c - ARG_REG_COUNT : 0;
+	//The stack must stay 16-byte aligned at the call
+	uint32_t pad = stacked % 2 == 0 ? 0 : 8;
+	if (pad != 0){ out << "\tsubq\t$" << pad << ", %rsp\n"; }
+	for (uint32_t i = in.c; i > ARG_REG_COUNT; i--){
+		out << "\tpushq\t" << home(args[i - 1]) << "\n";
+	}
+	//No argument lives in an argument register, so they can be
+	// loaded in any order
+	for (uint32_t i = 0; i < in.c && i < ARG_REG_COUNT; i++){
+		out << "\tmovq\t" << home(args[i]) << ", " << ARG_REGS[i] << "\n";
+	}
+	out << "\tcall\t" << symbol(in.a) << "\n";
+	if (stacked != 0){
+		out << "\taddq\t$" << 8 * uint64_t(stacked) + pad << ", %rsp\n";
+	}
+	if (in.dst != IR_NONE){ out << "\tmovq\t%rax, " << home(in.dst) << "\n"; }
+}
+
+void X64Writer::writeTerminator(uint32_t block, const IrInstr * cmp){
+	std::ostream& out = *myOut;
+	const IrInstr& term = myFn->terminator(block);
+	uint32_t next = block + 1;
+	switch (term.op){
+	case IrOp::Jump:
+		if (term.a != next){ out << "\tjmp\t" << label(term.a) << "\n"; }
+		return;
+	case IrOp::Branch: {
+		const char * taken;
+		const char * notTaken;
+		if (cmp != nullptr){
+			writeCompare(*cmp);
+			taken = condition(cmp->op, false);
+			notTaken = condition(cmp->op, true);
+		} else {
+			if (inMachine(term.a)){
+				out << "\ttestl\t" << home32(term.a) << ", " << home32(term.a)
+				  << "\n";
+			} else {
+				out << "\tcmpl\t$0, " << home(term.a) << "\n";
+			}
+			taken = "ne";
+			notTaken = "e";
+		}
+		if (term.b == next){
+			out << "\tj" << notTaken << "\t" << label(term.c) << "\n";
+		} else {
+			out << "\tj" << taken << "\t" << label(term.b) << "\n";
+			if (term.c != next){ out << "\tjmp\t" << label(term.c) << "\n"; }
+		}
+		return;
+	}
+	case IrOp::Return:
+		if (term.a != IR_NONE){ out << "\tmovq\t" << home(term.a) << ", %rax\n"; }
+		for (size_t i = 0; i < mySaved.size(); i++){
+			out << "\tmovq\t-" << 8 * (i + 1) << "(%rbp), "
+			  << MACHINE_REGS[mySaved[i]].full << "\n";
+		}
+		out << "\tleave\n"
+		  << "\tret\n";
+		return;
+	case IrOp::Exit:
+		out << "\tcall\tdm_exit\n";
+		return;
+	default:
+		throw new InternalError("A block without a terminator");
+	}
+}
+
+void X64Writer::writeRuntime(){
+	std::ostream& out = *myOut;
+	//The stack limit the functions check against is taken from
+	// RLIMIT_STACK (capped at 1GiB), less room for the runtime
+	out << "\n\t.globl\tmain\n"
+	  << "\t.type\tmain, @function\n"
+	  << "main:\n"
+	  << "\tpushq\t%rbp\n"
+	  << "\tmovq\t%rsp, %rbp\n"
+	  << "\tsubq\t$16, %rsp\n"
+	  << "\tmovl\t$3, %edi\n"
+	  << "\tmovq\t%rsp, %rsi\n"
+	  << "\tcall\tgetrlimit@PLT\n"
+	  << "\tmovl\t$8388608, %ecx\n"
+	  << "\ttestl\t%eax, %eax\n"
+	  << "\tcmovzq\t(%rsp), %rcx\n"
+	  << "\tmovl\t$1073741824, %eax\n"
+	  << "\tcmpq\t%rax, %rcx\n"
+	  << "\tcmovaq\t%rax, %rcx\n"
+	  << "\tsubq\t$262144, %rcx\n"
+	  << "\tmovq\t%rbp, %rax\n"
+	  << "\tsubq\t%rcx, %rax\n"
+	  << "\tmovq\t%rax, dm_stack_limit(%rip)\n"
+	  << "\tcall\t" << symbol(myModule.start) << "\n"
+	  << "\txorl\t%eax, %eax\n"
+	  << "\tleave\n"
+	  << "\tret\n"
+	  << RUNTIME;
+
+	if (!myModule.strings.empty()){ out << "\n\t.section\t.rodata\n"; }
+	for (size_t i = 0; i < myModule.strings.size(); i++){
+		out << ".Lstr" << i << ":\n\t.string\t";
+		writeString(out, myModule.strings[i]);
+		out << "\n";
+	}
+
+	uint64_t globalBytes = 8 * uint64_t(myModule.globalSlots);
+	out << "\n\t.bss\n"
+	  << "\t.align\t8\n"
+	  << "dm_stack_limit:\n"
+	  << "\t.zero\t8\n"
+	  << "dm_globals:\n"
+	  << "\t.zero\t" << (globalBytes == 0 ? 8 : globalBytes) << "\n"
+	  << "\n\t.section\t.note.GNU-stack,\"\",@progbits\n";
+}
+
+}
@@ -0,0 +1,62 @@
+#ifndef DREWNO_MARS_X64_HPP
+#define DREWNO_MARS_X64_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+#include "ir.hpp"
+#include "regalloc.hpp"
+
+//The native backend (dmc -o): writes a module out as x86-64 GNU
+// assembly for the System V ABI, with the runtime that take,
+// give and exit call, so that the system's compiler driver turns
+// it straight into an executable (cc prog.s -o prog).
+//
+//Each IR function becomes one native function, its arguments
+// in the ABI's registers and then on the stack. Its virtual
+// registers are given machine registers by linear scan (see
+// regalloc.hpp), and those that don't get one are spilled to
+// its frame, as are all of them if DREWNO_MARS_NO_REGALLOC is
+// defined. Ints are 32-bit and wrap, and are only ever read as
+// the low half of a register. Each function is headed by a
+// comment saying how many of its registers were spilled.
+namespace drewno_mars{
+
+class X64Writer{
+public:
+	explicit X64Writer(const IrModule& module);
+	void write(std::ostream& out);
+
+private:
+	void writeFunction(uint32_t index);
+	void writeInstr(const IrInstr& in);
+	void writeCompare(const IrInstr& cmp);
+	void writeCall(const IrInstr& in);
+	void writeTerminator(uint32_t block, const IrInstr * cmp);
+	void writeRuntime();
+	std::string symbol(uint32_t function) const;
+	std::string label(uint32_t block) const;
+	bool inMachine(uint32_t reg) const;
+	//Where register reg lives, and its low 32 bits
+	std::string home(uint32_t reg) const;
+	std::string home32(uint32_t reg) const;
+	//reg as a base address: its machine register, or else rax
+	// loaded from its spill slot
+	std::string base(uint32_t reg);
+
+	const IrModule& myModule;
+	std::ostream * myOut;
+	const IrFunction * myFn;
+	uint32_t myIndex;
+	uint32_t myFrameBytes;
+	RegAllocation myAlloc;
+	//The callee-saved machine registers the function uses
+	std::vector<uint32_t> mySaved;
+	size_t myAllocated;
+	size_t mySpilled;
+};
+
+}
+
+#endif
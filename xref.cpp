@@ -0,0 +1,353 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "errors.hpp"
+#include "symbol_table.hpp"
+#include "visitor.hpp"
+#include "xref.hpp"
+
+namespace drewno_mars{
+
+static const char MAGIC[4] = {'D', 'M', 'C', 'X'};
+static const uint32_t VERSION = 1;
+static const size_t HEADER_WORDS = 11;
+static const size_t REF_WORDS = 4;
+static const size_t SYMBOL_WORDS = 6;
+
+static void put32(std::vector<unsigned char>& bytes, uint32_t val){
+	for (int i = 0; i < 4; i++){
+		bytes.push_back(static_cast<unsigned char>(val >> (8 * i)));
+	}
+}
+
+static uint32_t get32(const unsigned char * bytes){
+	return static_cast<uint32_t>(bytes[0])
+	  | static_cast<uint32_t>(bytes[1]) << 8
+	  | static_cast<uint32_t>(bytes[2]) << 16
+	  | static_cast<uint32_t>(bytes[3]) << 24;
+}
+
+static void corrupt(){
+	throw new UserError("Corrupt cross-reference index");
+}
+
+static uint32_t narrow(size_t val){
+	if (val > 0xffffffff){
+		throw new InternalError("Program too big for a cross-reference index");
+	}
+	return static_cast<uint32_t>(val);
+}
+
+//Hands each bound ID of a tree to the writer, noting which
+// are the names given in declarations
+class XrefCollector : public AstWalker<XrefCollector>{
+public:
+	XrefCollector(XrefWriter& writer)
+	: myWriter(writer), myDeclared(nullptr){ }
+	bool pre(ASTNode * node){
+		switch (node->kind()){
+		case NodeKind::ClassDefn:
+			myDeclared = static_cast<ClassDefnNode *>(node)->ID();
+			break;
+		case NodeKind::VarDecl: case NodeKind::FormalDecl:
+			myDeclared = static_cast<VarDeclNode *>(node)->ID();
+			break;
+		case NodeKind::FnDecl:
+			myDeclared = static_cast<FnDeclNode *>(node)->ID();
+			break;
+		case NodeKind::ID: {
+			IDNode * id = static_cast<IDNode *>(node);
+			if (id->getSymbol() != nullptr){
+				myWriter.ref(id, id == myDeclared);
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		return true;
+	}
+private:
+	XrefWriter& myWriter;
+	IDNode * myDeclared;
+};
+
+void XrefWriter::add(ASTNode * tree){
+	XrefCollector(*this).walk(tree);
+}
+
+void XrefWriter::ref(IDNode * id, bool def){
+	SemSymbol * symbol = id->getSymbol();
+	auto found = mySymbolIds.find(symbol);
+	if (found == mySymbolIds.end()){
+		uint32_t index = narrow(mySymbols.size());
+		found = mySymbolIds.insert(std::make_pair(symbol, index)).first;
+		mySymbols.push_back(symbol);
+	}
+	const Position * pos = id->pos();
+	Ref ref;
+	ref.line = narrow(pos->lineBegin());
+	ref.col = narrow(pos->colBegin());
+	ref.colEnd = narrow(pos->colEnd());
+	ref.symbol = found->second;
+	ref.def = def;
+	myRefs.push_back(ref);
+}
+
+void XrefWriter::source(const std::string& text){
+	myLines.clear();
+	myLines.push_back(0);
+	const char * start = text.data();
+	const char * end = start + text.size();
+	for (const char * at = start; at < end; at++){
+		at = static_cast<const char *>(memchr(at, '\n',
+		  static_cast<size_t>(end - at)));
+		if (at == nullptr){ break; }
+		myLines.push_back(narrow(static_cast<size_t>(at + 1 - start)));
+	}
+}
+
+uint32_t XrefWriter::name(const std::string& str){
+	auto found = myStringIds.find(str);
+	if (found != myStringIds.end()){ return found->second; }
+	uint32_t at = narrow(myStrings.size());
+	myStringIds[str] = at;
+	myStrings += str;
+	myStrings.push_back('\0');
+	return at;
+}
+
+void XrefWriter::write(std::ostream& out){
+	std::stable_sort(myRefs.begin(), myRefs.end(),
+	  [](const Ref& a, const Ref& b){
+		return a.line < b.line || (a.line == b.line && a.col < b.col);
+	});
+
+	//Each symbol's uses go together, in source order
+	uint32_t none = XrefIndex::NO_REF;
+	std::vector<uint32_t> defs(mySymbols.size(), none);
+	std::vector<uint32_t> firstUse(mySymbols.size() + 1, 0);
+	for (size_t i = 0; i < myRefs.size(); i++){
+		const Ref& ref = myRefs[i];
+		if (ref.def && defs[ref.symbol] == none){
+			defs[ref.symbol] = static_cast<uint32_t>(i);
+		} else {
+			firstUse[ref.symbol + 1]++;
+		}
+	}
+	for (size_t i = 1; i < firstUse.size(); i++){
+		firstUse[i] += firstUse[i - 1];
+	}
+	std::vector<uint32_t> uses(firstUse.back());
+	std::vector<uint32_t> filled(firstUse.begin(), firstUse.end() - 1);
+	std::vector<unsigned char> refs;
+	refs.reserve(4 * REF_WORDS * myRefs.size());
+	for (size_t i = 0; i < myRefs.size(); i++){
+		const Ref& ref = myRefs[i];
+		if (defs[ref.symbol] != i){
+			uses[filled[ref.symbol]++] = static_cast<uint32_t>(i);
+		}
+		put32(refs, ref.line);
+		put32(refs, ref.col);
+		put32(refs, ref.colEnd);
+		put32(refs, ref.symbol);
+	}
+
+	std::vector<unsigned char> symbols;
+	for (size_t i = 0; i < mySymbols.size(); i++){
+		put32(symbols, name(mySymbols[i]->getName()));
+		put32(symbols, name(mySymbols[i]->getKind()));
+		put32(symbols, name(mySymbols[i]->getType()));
+		put32(symbols, defs[i]);
+		put32(symbols, firstUse[i]);
+		put32(symbols, firstUse[i + 1] - firstUse[i]);
+	}
+	std::vector<unsigned char> rest;
+	for (uint32_t use : uses){ put32(rest, use); }
+	for (uint32_t line : myLines){ put32(rest, line); }
+
+	std::vector<unsigned char> header(MAGIC, MAGIC + 4);
+	size_t refsAt = 4 * HEADER_WORDS;
+	size_t symbolsAt = refsAt + refs.size();
+	size_t usesAt = symbolsAt + symbols.size();
+	size_t linesAt = usesAt + 4 * uses.size();
+	size_t stringsAt = linesAt + 4 * myLines.size();
+	narrow(stringsAt + myStrings.size());
+	put32(header, VERSION);
+	put32(header, narrow(myRefs.size()));
+	put32(header, narrow(mySymbols.size()));
+	put32(header, narrow(uses.size()));
+	put32(header, narrow(myLines.size()));
+	put32(header, narrow(refsAt));
+	put32(header, narrow(symbolsAt));
+	put32(header, narrow(usesAt));
+	put32(header, narrow(linesAt));
+	put32(header, narrow(stringsAt));
+
+	out.write(reinterpret_cast<const char *>(header.data()),
+	  static_cast<std::streamsize>(header.size()));
+	out.write(reinterpret_cast<const char *>(refs.data()),
+	  static_cast<std::streamsize>(refs.size()));
+	out.write(reinterpret_cast<const char *>(symbols.data()),
+	  static_cast<std::streamsize>(symbols.size()));
+	out.write(reinterpret_cast<const char *>(rest.data()),
+	  static_cast<std::streamsize>(rest.size()));
+	out << myStrings;
+}
+
+XrefIndex::XrefIndex(const unsigned char * bytes, size_t size)
+: myBytes(bytes), mySize(size){
+}
+
+XrefIndex::~XrefIndex(){
+	munmap(const_cast<unsigned char *>(myBytes), mySize);
+}
+
+//Check that the sections all lie within the index, in order,
+// so that lookups only need to check the indices they follow
+static void checkLayout(const unsigned char * bytes, size_t size){
+	if (size < 4 * HEADER_WORDS || memcmp(bytes, MAGIC, 4) != 0){
+		corrupt();
+	}
+	if (get32(bytes + 4) != VERSION){
+		throw new UserError("Unsupported cross-reference index version");
+	}
+	uint64_t refs = get32(bytes + 8);
+	uint64_t symbols = get32(bytes + 12);
+	uint64_t uses = get32(bytes + 16);
+	uint64_t lines = get32(bytes + 20);
+	uint64_t refsAt = get32(bytes + 24);
+	uint64_t symbolsAt = get32(bytes + 28);
+	uint64_t usesAt = get32(bytes + 32);
+	uint64_t linesAt = get32(bytes + 36);
+	uint64_t stringsAt = get32(bytes + 40);
+	bool good = refsAt == 4 * HEADER_WORDS
+	  && refsAt + 4 * REF_WORDS * refs <= symbolsAt
+	  && symbolsAt + 4 * SYMBOL_WORDS * symbols <= usesAt
+	  && usesAt + 4 * uses <= linesAt
+	  && linesAt + 4 * lines <= stringsAt
+	  && stringsAt <= size
+	  && (stringsAt == size || bytes[size - 1] == 0);
+	if (!good){ corrupt(); }
+}
+
+XrefIndex * XrefIndex::map(const char * path){
+	int fd = open(path, O_RDONLY);
+	if (fd < 0){
+		std::string msg = "Bad cross-reference index ";
+		msg += path;
+		throw new UserError(msg.c_str());
+	}
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)
+	  || static_cast<size_t>(info.st_size) < 4 * HEADER_WORDS){
+		close(fd);
+		corrupt();
+	}
+	size_t size = static_cast<size_t>(info.st_size);
+	void * bytes = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (bytes == MAP_FAILED){
+		throw new InternalError("Couldn't map the cross-reference index");
+	}
+	XrefIndex * index = new XrefIndex(
+	  static_cast<const unsigned char *>(bytes), size);
+	try {
+		checkLayout(index->myBytes, size);
+	} catch (UserError *){
+		delete index;
+		throw;
+	}
+	return index;
+}
+
+uint32_t XrefIndex::header(size_t i) const{
+	return get32(myBytes + 4 * i);
+}
+
+//Word i of the section whose offset is header word at
+uint32_t XrefIndex::word(size_t at, size_t i) const{
+	return get32(myBytes + header(at) + 4 * i);
+}
+
+uint32_t XrefIndex::find(size_t line, size_t col) const{
+	//The last ref starting at or before line and column
+	size_t low = 0;
+	size_t high = header(2);
+	while (low < high){
+		size_t mid = low + (high - low) / 2;
+		size_t midLine = word(6, REF_WORDS * mid);
+		size_t midCol = word(6, REF_WORDS * mid + 1);
+		if (midLine < line || (midLine == line && midCol <= col)){
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (low == 0){ return NO_REF; }
+	size_t ref = low - 1;
+	if (word(6, REF_WORDS * ref) != line
+	  || col >= word(6, REF_WORDS * ref + 2)){
+		return NO_REF;
+	}
+	return static_cast<uint32_t>(ref);
+}
+
+bool XrefIndex::locate(size_t offset, size_t& line, size_t& col) const{
+	size_t lines = header(5);
+	if (lines == 0){ return false; }
+	//The last line starting at or before offset
+	size_t low = 0;
+	size_t high = lines;
+	while (low < high){
+		size_t mid = low + (high - low) / 2;
+		if (word(9, mid) <= offset){
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	if (low == 0){ corrupt(); }
+	line = low;
+	col = offset - word(9, low - 1) + 1;
+	return true;
+}
+
+Position XrefIndex::position(uint32_t ref) const{
+	if (ref >= header(2)){ corrupt(); }
+	size_t line = word(6, REF_WORDS * ref);
+	return Position(line, word(6, REF_WORDS * ref + 1), line,
+	  word(6, REF_WORDS * ref + 2));
+}
+
+uint32_t XrefIndex::symbol(uint32_t ref) const{
+	if (ref >= header(2)){ corrupt(); }
+	uint32_t symbol = word(6, REF_WORDS * ref + 3);
+	if (symbol >= header(3)){ corrupt(); }
+	return symbol;
+}
+
+const char * XrefIndex::symbolPart(uint32_t symbol, size_t part) const{
+	size_t at = header(10) + word(7, SYMBOL_WORDS * symbol + part);
+	if (at >= mySize){ corrupt(); }
+	return reinterpret_cast<const char *>(myBytes + at);
+}
+
+uint32_t XrefIndex::definition(uint32_t symbol) const{
+	return word(7, SYMBOL_WORDS * symbol + 3);
+}
+
+size_t XrefIndex::useCount(uint32_t symbol) const{
+	return word(7, SYMBOL_WORDS * symbol + 5);
+}
+
+uint32_t XrefIndex::use(uint32_t symbol, size_t i) const{
+	size_t at = static_cast<size_t>(word(7, SYMBOL_WORDS * symbol + 4)) + i;
+	if (at >= header(4)){ corrupt(); }
+	return word(8, at);
+}
+
+}
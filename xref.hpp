@@ -0,0 +1,100 @@
+#ifndef DREWNO_MARS_XREF_HPP
+#define DREWNO_MARS_XREF_HPP
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ast.hpp"
+
+//The cross-reference index (written by -x, and read by
+// dmc --query). It records, for every ID name analysis bound,
+// where it is and which symbol it names, so that definitions
+// and references can be looked up without compiling again. As
+// in the binary AST, numbers are 32-bit little-endian and
+// every reference is an index or offset, so a file can be
+// mapped into memory and searched where it lies.
+//
+// header:  "DMCX" version refCount symbolCount useCount
+//          lineCount refsAt symbolsAt usesAt linesAt stringsAt
+// refs:    refCount (line, column, end column, symbol), one
+//          per bound ID, sorted by line and column
+// symbols: symbolCount (name, kind, type, def, firstUse,
+//          useCount); name, kind and type are offsets into
+//          strings, def is the index of the ref that declares
+//          the symbol (NO_REF if none does), and its other refs
+//          are uses[firstUse] onwards
+// uses:    useCount ref indices, grouped by symbol, each group
+//          in source order
+// lines:   the byte offset at which each line of the source
+//          starts (none if the program was a binary AST)
+// strings: NUL-terminated bytes
+namespace drewno_mars{
+
+//Collects the bound IDs of analysed trees, then writes them out
+class XrefWriter{
+public:
+	//Record the IDs of tree, which must still be bound (and its
+	// symbols alive). Trees may be added a global at a time.
+	void add(ASTNode * tree);
+	//Record where source's lines start, so that queries can
+	// be made by byte offset
+	void source(const std::string& text);
+	void write(std::ostream& out);
+	size_t refCount() const{ return myRefs.size(); }
+	//Record one bound ID (add does this for each of a tree's)
+	void ref(IDNode * id, bool def);
+private:
+	struct Ref{
+		uint32_t line;
+		uint32_t col;
+		uint32_t colEnd;
+		uint32_t symbol;
+		bool def;
+	};
+	uint32_t name(const std::string& str);
+
+	std::vector<Ref> myRefs;
+	std::vector<SemSymbol *> mySymbols;
+	std::unordered_map<SemSymbol *, uint32_t> mySymbolIds;
+	std::vector<uint32_t> myLines;
+	std::string myStrings;
+	std::unordered_map<std::string, uint32_t> myStringIds;
+};
+
+//An index written by XrefWriter, mapped from a file
+class XrefIndex{
+public:
+	static const uint32_t NO_REF = 0xffffffff;
+
+	//Throws a UserError if path isn't an index
+	static XrefIndex * map(const char * path);
+	~XrefIndex();
+
+	//The ref whose ID covers line and column, or NO_REF
+	uint32_t find(size_t line, size_t col) const;
+	//The line and column of a byte offset in the source.
+	// False if the index doesn't know where lines start.
+	bool locate(size_t offset, size_t& line, size_t& col) const;
+
+	Position position(uint32_t ref) const;
+	uint32_t symbol(uint32_t ref) const;
+	//The name, kind and type of a symbol
+	const char * symbolPart(uint32_t symbol, size_t part) const;
+	uint32_t definition(uint32_t symbol) const;
+	size_t useCount(uint32_t symbol) const;
+	uint32_t use(uint32_t symbol, size_t i) const;
+
+private:
+	XrefIndex(const unsigned char * bytes, size_t size);
+	uint32_t header(size_t i) const;
+	uint32_t word(size_t at, size_t i) const;
+
+	const unsigned char * myBytes;
+	size_t mySize;
+};
+
+}
+
+#endif